@@ -0,0 +1,154 @@
+# Run a TestCase program one way and compare what it prints with the
+# <name>.expected file next to it, or with the file EXPECTED_FILE:
+#
+#   cmake -DCMM=<cmm> -DMODE=<mode> -DPROGRAM=<name>.cmm
+#         -DWORK_DIR=<dir> [-DARGS=<options>] [-DEXPECTED_FILE=<file>]
+#         -P RunTest.cmake
+#
+# MODE is one of
+#   walker  run it on the tree walker
+#   vm      run it on the bytecode VM
+#   jit     run it on the VM, compiling hot functions to machine code
+#   cache   run it on the tree walker twice through an empty program cache,
+#           once parsing it and once loading what the first run stored, then
+#           once more from the cache on the VM
+#   disasm  compile it to bytecode; a program that doesn't compile must
+#           report the same errors it reports when run
+#   profile run it on the tree walker with --profile, keeping from the summary
+#           only the calls and name of each function, sorted by name; the
+#           folded stacks must be well formed and --profile --vm must fail
+#   emit-cpp  translate it to C++, build that without warnings with CXX
+#           against the runtime library RUNTIME and the libraries LIBS, and
+#           run it; a program that can't be translated must report what it
+#           reports when run
+#
+# ARGS are extra options for cmm. A program reading its standard input gets
+# the <name>.in file next to it, if there is one.
+
+get_filename_component(DIR ${PROGRAM} DIRECTORY)
+get_filename_component(NAME ${PROGRAM} NAME_WE)
+if (NOT EXPECTED_FILE)
+    set(EXPECTED_FILE ${DIR}/${NAME}.expected)
+endif ()
+file(READ ${EXPECTED_FILE} EXPECTED)
+set(INPUT)
+if (EXISTS ${DIR}/${NAME}.in)
+    set(INPUT INPUT_FILE ${DIR}/${NAME}.in)
+endif ()
+file(MAKE_DIRECTORY ${WORK_DIR})
+
+# Run cmm with the given options on PROGRAM, leaving what it prints on both
+# streams in OUTPUT and its exit status in RESULT.
+macro(run_cmm)
+    execute_process(COMMAND ${CMM} ${ARGN} ${ARGS} ${PROGRAM} ${INPUT}
+                    OUTPUT_VARIABLE OUTPUT ERROR_VARIABLE OUTPUT
+                    RESULT_VARIABLE RESULT)
+endmacro()
+
+macro(check_output WHAT)
+    if (NOT OUTPUT STREQUAL EXPECTED)
+        file(WRITE ${WORK_DIR}/${NAME}.${MODE}.actual "${OUTPUT}")
+        message(FATAL_ERROR "${WHAT} printed\n${OUTPUT}\ninstead of\n"
+                "${EXPECTED}\n(saved in ${WORK_DIR}/${NAME}.${MODE}.actual)")
+    endif ()
+endmacro()
+
+if (MODE STREQUAL "walker")
+    run_cmm(--no-cache)
+    check_output("the tree walker")
+elseif (MODE STREQUAL "vm")
+    run_cmm(--vm --no-cache)
+    check_output("the VM")
+elseif (MODE STREQUAL "jit")
+    run_cmm(--jit --no-cache)
+    check_output("the JIT")
+elseif (MODE STREQUAL "cache")
+    set(ENV{CMM_CACHE_DIR} ${WORK_DIR}/cache)
+    file(REMOVE_RECURSE ${WORK_DIR}/cache)
+    run_cmm()
+    check_output("the tree walker, filling the cache,")
+    run_cmm()
+    check_output("the tree walker, loading from the cache,")
+    run_cmm(--vm)
+    check_output("the VM, loading from the cache,")
+elseif (MODE STREQUAL "disasm")
+    run_cmm(--disasm --no-cache)
+    if (RESULT EQUAL 0)
+        if (NOT OUTPUT MATCHES "chunk 0: toplevel")
+            message(FATAL_ERROR "--disasm printed no bytecode:\n${OUTPUT}")
+        endif ()
+    else ()
+        check_output("--disasm")
+    endif ()
+elseif (MODE STREQUAL "profile")
+    set(FOLDED ${WORK_DIR}/${NAME}.folded)
+    file(REMOVE ${FOLDED})
+    run_cmm(--no-cache --profile=${FOLDED})
+    # Times vary from run to run, and so does the order of the summary.
+    string(FIND "${OUTPUT}" "CMM profile (wall time)\n" SUMMARY)
+    if (SUMMARY EQUAL -1)
+        message(FATAL_ERROR "--profile printed no summary:\n${OUTPUT}")
+    endif ()
+    string(SUBSTRING "${OUTPUT}" ${SUMMARY} -1 SUMMARY_TEXT)
+    string(SUBSTRING "${OUTPUT}" 0 ${SUMMARY} OUTPUT)
+    string(REGEX MATCHALL "\n *[0-9.]+ +[0-9.]+ +[0-9.]+ +[0-9]+  [^\n]+"
+           ROWS "${SUMMARY_TEXT}")
+    set(CALLS)
+    foreach (ROW ${ROWS})
+        string(REGEX REPLACE "^\n *[0-9.]+ +[0-9.]+ +[0-9.]+ +([0-9]+)  (.*)$"
+               "\\2: \\1" ROW "${ROW}")
+        list(APPEND CALLS "${ROW}")
+    endforeach ()
+    list(SORT CALLS)
+    foreach (ROW ${CALLS})
+        set(OUTPUT "${OUTPUT}${ROW}\n")
+    endforeach ()
+    if (NOT SUMMARY_TEXT MATCHES "\nFolded stacks written to `[^\n]*'\n$")
+        message(FATAL_ERROR "--profile didn't write the folded stacks:\n"
+                "${SUMMARY_TEXT}")
+    endif ()
+    check_output("the profiled tree walker")
+
+    file(STRINGS ${FOLDED} STACKS)
+    if (NOT STACKS)
+        message(FATAL_ERROR "--profile wrote no folded stacks")
+    endif ()
+    foreach (STACK ${STACKS})
+        if (NOT STACK MATCHES "^<top level>(;[^;]+)* [0-9]+$")
+            message(FATAL_ERROR "malformed folded stack `${STACK}'")
+        endif ()
+    endforeach ()
+
+    run_cmm(--no-cache --profile=${FOLDED} --vm)
+    if (RESULT EQUAL 0 OR
+        NOT OUTPUT MATCHES "--profile only works with the tree walker")
+        message(FATAL_ERROR "--profile --vm wasn't rejected:\n${OUTPUT}")
+    endif ()
+elseif (MODE STREQUAL "emit-cpp")
+    execute_process(COMMAND ${CMM} --emit-cpp --no-cache ${ARGS} ${PROGRAM}
+                    OUTPUT_FILE ${WORK_DIR}/${NAME}.cpp
+                    ERROR_VARIABLE DIAGNOSTICS RESULT_VARIABLE RESULT)
+    set(OUTPUT "${DIAGNOSTICS}")
+    if (NOT RESULT EQUAL 0)
+        check_output("--emit-cpp")
+        return()
+    endif ()
+
+    get_filename_component(INCLUDE_DIR ${DIR}/../include ABSOLUTE)
+    execute_process(COMMAND ${CXX} -std=c++11 -Wall -Wextra -Werror
+                            -I${INCLUDE_DIR}
+                            ${WORK_DIR}/${NAME}.cpp ${RUNTIME} ${LIBS}
+                            -o ${WORK_DIR}/${NAME}
+                    OUTPUT_VARIABLE BUILD_OUTPUT ERROR_VARIABLE BUILD_OUTPUT
+                    RESULT_VARIABLE RESULT)
+    if (NOT RESULT EQUAL 0)
+        message(FATAL_ERROR "the emitted C++ doesn't build:\n${BUILD_OUTPUT}")
+    endif ()
+
+    execute_process(COMMAND ${WORK_DIR}/${NAME} ${INPUT}
+                    OUTPUT_VARIABLE OUTPUT ERROR_VARIABLE OUTPUT)
+    set(OUTPUT "${DIAGNOSTICS}${OUTPUT}")
+    check_output("the emitted C++")
+else ()
+    message(FATAL_ERROR "unknown test mode `${MODE}'")
+endif ()
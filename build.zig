@@ -28,12 +28,33 @@ pub fn build(b: *std.Build) void {
     exe.addCSourceFiles(&.{
         //
         "src/AST.cpp",
+        "src/ASTArena.cpp",
+        "src/BasicValue.cpp",
+        "src/Bytecode.cpp",
+        "src/BytecodeCompiler.cpp",
+        "src/BytecodeVM.cpp",
         "src/cmm.cpp",
         "src/CMMInterpreter.cpp",
         "src/CMMLexer.cpp",
         "src/CMMParser.cpp",
+        "src/CMMResolver.cpp",
+        "src/ConstantPropagator.cpp",
+        "src/CppEmitter.cpp",
+        "src/CycleCollector.cpp",
+        "src/FrameArena.cpp",
+        "src/GlobalDeclarations.cpp",
+        "src/Inliner.cpp",
+        "src/JIT.cpp",
+        "src/LoopOptimizer.cpp",
         "src/NativeFunctions.cpp",
+        "src/Profiler.cpp",
+        "src/ProgramCache.cpp",
+        "src/ProgramWalker.cpp",
+        "src/Runtime.cpp",
         "src/SourceMgr.cpp",
+        "src/Symbol.cpp",
+        "src/TokenBuffer.cpp",
+        "src/TypeChecker.cpp",
     }, &.{"-std=c++11"});
     exe.linkLibCpp();
 
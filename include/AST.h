@@ -1,7 +1,10 @@
 #ifndef AST_H
 #define AST_H
 
+#include "ASTArena.h"
+#include "BasicValue.h"
 #include "CMMLexer.h"
+#include "Symbol.h"
 #include <string>
 #include <map>
 #include <iostream>
@@ -9,65 +12,8 @@
 #include <list>
 #include <vector>
 #include <cstdlib>
+#include <cstdint>
 
-///code.h
-namespace cvm {
-enum BasicType { BoolType, IntType, DoubleType, StringType, VoidType };
-std::string TypeToStr(BasicType Type);
-
-class BasicValue {
-public:
-  /// Public member variables
-  BasicType Type;
-
-  std::string StrVal;
-  union {
-    int IntVal;
-    double DoubleVal;
-    bool BoolVal;
-  };
-
-  std::shared_ptr<std::vector<BasicValue>> ArrayPtr;
-
-public:
-  /// Public constructors
-  BasicValue() : Type(VoidType) {}
-  BasicValue(const std::string &S) : Type(StringType), StrVal(S) {}
-  BasicValue(int I) : Type(IntType), IntVal(I) {}
-  BasicValue(double D) : Type(DoubleType), DoubleVal(D) {}
-  BasicValue(bool B) : Type(BoolType), BoolVal(B) {}
-
-  BasicValue(BasicType T);
-  BasicValue(BasicType T, const std::list<int> &DimensionList);
-  BasicValue(BasicType T, std::shared_ptr<std::vector<BasicValue>> P);
-  // This should not used by user directly!
-  BasicValue(BasicType Type,
-             std::list<int>::const_iterator It,
-             std::list<int>::const_iterator End);
-
-public:
-  bool isArray() const { return ArrayPtr != nullptr; }
-  bool isInt() const { return Type == IntType; }
-  bool isDouble() const { return Type == DoubleType; }
-  bool isBool() const { return Type == BoolType; }
-  bool isString() const { return Type == StringType; }
-  bool isVoid() const { return Type == VoidType; }
-  bool isNumeric() const { return isInt() || isDouble(); }
-
-  int toInt() const;
-  double toDouble() const;
-  bool toBool() const ;
-  std::string toString(decltype(ArrayPtr) P = nullptr) const;
-
-  bool operator<(const BasicValue &RHS) const;
-  bool operator<=(const BasicValue &RHS) const;
-  bool operator==(const BasicValue &RHS) const;
-  bool operator!=(const BasicValue &RHS) const;
-  bool operator>(const BasicValue &RHS) const;
-  bool operator>=(const BasicValue &RHS) const;
-};
-}
-/// !code.h
 
 
 namespace cmm {
@@ -110,7 +56,7 @@ public:
  */
 
 class Parameter {
-  std::string Name;
+  Symbol Name;
   // std::unique_ptr<TypeSpecifier> Type;
   cvm::BasicType Type;
   CMMLexer::LocTy Loc;
@@ -119,31 +65,66 @@ public:
   Parameter(const std::string &Name, cvm::BasicType Type, CMMLexer::LocTy Loc)
     : Name(Name), Type(new TypeSpecifier(Type)), Loc(Loc) {}
    */
-  Parameter(const std::string &Name, cvm::BasicType Type, CMMLexer::LocTy Loc)
+  Parameter(Symbol Name, cvm::BasicType Type, CMMLexer::LocTy Loc)
       : Name(Name), Type(Type), Loc(Loc) {}
 
   std::string toString() const {
-    return  cvm::TypeToStr(Type) + " " + Name;
+    return  cvm::TypeToStr(Type) + " " + Name.str();
   }
 
   /** a hack... **/
   // cvm::BasicType getType() const { return Type->getBasicType(); }
   cvm::BasicType getType() const { return Type; }
-  const std::string &getName() const { return Name; }
+  Symbol getName() const { return Name; }
+  CMMLexer::LocTy getLoc() const { return Loc; }
 };
 
 /*
 class FunctionType : public DerivedType {
   std::unique_ptr<TypeSpecifier> Type;
-  std::list<Parameter> ParameterList;
+  std::vector<Parameter> ParameterList;
 };
  */
 
 
 
+/// \brief Static shape of a runtime variable frame.
+/// Every block, function and infix operator owns one; the resolver assigns
+/// each declared name a slot index in it, in declaration order.
+class FrameLayout {
+  std::vector<Symbol> SlotNames;
+public:
+  size_t getSlotCount() const { return SlotNames.size(); }
+  Symbol getSlotName(size_t Slot) const { return SlotNames[Slot]; }
+
+  /// Return the first slot bound to Name, or -1 if there is none.
+  int findSlot(Symbol Name) const;
+
+  /// Return the slot of Name, appending a new one if it doesn't exist yet.
+  int addSlot(Symbol Name);
+
+  /// Append a new slot even if Name is already bound (used by parameters).
+  int appendSlot(Symbol Name);
+
+  void clear() { SlotNames.clear(); }
+};
+
+
+class FunctionDefinitionAST;
+class InfixOpDefinitionAST;
+
+/// \brief What storing a value into a variable of a declared type takes, as
+/// far as the TypeChecker proved it.
+/// Unchecked values go through the checks of the runtime library.
+enum class Coercion : uint8_t { Unchecked, Identity, IntToDouble };
+
+/// Nodes live in the ASTArena of the parser, which destroys them with their
+/// static type; they are never deleted through an AST pointer.
 class AST {
+protected:
+  ~AST() = default;
+
 public:
-  virtual ~AST() {};
   virtual void dump(const std::string &prefix = "") const = 0;
 };
 
@@ -162,13 +143,20 @@ public:
   };
 private:
   ExpressionKind Kind;
+  // Set by the TypeChecker if every value the expression yields has the same
+  // type.
+  bool HasStaticType;
+  cvm::BasicType StaticType;
 public:
   // Constructor
-  ExpressionAST(ExpressionKind Kind) : Kind(Kind) {}
+  ExpressionAST(ExpressionKind Kind)
+    : Kind(Kind), HasStaticType(false), StaticType(cvm::VoidType) {}
 
   // Other public member functions
   template <typename T>
   const T *as_cptr() const { return static_cast<const T*>(this); }
+  template <typename T>
+  T *as_ptr() { return static_cast<T*>(this); }
 
   ExpressionKind getKind() const { return Kind; }
 
@@ -176,17 +164,37 @@ public:
   bool isBinaryOperatorExpression() const {
     return getKind() == BinaryOperatorExpression;
   }
-  bool isInt() { return getKind() == IntExpression; }
-  bool isDouble() { return getKind() == DoubleExpression; }
-  bool isBool() { return getKind() == BoolExpression; }
-  bool isString() { return getKind() == StringExpression; }
-  bool isNumeric() { return isInt() || isDouble(); }
-  bool isConstant() { return isInt() || isDouble() || isBool() || isString(); }
+  bool isInt() const { return getKind() == IntExpression; }
+  bool isDouble() const { return getKind() == DoubleExpression; }
+  bool isBool() const { return getKind() == BoolExpression; }
+  bool isString() const { return getKind() == StringExpression; }
+  bool isNumeric() const { return isInt() || isDouble(); }
+  bool isConstant() const {
+    return isInt() || isDouble() || isBool() || isString();
+  }
+
+  bool hasStaticType() const { return HasStaticType; }
+  /// The type of the values, only meaningful if hasStaticType().
+  cvm::BasicType getStaticType() const { return StaticType; }
+  bool hasStaticType(cvm::BasicType T) const {
+    return HasStaticType && StaticType == T;
+  }
+  bool hasNumericType() const {
+    return hasStaticType(cvm::IntType) || hasStaticType(cvm::DoubleType);
+  }
+  void setStaticType(cvm::BasicType T) {
+    HasStaticType = true;
+    StaticType = T;
+  }
 
   int asInt() const;
   bool asBool() const;
   double asDouble() const;
   std::string asString() const;
+
+  /// \brief Return true if evaluating the expression may call code or assign
+  /// variables
+  bool mayHaveSideEffects() const;
 };
 
 
@@ -215,9 +223,23 @@ public:
 
   template <typename T>
   const T *as_cptr() const { return static_cast<const T*>(this); }
+  template <typename T>
+  T *as_ptr() { return static_cast<T*>(this); }
   // bool isBlock() { return Kind == BlockStatement; }
   // bool isIfStatement() { return Kind == IfStatement; }
   // bool isWhileStatement() { return Kind == WhileStatement; }
+
+  /// \brief Return true if the statement returns by itself when it is in tail
+  /// position
+  ///
+  /// A statement in tail position is the last one run by a function or infix
+  /// operator body, so it also returns. An expression statement returns its
+  /// value, and return, break and continue statements leave the body anyway.
+  /// A block passes the tail position on to its last statement, or returns
+  /// void if it is empty, and an if statement passes it on to its branches.
+  /// The backends return void after any other statement in tail position,
+  /// including an if statement without an else branch.
+  bool returnsInTail() const;
 };
 
 
@@ -262,50 +284,101 @@ public:
 };
 
 class IdentifierAST : public ExpressionAST {
-  std::string Name;
-public:
-  IdentifierAST(const std::string &Name)
-    : ExpressionAST(IdentifierExpression), Name(Name) {}
-
-  const std::string &getName() const { return Name; }
+  Symbol Name;
+  // Filled by the resolver: walk Depth frames outward, then use Slot if that
+  // frame has layout Scope. Otherwise fall back to a lookup by name.
+  int Depth, Slot;
+  const FrameLayout *Scope;
+public:
+  IdentifierAST(Symbol Name)
+    : ExpressionAST(IdentifierExpression), Name(Name)
+    , Depth(0), Slot(-1), Scope(nullptr) {}
+
+  Symbol getName() const { return Name; }
+  int getDepth() const { return Depth; }
+  int getSlot() const { return Slot; }
+  const FrameLayout *getScope() const { return Scope; }
+  bool isResolved() const { return Scope != nullptr; }
+
+  void setBinding(int D, int S, const FrameLayout *L) {
+    Depth = D;
+    Slot = S;
+    Scope = L;
+  }
   void dump(const std::string &prefix = "") const override;
 };
 
 class InfixOpExprAST : public ExpressionAST {
 private:
-  std::string Symbol;
-  std::unique_ptr<ExpressionAST> LHS, RHS;
+  Symbol Sym;
+  ExpressionAST *LHS, *RHS;
+  const InfixOpDefinitionAST *Definition;
 
 public:
-  InfixOpExprAST(const std::string &Symbol,
-                 std::unique_ptr<ExpressionAST> LHS,
-                 std::unique_ptr<ExpressionAST> RHS)
+  InfixOpExprAST(Symbol Sym,
+                 ExpressionAST *LHS,
+                 ExpressionAST *RHS)
       : ExpressionAST(InfixOpExpression)
-      , Symbol(Symbol), LHS(std::move(LHS)), RHS(std::move(RHS)) {}
+      , Sym(Sym), LHS(LHS), RHS(RHS)
+      , Definition(nullptr) {}
+
+  Symbol getSymbol() const { return Sym; }
+  const ExpressionAST *getLHS() const { return LHS; }
+  ExpressionAST *getLHS() { return LHS; }
+  const ExpressionAST *getRHS() const { return RHS; }
+  ExpressionAST *getRHS() { return RHS; }
+  void setLHS(ExpressionAST *E) { LHS = E; }
+  void setRHS(ExpressionAST *E) { RHS = E; }
 
-  const std::string &getSymbol() const { return Symbol; }
-  const ExpressionAST *getLHS() const { return LHS.get(); }
-  const ExpressionAST *getRHS() const { return RHS.get(); }
+  /// The operator definition, bound by the resolver.
+  const InfixOpDefinitionAST *getDefinition() const { return Definition; }
+  void setDefinition(const InfixOpDefinitionAST *D) { Definition = D; }
 
   void dump(const std::string &prefix = "") const override;
 };
 
 
 class FunctionCallAST : public ExpressionAST {
-  std::string Callee;
-  std::list<std::unique_ptr<ExpressionAST>> Arguments;
+  Symbol Callee;
+  ASTArray<ExpressionAST *> Arguments;
   bool DynamicBound : 1;
+  bool TailCall : 1;
+  bool CheckedArguments : 1;
+  CMMLexer::LocTy Loc;
+  const FunctionDefinitionAST *Function;
+  cvm::NativeFunction Native;
 public:
-  FunctionCallAST(const std::string &Callee,
-                  std::list<std::unique_ptr<ExpressionAST>> Arguments,
-                  bool DynamicBound = false)
+  FunctionCallAST(Symbol Callee,
+                  ASTArray<ExpressionAST *> Arguments,
+                  bool DynamicBound = false, CMMLexer::LocTy Loc = 0)
     : ExpressionAST(FunctionCallExpression), Callee(Callee)
-    , Arguments(std::move(Arguments))
-    , DynamicBound(DynamicBound) {}
+    , Arguments(Arguments)
+    , DynamicBound(DynamicBound), TailCall(false), CheckedArguments(false)
+    , Loc(Loc)
+    , Function(nullptr), Native(nullptr) {}
 
-  const std::string &getCallee() const  { return Callee; }
+  Symbol getCallee() const  { return Callee; }
   const decltype(Arguments) &getArguments() const { return Arguments; }
   bool isDynamicBound() const { return DynamicBound; }
+  CMMLexer::LocTy getLoc() const { return Loc; }
+
+  /// The callee, bound by the resolver: a user function, which hides a native
+  /// function of the same name, or else a native function.
+  const FunctionDefinitionAST *getFunction() const { return Function; }
+  cvm::NativeFunction getNativeFunction() const { return Native; }
+  void bind(const FunctionDefinitionAST *F) { Function = F; Native = nullptr; }
+  void bind(cvm::NativeFunction N) { Function = nullptr; Native = N; }
+
+  /// Whether the call is the last thing the function containing it does, so
+  /// the callee can take over its frame. Set by the resolver, only for
+  /// statically bound calls to user functions.
+  bool isTailCall() const { return TailCall; }
+  void setTailCall(bool T) { TailCall = T; }
+
+  /// Whether the TypeChecker proved every argument to have the type of its
+  /// parameter, so binding them needs no check.
+  bool hasCheckedArguments() const { return CheckedArguments; }
+  void setCheckedArguments(bool C) { CheckedArguments = C; }
 
   void dump(const std::string &prefix = "") const override;
 };
@@ -321,54 +394,97 @@ public:
     Assign /**, Comma**/, Index
   };
 
+  /// \brief Form the tree walker rewrote the node to after seeing the types
+  /// of its operands, or the TypeChecker did after proving them.
+  /// An Int* node checks that both operands are int and computes the result
+  /// directly. Any other operands turn it into Generic for good. A Double*
+  /// node is only made by the TypeChecker, for operands proven numeric and
+  /// not both int, and computes on doubles without checks.
+  enum QuickKind {
+    Unquickened, Generic,
+    IntAdd, IntMinus, IntMultiply, IntDivision, IntModulo,
+    IntLess, IntLessEqual, IntEqual, IntNotEqual, IntGreater, IntGreaterEqual,
+    IntBitwiseAnd, IntBitwiseOr, IntBitwiseXor, IntLeftShift, IntRightShift,
+    DoubleAdd, DoubleMinus, DoubleMultiply, DoubleDivision,
+    DoubleLess, DoubleLessEqual, DoubleEqual, DoubleNotEqual, DoubleGreater,
+    DoubleGreaterEqual
+  };
+
 private:
   OperatorKind OpKind;
-  std::unique_ptr<ExpressionAST> LHS, RHS;
+  ExpressionAST *LHS, *RHS;
+  mutable QuickKind Quick;
+  // What an assignment takes to store the value into a variable.
+  Coercion AssignCoercion;
+  CMMLexer::LocTy Loc;
 
 public:
   BinaryOperatorAST(OperatorKind OpKind,
-                    std::unique_ptr<ExpressionAST> LHS,
-                    std::unique_ptr<ExpressionAST> RHS)
+                    ExpressionAST *LHS,
+                    ExpressionAST *RHS,
+                    CMMLexer::LocTy Loc = 0)
     : ExpressionAST(BinaryOperatorExpression)
-    , OpKind(OpKind), LHS(std::move(LHS)), RHS(std::move(RHS)) {}
+    , OpKind(OpKind), LHS(LHS), RHS(RHS)
+    , Quick(Unquickened), AssignCoercion(Coercion::Unchecked), Loc(Loc) {}
 
   // bool isLogical() const;
   OperatorKind getOpKind() const { return OpKind; }
-  ExpressionAST *getLHS() const { return LHS.get(); }
-  ExpressionAST *getRHS() const { return RHS.get(); }
+  ExpressionAST *getLHS() const { return LHS; }
+  ExpressionAST *getRHS() const { return RHS; }
+  void setLHS(ExpressionAST *E) { LHS = E; }
+  void setRHS(ExpressionAST *E) { RHS = E; }
+
+  QuickKind getQuickKind() const { return Quick; }
+  void quicken(QuickKind K) const { Quick = K; }
+
+  Coercion getAssignCoercion() const { return AssignCoercion; }
+  void setAssignCoercion(Coercion C) { AssignCoercion = C; }
+
+  /// Where the operator, or the '[' of an index, is.
+  CMMLexer::LocTy getLoc() const { return Loc; }
+
+  /// Return the Int* or Double* form of OpKind, or Generic if it has none.
+  static QuickKind getIntQuickKind(OperatorKind OpKind);
+  static QuickKind getDoubleQuickKind(OperatorKind OpKind);
 
   void dump(const std::string &prefix = "") const override;
 
   /// Static utilities
-  static std::unique_ptr<ExpressionAST>
-    create(Token::TokenKind TokenKind,
-           std::unique_ptr<ExpressionAST> LHS,
-           std::unique_ptr<ExpressionAST> RHS);
-
-  static std::unique_ptr<ExpressionAST>
-  tryFoldBinOp(Token::TokenKind TokenKind,
-               std::unique_ptr<ExpressionAST> LHS,
-               std::unique_ptr<ExpressionAST> RHS);
-
-  static std::unique_ptr<ExpressionAST>
-  tryFoldBinOpArith(Token::TokenKind TokenKind,
-                    std::unique_ptr<ExpressionAST> LHS,
-                    std::unique_ptr<ExpressionAST> RHS);
-
-  static std::unique_ptr<ExpressionAST>
-  tryFoldBinOpLogic(Token::TokenKind TokenKind,
-                    std::unique_ptr<ExpressionAST> LHS,
-                    std::unique_ptr<ExpressionAST> RHS);
-
-  static std::unique_ptr<ExpressionAST>
-  tryFoldBinOpRelation(Token::TokenKind TokenKind,
-                       std::unique_ptr<ExpressionAST> LHS,
-                       std::unique_ptr<ExpressionAST> RHS);
-
-  static std::unique_ptr<ExpressionAST>
-  tryFoldBinOpBitwise(Token::TokenKind TokenKind,
-                      std::unique_ptr<ExpressionAST> LHS,
-                      std::unique_ptr<ExpressionAST> RHS);
+  static ExpressionAST *
+    create(ASTArena &Arena, Token::TokenKind TokenKind,
+           ExpressionAST *LHS,
+           ExpressionAST *RHS,
+           CMMLexer::LocTy Loc);
+
+  static ExpressionAST *
+  tryFoldBinOp(ASTArena &Arena, Token::TokenKind TokenKind,
+               ExpressionAST *LHS,
+               ExpressionAST *RHS,
+               CMMLexer::LocTy Loc);
+
+  static ExpressionAST *
+  tryFoldBinOpArith(ASTArena &Arena, Token::TokenKind TokenKind,
+                    ExpressionAST *LHS,
+                    ExpressionAST *RHS,
+                    CMMLexer::LocTy Loc);
+
+  static ExpressionAST *
+  tryFoldBinOpLogic(ASTArena &Arena, Token::TokenKind TokenKind,
+                    ExpressionAST *LHS,
+                    ExpressionAST *RHS,
+                    CMMLexer::LocTy Loc);
+
+  static ExpressionAST *
+  tryFoldBinOpRelation(ASTArena &Arena, Token::TokenKind TokenKind,
+                       ExpressionAST *LHS,
+                       ExpressionAST *RHS,
+                       CMMLexer::LocTy Loc);
+
+  static ExpressionAST *
+  tryFoldBinOpBitwise(ASTArena &Arena, Token::TokenKind TokenKind,
+                      ExpressionAST *LHS,
+                      ExpressionAST *RHS,
+                      CMMLexer::LocTy Loc);
 };
 
 
@@ -378,44 +494,66 @@ public:
   enum OperatorKind { Plus, Minus, LogicalNot, BitwiseNot };
 private:
   OperatorKind OpKind;
-  std::unique_ptr<ExpressionAST> Operand;
+  ExpressionAST *Operand;
+  CMMLexer::LocTy Loc;
 public:
-  UnaryOperatorAST(OperatorKind Kind, std::unique_ptr<ExpressionAST> Operand)
+  UnaryOperatorAST(OperatorKind Kind, ExpressionAST *Operand,
+                   CMMLexer::LocTy Loc = 0)
     : ExpressionAST(UnaryOperatorExpression)
-    , OpKind(Kind), Operand(std::move(Operand)) {}
+    , OpKind(Kind), Operand(Operand), Loc(Loc) {}
 
   OperatorKind getOpKind() const { return OpKind; }
-  const ExpressionAST *getOperand() const { return Operand.get(); }
+  CMMLexer::LocTy getLoc() const { return Loc; }
+  const ExpressionAST *getOperand() const { return Operand; }
+  ExpressionAST *getOperand() { return Operand; }
+  void setOperand(ExpressionAST *E) { Operand = E; }
 
   void dump(const std::string &prefix = "") const override;
 
   /// Static utilities
-  static std::unique_ptr<ExpressionAST>
-  tryFoldUnaryOp(OperatorKind OpKind, std::unique_ptr<ExpressionAST> Operand);
+  static ExpressionAST *
+  tryFoldUnaryOp(ASTArena &Arena, OperatorKind OpKind,
+                 ExpressionAST *Operand, CMMLexer::LocTy Loc);
 };
 
 
 class DeclarationAST : public StatementAST {
-  std::string Name;
+  Symbol Name;
   // std::unique_ptr<TypeSpecifier> Type;
   cvm::BasicType Type;
-  std::unique_ptr<ExpressionAST> Initializer;
-  std::list<std::unique_ptr<ExpressionAST>> ElementCountList;
+  ExpressionAST *Initializer;
+  ASTArray<ExpressionAST *> ElementCountList;
+  // A declaration always lands in the innermost frame, so the resolver only
+  // needs to record the slot.
+  int Slot;
+  Coercion InitializerCoercion;
+  CMMLexer::LocTy Loc;
 public:
-  DeclarationAST(const std::string &Name, cvm::BasicType Type,
-                 std::unique_ptr<ExpressionAST> Initializer,
-                 std::list<std::unique_ptr<ExpressionAST>> ElementCountList)
+  DeclarationAST(Symbol Name, cvm::BasicType Type,
+                 ExpressionAST *Initializer,
+                 ASTArray<ExpressionAST *> ElementCountList,
+                 CMMLexer::LocTy Loc = 0)
     : StatementAST(DeclarationStatement), Name(Name), Type(Type)
-    , Initializer(std::move(Initializer))
-    , ElementCountList(std::move(ElementCountList)) {}
+    , Initializer(Initializer)
+    , ElementCountList(ElementCountList), Slot(-1)
+    , InitializerCoercion(Coercion::Unchecked), Loc(Loc) {}
 
   bool isArray() const { return !ElementCountList.empty(); }
 
-  const std::string &getName() const { return Name; }
+  Symbol getName() const { return Name; }
+  CMMLexer::LocTy getLoc() const { return Loc; }
 
   cvm::BasicType getType() const { return Type; }
 
-  const ExpressionAST *getInitializer() const { return Initializer.get(); }
+  const ExpressionAST *getInitializer() const { return Initializer; }
+  ExpressionAST *getInitializer() { return Initializer; }
+  void setInitializer(ExpressionAST *E) { Initializer = E; }
+
+  int getSlot() const { return Slot; }
+  void setSlot(int S) { Slot = S; }
+
+  Coercion getInitializerCoercion() const { return InitializerCoercion; }
+  void setInitializerCoercion(Coercion C) { InitializerCoercion = C; }
 
   const decltype(ElementCountList) &getElementCountList() const {
       return ElementCountList;
@@ -429,19 +567,16 @@ public:
 
 class DeclarationListAST : public StatementAST {
   cvm::BasicType Type;
-  std::list<std::unique_ptr<DeclarationAST>> DeclarationList;
+  ASTArray<DeclarationAST *> DeclarationList;
 public:
   DeclarationListAST(cvm::BasicType Type)
     : StatementAST(DeclarationListStatement), Type(Type) {}
 
-  void addDeclaration(const std::string &Name,
-                      std::unique_ptr<ExpressionAST> I,
-                      std::list<std::unique_ptr<ExpressionAST>> C) {
-    DeclarationList.emplace_back(new DeclarationAST(Name, Type, std::move(I),
-                                                                std::move(C)));
+  void setDeclarationList(ASTArray<DeclarationAST *> List) {
+    DeclarationList = List;
   }
 
-  const std::list<std::unique_ptr<DeclarationAST>> &getDeclarationList() const {
+  const ASTArray<DeclarationAST *> &getDeclarationList() const {
     return DeclarationList;
   }
 
@@ -455,16 +590,16 @@ public:
   //enum BlockKind { UndefinedBlock, FunctionBlock, NormalBlock };
 private:
   BlockAST *OuterBlock;
-  std::list<std::unique_ptr<StatementAST>> StatementList;
+  ASTArray<StatementAST *> StatementList;
   //std::list<std::unique_ptr<DeclarationAST>> DeclarationList;
+  FrameLayout Layout;
 
 public:
   BlockAST(BlockAST *OuterBlock = nullptr)
     : StatementAST(BlockStatement), OuterBlock(OuterBlock) {}
 
-  void addStatement(std::unique_ptr<StatementAST> Statement) {
-    if (Statement)
-      StatementList.push_back(std::move(Statement));
+  void setStatementList(ASTArray<StatementAST *> List) {
+    StatementList = List;
   }
 
   const decltype(StatementList) &getStatementList() const {
@@ -480,21 +615,22 @@ public:
   //}
 
   BlockAST *getOuterBlock() const { return OuterBlock; }
-  std::list<std::unique_ptr<StatementAST>> &getStatementList() {
-    return StatementList;
-  }
+  const FrameLayout &getLayout() const { return Layout; }
+  FrameLayout &getLayout() { return Layout; }
 
   void dump(const std::string &prefix = "") const override;
 };
 
 
 class ExprStatementAST : public StatementAST {
-  std::unique_ptr<ExpressionAST> Expression;
+  ExpressionAST *Expression;
 public:
-  ExprStatementAST(std::unique_ptr<ExpressionAST> Expression)
-    : StatementAST(ExprStatement), Expression(std::move(Expression)) {}
+  ExprStatementAST(ExpressionAST *Expression)
+    : StatementAST(ExprStatement), Expression(Expression) {}
 
-  const ExpressionAST *getExpression() const { return Expression.get(); }
+  const ExpressionAST *getExpression() const { return Expression; }
+  ExpressionAST *getExpression() { return Expression; }
+  void setExpression(ExpressionAST *E) { Expression = E; }
 
   void dump(const std::string &prefix) const override;
 };
@@ -511,21 +647,22 @@ public:
   static const int8_t DefaultPrecedence = 12;
 
 private:
-  std::string Symbol;
-  std::string LHSName, RHSName;
-  std::unique_ptr<StatementAST> Statement;
+  Symbol Sym;
+  Symbol LHSName, RHSName;
+  StatementAST *Statement;
+  FrameLayout Layout;
 
 public:
-  InfixOpDefinitionAST(const std::string &Sym,
-                       const std::string &LHS,
-                       const std::string &RHS,
-                       std::unique_ptr<StatementAST> Stmt)
-  : Symbol(Sym), LHSName(LHS), RHSName(RHS), Statement(std::move(Stmt)) {}
+  InfixOpDefinitionAST(Symbol Sym, Symbol LHS, Symbol RHS, StatementAST *Stmt)
+  : Sym(Sym), LHSName(LHS), RHSName(RHS), Statement(Stmt) {}
 
-  const std::string &getSymbol() const { return Symbol; }
-  const std::string &getLHSName() const { return LHSName; }
-  const std::string &getRHSName() const { return RHSName; }
-  const StatementAST *getStatement() const { return Statement.get(); }
+  Symbol getSymbol() const { return Sym; }
+  Symbol getLHSName() const { return LHSName; }
+  Symbol getRHSName() const { return RHSName; }
+  const StatementAST *getStatement() const { return Statement; }
+  StatementAST *getStatement() { return Statement; }
+  const FrameLayout &getLayout() const { return Layout; }
+  FrameLayout &getLayout() { return Layout; }
 
   void dump() const;
 };
@@ -533,26 +670,39 @@ public:
 
 
 class FunctionDefinitionAST {
-  std::string Name;
+  Symbol Name;
   cvm::BasicType Type;
-  std::list<Parameter> ParameterList;
-  std::unique_ptr<StatementAST> Statement;
+  std::vector<Parameter> ParameterList;
+  StatementAST *Statement;
+  FrameLayout Layout;
+  // Set by the TypeChecker if every return statement is proven to return a
+  // value of Type.
+  bool CheckedReturns;
   // std::list<std::unique_ptr<DeclarationAST>> LocalVariableList;
   // int Index;
 public:
-  FunctionDefinitionAST() = default;
-  FunctionDefinitionAST(const std::string &Name,
+  FunctionDefinitionAST()
+    : Type(cvm::VoidType), Statement(nullptr), CheckedReturns(false) {}
+  FunctionDefinitionAST(Symbol Name,
                         cvm::BasicType Type,
-                        std::list<Parameter> &&ParameterList,
-                        std::unique_ptr<StatementAST> Statement)
+                        std::vector<Parameter> &&ParameterList,
+                        StatementAST *Statement)
     : Name(Name), Type(Type), ParameterList(std::move(ParameterList))
-    , Statement(std::move(Statement)) {}
+    , Statement(Statement), CheckedReturns(false) {}
 
   cvm::BasicType getType() const { return Type; }
-  const std::string &getName() const { return Name; }
+  Symbol getName() const { return Name; }
   size_t getParameterCount() const { return ParameterList.size(); }
-  const std::list<Parameter> &getParameterList() const { return ParameterList; }
-  const StatementAST *getStatement() const { return Statement.get(); }
+  const std::vector<Parameter> &getParameterList() const {
+    return ParameterList;
+  }
+  const StatementAST *getStatement() const { return Statement; }
+  StatementAST *getStatement() { return Statement; }
+  const FrameLayout &getLayout() const { return Layout; }
+  FrameLayout &getLayout() { return Layout; }
+
+  bool hasCheckedReturns() const { return CheckedReturns; }
+  void setCheckedReturns(bool C) { CheckedReturns = C; }
 
   void dump() const;
 };
@@ -565,93 +715,112 @@ public:
 
 
 class IfStatementAST : public StatementAST {
-  std::unique_ptr<ExpressionAST> Condition;
-  std::unique_ptr<StatementAST> StatementThen;
-  std::unique_ptr<StatementAST> StatementElse;
+  ExpressionAST *Condition;
+  StatementAST *StatementThen;
+  StatementAST *StatementElse;
 
 public:
-  IfStatementAST(std::unique_ptr<ExpressionAST> Condition,
-                 std::unique_ptr<StatementAST> StatementThen,
-                 std::unique_ptr<StatementAST> StatementElse)
+  IfStatementAST(ExpressionAST *Condition,
+                 StatementAST *StatementThen,
+                 StatementAST *StatementElse)
     : StatementAST(IfStatement)
-    , Condition(std::move(Condition))
-    , StatementThen(std::move(StatementThen))
-    , StatementElse(std::move(StatementElse)) {}
-
-  const ExpressionAST *getCondition() const { return Condition.get(); }
-  const StatementAST *getStatementThen() const { return StatementThen.get(); }
-  const StatementAST *getStatementElse() const { return StatementElse.get(); }
+    , Condition(Condition)
+    , StatementThen(StatementThen)
+    , StatementElse(StatementElse) {}
+
+  const ExpressionAST *getCondition() const { return Condition; }
+  ExpressionAST *getCondition() { return Condition; }
+  void setCondition(ExpressionAST *E) { Condition = E; }
+  const StatementAST *getStatementThen() const { return StatementThen; }
+  StatementAST *getStatementThen() { return StatementThen; }
+  const StatementAST *getStatementElse() const { return StatementElse; }
+  StatementAST *getStatementElse() { return StatementElse; }
 
   void dump(const std::string &prefix = "") const override;
 
   // Static helper
-  static std::unique_ptr<StatementAST>
-  create(std::unique_ptr<ExpressionAST> Condition,
-         std::unique_ptr<StatementAST> StatementThen,
-         std::unique_ptr<StatementAST> StatementElse);
+  static StatementAST *
+  create(ASTArena &Arena, ExpressionAST *Condition,
+         StatementAST *StatementThen,
+         StatementAST *StatementElse);
 };
 
 
 class WhileStatementAST : public StatementAST {
-  std::unique_ptr<ExpressionAST> Condition;
-  std::unique_ptr<StatementAST> Statement;
+  ExpressionAST *Condition;
+  StatementAST *Statement;
 public:
-  WhileStatementAST(std::unique_ptr<ExpressionAST> Condition,
-                    std::unique_ptr<StatementAST> Statement)
+  WhileStatementAST(ExpressionAST *Condition,
+                    StatementAST *Statement)
     : StatementAST(WhileStatement)
-    , Condition(std::move(Condition))
-    , Statement(std::move(Statement)) {}
+    , Condition(Condition)
+    , Statement(Statement) {}
 
-  const ExpressionAST *getCondition() const { return Condition.get(); }
-  const StatementAST *getStatement() const { return Statement.get(); }
+  const ExpressionAST *getCondition() const { return Condition; }
+  ExpressionAST *getCondition() { return Condition; }
+  void setCondition(ExpressionAST *E) { Condition = E; }
+  const StatementAST *getStatement() const { return Statement; }
+  StatementAST *getStatement() { return Statement; }
 
   void dump(const std::string &prefix = "") const override;
 
   // Static helper
-  static std::unique_ptr<StatementAST>
-  create(std::unique_ptr<ExpressionAST> Condition,
-         std::unique_ptr<StatementAST> Statement);
+  static StatementAST *
+  create(ASTArena &Arena, ExpressionAST *Condition,
+         StatementAST *Statement);
 };
 
 
 class ForStatementAST : public StatementAST {
-  std::unique_ptr<ExpressionAST> Init;
-  std::unique_ptr<ExpressionAST> Condition;
-  std::unique_ptr<ExpressionAST> Post;
-  std::unique_ptr<StatementAST> Statement;
-public:
-  ForStatementAST(std::unique_ptr<ExpressionAST> Init,
-                  std::unique_ptr<ExpressionAST> Condition,
-                  std::unique_ptr<ExpressionAST> Post,
-                  std::unique_ptr<StatementAST> Statement)
+  ExpressionAST *Init;
+  ExpressionAST *Condition;
+  ExpressionAST *Post;
+  StatementAST *Statement;
+public:
+  ForStatementAST(ExpressionAST *Init,
+                  ExpressionAST *Condition,
+                  ExpressionAST *Post,
+                  StatementAST *Statement)
     : StatementAST(ForStatement)
-    , Init(std::move(Init)), Condition(std::move(Condition))
-    , Post(std::move(Post)), Statement(std::move(Statement)) {}
-
-  const ExpressionAST *getInit() const { return Init.get(); }
-  const ExpressionAST *getCondition() const { return Condition.get(); }
-  const ExpressionAST *getPost() const { return Post.get(); }
-  const StatementAST *getStatement() const { return Statement.get(); }
+    , Init(Init), Condition(Condition)
+    , Post(Post), Statement(Statement) {}
+
+  const ExpressionAST *getInit() const { return Init; }
+  ExpressionAST *getInit() { return Init; }
+  const ExpressionAST *getCondition() const { return Condition; }
+  ExpressionAST *getCondition() { return Condition; }
+  const ExpressionAST *getPost() const { return Post; }
+  ExpressionAST *getPost() { return Post; }
+  const StatementAST *getStatement() const { return Statement; }
+  StatementAST *getStatement() { return Statement; }
+  void setInit(ExpressionAST *E) { Init = E; }
+  void setCondition(ExpressionAST *E) { Condition = E; }
+  void setPost(ExpressionAST *E) { Post = E; }
 
   void dump(const std::string &prefix) const override;
 
   // Static helper
-  static std::unique_ptr<StatementAST>
-  create(std::unique_ptr<ExpressionAST> Init,
-         std::unique_ptr<ExpressionAST> Condition,
-         std::unique_ptr<ExpressionAST> Post,
-         std::unique_ptr<StatementAST> Statement);
+  static StatementAST *
+  create(ASTArena &Arena, ExpressionAST *Init,
+         ExpressionAST *Condition,
+         ExpressionAST *Post,
+         StatementAST *Statement);
 };
 
 
 
 class ReturnStatementAST : public StatementAST {
-  std::unique_ptr<ExpressionAST> ReturnValue;
+  ExpressionAST *ReturnValue;
+  CMMLexer::LocTy Loc;
 public:
-  ReturnStatementAST(std::unique_ptr<ExpressionAST> ReturnValue)
-    : StatementAST(ReturnStatement), ReturnValue(std::move(ReturnValue)) {}
+  ReturnStatementAST(ExpressionAST *ReturnValue, CMMLexer::LocTy Loc = 0)
+    : StatementAST(ReturnStatement), ReturnValue(ReturnValue), Loc(Loc) {}
+
+  CMMLexer::LocTy getLoc() const { return Loc; }
 
-  const ExpressionAST *getReturnValue() const { return ReturnValue.get(); }
+  const ExpressionAST *getReturnValue() const { return ReturnValue; }
+  ExpressionAST *getReturnValue() { return ReturnValue; }
+  void setReturnValue(ExpressionAST *E) { ReturnValue = E; }
 
   void dump(const std::string &prefix = "") const override;
 };
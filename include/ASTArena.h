@@ -0,0 +1,92 @@
+#ifndef ASTARENA_H
+#define ASTARENA_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace cmm {
+/// \brief Children of an AST node, stored contiguously in an ASTArena.
+template <typename T> class ASTArray {
+  T *Data;
+  size_t Size;
+
+public:
+  ASTArray() : Data(nullptr), Size(0) {}
+  ASTArray(T *Data, size_t Size) : Data(Data), Size(Size) {}
+
+  T *begin() const { return Data; }
+  T *end() const { return Data + Size; }
+  size_t size() const { return Size; }
+  bool empty() const { return Size == 0; }
+  T &operator[](size_t Index) const { return Data[Index]; }
+  T &front() const { return Data[0]; }
+  T &back() const { return Data[Size - 1]; }
+};
+
+/// \brief Bump allocator the parser allocates every AST node from.
+///
+/// Nodes are placed one after another in large chunks and are never freed
+/// one by one; the whole tree goes away with the arena. Nodes that own
+/// resources (names, string literals, frame layouts) have their destructors
+/// run then, in reverse order of creation; the others are simply dropped.
+class ASTArena {
+  struct Destructor {
+    void *Object;
+    void (*Destroy)(void *);
+  };
+
+  std::vector<std::unique_ptr<char[]>> Chunks;
+  char *Cur;
+  char *End;
+  std::vector<Destructor> Destructors;
+
+  template <typename T> static void destroy(void *Object) {
+    static_cast<T *>(Object)->~T();
+  }
+
+  void *allocateInNewChunk(size_t Size, size_t Align);
+
+public:
+  ASTArena() : Cur(nullptr), End(nullptr) {}
+  ASTArena(const ASTArena &) = delete;
+  ASTArena &operator=(const ASTArena &) = delete;
+  ~ASTArena();
+
+  /// \brief Return Size bytes aligned to Align, a power of two
+  void *allocate(size_t Size, size_t Align) {
+    uintptr_t P = (reinterpret_cast<uintptr_t>(Cur) + Align - 1) &
+                  ~static_cast<uintptr_t>(Align - 1);
+    if (!Cur || P + Size > reinterpret_cast<uintptr_t>(End))
+      return allocateInNewChunk(Size, Align);
+    Cur = reinterpret_cast<char *>(P + Size);
+    return reinterpret_cast<void *>(P);
+  }
+
+  template <typename T, typename... Ts> T *create(Ts &&... Args) {
+    T *Object = new (allocate(sizeof(T), alignof(T)))
+        T(std::forward<Ts>(Args)...);
+    if (!std::is_trivially_destructible<T>::value)
+      Destructors.push_back(Destructor{Object, &destroy<T>});
+    return Object;
+  }
+
+  /// \brief Copy Size elements at Begin into the arena
+  template <typename T> ASTArray<T> copyArray(const T *Begin, size_t Size) {
+    static_assert(std::is_trivially_copyable<T>::value,
+                  "ASTArray only holds trivially copyable elements");
+    if (Size == 0)
+      return ASTArray<T>();
+    T *Data = static_cast<T *>(allocate(sizeof(T) * Size, alignof(T)));
+    std::memcpy(Data, Begin, sizeof(T) * Size);
+    return ASTArray<T>(Data, Size);
+  }
+};
+}
+
+#endif // !ASTARENA_H
@@ -0,0 +1,226 @@
+#ifndef BASICVALUE_H
+#define BASICVALUE_H
+
+#include <string>
+#include <map>
+#include <iostream>
+#include <memory>
+#include <list>
+#include <vector>
+#include <cstdlib>
+#include <cstdint>
+#include <cstring>
+
+namespace cvm {
+enum BasicType : uint8_t { BoolType, IntType, DoubleType, StringType, VoidType };
+std::string TypeToStr(BasicType Type);
+
+class BasicValue;
+struct ArrayObject;
+
+/// \brief Header of the reference counted objects a BasicValue points to.
+struct HeapObject {
+  unsigned RefCount;
+  HeapObject() : RefCount(0) {}
+};
+
+/// Strings are immutable, so values share them.
+struct StringObject : HeapObject {
+  std::string Value;
+  explicit StringObject(std::string V) : Value(std::move(V)) {}
+};
+
+/// \brief A CMM value in 16 bytes.
+/// Ints, doubles and bools are stored inline. Strings and arrays live out of
+/// line behind one intrusively reference counted pointer; an empty string
+/// needs no object. An array value is a view of one ArrayObject: the sub-array
+/// at dimension Depth that starts at element Offset. An array has the type of
+/// its elements, and reads as the default value of that type when used as a
+/// scalar.
+class BasicValue {
+  BasicType Type;
+  bool Array;
+  uint16_t Depth;
+  uint32_t Offset;
+  union {
+    int IntVal;
+    double DoubleVal;
+    bool BoolVal;
+    StringObject *Str;
+    ArrayObject *Arr;
+    HeapObject *Object;
+    /// All of the payload, whichever member is in use.
+    uint64_t Bits;
+  };
+
+public:
+  /// Public constructors
+  BasicValue()
+      : Type(VoidType), Array(false), Depth(0), Offset(0), Bits(0) {
+    Object = nullptr;
+  }
+  BasicValue(std::string S);
+  BasicValue(int I)
+      : Type(IntType), Array(false), Depth(0), Offset(0), Bits(0) {
+    IntVal = I;
+  }
+  BasicValue(double D)
+      : Type(DoubleType), Array(false), Depth(0), Offset(0), DoubleVal(D) {}
+  BasicValue(bool B)
+      : Type(BoolType), Array(false), Depth(0), Offset(0), Bits(0) {
+    BoolVal = B;
+  }
+
+  BasicValue(BasicType T);
+  BasicValue(BasicType T, const std::list<int> &DimensionList);
+  BasicValue(BasicType T, std::vector<BasicValue> Elements);
+
+  BasicValue(const BasicValue &V) {
+    copyFrom(V);
+    if (isBoxed())
+      ++Object->RefCount;
+  }
+  BasicValue(BasicValue &&V) {
+    copyFrom(V);
+    V.Type = VoidType;
+    V.Array = false;
+  }
+  BasicValue &operator=(const BasicValue &V) {
+    if (V.isBoxed())
+      ++V.Object->RefCount;
+    release();
+    copyFrom(V);
+    return *this;
+  }
+  BasicValue &operator=(BasicValue &&V) {
+    if (this != &V) {
+      release();
+      copyFrom(V);
+      V.Type = VoidType;
+      V.Array = false;
+    }
+    return *this;
+  }
+  ~BasicValue() { release(); }
+
+public:
+  BasicType getType() const { return Type; }
+  bool isArray() const { return Array; }
+  bool isInt() const { return Type == IntType; }
+  bool isDouble() const { return Type == DoubleType; }
+  bool isBool() const { return Type == BoolType; }
+  bool isString() const { return Type == StringType; }
+  bool isVoid() const { return Type == VoidType; }
+  bool isNumeric() const { return isInt() || isDouble(); }
+
+  /// Payload accessors; they don't convert between types.
+  int getInt() const { return Array ? 0 : IntVal; }
+  double getDouble() const { return Array ? 0.0 : DoubleVal; }
+  bool getBool() const { return Array ? false : BoolVal; }
+  const std::string &getString() const;
+
+  /// Array accessors; the value must be an array and I must be in range.
+  int getArraySize() const;
+  /// Return element I: a sub-array view, or a copy of the stored value.
+  BasicValue getElement(int I) const;
+  /// Overwrite element I of an innermost array, unchecked.
+  void setElement(int I, const BasicValue &V) const;
+  ArrayObject *getArrayObject() const { return Array ? Arr : nullptr; }
+  bool isSameArray(const BasicValue &RHS) const {
+    return Arr == RHS.Arr && Depth == RHS.Depth && Offset == RHS.Offset;
+  }
+
+  int toInt() const;
+  double toDouble() const;
+  bool toBool() const ;
+  std::string toString(const BasicValue *Outermost = nullptr) const;
+
+  bool operator<(const BasicValue &RHS) const;
+  bool operator<=(const BasicValue &RHS) const;
+  bool operator==(const BasicValue &RHS) const;
+  bool operator!=(const BasicValue &RHS) const;
+  bool operator>(const BasicValue &RHS) const;
+  bool operator>=(const BasicValue &RHS) const;
+
+private:
+  void copyFrom(const BasicValue &V) {
+    Type = V.Type;
+    Array = V.Array;
+    Depth = V.Depth;
+    Offset = V.Offset;
+    std::memcpy(&Bits, &V.Bits, sizeof(Bits));
+  }
+  /// Strings and arrays own a heap object, unless it's an empty string.
+  bool isBoxed() const { return Array || (Type == StringType && Str); }
+  void release() {
+    if (isBoxed() && --Object->RefCount == 0)
+      destroyObject();
+  }
+  void destroyObject();
+};
+
+static_assert(sizeof(BasicValue) == 16,
+              "a BasicValue is an 8 byte header and an 8 byte payload");
+
+/// \brief Storage of a (multi-dimensional) array, shared by all its views.
+/// Elements are kept row-major in one buffer of their own type. Strings, and
+/// arrays another array has been stored into, keep BasicValues instead; the
+/// latter are tracked by the cycle collector.
+struct ArrayObject : HeapObject {
+  BasicType ElementType;
+  std::vector<int> Shape;
+  /// Distance in elements between neighbours in each dimension.
+  std::vector<size_t> Strides;
+
+  std::vector<int32_t> Ints;
+  std::vector<double> Doubles;
+  std::vector<uint8_t> Bools;
+  std::vector<BasicValue> Values;
+  bool Boxed;
+
+  /// Cycle collector state.
+  bool Tracked;
+  bool Reachable;
+  unsigned TrialRefCount;
+  ArrayObject *PrevContainer;
+  ArrayObject *NextContainer;
+
+  ArrayObject(BasicType T, std::vector<int> Shape);
+  ~ArrayObject();
+  size_t getByteSize() const;
+
+  BasicValue load(size_t Index) const;
+  void store(size_t Index, const BasicValue &V);
+  /// Move the elements over to Values.
+  void box();
+};
+
+/// \brief Arguments of a built-in function call.
+/// A view of consecutive values owned by the caller's argument stack, valid
+/// for the duration of the call.
+class ArgumentList {
+  BasicValue *Begin;
+  BasicValue *End;
+
+public:
+  typedef BasicValue *iterator;
+  typedef const BasicValue *const_iterator;
+
+  ArgumentList(BasicValue *Begin, BasicValue *End) : Begin(Begin), End(End) {}
+
+  bool empty() const { return Begin == End; }
+  size_t size() const { return static_cast<size_t>(End - Begin); }
+  BasicValue &front() const { return *Begin; }
+  BasicValue &back() const { return End[-1]; }
+  BasicValue &operator[](size_t I) const { return Begin[I]; }
+
+  iterator begin() const { return Begin; }
+  iterator end() const { return End; }
+  const_iterator cbegin() const { return Begin; }
+  const_iterator cend() const { return End; }
+};
+
+typedef BasicValue (*NativeFunction)(ArgumentList Args);
+}
+
+#endif // !BASICVALUE_H
@@ -0,0 +1,123 @@
+#ifndef BYTECODE_H
+#define BYTECODE_H
+
+#include "AST.h"
+#include "NativeFunctions.h"
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace cmm {
+/// One instruction word: the opcode takes the low 8 bits and its operand the
+/// upper 24 bits. Instructions listed with two operands are followed by one
+/// extra word holding the second one.
+typedef uint32_t Instruction;
+
+namespace Op {
+enum Opcode : uint8_t {
+  Const,          // push Constants[A]
+  Pop,            // drop the top of the stack
+  Dup2,           // push copies of the top two values
+  LoadLocal,      // push frame slot A, or the variable of its name if void
+  StoreLocal,     // assign the top of the stack to frame slot A
+  LoadGlobal,     // push global slot A
+  StoreGlobal,    // assign the top of the stack to global slot A
+  LoadName,       // push the variable named Names[A]
+  StoreName,      // assign the top of the stack to the variable Names[A]
+  ClearSlots,     // A, N: void the N frame slots from A on (block exit)
+
+  DeclCheck,      // Decls[A] must not be declared in the current scope yet
+  DeclDim,        // check the dimension on the top of the stack for Decls[A]
+  DeclArray,      // pop the dimensions of Decls[A] and create the array
+  DeclInit,       // pop the initializer of Decls[A] and store it
+  DeclDefault,    // default initialize Decls[A]
+
+  CheckArray,     // the top of the stack must be an array
+  Index,          // pop index and array, push the element
+  CheckElem,      // array and index on the stack must name an element
+  StoreElem,      // pop value, index and array; assign the element
+
+  Plus, Negate, LogicalNot, BitwiseNot,
+  Add, Minus, Multiply, Division, Modulo,
+  Less, LessEqual, Equal, NotEqual, Greater, GreaterEqual,
+  BitwiseAnd, BitwiseOr, BitwiseXor, LeftShift, RightShift,
+  ToBool,         // convert the top of the stack to bool
+
+  Jump,           // jump to A
+  JumpIfFalse,    // pop, jump to A if false
+  JumpIfTrue,     // pop, jump to A if true
+  AndThen,        // pop, if false push false and jump to A
+  OrElse,         // pop, if true push true and jump to A
+
+  Call,           // A, N: call function A with N arguments
+  CallDynamic,    // A, N: call function A with N arguments, binding names
+                  //       in the caller's frame (`foo!()`)
+  CallNative,     // A, N: call native A with N arguments
+  CallInfixOp,    // call infix operator A with two arguments
+  Return,         // return statement; pops the return value
+  ReturnImplicit, // fall off the end of a body; pops the value of the last
+                  // statement
+  ReturnVoid,     // fall off the end of a body whose last statement was void
+
+  Error,          // raise a runtime error with message Constants[A]
+  Halt            // end of the top level code
+};
+
+/// \brief Return the mnemonic of an opcode
+const char *getOpcodeName(Opcode Code);
+/// \brief Return true if the opcode is followed by an extra operand word
+bool hasExtraOperand(Opcode Code);
+}
+
+inline Instruction makeInstruction(Op::Opcode Code, uint32_t Operand = 0) {
+  return static_cast<uint32_t>(Code) | (Operand << 8);
+}
+inline Op::Opcode getOpcode(Instruction I) {
+  return static_cast<Op::Opcode>(I & 0xFF);
+}
+inline uint32_t getOperand(Instruction I) { return I >> 8; }
+
+/// \brief Compiled code of the top level, a function or an infix operator.
+/// All blocks of a body share one flat frame: each block gets its own slot
+/// range above the one of its enclosing block.
+struct BytecodeChunk {
+  enum ChunkKind { TopLevelChunk, FunctionChunk, InfixOpChunk };
+
+  ChunkKind Kind;
+  std::string Name;
+  std::vector<Instruction> Code;
+  std::vector<cvm::BasicValue> Constants;
+  /// Identifiers the resolver couldn't bind, looked up by name.
+  std::vector<Symbol> Names;
+  /// Declarations run by the Decl* instructions, and their frame slots.
+  std::vector<std::pair<const DeclarationAST *, unsigned>> Decls;
+  /// Name of every frame slot, for lookups by name. Empty if the slot can't
+  /// be found by name (a repeated parameter).
+  std::vector<Symbol> SlotNames;
+  /// Deepest value stack this chunk needs.
+  unsigned MaxStack = 0;
+  const FunctionDefinitionAST *Function = nullptr;
+
+  BytecodeChunk(ChunkKind Kind, const std::string &Name)
+      : Kind(Kind), Name(Name) {}
+
+  void dump() const;
+};
+
+/// \brief A whole compiled CMM program.
+/// Chunks[0] is the top level code, followed by the user functions and the
+/// infix operators.
+struct BytecodeProgram {
+  std::vector<BytecodeChunk> Chunks;
+  std::vector<cvm::NativeFunction> Natives;
+  std::vector<std::string> NativeNames;
+  /// Number of global variables, held in the first top level frame slots.
+  unsigned GlobalCount = 0;
+  /// Chunk of the `main' function, or -1 if there is none.
+  int MainChunk = -1;
+
+  void dump() const;
+};
+}
+
+#endif // !BYTECODE_H
@@ -0,0 +1,86 @@
+#ifndef BYTECODECOMPILER_H
+#define BYTECODECOMPILER_H
+
+#include "Bytecode.h"
+#include <map>
+#include <vector>
+
+namespace cmm {
+/// \brief Translate a resolved program into bytecode for the BytecodeVM.
+///
+/// Each top level, function and infix operator body becomes one chunk, and
+/// each of them runs in one flat frame: blocks are given consecutive slot
+/// ranges, which are voided again when the block is left so that the
+/// "declared yet?" checks and the lookups by name behave like the fresh
+/// VariableEnv the tree walker creates for every block.
+class BytecodeCompiler {
+  const BlockAST &TopLevelBlock;
+  const std::map<Symbol, FunctionDefinitionAST> &FunctionDefinition;
+  const std::map<Symbol, InfixOpDefinitionAST> &InfixOpDefinition;
+
+  BytecodeProgram Program;
+  std::map<Symbol, unsigned> FunctionIndex, InfixOpIndex, NativeIndex;
+
+  /// State of the chunk being compiled.
+  struct Scope {
+    const FrameLayout *Layout;
+    unsigned Base;
+  };
+  struct LoopContext {
+    size_t ScopeDepth;
+    std::vector<size_t> BreakJumps, ContinueJumps;
+  };
+  BytecodeChunk *Chunk;
+  std::vector<Scope> Scopes;
+  std::vector<LoopContext> Loops;
+  int StackDepth;
+
+public:
+  BytecodeCompiler(const BlockAST &TopLevelBlock,
+                   const std::map<Symbol, FunctionDefinitionAST> &F,
+                   const std::map<Symbol, InfixOpDefinitionAST> &I)
+      : TopLevelBlock(TopLevelBlock), FunctionDefinition(F),
+        InfixOpDefinition(I), Chunk(nullptr), StackDepth(0) {}
+
+  BytecodeProgram compile();
+
+private:
+  void compileTopLevel();
+  void compileFunction(const FunctionDefinitionAST &Function);
+  void compileInfixOp(const InfixOpDefinitionAST &InfixOp);
+
+  void compileStatement(const StatementAST *Stmt, bool Tail);
+  void compileBlock(const BlockAST *Block, bool Tail);
+  void compileIfStatement(const IfStatementAST *IfStmt, bool Tail);
+  void compileWhileStatement(const WhileStatementAST *WhileStmt);
+  void compileForStatement(const ForStatementAST *ForStmt);
+  void compileLoopExit(bool IsBreak);
+  void compileDeclaration(const DeclarationAST *Decl);
+
+  void compileExpression(const ExpressionAST *Expr);
+  void compileVariable(const IdentifierAST *IdExpr, bool Store);
+  void compileIndexTarget(const BinaryOperatorAST *IndexExpr);
+  const IdentifierAST *compileAssignTarget(const ExpressionAST *RefExpr,
+                                           const ExpressionAST *ValExpr);
+  void compileAssignment(const ExpressionAST *RefExpr,
+                         const ExpressionAST *ValExpr);
+  void compileFunctionCall(const FunctionCallAST *FuncCall);
+  void compileInfixOpExpr(const InfixOpExprAST *Expr);
+  void compileError(const std::string &Msg, int StackDelta);
+
+  void beginChunk(BytecodeChunk &C, const FrameLayout &Layout);
+  void pushScope(const FrameLayout &Layout);
+  void emitClearSlots(unsigned First);
+
+  size_t emit(Op::Opcode Code, uint32_t Operand = 0);
+  void emitExtra(uint32_t Operand);
+  void patchJump(size_t At, size_t Target);
+  size_t here() const { return Chunk->Code.size(); }
+  void adjustStack(int Delta);
+
+  unsigned addConstant(const cvm::BasicValue &Value);
+  unsigned addName(Symbol Name);
+};
+}
+
+#endif // !BYTECODECOMPILER_H
@@ -0,0 +1,63 @@
+#ifndef BYTECODEVM_H
+#define BYTECODEVM_H
+
+#include "Bytecode.h"
+#include "JIT.h"
+#include <vector>
+
+namespace cmm {
+/// \brief Run a BytecodeProgram.
+///
+/// Calls don't recurse on the C++ stack: every call pushes a Frame, whose
+/// slots live in one shared slot vector and whose operands live on one shared
+/// value stack. Values are checked and combined by the same helpers the tree
+/// walker uses, so both engines report the same results and errors.
+class BytecodeVM {
+  struct Frame {
+    const BytecodeChunk *Chunk;
+    /// Where to resume the chunk when a callee returns.
+    const Instruction *PC;
+    size_t SlotBase;
+    /// Stack index the arguments started at; the return value goes there.
+    size_t StackBase;
+    /// Frame looked at next when searching a variable by name: the caller
+    /// for a dynamically bound call, the top level frame otherwise.
+    size_t Outer;
+    bool Dynamic;
+  };
+
+  const BytecodeProgram &Program;
+  /// Compiles and runs hot functions if not null (`--jit').
+  BaselineJIT *JIT;
+  std::vector<Frame> Frames;
+  std::vector<cvm::BasicValue> Slots;
+  std::vector<cvm::BasicValue> Stack;
+  /// Stack index past the operands of the frame that called compiled code.
+  size_t CallerTop;
+  bool TopLevelReturned;
+
+public:
+  BytecodeVM(const BytecodeProgram &Program, BaselineJIT *JIT = nullptr)
+      : Program(Program), JIT(JIT), CallerTop(0), TopLevelReturned(false) {
+    if (JIT)
+      JIT->setVM(this);
+  }
+
+  int run(int Argc, char *Argv[]);
+
+  /// \brief Run a call of the function of chunk Index, with arguments checked
+  /// against its parameters, from compiled code and return its value
+  cvm::BasicValue call(unsigned Index, const cvm::BasicValue *Args,
+                       size_t ArgCount);
+
+private:
+  cvm::BasicValue execute(size_t BaseDepth);
+  void pushFrame(const BytecodeChunk &Callee, size_t ArgBase,
+                 size_t ArgCount, bool Dynamic);
+  void checkArguments(const BytecodeChunk &Callee, cvm::BasicValue *Args,
+                      size_t ArgCount);
+  cvm::BasicValue &searchVariable(Symbol Name);
+};
+}
+
+#endif // !BYTECODEVM_H
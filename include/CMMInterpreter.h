@@ -2,6 +2,9 @@
 #define CMMINTERPRETER_H
 
 #include "AST.h"
+#include "FrameArena.h"
+#include "NativeFunctions.h"
+#include "Profiler.h"
 #include <map>
 
 namespace cmm {
@@ -16,47 +19,143 @@ private:  /* private data types */
       ContinueStatementResult
     } Kind;
     cvm::BasicValue ReturnValue;
-
-    ExecutionResult() : Kind(NormalStatementResult) {}
-    ExecutionResult(ExecutionResultKind K) : Kind(K) {}
-    ExecutionResult(ExecutionResultKind K, const cvm::BasicValue &V)
-        : Kind(K), ReturnValue(V) {}
+    /// A tail call still to be made in place of the current function, whose
+    /// arguments are on top of ArgumentStack. Its value is the ReturnValue.
+    const FunctionCallAST *TailCall;
+
+    ExecutionResult() : Kind(NormalStatementResult), TailCall(nullptr) {}
+    ExecutionResult(ExecutionResultKind K) : Kind(K), TailCall(nullptr) {}
+    ExecutionResult(ExecutionResultKind K, cvm::BasicValue V)
+        : Kind(K), ReturnValue(std::move(V)), TailCall(nullptr) {}
   };
 
+  /// \brief A variable frame, whose slots are taken from the FrameArena for
+  /// as long as the frame is alive.
   struct VariableEnv {
     VariableEnv *OuterEnv;
-    std::map<std::string, cvm::BasicValue> VarMap;
+    const FrameLayout *Layout;
+    cvm::BasicValue *Slots;
+
+  private:
+    FrameArena &Arena;
+    FrameArena::Mark Mark;
 
   public:
-    VariableEnv(VariableEnv *OuterEnv = nullptr) : OuterEnv(OuterEnv) {}
+    VariableEnv(FrameArena &Arena, const FrameLayout &Layout,
+                VariableEnv *OuterEnv = nullptr)
+        : OuterEnv(OuterEnv), Layout(&Layout), Arena(Arena),
+          Mark(Arena.getMark()) {
+      Slots = Arena.allocate(Layout.getSlotCount());
+    }
+    VariableEnv(const VariableEnv &) = delete;
+    VariableEnv &operator=(const VariableEnv &) = delete;
+    ~VariableEnv() { Arena.release(Mark, Slots, Layout->getSlotCount()); }
+
+    /// \brief Make this a new frame of NewLayout in place, for a tail call
+    void reset(const FrameLayout &NewLayout, VariableEnv *NewOuterEnv) {
+      Arena.release(Mark, Slots, Layout->getSlotCount());
+      OuterEnv = NewOuterEnv;
+      Layout = &NewLayout;
+      Slots = Arena.allocate(Layout->getSlotCount());
+    }
+
+    /// A slot holds void until its declaration has been executed.
+    bool contain(int Slot) const { return !Slots[Slot].isVoid(); }
+  };
 
-    bool contain(const std::string &Name) const {
-      return VarMap.count(Name) != 0;
+  /// \brief What a lvalue expression refers to: a variable, or element Index
+  /// of an array.
+  struct Lvalue {
+    cvm::BasicValue *Variable;
+    cvm::BasicValue Array;
+    int Index;
+
+    Lvalue(cvm::BasicValue &V) : Variable(&V), Index(0) {}
+    Lvalue(const cvm::BasicValue &A, int I)
+        : Variable(nullptr), Array(A), Index(I) {}
+
+    cvm::BasicValue load() const {
+      return Variable ? *Variable : Array.getElement(Index);
     }
   };
 
-  typedef cvm::BasicValue (*NativeFunction)(std::list<cvm::BasicValue> &);
+  typedef cvm::NativeFunction NativeFunction;
 
 private:  /*  private member variables  */
   const BlockAST &TopLevelBlock;
-  const std::map<std::string, FunctionDefinitionAST> &UserFunctionMap;
-  const std::map<std::string, InfixOpDefinitionAST> &InfixOpMap;
-  std::map<std::string, NativeFunction> NativeFunctionMap;
+  const std::map<Symbol, FunctionDefinitionAST> &UserFunctionMap;
+  const std::map<Symbol, InfixOpDefinitionAST> &InfixOpMap;
+  FrameArena Arena;
   VariableEnv TopLevelEnv;
+  /// Arguments of the calls being evaluated, each call's on top of those of
+  /// the calls enclosing it.
+  std::vector<cvm::BasicValue> ArgumentStack;
+  /// Functions that returned a tail call with a return statement, so the
+  /// final value is still to be checked against their type; each call's on
+  /// top of those of the calls enclosing it.
+  std::vector<const FunctionDefinitionAST *> ReturnChecks;
+  /// Told about every call when --profile is given, or null.
+  Profiler *Prof;
 
 public:   /* public member functions */
   CMMInterpreter(const BlockAST &Block,
-                 const std::map<std::string, FunctionDefinitionAST> &F,
-                 const std::map<std::string, InfixOpDefinitionAST> &I)
-      : TopLevelBlock(Block), UserFunctionMap(F), InfixOpMap(I) {
-    addNativeFunctions();
+                 const std::map<Symbol, FunctionDefinitionAST> &F,
+                 const std::map<Symbol, InfixOpDefinitionAST> &I,
+                 Profiler *Prof = nullptr)
+      : TopLevelBlock(Block), UserFunctionMap(F), InfixOpMap(I),
+        TopLevelEnv(Arena, Block.getLayout()), Prof(Prof) {
+    ArgumentStack.reserve(256);
   }
 
   int interpret(int Argc, char *Argv[]);
 
+public:   /* value semantics shared with the bytecode VM */
+  [[noreturn]] static void RuntimeError(const std::string &Msg);
+
+  static cvm::BasicValue evaluateUnaryCalc(UnaryOperatorAST::OperatorKind OpKind,
+                                           const cvm::BasicValue &Operand);
+  static cvm::BasicValue evaluateUnaryArith(UnaryOperatorAST::OperatorKind OpKind,
+                                            const cvm::BasicValue &Operand);
+  static cvm::BasicValue
+  evaluateUnaryLogical(UnaryOperatorAST::OperatorKind OpKind,
+                       const cvm::BasicValue &Operand);
+  static cvm::BasicValue
+  evaluateUnaryBitwise(UnaryOperatorAST::OperatorKind OpKind,
+                       const cvm::BasicValue &Operand);
+  static cvm::BasicValue evaluateBinaryCalc(BinaryOperatorAST::OperatorKind OpKind,
+                                            const cvm::BasicValue &LHS,
+                                            const cvm::BasicValue &RHS);
+  static cvm::BasicValue evaluateBinArith(BinaryOperatorAST::OperatorKind OpKind,
+                                          const cvm::BasicValue &LHS,
+                                          const cvm::BasicValue &RHS);
+  static cvm::BasicValue
+  evaluateBinRelation(BinaryOperatorAST::OperatorKind OpKind,
+                      const cvm::BasicValue &LHS,
+                      const cvm::BasicValue &RHS);
+  static cvm::BasicValue evaluateBinBitwise(BinaryOperatorAST::OperatorKind OpKind,
+                                            const cvm::BasicValue &LHS,
+                                            const cvm::BasicValue &RHS);
+
+  static cvm::BasicValue &assignValue(cvm::BasicValue &Variable,
+                                      cvm::BasicValue Value);
+  static int checkDimension(const DeclarationAST *Decl,
+                            const cvm::BasicValue &Dimension);
+  static void coerceInitializer(const DeclarationAST *Decl,
+                                cvm::BasicValue &Val);
+  static void checkIndexBase(const cvm::BasicValue &Base);
+  static int checkIndex(const cvm::BasicValue &Base,
+                        const cvm::BasicValue &Index);
+  static cvm::BasicValue storeElement(const cvm::BasicValue &Base, int Index,
+                                      const cvm::BasicValue &Value);
+  static void checkInfixOpValue(const cvm::BasicValue &Value);
+  static void checkArgumentCount(const FunctionDefinitionAST &Function,
+                                 size_t Count);
+  static void coerceArgument(const FunctionDefinitionAST &Function,
+                             const Parameter &Param, cvm::BasicValue &Arg);
+  static void checkReturnValue(const FunctionDefinitionAST &Function,
+                               const cvm::BasicValue &Value);
+
 private:  /* private member functions */
-  void addNativeFunctions();
-  void RuntimeError(const std::string &Msg);
 
   ExecutionResult executeBlock(VariableEnv *Env, const BlockAST *Block);
   ExecutionResult executeStatement(VariableEnv *Env, const StatementAST *Stmt);
@@ -81,16 +180,16 @@ private:  /* private member functions */
 
   cvm::BasicValue evaluateExpression(VariableEnv *Env,
                                      const ExpressionAST *Expr);
-  cvm::BasicValue &evaluateLvalueExpr(VariableEnv *Env,
-                                      const ExpressionAST *Expr);
+  const cvm::BasicValue &borrowExpression(VariableEnv *Env,
+                                          const ExpressionAST *Expr,
+                                          cvm::BasicValue &Temp);
+  bool evaluateCondition(VariableEnv *Env, const ExpressionAST *Expr);
+  Lvalue evaluateLvalueExpr(VariableEnv *Env, const ExpressionAST *Expr);
   cvm::BasicValue &evaluateIdentifierExpr(VariableEnv *Env,
                                           const IdentifierAST *Expr);
-  cvm::BasicValue &evaluateIndexExpr(VariableEnv *Env,
-                                     const ExpressionAST *BaseExpr,
-                                     const ExpressionAST *IndexExpr);
-  cvm::BasicValue &evaluateAssignment(VariableEnv *Env,
-                                      const ExpressionAST *RefExpr,
-                                      const ExpressionAST *VarExpr);
+  Lvalue evaluateIndexExpr(VariableEnv *Env, const ExpressionAST *BaseExpr,
+                           const ExpressionAST *IndexExpr);
+  Lvalue evaluateAssignment(VariableEnv *Env, const BinaryOperatorAST *Expr);
   cvm::BasicValue evaluateLogicalAnd(VariableEnv *Env,
                                      const ExpressionAST *LHS,
                                      const ExpressionAST *RHS);
@@ -103,38 +202,33 @@ private:  /* private member functions */
                                       const InfixOpExprAST *Expr);
   cvm::BasicValue evaluateUnaryOpExpr(VariableEnv *Env,
                                       const UnaryOperatorAST *Expr);
-  cvm::BasicValue evaluateUnaryArith(UnaryOperatorAST::OperatorKind OpKind,
-                                     cvm::BasicValue Operand);
-  cvm::BasicValue evaluateUnaryLogical(UnaryOperatorAST::OperatorKind OpKind,
-                                       cvm::BasicValue Operand);
-  cvm::BasicValue evaluateUnaryBitwise(UnaryOperatorAST::OperatorKind OpKind,
-                                       cvm::BasicValue Operand);
   cvm::BasicValue evaluateBinaryOpExpr(VariableEnv *Env,
                                        const BinaryOperatorAST *Expr);
-  cvm::BasicValue evaluateAssignExpr(VariableEnv *Env,
-                                     const BinaryOperatorAST *Expr);
-  cvm::BasicValue evaluateBinaryCalc(BinaryOperatorAST::OperatorKind OpKind,
-                                     cvm::BasicValue LHS, cvm::BasicValue RHS);
-  cvm::BasicValue evaluateBinArith(BinaryOperatorAST::OperatorKind OpKind,
-                                   cvm::BasicValue LHS, cvm::BasicValue RHS);
-  cvm::BasicValue evaluateBinRelation(BinaryOperatorAST::OperatorKind OpKind,
-                                      cvm::BasicValue LHS, cvm::BasicValue RHS);
-  cvm::BasicValue evaluateBinBitwise(BinaryOperatorAST::OperatorKind OpKind,
-                                     cvm::BasicValue LHS, cvm::BasicValue RHS);
-
-
-  std::list<cvm::BasicValue>
-  evaluateArgumentList(VariableEnv *Env,
-                       const std::list<std::unique_ptr<ExpressionAST>> &Args);
+  static void quickenBinaryOpExpr(const BinaryOperatorAST *Expr,
+                                  const cvm::BasicValue &LHS,
+                                  const cvm::BasicValue &RHS);
+  static cvm::BasicValue evaluateDoubleOp(BinaryOperatorAST::QuickKind K,
+                                          const cvm::BasicValue &LHS,
+                                          const cvm::BasicValue &RHS);
+
+
+  cvm::ArgumentList
+  evaluateArgumentList(VariableEnv *Env, ASTArray<ExpressionAST *> Args);
 
   cvm::BasicValue callNativeFunction(const NativeFunction &Function,
-                                     std::list<cvm::BasicValue> &Args);
+                                     cvm::ArgumentList Args);
   cvm::BasicValue callUserFunction(const FunctionDefinitionAST &Function,
-                                   std::list<cvm::BasicValue> &Args,
-                                   VariableEnv *Env = nullptr);
-
-  std::map<std::string, cvm::BasicValue>::iterator
-  searchVariable(VariableEnv *Env, const std::string &Name);
+                                   cvm::ArgumentList Args,
+                                   VariableEnv *Env = nullptr,
+                                   bool CheckedArguments = false);
+  ExecutionResult prepareTailCall(VariableEnv *Env,
+                                  ExecutionResult::ExecutionResultKind Kind,
+                                  const FunctionCallAST *FuncCall);
+  void bindArguments(const FunctionDefinitionAST &Function,
+                     VariableEnv &FuncEnv, cvm::ArgumentList Args,
+                     bool Checked);
+
+  cvm::BasicValue &searchVariable(VariableEnv *Env, Symbol Name);
 };
 }
 
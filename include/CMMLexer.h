@@ -2,6 +2,7 @@
 #define CMMLEXER_H
 
 #include "SourceMgr.h"
+#include "Symbol.h"
 #include <string>
 
 namespace cmm {
@@ -59,10 +60,17 @@ public:
 
 private:
   SourceMgr &SrcMgr;
+  /// The lexer reads the source buffer in place.
+  const char *BufferStart;
+  const char *BufferEnd;
+  const char *CurPtr;
   /// Information about the current token.
   Token CurTok;
   LocTy TokStartLoc;
+  /// Value of a String token.
   std::string StrVal;
+  /// Value of an Identifier or InfixOp token.
+  Symbol SymVal;
   union {
     int IntVal;
     double DoubleVal;
@@ -71,7 +79,9 @@ private:
 
 public:
   CMMLexer(SourceMgr &SrcMgr) :
-      SrcMgr(SrcMgr), CurTok(Token::Boolean) {}
+      SrcMgr(SrcMgr), BufferStart(SrcMgr.getBufferStart()),
+      BufferEnd(SrcMgr.getBufferEnd()), CurPtr(BufferStart),
+      CurTok(Token::Boolean) {}
   Token Lex() {
     return CurTok = LexToken();
   }
@@ -80,6 +90,7 @@ public:
   Token getTok() const { return CurTok; }
   Token::TokenKind getKind() const { return CurTok.getKind(); }
   const std::string &getStrVal() const { return StrVal; }
+  Symbol getSymbolVal() const { return SymVal; }
   LocTy getLoc() const { return TokStartLoc; }
   int getIntVal() const { return IntVal; }
   double getDoubleVal() const { return DoubleVal; }
@@ -95,9 +106,6 @@ public:
     return is(K1) || isOneOf(K2, Ks...);
   }
 
-  /// State change
-  void seekLoc(LocTy Loc) { SrcMgr.seekLoc(Loc); }
-
   bool Error(LocTy ErrorLoc, const std::string &Msg);
   bool Error(const std::string &Msg) { return Error(getLoc(), Msg); }
   void Warning(LocTy ErrorLoc, const std::string &Msg);
@@ -106,15 +114,24 @@ public:
 private:
   Token LexToken();
 
-  int peekNextChar();
-  int getNextChar();
-  void ungetChar();
+  LocTy getCurLoc() const { return CurPtr - BufferStart; }
+  int peekNextChar() const {
+    return CurPtr == BufferEnd ? std::char_traits<char>::eof() : *CurPtr;
+  }
+  int getNextChar() {
+    return CurPtr == BufferEnd ? std::char_traits<char>::eof() : *CurPtr++;
+  }
+  void ungetChar() {
+    if (CurPtr != BufferStart)
+      --CurPtr;
+  }
 
   Token LexIdentifier();
   Token LexString();
   Token LexDigit();
   Token LexChar();
   Token LexInfixOp(int HeadChar);
+  void skipBlanks();
   void skipLineComment();
   bool skipBlockComment();
 };
@@ -1,81 +1,115 @@
 #ifndef CMMPARSER_H
 #define CMMPARSER_H
 
-#include "CMMLexer.h"
 #include "AST.h"
-#include <list>
-#include <memory>
+#include "ConstantPropagator.h"
+#include "Inliner.h"
+#include "TokenBuffer.h"
+#include <vector>
 
 
 namespace cmm {
+class ProgramCache;
+
 /************************** Parser class ****************************/
 class CMMParser {
+  // Rebuilds a cached program in place of parsing it.
+  friend class ProgramCache;
+
 public:
-  using LocTy = CMMLexer::LocTy;
+  using LocTy = TokenBuffer::LocTy;
 
 private:
   SourceMgr &SrcMgr;
-  CMMLexer Lexer;
+  TokenBuffer Tokens;
+  /// Owns every AST node but the top level block.
+  ASTArena Arena;
   BlockAST TopLevelBlock;
   BlockAST *CurrentBlock;
+  /// Children of the nodes being parsed, kept here until takePending() moves
+  /// them into the arena as the node is complete.
+  std::vector<StatementAST *> PendingStatements;
+  std::vector<ExpressionAST *> PendingExpressions;
+  std::vector<DeclarationAST *> PendingDeclarations;
 
-  std::map<std::string, int8_t> BinOpPrecedence;
-  std::map<std::string, FunctionDefinitionAST> FunctionDefinition;
-  std::map<std::string, InfixOpDefinitionAST> InfixOpDefinition;
+  std::map<Symbol, int8_t> BinOpPrecedence;
+  std::map<Symbol, FunctionDefinitionAST> FunctionDefinition;
+  std::map<Symbol, InfixOpDefinitionAST> InfixOpDefinition;
+  ConstantPropagator Propagator;
 
 private:
-  Token::TokenKind getKind() { return Lexer.getKind(); }
-  Token Lex() { return Lexer.Lex(); }
+  Token::TokenKind getKind() { return Tokens.getKind(); }
+  Token Lex() { return Tokens.Lex(); }
 
-  bool Error(LocTy L, const std::string &Msg) { return Lexer.Error(L, Msg); }
-  bool Error(const std::string &Msg) { return Lexer.Error(Msg); }
-  void Warning(LocTy Loc, const std::string &Msg) { Lexer.Warning(Loc, Msg); }
-  void Warning(const std::string &Msg) { Lexer.Warning(Msg); }
+  bool Error(LocTy L, const std::string &Msg) { return Tokens.Error(L, Msg); }
+  bool Error(const std::string &Msg) { return Tokens.Error(Msg); }
+  void Warning(LocTy Loc, const std::string &Msg) { Tokens.Warning(Loc, Msg); }
+  void Warning(const std::string &Msg) { Tokens.Warning(Msg); }
 
   int8_t getBinOpPrecedence();
+  bool resolve();
+
+  /// \brief Copy the elements of Pending from Mark on into the arena, and
+  /// drop them from Pending
+  template <typename T>
+  ASTArray<T *> takePending(std::vector<T *> &Pending, size_t Mark) {
+    ASTArray<T *> Res = Arena.copyArray(Pending.data() + Mark,
+                                        Pending.size() - Mark);
+    Pending.resize(Mark);
+    return Res;
+  }
 
   bool parseTopLevel();
   bool parseInfixOpDefinition();
   bool parseFunctionDefinition();
-  bool parseFunctionDefinition(cvm::BasicType Type, const std::string &Name);
-  bool parseStatement(std::unique_ptr<StatementAST> &Res);
-  bool parseEmptyStatement(std::unique_ptr<StatementAST> &Res);
-  bool parseBlock(std::unique_ptr<StatementAST> &Res);
+  bool parseFunctionDefinition(cvm::BasicType Type, Symbol Name);
+  bool parseStatement(StatementAST *&Res);
+  bool parseEmptyStatement(StatementAST *&Res);
+  bool parseBlock(StatementAST *&Res);
   bool parseTypeSpecifier(cvm::BasicType &Type); //?
-  bool parseParameterList(std::list<Parameter> &ParameterList);
-  bool parseOptionalArgList(std::list<std::unique_ptr<ExpressionAST>> &ArgList);
-  bool parseArgumentList(std::list<std::unique_ptr<ExpressionAST>> &ArgList);
-  bool parseExprStatement(std::unique_ptr<StatementAST> &Res);
-  bool parseIfStatement(std::unique_ptr<StatementAST> &Res);
-  bool parseWhileStatement(std::unique_ptr<StatementAST> &Res);
-  bool parseForStatement(std::unique_ptr<StatementAST> &Res);
-  bool parseReturnStatement(std::unique_ptr<StatementAST> &Res);
-  bool parseBreakStatement(std::unique_ptr<StatementAST> &Res);
-  bool parseContinueStatement(std::unique_ptr<StatementAST> &Res);
-  bool parseDeclarationStatement(std::unique_ptr<StatementAST> &Res);
+  bool parseParameterList(std::vector<Parameter> &ParameterList);
+  bool parseOptionalArgList(ASTArray<ExpressionAST *> &ArgList);
+  bool parseArgumentList(ASTArray<ExpressionAST *> &ArgList);
+  bool parseExprStatement(StatementAST *&Res);
+  bool parseIfStatement(StatementAST *&Res);
+  bool parseWhileStatement(StatementAST *&Res);
+  bool parseForStatement(StatementAST *&Res);
+  bool parseReturnStatement(StatementAST *&Res);
+  bool parseBreakStatement(StatementAST *&Res);
+  bool parseContinueStatement(StatementAST *&Res);
+  bool parseDeclarationStatement(StatementAST *&Res);
   bool parseDeclarationStatement(cvm::BasicType Type,
-                                 std::unique_ptr<StatementAST> &Res);
+                                 StatementAST *&Res);
   // First: LParen,Id,Int,Double,Str,Bool,Plus,Minus,Tilde,Exclaim
-  bool parseExpression(std::unique_ptr<ExpressionAST> &Res);
-  bool parsePrimaryExpression(std::unique_ptr<ExpressionAST> &Res);
-  bool parseBinOpRHS(int8_t ExprPrec, std::unique_ptr<ExpressionAST> &Res);
-  bool parseParenExpression(std::unique_ptr<ExpressionAST> &Res);
-  bool parseIdentifierExpression(std::unique_ptr<ExpressionAST> &Res);
-  bool parseConstantExpression(std::unique_ptr<ExpressionAST> &Res);
+  bool parseExpression(ExpressionAST *&Res);
+  bool parsePrimaryExpression(ExpressionAST *&Res);
+  bool parseBinOpRHS(int8_t ExprPrec, ExpressionAST *&Res);
+  bool parseParenExpression(ExpressionAST *&Res);
+  bool parseIdentifierExpression(ExpressionAST *&Res);
+  bool parseConstantExpression(ExpressionAST *&Res);
 
 public:
   CMMParser(SourceMgr &SrcMgr)
-    : SrcMgr(SrcMgr), Lexer(SrcMgr), CurrentBlock(&TopLevelBlock) {}
+    : SrcMgr(SrcMgr), Tokens(SrcMgr), CurrentBlock(&TopLevelBlock),
+      Propagator(SrcMgr, Arena, TopLevelBlock, FunctionDefinition,
+                 InfixOpDefinition) {}
 
   bool parse();
+  /// \brief Inline calls to functions and infix operators of at most
+  /// InlineLimit nodes, then optimize loops
+  /// Done on the program parse() made or the cache loaded, so the cache
+  /// doesn't depend on the limit.
+  void optimize(unsigned InlineLimit = Inliner::DefaultLimit);
   void dumpAST() const;
+  /// \brief Report what constant propagation folded
+  void dumpFoldings() const { Propagator.dump(); }
 
   const BlockAST &getTopLevelBlock() const { return TopLevelBlock; }
 
-  const std::map<std::string, FunctionDefinitionAST> &
+  const std::map<Symbol, FunctionDefinitionAST> &
       getFunctionDefinition() const { return FunctionDefinition; };
 
-  const std::map<std::string, InfixOpDefinitionAST> &
+  const std::map<Symbol, InfixOpDefinitionAST> &
       getInfixOpDefinition() const { return InfixOpDefinition; };
 };
 }
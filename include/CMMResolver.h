@@ -0,0 +1,54 @@
+#ifndef CMMRESOLVER_H
+#define CMMRESOLVER_H
+
+#include "AST.h"
+#include <map>
+#include <vector>
+
+namespace cmm {
+/// \brief Bind every identifier and declaration to a (depth, slot) pair, and
+/// every call to its callee.
+///
+/// Runs once after parsing. Each block, function and infix operator gets a
+/// FrameLayout, and the interpreter allocates one slot per declared name
+/// instead of keeping a name-keyed map per scope. Names that can't be bound
+/// statically (undefined, or seen through a dynamically bound `foo!()` call)
+/// are still found by name at run time. Calls to undefined functions are
+/// reported here, before anything runs. Calls a function returns the value of
+/// are marked as tail calls.
+class CMMResolver {
+  SourceMgr &SrcMgr;
+  BlockAST &TopLevelBlock;
+  std::map<Symbol, FunctionDefinitionAST> &FunctionDefinition;
+  std::map<Symbol, InfixOpDefinitionAST> &InfixOpDefinition;
+
+  /// Static scope chain of the code being resolved, innermost scope last.
+  std::vector<FrameLayout *> Scopes;
+  bool HadError;
+
+public:
+  CMMResolver(SourceMgr &SrcMgr, BlockAST &TopLevelBlock,
+              std::map<Symbol, FunctionDefinitionAST> &F,
+              std::map<Symbol, InfixOpDefinitionAST> &I)
+      : SrcMgr(SrcMgr), TopLevelBlock(TopLevelBlock), FunctionDefinition(F),
+        InfixOpDefinition(I), HadError(false) {}
+
+  /// Return true if some call can't be bound.
+  bool resolve();
+
+private:
+  void resolveFunction(FunctionDefinitionAST &Function);
+  void resolveInfixOp(InfixOpDefinitionAST &InfixOp);
+
+  void resolveStatement(StatementAST *Stmt);
+  void resolveBlock(BlockAST *Block);
+  void resolveDeclaration(DeclarationAST *Decl);
+  void resolveExpression(ExpressionAST *Expr);
+  void resolveIdentifier(IdentifierAST *IdExpr);
+  void resolveFunctionCall(FunctionCallAST *FuncCall);
+  void resolveInfixOpExpr(InfixOpExprAST *Expr);
+  void markTailCalls(StatementAST *Stmt, bool Tail);
+};
+}
+
+#endif // !CMMRESOLVER_H
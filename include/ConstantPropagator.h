@@ -0,0 +1,112 @@
+#ifndef CONSTANTPROPAGATOR_H
+#define CONSTANTPROPAGATOR_H
+
+#include "AST.h"
+#include "GlobalDeclarations.h"
+#include "ProgramWalker.h"
+#include <map>
+#include <set>
+#include <utility>
+#include <vector>
+
+namespace cmm {
+/// \brief Replace reads of variables that never change by their values, and
+/// fold what becomes constant.
+///
+/// Runs after the resolver. A variable qualifies when it is declared once,
+/// directly in a block, with an initializer that folds to a scalar of its type,
+/// and nothing assigns to it. A read is replaced when the resolver bound it to
+/// the variable's slot. Then operators with constant operands, calls to pure
+/// natives (sqrt, pow, exp, log, toint, tostring, strlen...) with constant
+/// arguments and concatenations of string literals are folded. Operators are
+/// evaluated by the runtime library, and only when it wouldn't report an
+/// error, so a folded program computes exactly what it did before.
+///
+/// Names are still looked up at run time in dynamically bound callees
+/// (`foo!()`), which may see and assign the caller's variables. Reads in such
+/// a callee are left alone, and its assignments, like those to unbound names,
+/// disqualify every variable of that name. Globals are only replaced in
+/// function and infix operator bodies if they are declared before the top
+/// level code first calls into user code.
+class ConstantPropagator : ProgramWalker {
+public:
+  /// One fold, reported by -d.
+  struct Folding {
+    enum FoldingKind { Variable, NativeCall, Concatenation } Kind;
+    /// The variable, or the native called.
+    Symbol Name;
+    /// Location of the call.
+    CMMLexer::LocTy Loc;
+    const ExpressionAST *Value;
+    /// How many reads of the variable were replaced.
+    unsigned Uses;
+  };
+
+private:
+  SourceMgr &SrcMgr;
+  ASTArena &Arena;
+  BlockAST &TopLevelBlock;
+  std::map<Symbol, FunctionDefinitionAST> &FunctionDefinition;
+  std::map<Symbol, InfixOpDefinitionAST> &InfixOpDefinition;
+
+  typedef std::pair<const FrameLayout *, int> VariableKey;
+  struct VariableInfo {
+    unsigned DeclarationCount;
+    /// Scalar, initialized and directly in a block.
+    bool Candidate;
+    bool Assigned;
+    /// The value, once its declaration has been folded.
+    ExpressionAST *Value;
+    size_t FoldingIndex;
+
+    VariableInfo()
+        : DeclarationCount(0), Candidate(false), Assigned(false),
+          Value(nullptr), FoldingIndex(0) {}
+  };
+
+  std::map<VariableKey, VariableInfo> Variables;
+  /// Names some assignment finds by name at run time.
+  std::set<Symbol> AssignedByName;
+  std::set<const FunctionDefinitionAST *> DynamicCallees;
+  /// Targets of assignments, with the function containing them.
+  std::vector<std::pair<const IdentifierAST *, const FunctionDefinitionAST *>>
+      AssignedIdentifiers;
+  GlobalDeclarations Globals;
+  std::vector<Folding> Foldings;
+
+  /// State of the code being walked.
+  const FunctionDefinitionAST *Function;
+  bool InBody;
+
+public:
+  ConstantPropagator(SourceMgr &SrcMgr, ASTArena &Arena,
+                     BlockAST &TopLevelBlock,
+                     std::map<Symbol, FunctionDefinitionAST> &F,
+                     std::map<Symbol, InfixOpDefinitionAST> &I);
+
+  void propagate();
+
+  const std::vector<Folding> &getFoldings() const { return Foldings; }
+  void dump() const;
+
+private:
+  void collect();
+  void enterFunction(const FunctionDefinitionAST &F) override;
+  void leaveFunction(const FunctionDefinitionAST &F) override;
+  void visitDeclaration(const DeclarationAST *Decl, bool InBlock) override;
+  void visitExpression(const ExpressionAST *Expr) override;
+
+  void fold();
+  void foldBody(StatementAST *Stmt, const FrameLayout &Layout);
+  void foldStatement(StatementAST *Stmt);
+  void foldDeclaration(DeclarationAST *Decl);
+  ExpressionAST *foldExpression(ExpressionAST *Expr);
+  ExpressionAST *foldLvalue(ExpressionAST *Expr);
+  ExpressionAST *foldIdentifier(IdentifierAST *IdExpr);
+  ExpressionAST *foldFunctionCall(FunctionCallAST *FuncCall);
+  ExpressionAST *foldBinaryOperator(BinaryOperatorAST *BinOp);
+  ExpressionAST *foldUnaryOperator(UnaryOperatorAST *UnaryOp);
+};
+}
+
+#endif // !CONSTANTPROPAGATOR_H
@@ -0,0 +1,201 @@
+#ifndef CPPEMITTER_H
+#define CPPEMITTER_H
+
+#include "AST.h"
+#include "ProgramWalker.h"
+#include <map>
+#include <ostream>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace cmm {
+/// \brief Translate a resolved program into a standalone C++ translation unit
+/// that links against the cmmrt runtime library.
+///
+/// Variables, parameters and function results whose type is known statically
+/// to be int, double or bool become native C++ values; strings, arrays and
+/// everything else (infix operator operands, results of natives, variables an
+/// array may be stored into) stay cvm::BasicValues handled by the runtime,
+/// which reports errors exactly like the interpreters. Code the tree walker
+/// evaluates left to right is sequenced explicitly wherever C++ leaves the
+/// order unspecified.
+///
+/// Dynamically bound calls (`foo!()`), declarations that aren't directly in a
+/// block and assignments to anything but a variable or an array element have
+/// no C++ counterpart and are rejected.
+class CppEmitter : ProgramWalker {
+  SourceMgr &SrcMgr;
+  const BlockAST &TopLevelBlock;
+  const std::map<Symbol, FunctionDefinitionAST> &FunctionDefinition;
+  const std::map<Symbol, InfixOpDefinitionAST> &InfixOpDefinition;
+
+  /// Static type of a C++ expression.
+  struct ValueType {
+    enum KindTy { Int, Double, Bool, String, Array, Dynamic } Kind;
+    cvm::BasicType ElementType;
+    unsigned Rank;
+    /// A Dynamic value may be an array.
+    bool HoldsArray;
+
+    ValueType(KindTy K, cvm::BasicType E = cvm::VoidType, unsigned R = 0)
+        : Kind(K), ElementType(E), Rank(R), HoldsArray(false) {}
+    static ValueType dynamicArray() {
+      ValueType T(Dynamic);
+      T.HoldsArray = true;
+      return T;
+    }
+    bool isNative() const {
+      return Kind == Int || Kind == Double || Kind == Bool;
+    }
+    bool isNumeric() const { return Kind == Int || Kind == Double; }
+    bool mayBeArray() const { return Kind == Array || HoldsArray; }
+  };
+
+  struct CppExpr {
+    std::string Code;
+    ValueType Type;
+  };
+
+  typedef std::pair<const FrameLayout *, int> VariableKey;
+  struct VariableInfo {
+    std::string CppName;
+    cvm::BasicType Type;
+    unsigned Rank;
+    /// An array may be stored into it, so it can't be native.
+    bool Boxed;
+    bool Global;
+  };
+
+  std::map<VariableKey, VariableInfo> Variables;
+  /// Functions whose every exit yields a value of their declared native type.
+  std::set<const FunctionDefinitionAST *> NativeReturns;
+  /// Functions and infix operators that may yield an array.
+  std::set<const FunctionDefinitionAST *> ArrayReturns;
+  std::set<const InfixOpDefinitionAST *> InfixArrayReturns;
+  /// Functions that return a call to themselves with `return`.
+  std::set<const FunctionDefinitionAST *> CheckedTailCalls;
+  std::map<const InfixOpDefinitionAST *, unsigned> InfixOpIndex;
+  /// Variables some emitted code reads, and the locals the current pass
+  /// cast to void because nothing had read them yet.
+  std::set<VariableKey> ReadVariables;
+  std::set<VariableKey> UnreadVariables;
+  /// Functions and infix operators the code emitted so far calls.
+  std::set<const FunctionDefinitionAST *> CalledFunctions;
+  std::set<const InfixOpDefinitionAST *> CalledInfixOps;
+  std::map<std::string, unsigned> StringIndex;
+  std::map<std::string, std::string> NativeNames;
+  /// Whether some array may be stored into an array element.
+  bool ArraysInElements;
+  /// Whether the last pass weakened a type assumed by an earlier one.
+  bool Changed;
+  bool HadError;
+
+  /// State of the body being emitted.
+  const FunctionDefinitionAST *Function;
+  const InfixOpDefinitionAST *InfixOp;
+  std::set<VariableKey> Declared;
+  std::map<std::string, unsigned> NameCounts;
+  unsigned LoopDepth;
+  bool HasSelfTailCall;
+  const FrameLayout *CurrentLayout;
+  unsigned TempCount;
+  unsigned Indent;
+  std::string Out;
+
+public:
+  CppEmitter(SourceMgr &SrcMgr, const BlockAST &TopLevelBlock,
+             const std::map<Symbol, FunctionDefinitionAST> &F,
+             const std::map<Symbol, InfixOpDefinitionAST> &I)
+      : SrcMgr(SrcMgr), TopLevelBlock(TopLevelBlock), FunctionDefinition(F),
+        InfixOpDefinition(I), ArraysInElements(false), Changed(false),
+        HadError(false), Function(nullptr), InfixOp(nullptr), LoopDepth(0),
+        HasSelfTailCall(false), CurrentLayout(nullptr), TempCount(0),
+        Indent(0) {}
+
+  /// Write the translation unit to OS. Return true if the program uses
+  /// something that can't be compiled.
+  bool emit(std::ostream &OS);
+
+private:
+  void collectVariables();
+  void enterFunction(const FunctionDefinitionAST &F) override;
+  void leaveFunction(const FunctionDefinitionAST &F) override;
+  void enterInfixOp(const InfixOpDefinitionAST &I) override;
+  void leaveInfixOp(const InfixOpDefinitionAST &I) override;
+  void visitStatement(const StatementAST *Stmt, bool InBlock) override;
+  void visitDeclaration(const DeclarationAST *Decl, bool InBlock) override;
+  void visitExpression(const ExpressionAST *Expr) override;
+  void addVariable(const FrameLayout *Layout, int Slot,
+                   const std::string &Name, cvm::BasicType Type, size_t Rank,
+                   bool Global);
+  void reportUnsupported(CMMLexer::LocTy Loc, const std::string &What);
+
+  std::string emitProgram();
+  std::string getSignature(const FunctionDefinitionAST &F) const;
+  std::string getSignature(const InfixOpDefinitionAST &I) const;
+  void beginBody(const FrameLayout &Layout, size_t ParamCount);
+  void noteUnread(const VariableKey &Key, const VariableInfo &Var);
+  void emitFunction(const FunctionDefinitionAST &F);
+  void emitInfixOp(const InfixOpDefinitionAST &I);
+  void emitTopLevel();
+
+  void line(const std::string &Code);
+  void emitBody(const StatementAST *Stmt, bool Tail);
+  void emitStatement(const StatementAST *Stmt, bool Tail);
+  void emitBlock(const BlockAST *Block, bool Tail, bool Braces);
+  void emitDeclaration(const DeclarationAST *Decl);
+  void emitReturn(const ExpressionAST *ValueExpr);
+  void emitTailValue(const CppExpr &Value);
+  const FunctionCallAST *getSelfTailCall(const ExpressionAST *Value) const;
+  bool emitSelfTailCall(const ExpressionAST *Value, bool IsReturn);
+  bool needsTailCheck() const;
+  void emitUncheckedReturn(const std::string &Value);
+  void noteResult(const CppExpr &Value);
+  void emitVoidExit();
+
+  std::string emitCondition(const ExpressionAST *Expr);
+  CppExpr emitError(const std::string &Msg);
+  CppExpr emitExpression(const ExpressionAST *Expr);
+  CppExpr emitVariable(const IdentifierAST *IdExpr);
+  CppExpr emitIndexBase(const ExpressionAST *BaseExpr);
+  CppExpr emitIndex(const BinaryOperatorAST *IndexExpr);
+  CppExpr emitAssignment(const ExpressionAST *RefExpr,
+                         const ExpressionAST *ValExpr);
+  CppExpr emitUnary(const UnaryOperatorAST *Expr);
+  CppExpr emitBinary(const BinaryOperatorAST *Expr);
+  CppExpr emitBinaryValue(BinaryOperatorAST::OperatorKind OpKind,
+                          const CppExpr &LHS, const CppExpr &RHS);
+  std::vector<CppExpr>
+  emitOperands(const std::vector<const ExpressionAST *> &Exprs,
+               std::string &Prologue);
+  CppExpr sequence(const std::string &Prologue, CppExpr Value);
+  CppExpr emitFunctionCall(const FunctionCallAST *FuncCall);
+  CppExpr emitCall(const FunctionDefinitionAST &F,
+                   const std::vector<CppExpr> &Args);
+  std::string emitArgument(const FunctionDefinitionAST &F, int Slot,
+                           const CppExpr &Arg);
+  CppExpr emitInfixOpExpr(const InfixOpExprAST *Expr);
+
+  const VariableInfo *findVariable(const IdentifierAST *IdExpr) const;
+  ValueType getVariableType(const VariableInfo &Var) const;
+  void noteStore(VariableInfo &Var, const CppExpr &Value);
+  std::string stringConstant(const std::string &S);
+  std::string nativeFunction(const std::string &Name);
+  std::string newTemp();
+  bool hasNativeReturn(const FunctionDefinitionAST *F) const {
+    return NativeReturns.count(F) != 0;
+  }
+
+  static bool isNativeStorage(const VariableInfo &Var);
+  static ValueType::KindTy getValueKind(cvm::BasicType Type);
+  static std::string getCppType(ValueType::KindTy Kind);
+  static std::string getCppType(const VariableInfo &Var);
+  static bool convertsImplicitly(const ValueType &From, ValueType::KindTy To);
+  static std::string box(const CppExpr &Value);
+  static std::string quote(const std::string &S);
+};
+}
+
+#endif // !CPPEMITTER_H
@@ -0,0 +1,36 @@
+#ifndef CYCLECOLLECTOR_H
+#define CYCLECOLLECTOR_H
+
+#include "BasicValue.h"
+#include <ostream>
+
+namespace cvm {
+/// \brief Collector for reference cycles between arrays.
+///
+/// Reference counting frees everything else. Only an array holding other
+/// arrays (a container) can be part of a cycle, so only containers are
+/// tracked. A collection is a trial deletion: references from tracked
+/// containers are subtracted from their targets' counts, whatever is still
+/// referenced from outside is live along with all it reaches, and the rest is
+/// garbage.
+struct CollectorStatistics {
+  size_t Collections;
+  size_t ArraysFreed;
+  size_t BytesFreed;
+};
+
+void trackContainer(ArrayObject *A);
+void untrackContainer(ArrayObject *A);
+
+/// Called for every new array; collects once enough arrays were allocated
+/// since the last collection.
+void noteArrayAllocation();
+
+/// Collect unreachable cycles now and return the bytes freed.
+size_t collectCycles();
+
+const CollectorStatistics &getCollectorStatistics();
+void dumpCollectorStatistics(std::ostream &OS);
+}
+
+#endif // !CYCLECOLLECTOR_H
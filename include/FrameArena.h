@@ -0,0 +1,64 @@
+#ifndef FRAMEARENA_H
+#define FRAMEARENA_H
+
+#include "AST.h"
+#include <memory>
+#include <vector>
+
+namespace cmm {
+/// \brief Stack the tree walker allocates variable frames from.
+///
+/// Frames are created and destroyed in LIFO order, so allocating one bumps a
+/// pointer and releasing one moves it back. Slots live in chunks that never
+/// move, which keeps references to variables valid while calls nested in the
+/// same expression push frames of their own. Every slot above the top is void,
+/// which is what a frame expects of undeclared variables.
+class FrameArena {
+  struct Chunk {
+    std::unique_ptr<cvm::BasicValue[]> Slots;
+    size_t Size;
+  };
+
+  std::vector<Chunk> Chunks;
+  size_t CurChunk;
+  size_t Top;
+
+public:
+  /// Where the top was before an allocation; release() goes back to it.
+  struct Mark {
+    size_t Chunk;
+    size_t Top;
+  };
+
+  FrameArena() : CurChunk(0), Top(0) {}
+  FrameArena(const FrameArena &) = delete;
+  FrameArena &operator=(const FrameArena &) = delete;
+
+  Mark getMark() const { return {CurChunk, Top}; }
+
+  /// \brief Return Count void slots on top of the stack
+  cvm::BasicValue *allocate(size_t Count) {
+    if (Count == 0)
+      return nullptr;
+    if (CurChunk < Chunks.size() && Top + Count <= Chunks[CurChunk].Size) {
+      cvm::BasicValue *Slots = Chunks[CurChunk].Slots.get() + Top;
+      Top += Count;
+      return Slots;
+    }
+    return allocateInNextChunk(Count);
+  }
+
+  /// \brief Clear the Count slots at Slots and pop everything above M
+  void release(Mark M, cvm::BasicValue *Slots, size_t Count) {
+    for (size_t I = 0; I != Count; ++I)
+      Slots[I] = cvm::BasicValue();
+    CurChunk = M.Chunk;
+    Top = M.Top;
+  }
+
+private:
+  cvm::BasicValue *allocateInNextChunk(size_t Count);
+};
+}
+
+#endif // !FRAMEARENA_H
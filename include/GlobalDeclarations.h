@@ -0,0 +1,43 @@
+#ifndef GLOBALDECLARATIONS_H
+#define GLOBALDECLARATIONS_H
+
+#include "AST.h"
+#include <map>
+
+namespace cmm {
+/// \brief Which globals the top level declares before it may first run user
+/// code.
+///
+/// A function or infix operator body the top level calls before a global is
+/// declared finds that global undefined, so a body may only count on the
+/// globals declared directly by the top level statements ahead of the first
+/// one that may call user code. Passes compute this on the tree they are about
+/// to walk, since inlining moves calls around.
+class GlobalDeclarations {
+  const BlockAST &TopLevelBlock;
+  /// Top level statement index of the first declaration of each global.
+  std::map<int, size_t> GlobalIndex;
+  /// Index of the first top level statement that may run user code.
+  size_t FirstCallingStatement;
+
+  static bool mayCallUserCode(const StatementAST *Stmt);
+  static bool mayCallUserCode(const DeclarationAST *Decl);
+  static bool mayCallUserCode(const ExpressionAST *Expr);
+
+public:
+  explicit GlobalDeclarations(const BlockAST &TopLevelBlock)
+      : TopLevelBlock(TopLevelBlock), FirstCallingStatement(0) {}
+
+  void compute();
+
+  /// \brief Return true if IdExpr is sure to be declared wherever it is
+  /// evaluated, InBody telling whether that is in a function or infix operator
+  /// body
+  ///
+  /// A name the resolver left to be looked up at run time may be undefined
+  /// anywhere.
+  bool isDeclared(const IdentifierAST *IdExpr, bool InBody) const;
+};
+}
+
+#endif // !GLOBALDECLARATIONS_H
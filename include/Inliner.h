@@ -0,0 +1,117 @@
+#ifndef INLINER_H
+#define INLINER_H
+
+#include "AST.h"
+#include "GlobalDeclarations.h"
+#include "ProgramWalker.h"
+#include <map>
+#include <set>
+#include <utility>
+#include <vector>
+
+namespace cmm {
+/// \brief Substitute the bodies of small functions and infix operators for
+/// the calls to them.
+///
+/// Runs on a resolved and type checked program once it is stored to or loaded
+/// from the cache, so the limit doesn't change what is cached. A body is small
+/// if it has at most Limit statements and expressions. Dynamically bound calls
+/// (`foo!()`), calls in the functions they call and calls of a function in its
+/// own body are left alone, and so are bodies that make dynamically bound
+/// calls or look names up at run time.
+///
+/// A body that only computes a value, `return E;` or `a@b = E;`, with neither
+/// assignments nor calls but to natives, replaces a call whose arguments are
+/// literals or variables sure to be declared: E can't change those, so it may
+/// read each of them any number of times, in any order.
+///
+/// A function called as a statement directly in a block, with arguments
+/// proven to have the types of its parameters, is spliced into the block: its
+/// arguments are stored into new variables standing for the parameters, then
+/// come the statements of its body, whose own variables move into the block.
+/// Such a body may only return at its end, may not break or continue out of a
+/// loop, and may only declare variables directly in a block.
+///
+/// The reads of a substituted body keep their slots. A global it reads is
+/// looked up by name if it isn't declared yet, so no frame at the call site
+/// may declare that name. The new variables are named by a number, which no
+/// CMM identifier is.
+class Inliner : ProgramWalker {
+public:
+  static const unsigned DefaultLimit = 24;
+
+private:
+  ASTArena &Arena;
+  BlockAST &TopLevelBlock;
+  std::map<Symbol, FunctionDefinitionAST> &FunctionDefinition;
+  std::map<Symbol, InfixOpDefinitionAST> &InfixOpDefinition;
+  unsigned Limit;
+
+  std::set<const FunctionDefinitionAST *> DynamicCallees;
+  GlobalDeclarations Globals;
+  unsigned InlineCount;
+
+  /// State of the code being walked.
+  const FunctionDefinitionAST *Function;
+  bool InBody;
+
+  /// State of the body being substituted: the frame of the callee, and when
+  /// spliced, its body block and where their variables went.
+  const FrameLayout *CalleeLayout;
+  const FrameLayout *BodyLayout;
+  ASTArray<ExpressionAST *> Operands;
+  typedef std::pair<Symbol, int> Variable;
+  std::vector<Variable> ParameterVariables;
+  std::vector<Variable> BodyVariables;
+  FrameLayout *Target;
+  std::map<const FrameLayout *, const FrameLayout *> ClonedLayouts;
+  int GlobalDepth;
+  /// How many cloned blocks the code being cloned is in.
+  int Nesting;
+
+public:
+  Inliner(ASTArena &Arena, BlockAST &TopLevelBlock,
+          std::map<Symbol, FunctionDefinitionAST> &F,
+          std::map<Symbol, InfixOpDefinitionAST> &I, unsigned Limit);
+
+  void inlineCalls();
+
+private:
+  void collect();
+  void visitExpression(const ExpressionAST *Expr) override;
+
+  void inlineStatement(StatementAST *Stmt);
+  void inlineBlock(BlockAST *Block);
+  void inlineDeclaration(DeclarationAST *Decl);
+  ExpressionAST *inlineExpression(ExpressionAST *Expr);
+  ExpressionAST *inlineFunctionCall(FunctionCallAST *FuncCall);
+  ExpressionAST *inlineInfixOp(InfixOpExprAST *InfixOp);
+  bool splice(FunctionCallAST *FuncCall, BlockAST *Block, bool IsLast,
+              std::vector<StatementAST *> &List);
+
+  const ExpressionAST *getValue(const StatementAST *Body,
+                                bool CheckedReturns) const;
+  bool isSmall(const StatementAST *Body) const;
+  bool isSimple(const ExpressionAST *Expr) const;
+  bool isDeclared(const IdentifierAST *IdExpr) const;
+  bool canSubstitute(const ExpressionAST *Expr, bool ValueOnly) const;
+  bool canSplice(const StatementAST *Stmt, bool InBlock, bool InLoop) const;
+  bool canSpliceDeclaration(const DeclarationAST *Decl, bool InBlock) const;
+
+  StatementAST *cloneStatement(const StatementAST *Stmt);
+  DeclarationAST *cloneDeclaration(const DeclarationAST *Decl);
+  ExpressionAST *cloneExpression(const ExpressionAST *Expr);
+  ExpressionAST *cloneIdentifier(const IdentifierAST *IdExpr);
+  ASTArray<ExpressionAST *>
+  cloneExpressionList(const ASTArray<ExpressionAST *> &List);
+
+  Variable makeVariable(Symbol Name);
+  DeclarationListAST *makeDeclaration(const Variable &Var, cvm::BasicType Type,
+                                      ExpressionAST *Init);
+  static unsigned getSize(const StatementAST *Stmt);
+  static unsigned getSize(const DeclarationAST *Decl);
+  static unsigned getSize(const ExpressionAST *Expr);
+};
+}
+
+#endif // !INLINER_H
@@ -0,0 +1,79 @@
+#ifndef JIT_H
+#define JIT_H
+
+#include "Bytecode.h"
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <vector>
+
+#if defined(__x86_64__) && (defined(__linux__) || defined(__APPLE__))
+#define CMM_HAS_JIT 1
+#endif
+
+namespace cmm {
+class BytecodeVM;
+
+/// \brief Baseline compiler from bytecode to x86-64 machine code.
+///
+/// Only functions whose values can be typed statically are compiled: their
+/// parameters, locals, return type and every intermediate value must be int,
+/// double or bool, they may only call functions like themselves, and every
+/// local they read must be declared on all paths leading there. Arrays,
+/// strings, globals, lookups by name, natives, infix operators and dynamic
+/// calls all leave a function to the VM. A compiled function keeps every
+/// slot and operand in a native stack frame as a raw word and reports errors
+/// with the same messages as the VM.
+///
+/// A function is compiled the HotCallCount'th time the VM calls it, along
+/// with the functions it calls, so short scripts never pay for compiling.
+/// Calls of a function to itself just before returning become jumps. A call
+/// that finds the native stack of its thread nearly used up runs on the VM
+/// instead, whose frames don't take any.
+class BaselineJIT {
+public:
+  /// Compiled code: takes the raw parameter words and returns the raw result.
+  typedef uint64_t (*CompiledFunction)(const uint64_t *Args);
+
+  static const unsigned HotCallCount = 1000;
+
+private:
+  enum ChunkState : uint8_t { Cold, Compiled, Rejected };
+
+  const BytecodeProgram &Program;
+  std::vector<ChunkState> States;
+  std::vector<unsigned> CallCounts;
+  /// Entry point of every compiled chunk; compiled code calls through it.
+  std::vector<CompiledFunction> Entries;
+  /// Error messages referenced by compiled code.
+  std::deque<std::string> Messages;
+  std::vector<std::pair<void *, size_t>> CodeBlocks;
+  /// The VM running out of native stack hands calls back to.
+  BytecodeVM *VM;
+
+public:
+  BaselineJIT(const BytecodeProgram &Program);
+  ~BaselineJIT();
+  BaselineJIT(const BaselineJIT &) = delete;
+  BaselineJIT &operator=(const BaselineJIT &) = delete;
+
+  void setVM(BytecodeVM *V) { VM = V; }
+
+  /// \brief Run the function of chunk Index on compiled code if it is, or just
+  /// became, hot and compilable
+  /// The arguments must have been checked against the parameters. Return
+  /// false if the VM has to run the call instead.
+  bool tryCall(unsigned Index, const cvm::BasicValue *Args, size_t ArgCount,
+               cvm::BasicValue &Result);
+
+  /// \brief Run a call of chunk Index with the raw parameter words Args on
+  /// the VM, for compiled code short of native stack
+  uint64_t callOnVM(unsigned Index, const uint64_t *Args);
+
+private:
+  bool compile(unsigned Index);
+  void *emitCode(const std::vector<uint8_t> &Code);
+};
+}
+
+#endif // !JIT_H
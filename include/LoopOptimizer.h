@@ -0,0 +1,163 @@
+#ifndef LOOPOPTIMIZER_H
+#define LOOPOPTIMIZER_H
+
+#include "AST.h"
+#include "GlobalDeclarations.h"
+#include "ProgramWalker.h"
+#include <map>
+#include <set>
+#include <utility>
+#include <vector>
+
+namespace cmm {
+/// \brief Hoist loop invariant expressions out of for and while loops, and
+/// strength reduce products of their induction variables.
+///
+/// Runs after the TypeChecker, on loops directly in a block. An expression is
+/// invariant in a loop if it reads no variable whose name the loop assigns or
+/// declares, or may assign through the functions and infix operators it
+/// calls, and calls nothing with side effects. Each invariant expression with
+/// a static type is computed once into a temporary declared in the block just
+/// before the loop, after the initializer of a for loop. That computation is
+/// speculative if the loop doesn't get to it, so it is only done for
+/// expressions that can't fail: operators on operands of types the runtime
+/// accepts, pure natives, variables sure to be declared and pure user
+/// functions whose bodies compute nothing else and neither loop nor recurse.
+/// Expressions that may fail are only hoisted from where the first test of
+/// the condition evaluates them before anything else that may fail or has a
+/// side effect.
+///
+/// A for loop that steps an int variable by a constant and assigns it nowhere
+/// else has a product of the variable by a constant or an invariant variable
+/// that it computes more than once replaced by a temporary, which the end of
+/// the body advances by the product of the step.
+///
+/// Temporaries are named by a number, which no CMM identifier is, so they
+/// never meet a lookup by name.
+class LoopOptimizer : ProgramWalker {
+  ASTArena &Arena;
+  BlockAST &TopLevelBlock;
+  std::map<Symbol, FunctionDefinitionAST> &FunctionDefinition;
+  std::map<Symbol, InfixOpDefinitionAST> &InfixOpDefinition;
+
+  /// \brief What running some code may do to the variables and the world
+  struct Effects {
+    /// Names of the variables it may assign or declare. For a function or
+    /// infix operator, only those past its own frames.
+    std::set<Symbol> Writes;
+    /// Names of the variables past its own frames a function or infix
+    /// operator may read.
+    std::set<Symbol> Reads;
+    bool StoresElements;
+    /// Whether it does no input, output or anything else but computing.
+    bool Pure;
+    /// Functions and infix operators it calls.
+    std::vector<const Effects *> Callees;
+    /// Whether a call to a function with arguments of its parameter types
+    /// can't fail.
+    bool Safe;
+
+    Effects() : StoresElements(false), Pure(true), Safe(false) {}
+    bool merge(const Effects &Callee);
+    bool isPureCall() const {
+      return Pure && Writes.empty() && !StoresElements;
+    }
+  };
+
+  std::map<const FunctionDefinitionAST *, Effects> FunctionEffects;
+  std::map<const InfixOpDefinitionAST *, Effects> InfixOpEffects;
+  /// Names a declaration outside any block may leave to be looked up at run
+  /// time, so their accesses in a body may reach past its frames.
+  std::set<Symbol> LooseNames;
+  GlobalDeclarations Globals;
+  unsigned TempCount;
+
+  /// State of the code being walked.
+  bool InBody;
+  bool CollectingBody;
+  /// The loop being optimized, what it may do, and the block it is in.
+  const Effects *Loop;
+  BlockAST *LoopBlock;
+  /// How many blocks in the loop the code being walked is.
+  int Nesting;
+  /// Declarations of the temporaries of the loop.
+  std::vector<StatementAST *> Temporaries;
+  /// Whether everything the condition evaluated so far can't fail and has no
+  /// side effect.
+  bool ConditionClean;
+
+  /// \brief A product of the induction variable being reduced, keyed by the
+  /// variable it is multiplied by, or by a null layout and the constant.
+  typedef std::pair<const FrameLayout *, int> FactorKey;
+  struct Reduction {
+    unsigned Uses;
+    /// The variable factor, and its depth from the block of the loop.
+    Symbol FactorName;
+    int FactorDepth;
+    /// The temporary holding the product, once made.
+    Symbol Name;
+    int Slot;
+
+    Reduction() : Uses(0), FactorDepth(0), Slot(-1) {}
+  };
+  const IdentifierAST *Induction;
+  std::map<FactorKey, Reduction> Reductions;
+  bool Replacing;
+
+public:
+  LoopOptimizer(ASTArena &Arena, BlockAST &TopLevelBlock,
+                std::map<Symbol, FunctionDefinitionAST> &F,
+                std::map<Symbol, InfixOpDefinitionAST> &I);
+
+  void optimize();
+
+private:
+  void collect();
+  void visitDeclaration(const DeclarationAST *Decl, bool InBlock) override;
+
+  void addEffects(const StatementAST *Stmt, Effects &Eff);
+  void addEffects(const DeclarationAST *Decl, Effects &Eff);
+  void addEffects(const ExpressionAST *Expr, Effects &Eff);
+  void addAccess(const IdentifierAST *IdExpr, Effects &Eff, bool Write);
+
+  void optimizeStatement(StatementAST *Stmt);
+  void optimizeBlock(BlockAST *Block);
+  bool optimizeLoop(StatementAST *Stmt, std::vector<StatementAST *> &List);
+
+  typedef ExpressionAST *(LoopOptimizer::*ExpressionVisitor)(
+      ExpressionAST *Expr);
+  void walkStatement(StatementAST *Stmt, ExpressionVisitor Visit);
+  void walkDeclaration(DeclarationAST *Decl, ExpressionVisitor Visit);
+  ExpressionAST *hoistInBody(ExpressionAST *Expr) {
+    return hoistExpression(Expr, false);
+  }
+  ExpressionAST *hoistExpression(ExpressionAST *Expr, bool InCondition);
+  ExpressionAST *hoistLvalue(ExpressionAST *Expr, bool InCondition);
+  ExpressionAST *makeTemporary(ExpressionAST *Expr);
+
+  bool findInduction(ForStatementAST *ForStmt, const Effects &Eff,
+                     int &Step);
+  bool isInductionRead(const ExpressionAST *Expr) const;
+  bool getFactorKey(const ExpressionAST *Expr, FactorKey &Key) const;
+  ExpressionAST *makeFactor(const FactorKey &Key, const Reduction &R);
+  ExpressionAST *reduceExpression(ExpressionAST *Expr);
+  void reduce(ForStatementAST *ForStmt, int Step, Effects &Eff);
+
+  bool isInvariant(const ExpressionAST *Expr) const;
+  bool isSafe(const ExpressionAST *Expr) const;
+  bool isSafeBody(const StatementAST *Stmt) const;
+  bool isSafeDeclaration(const DeclarationAST *Decl) const;
+  bool isDeclared(const IdentifierAST *IdExpr) const;
+
+  IdentifierAST *makeRead(Symbol Name, int Slot, cvm::BasicType Type);
+  BinaryOperatorAST *makeIntOperator(BinaryOperatorAST::OperatorKind OpKind,
+                                     ExpressionAST *LHS, ExpressionAST *RHS);
+  Symbol makeTemporaryName();
+  DeclarationListAST *makeDeclaration(Symbol Name, int Slot,
+                                      ExpressionAST *Init);
+  static void shiftDepth(ExpressionAST *Expr, int By);
+  static bool hasContinue(const StatementAST *Stmt);
+};
+}
+
+#endif // !LOOPOPTIMIZER_H
@@ -1,10 +1,30 @@
 #ifndef NATIVEFUNCTIONS_H
 #define NATIVEFUNCTIONS_H
 
-#include "CMMParser.h"
+#include "BasicValue.h"
 
 namespace cvm {
-#define ADD_FUNCTION(FUNC) BasicValue FUNC(std::list<BasicValue> &Args)
+/// Built-in functions, keyed by the name CMM code calls them with.
+const std::map<std::string, NativeFunction> &getNativeFunctionMap();
+
+/// \brief What the passes over the AST may assume about a built-in function
+struct NativeTraits {
+  /// What it does with its arguments if it has no side effects: look at their
+  /// type, size or scalar value, convert them to numbers, which fails on
+  /// strings, or convert them to strings, which reads array elements.
+  enum ArgumentUse : uint8_t { Impure, Inspect, ToNumber, ToText };
+  ArgumentUse Use;
+  /// Whether every value it returns has type ReturnType.
+  bool Typed;
+  BasicType ReturnType;
+
+  bool isPure() const { return Use != Impure; }
+};
+
+/// Traits of Function; a native that isn't listed is impure and untyped.
+const NativeTraits &getNativeTraits(NativeFunction Function);
+
+#define ADD_FUNCTION(FUNC) BasicValue FUNC(ArgumentList Args)
 
 namespace Native {
 ADD_FUNCTION(TypeOf);
@@ -17,6 +37,7 @@ ADD_FUNCTION(PrintLn);
 ADD_FUNCTION(System);
 ADD_FUNCTION(Time);
 ADD_FUNCTION(Exit);
+ADD_FUNCTION(CollectGarbage);
 
 ADD_FUNCTION(ToInt);
 ADD_FUNCTION(ToBool);
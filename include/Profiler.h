@@ -0,0 +1,85 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include "AST.h"
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace cmm {
+/// \brief Function level profiler of the tree walker, enabled by --profile.
+///
+/// The interpreter reports every call of a user function, native function or
+/// infix operator, which the profiler keeps on a shadow call stack. Wall time
+/// between two events is charged to the callee on top of the stack. Each
+/// callee gets a call count, an exclusive time and an inclusive time that
+/// counts recursive activations once. Each distinct call stack also gets its
+/// exclusive time, which printFoldedStacks() writes in the folded format that
+/// flame graph tools read.
+class Profiler {
+public:
+  enum EntryKind { TopLevel, UserFunction, NativeFunction, InfixOperator };
+
+private:
+  typedef std::chrono::steady_clock Clock;
+
+  struct Entry {
+    EntryKind Kind;
+    std::string Name;
+    uint64_t Calls;
+    Clock::duration Inclusive;
+    Clock::duration Exclusive;
+    /// Activations on the stack; only the outermost one counts as inclusive.
+    unsigned Active;
+  };
+
+  /// A node of the call tree: one distinct stack of entries.
+  struct StackNode {
+    unsigned Parent;
+    unsigned Entry;
+    Clock::duration Self;
+    std::map<unsigned, unsigned> Children;
+  };
+
+  struct Frame {
+    unsigned Node;
+    Clock::time_point Start;
+  };
+
+  std::vector<Entry> Entries;
+  std::map<const void *, unsigned> DefinitionEntries;
+  std::map<cvm::NativeFunction, unsigned> NativeEntries;
+  /// Node 0 is the top level code.
+  std::vector<StackNode> Nodes;
+  std::vector<Frame> Stack;
+  Clock::time_point Last;
+
+public:
+  /// Start profiling the top level code.
+  Profiler();
+  Profiler(const Profiler &) = delete;
+  Profiler &operator=(const Profiler &) = delete;
+
+  void enterFunction(const FunctionDefinitionAST &Function);
+  void enterInfixOp(const InfixOpDefinitionAST &InfixOp);
+  void enterNative(cvm::NativeFunction Native);
+  /// Return from the callee entered last.
+  void leave();
+  /// Return from every callee and the top level, as the program exits.
+  void finish();
+
+  void printSummary(std::ostream &OS) const;
+  void printFoldedStacks(std::ostream &OS) const;
+
+private:
+  unsigned addEntry(EntryKind Kind, const std::string &Name);
+  void enter(unsigned EntryIndex);
+  void charge(Clock::time_point Now);
+  std::string getFrameName(const Entry &E) const;
+};
+}
+
+#endif // !PROFILER_H
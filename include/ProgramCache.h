@@ -0,0 +1,49 @@
+#ifndef PROGRAMCACHE_H
+#define PROGRAMCACHE_H
+
+#include "CMMParser.h"
+#include <cstdint>
+#include <string>
+
+namespace cmm {
+/// \brief On-disk cache of parsed programs, keyed by the hash of the source.
+///
+/// A program that parses without any diagnostic is written to the cache
+/// directory as a flat serialization of its folded AST: the function and infix
+/// operator definitions and the top level statements. The next run of the same
+/// source maps that file and rebuilds the tree in the parser's arena in one
+/// pass, without lexing or parsing, then resolves it as usual. Bindings to
+/// native functions and frame layouts are never stored.
+///
+/// The cache lives in $CMM_CACHE_DIR, or else $XDG_CACHE_HOME/cmm or
+/// $HOME/.cache/cmm. Files are named after the hash of FormatVersion and the
+/// source text, and also record both, so an edited source or a newer
+/// interpreter simply misses. So does a damaged file, as its payload no longer
+/// matches the hash in its header.
+class ProgramCache {
+public:
+  /// Bump whenever the AST, constant folding in the front end or the layout of
+  /// cache files changes.
+  static const uint32_t FormatVersion = 5;
+
+private:
+  SourceMgr &SrcMgr;
+  uint64_t SourceHash;
+  /// Empty if there is no cache directory.
+  std::string Path;
+
+public:
+  ProgramCache(SourceMgr &SrcMgr);
+
+  /// \brief Load the cached program of the source into Parser, which must
+  /// not have parsed anything yet
+  /// Return true if there was a valid cache file and its program resolved.
+  bool tryLoad(CMMParser &Parser);
+
+  /// \brief Write the program Parser just parsed to the cache
+  /// Failures are silently ignored; the next run parses again.
+  void store(const CMMParser &Parser);
+};
+}
+
+#endif // !PROGRAMCACHE_H
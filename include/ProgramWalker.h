@@ -0,0 +1,48 @@
+#ifndef PROGRAMWALKER_H
+#define PROGRAMWALKER_H
+
+#include "AST.h"
+#include <map>
+#include <vector>
+
+namespace cmm {
+/// \brief Visit every statement, declaration and expression of a program,
+/// keeping the layouts of the frames they are in.
+///
+/// The top level statements come first, then the body of every function and
+/// infix operator. Passes that gather facts about the whole program before
+/// they change it derive from this and override the hooks they need; the
+/// hooks of a node run before those of the nodes in it, but a declaration is
+/// visited after its array dimensions and initializer.
+class ProgramWalker {
+protected:
+  /// Layouts of the frames the code being walked is in, innermost last.
+  std::vector<const FrameLayout *> Scopes;
+
+  virtual ~ProgramWalker() {}
+
+  void walkProgram(const BlockAST &TopLevelBlock,
+                   const std::map<Symbol, FunctionDefinitionAST> &F,
+                   const std::map<Symbol, InfixOpDefinitionAST> &I);
+
+  virtual void enterFunction(const FunctionDefinitionAST &F) {}
+  virtual void leaveFunction(const FunctionDefinitionAST &F) {}
+  virtual void enterInfixOp(const InfixOpDefinitionAST &I) {}
+  virtual void leaveInfixOp(const InfixOpDefinitionAST &I) {}
+
+  /// InBlock tells whether Stmt is directly in a block. Otherwise a
+  /// declaration in it may not have run when a read bound to it does, which
+  /// then finds whatever variable of that name it can.
+  virtual void visitStatement(const StatementAST *Stmt, bool InBlock) {}
+  /// Decl is declared in the frame of Scopes.back().
+  virtual void visitDeclaration(const DeclarationAST *Decl, bool InBlock) {}
+  virtual void visitExpression(const ExpressionAST *Expr) {}
+
+private:
+  void walkStatement(const StatementAST *Stmt, bool InBlock);
+  void walkDeclaration(const DeclarationAST *Decl, bool InBlock);
+  void walkExpression(const ExpressionAST *Expr);
+};
+}
+
+#endif // !PROGRAMWALKER_H
@@ -0,0 +1,171 @@
+#ifndef RUNTIME_H
+#define RUNTIME_H
+
+#include "BasicValue.h"
+#include <string>
+#include <utility>
+
+/// Value semantics of CMM shared by the tree walker, the bytecode VM and the
+/// C++ the --emit-cpp backend generates, which links against them as the cmmrt
+/// library. Every check reports a violation with RuntimeError, which doesn't
+/// return.
+namespace cvm {
+/// \brief Print a CMM runtime error and exit
+[[noreturn]] void RuntimeError(const std::string &Msg);
+
+BasicValue unaryPlus(const BasicValue &Operand);
+BasicValue unaryMinus(const BasicValue &Operand);
+BasicValue logicalNot(const BasicValue &Operand);
+BasicValue bitwiseNot(const BasicValue &Operand);
+
+BasicValue add(const BasicValue &LHS, const BasicValue &RHS);
+BasicValue subtract(const BasicValue &LHS, const BasicValue &RHS);
+BasicValue multiply(const BasicValue &LHS, const BasicValue &RHS);
+BasicValue divide(const BasicValue &LHS, const BasicValue &RHS);
+BasicValue modulo(const BasicValue &LHS, const BasicValue &RHS);
+
+BasicValue less(const BasicValue &LHS, const BasicValue &RHS);
+BasicValue lessEqual(const BasicValue &LHS, const BasicValue &RHS);
+BasicValue equal(const BasicValue &LHS, const BasicValue &RHS);
+BasicValue notEqual(const BasicValue &LHS, const BasicValue &RHS);
+BasicValue greater(const BasicValue &LHS, const BasicValue &RHS);
+BasicValue greaterEqual(const BasicValue &LHS, const BasicValue &RHS);
+
+BasicValue bitwiseAnd(const BasicValue &LHS, const BasicValue &RHS);
+BasicValue bitwiseOr(const BasicValue &LHS, const BasicValue &RHS);
+BasicValue bitwiseXor(const BasicValue &LHS, const BasicValue &RHS);
+BasicValue leftShift(const BasicValue &LHS, const BasicValue &RHS);
+BasicValue rightShift(const BasicValue &LHS, const BasicValue &RHS);
+
+BasicValue &assignValue(BasicValue &Variable, BasicValue Value);
+int checkDimension(const std::string &Name, const BasicValue &Dimension);
+void coerceInitializer(const std::string &Name, BasicType Type,
+                       BasicValue &Val);
+void checkIndexBase(const BasicValue &Base);
+int checkIndex(const BasicValue &Base, const BasicValue &Index);
+BasicValue storeElement(const BasicValue &Base, int Index,
+                        const BasicValue &Value);
+void checkInfixOpValue(const BasicValue &Value);
+void checkArgumentCount(const std::string &Function, size_t ParamCount,
+                        size_t Count);
+void coerceArgument(const std::string &Function, const std::string &Param,
+                    BasicType Type, BasicValue &Arg);
+void checkReturnValue(const std::string &Function, BasicType Type,
+                      const BasicValue &Value);
+int checkTopLevelReturn(const BasicValue &Value);
+
+/// \brief Return the string array a main function with a parameter is given
+BasicValue makeArgumentArray(int Argc, char *Argv[]);
+
+/*===------------- Helpers for the C++ --emit-cpp generates --------------===*/
+
+/// Compiled code keeps statically typed ints, doubles and bools in native
+/// variables; these convert between them and BasicValues.
+template <typename T> struct NativeType;
+template <> struct NativeType<int> {
+  static const BasicType Type = IntType;
+  static int get(const BasicValue &V) { return V.getInt(); }
+};
+template <> struct NativeType<double> {
+  static const BasicType Type = DoubleType;
+  static double get(const BasicValue &V) { return V.getDouble(); }
+};
+template <> struct NativeType<bool> {
+  static const BasicType Type = BoolType;
+  static bool get(const BasicValue &V) { return V.getBool(); }
+};
+
+/// \brief Return V, already checked to be of type T, as a native value
+template <typename T> T nativeValue(const BasicValue &V) {
+  if (V.isArray()) {
+    RuntimeError("compiled code can't keep an array where a " +
+        TypeToStr(NativeType<T>::Type) + " value is expected");
+  }
+  return NativeType<T>::get(V);
+}
+
+template <typename T> T assignNative(BasicValue V) {
+  BasicValue Variable(NativeType<T>::Type);
+  assignValue(Variable, std::move(V));
+  return nativeValue<T>(Variable);
+}
+
+template <typename T> T initializeNative(BasicValue V, const char *Name) {
+  coerceInitializer(Name, NativeType<T>::Type, V);
+  return nativeValue<T>(V);
+}
+
+template <typename T>
+T argumentNative(BasicValue V, const char *Function, const char *Param) {
+  coerceArgument(Function, Param, NativeType<T>::Type, V);
+  return nativeValue<T>(V);
+}
+
+template <typename T>
+T returnNative(const BasicValue &V, const char *Function) {
+  checkReturnValue(Function, NativeType<T>::Type, V);
+  return nativeValue<T>(V);
+}
+
+inline BasicValue initialized(BasicValue V, const char *Name,
+                              BasicType Type) {
+  coerceInitializer(Name, Type, V);
+  return V;
+}
+
+inline BasicValue coercedArgument(BasicValue V, const char *Function,
+                                  const char *Param, BasicType Type) {
+  coerceArgument(Function, Param, Type, V);
+  return V;
+}
+
+inline BasicValue checkedReturn(BasicValue V, const char *Function,
+                                BasicType Type) {
+  checkReturnValue(Function, Type, V);
+  return V;
+}
+
+inline BasicValue infixOpValue(BasicValue V) {
+  checkInfixOpValue(V);
+  return V;
+}
+
+inline void checkDeclared(bool Declared, const char *Name) {
+  if (!Declared)
+    RuntimeError("variable `" + std::string(Name) + "' is undefined");
+}
+
+inline BasicValue loadElement(const BasicValue &Base,
+                              const BasicValue &Index) {
+  return Base.getElement(checkIndex(Base, Index));
+}
+
+inline bool truth(int V) { return V != 0; }
+inline bool truth(double V) { return V != 0.0; }
+inline bool truth(bool V) { return V; }
+inline bool truth(const BasicValue &V) { return V.toBool(); }
+
+inline int divideInt(int L, int R) {
+  if (R == 0)
+    RuntimeError("int division by zero");
+  return L / R;
+}
+
+inline int moduloInt(int L, int R) {
+  if (R == 0)
+    RuntimeError("int modulo by zero");
+  return L % R;
+}
+
+inline BasicValue callNative(NativeFunction F) {
+  return F(ArgumentList(nullptr, nullptr));
+}
+
+template <typename... Ts>
+BasicValue callNative(NativeFunction F, Ts &&... Args) {
+  BasicValue Values[] = {BasicValue(std::forward<Ts>(Args))...};
+  return F(ArgumentList(Values, Values + sizeof...(Ts)));
+}
+}
+
+#endif // !RUNTIME_H
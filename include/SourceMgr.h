@@ -8,7 +8,6 @@
 #ifndef SOURCEMGR_H
 #define SOURCEMGR_H
 
-#include <fstream>
 #include <string>
 #include <vector>
 #include <tuple>
@@ -23,37 +22,44 @@ public:
   using ErrorTy = std::tuple<LocTy, ErrorKind, std::string>;
 
 private:
-  static const size_t ReservedLineNo = 120;
-  std::ifstream SourceStream;
+  /// The source is mapped read-only where mmap is available, and read into
+  /// ReadBuffer with a single read otherwise; either way the lexer reads it
+  /// in place between BufferStart and BufferEnd.
+  const char *BufferStart;
+  const char *BufferEnd;
+  void *MappedBase;
+  size_t MappedSize;
+  std::string ReadBuffer;
   std::vector<LocTy> LineNoOffsets;
   std::vector<ErrorTy> ErrorList;
-  std::string SourceContent;
-  LocTy CurrentLoc;
+  /// Errors and warnings reported so far, dumped or not.
+  size_t DiagnosticCount;
   bool DumpInstantly : 1;
 
+  bool mapFile(const std::string &SourcePath);
+  bool readFile(const std::string &SourcePath);
+  void buildLineTable();
   void dumpError(LocTy L, ErrorKind K, const std::string &Msg) const;
 
 public:
   SourceMgr(const std::string &SourcePath,
                 bool DumpInstantly = true);
+  SourceMgr(const SourceMgr &) = delete;
+  SourceMgr &operator=(const SourceMgr &) = delete;
+  ~SourceMgr();
 
-  /// Functions that simulate member functions of std::fstream
-  bool fail() const { return SourceStream.fail(); };
-  int get();
-  int peek();
-  void unget();
-  LocTy getLoc() { return CurrentLoc; }
-  void seekLoc(LocTy Loc) { CurrentLoc = Loc; }
+  const char *getBufferStart() const { return BufferStart; }
+  const char *getBufferEnd() const { return BufferEnd; }
+  size_t getBufferSize() const { return BufferEnd - BufferStart; }
 
   void Error(LocTy L, const std::string &Msg);
-  void Error(const std::string &Msg);
   void Warning(LocTy L, const std::string &Msg);
-  void Warning(const std::string &Msg);
+  size_t getDiagnosticCount() const { return DiagnosticCount; }
 
   std::pair<size_t, size_t> getLineColByLoc(LocTy Loc) const;
 
   // for debug
-  void dumpFile();
+  void dumpFile() const;
 };
 
 }
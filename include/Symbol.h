@@ -0,0 +1,56 @@
+#ifndef SYMBOL_H
+#define SYMBOL_H
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <ostream>
+#include <string>
+
+namespace cmm {
+/// \brief An interned identifier.
+///
+/// The lexer enters every identifier and infix operator into one process wide
+/// table, which keeps each distinct name once and hands out its index. AST
+/// nodes, frame layouts and the tables of the front end hold that index, so
+/// names are compared and hashed as integers and take four bytes. Symbols are
+/// ordered by when they were first interned, not by name. The default Symbol
+/// is the empty name.
+class Symbol {
+  uint32_t ID;
+
+  explicit Symbol(uint32_t ID) : ID(ID) {}
+
+public:
+  Symbol() : ID(0) {}
+
+  /// \brief Return the symbol of the Len characters at Name, entering it
+  /// into the table the first time
+  static Symbol intern(const char *Name, size_t Len);
+  static Symbol intern(const std::string &Name) {
+    return intern(Name.data(), Name.size());
+  }
+  /// \brief Return the symbol of a value getID() returned
+  static Symbol getFromID(uint32_t ID) { return Symbol(ID); }
+
+  const std::string &str() const;
+  uint32_t getID() const { return ID; }
+  bool empty() const { return ID == 0; }
+
+  bool operator==(Symbol RHS) const { return ID == RHS.ID; }
+  bool operator!=(Symbol RHS) const { return ID != RHS.ID; }
+  bool operator<(Symbol RHS) const { return ID < RHS.ID; }
+};
+
+inline std::ostream &operator<<(std::ostream &OS, Symbol S) {
+  return OS << S.str();
+}
+}
+
+namespace std {
+template <> struct hash<cmm::Symbol> {
+  size_t operator()(cmm::Symbol S) const { return S.getID(); }
+};
+}
+
+#endif // !SYMBOL_H
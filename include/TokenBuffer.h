@@ -0,0 +1,90 @@
+#ifndef TOKENBUFFER_H
+#define TOKENBUFFER_H
+
+#include "CMMLexer.h"
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace cmm {
+/// \brief A lexed token: its kind, where it starts and, for tokens with a
+/// value, what it is.
+///
+/// An Integer or Boolean token keeps its value in Value, and an Identifier or
+/// InfixOp token the ID of its symbol. A String token keeps an index into the
+/// string table of its TokenBuffer, and a Double token an index into the
+/// double table.
+struct LexedToken {
+  Token::TokenKind Kind;
+  uint32_t Value;
+  SourceMgr::LocTy Loc;
+
+  bool is(Token::TokenKind K) const { return Kind == K; }
+  bool isNot(Token::TokenKind K) const { return Kind != K; }
+};
+
+/// \brief The tokens of a source file, which the parser reads with any
+/// lookahead it needs.
+///
+/// Every token is lexed once, when the parser first reaches or looks at it,
+/// and kept afterwards; lexer diagnostics therefore appear in the same order
+/// as the parser's. Going back is a matter of moving an index.
+class TokenBuffer {
+public:
+  using LocTy = SourceMgr::LocTy;
+
+private:
+  CMMLexer Lexer;
+  std::vector<LexedToken> Tokens;
+  std::vector<std::string> Strings;
+  std::vector<double> Doubles;
+  /// Index of the current token in Tokens.
+  size_t Current;
+
+  void lexNext();
+  const LexedToken &getCurrent() const { return Tokens[Current]; }
+
+public:
+  TokenBuffer(SourceMgr &SrcMgr) : Lexer(SrcMgr), Current(0) {}
+
+  /// Move to the next token, the first one on the first call. Stay on the
+  /// Eof token once it is reached.
+  Token Lex();
+
+  /// \brief Return the token N tokens after the current one
+  const LexedToken &lookAhead(size_t N);
+
+  /// Getters of the current token
+  Token getTok() const { return getCurrent().Kind; }
+  Token::TokenKind getKind() const { return getCurrent().Kind; }
+  LocTy getLoc() const { return getCurrent().Loc; }
+  const std::string &getStrVal() const {
+    return Strings[getCurrent().Value];
+  }
+  Symbol getSymbolVal() const { return Symbol::getFromID(getCurrent().Value); }
+  int getIntVal() const { return static_cast<int>(getCurrent().Value); }
+  double getDoubleVal() const { return Doubles[getCurrent().Value]; }
+  bool getBoolVal() const { return getCurrent().Value != 0; }
+
+  bool is(Token::TokenKind K) const { return getKind() == K; }
+  bool isNot(Token::TokenKind K) const { return getKind() != K; }
+  bool isOneOf(Token::TokenKind K1, Token::TokenKind K2) const {
+    return is(K1) || is(K2);
+  }
+  template <typename... Ts>
+  bool isOneOf(Token::TokenKind K1, Token::TokenKind K2, Ts... Ks) const {
+    return is(K1) || isOneOf(K2, Ks...);
+  }
+
+  bool Error(LocTy ErrorLoc, const std::string &Msg) {
+    return Lexer.Error(ErrorLoc, Msg);
+  }
+  bool Error(const std::string &Msg) { return Error(getLoc(), Msg); }
+  void Warning(LocTy ErrorLoc, const std::string &Msg) {
+    Lexer.Warning(ErrorLoc, Msg);
+  }
+  void Warning(const std::string &Msg) { Warning(getLoc(), Msg); }
+};
+}
+
+#endif // !TOKENBUFFER_H
@@ -0,0 +1,99 @@
+#ifndef TYPECHECKER_H
+#define TYPECHECKER_H
+
+#include "AST.h"
+#include "ProgramWalker.h"
+#include <map>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace cmm {
+/// \brief Infer the static type of every expression, report the type errors
+/// the program is bound to hit, and mark the run time checks it can't hit.
+///
+/// Runs after the resolver and the constant propagator. A static type is the
+/// cvm::BasicType of every value an expression may yield; an array has the
+/// type of its elements. Literals, operators, variables and parameters have
+/// one, and so do calls to functions that always leave through a return
+/// statement, since their value is checked against the declared type, and
+/// calls to natives that always return one type (len, sqrt, tostring...).
+/// Infix operator operands, other natives and names looked up at run time
+/// don't: a read that isn't bound, one in a dynamically bound callee
+/// (`foo!()`) that goes past the callee's own frames, or one of a name that
+/// some declaration not directly in a block may redeclare.
+///
+/// An initializer, assignment, argument or return value of a known type that
+/// the runtime would reject is reported, as is an operator whose operand
+/// types it would reject, even in code that never runs. Those that match are
+/// marked for the tree walker to store without checking, and arithmetic,
+/// relational and bitwise operators on proven numbers are quickened ahead of
+/// time.
+class TypeChecker : ProgramWalker {
+  SourceMgr &SrcMgr;
+  BlockAST &TopLevelBlock;
+  std::map<Symbol, FunctionDefinitionAST> &FunctionDefinition;
+  std::map<Symbol, InfixOpDefinitionAST> &InfixOpDefinition;
+
+  typedef std::pair<const FrameLayout *, int> VariableKey;
+  struct VariableInfo {
+    cvm::BasicType Type;
+    /// Declared with different types, or somewhere that isn't a block.
+    bool Ambiguous;
+  };
+
+  std::map<VariableKey, VariableInfo> Variables;
+  /// Names declared somewhere that isn't directly in a block.
+  std::set<Symbol> LooseNames;
+  std::set<const FunctionDefinitionAST *> DynamicCallees;
+  /// Functions that always return through a return statement.
+  std::set<const FunctionDefinitionAST *> ExplicitReturns;
+  /// Type errors found so far, reported in source order once all are found.
+  std::vector<std::pair<CMMLexer::LocTy, std::string>> Errors;
+
+  /// State of the code being walked.
+  FunctionDefinitionAST *Function;
+  const InfixOpDefinitionAST *InfixOp;
+  /// Whether every return statement of Function was proven so far.
+  bool ReturnsProven;
+
+public:
+  TypeChecker(SourceMgr &SrcMgr, BlockAST &TopLevelBlock,
+              std::map<Symbol, FunctionDefinitionAST> &F,
+              std::map<Symbol, InfixOpDefinitionAST> &I)
+      : SrcMgr(SrcMgr), TopLevelBlock(TopLevelBlock), FunctionDefinition(F),
+        InfixOpDefinition(I), Function(nullptr), InfixOp(nullptr),
+        ReturnsProven(false) {}
+
+  /// Return true if the program has a type error.
+  bool check();
+
+private:
+  void collect();
+  void enterFunction(const FunctionDefinitionAST &F) override;
+  void leaveFunction(const FunctionDefinitionAST &F) override;
+  void visitDeclaration(const DeclarationAST *Decl, bool InBlock) override;
+  void visitExpression(const ExpressionAST *Expr) override;
+  void addVariable(const FrameLayout *Layout, int Slot, cvm::BasicType Type,
+                   bool Ambiguous);
+
+  void reportError(CMMLexer::LocTy Loc, const std::string &Msg);
+
+  void checkStatement(StatementAST *Stmt);
+  void checkDeclaration(DeclarationAST *Decl);
+  void checkReturn(ReturnStatementAST *Stmt);
+  void checkExpression(ExpressionAST *Expr);
+  void checkIdentifier(IdentifierAST *IdExpr);
+  void checkFunctionCall(FunctionCallAST *FuncCall);
+  void checkNativeCall(FunctionCallAST *FuncCall);
+  void checkBinaryOperator(BinaryOperatorAST *Expr);
+  void checkAssignment(BinaryOperatorAST *Expr);
+  void checkUnaryOperator(UnaryOperatorAST *Expr);
+
+  static bool returnsExplicitly(const StatementAST *Stmt);
+  static bool mayBreak(const StatementAST *Stmt);
+};
+}
+
+#endif // !TYPECHECKER_H
@@ -1,172 +1,75 @@
 #include "AST.h"
-#include <numeric>
 #include <cmath>
 #include <limits>
 
-namespace cvm {
-
-std::string TypeToStr(BasicType Type) {
-  switch (Type) {
-  case BoolType:    return "bool";
-  case IntType:     return "int";
-  case DoubleType:  return "double";
-  case StringType:  return "string";
-  case VoidType:    return "void";
-  default:          return "T";
-  }
-}
-
-// Constructors and member functions of BasicValue
-BasicValue::BasicValue(BasicType T) : Type(T) {
-  switch (Type) {
-  default: break;
-  case cvm::BoolType:   BoolVal = false;  break;
-  case cvm::IntType:    IntVal = 0;       break;
-  case cvm::DoubleType: DoubleVal = 0.0;  break;
-  }
-}
-
-BasicValue::BasicValue(BasicType T, const std::list<int> &DimensionList)
-    : BasicValue(T, DimensionList.cbegin(), DimensionList.cend()) {}
-
-BasicValue::BasicValue(BasicType T,
-                       std::list<int>::const_iterator I,
-                       std::list<int>::const_iterator E) : BasicValue(T) {
-  if (I == E)
-    return;
-
-  int N = *I++;
-  ArrayPtr = std::make_shared<std::vector<BasicValue>>();
-  ArrayPtr->reserve(N);
-  for (size_t Idx = 0; Idx < N; ++Idx)
-    ArrayPtr->emplace_back(T, I, E);
-}
-
-BasicValue::BasicValue(BasicType T,
-                       std::shared_ptr<std::vector<BasicValue>> P)
-    : Type(T), ArrayPtr(P) {}
-
-int BasicValue::toInt() const {
-  switch (Type) {
-  default:          return 0;
-  case IntType:     return IntVal;
-  case DoubleType:  return static_cast<int>(DoubleVal);
-  case BoolType:    return BoolVal;
-  case StringType:  return std::stoi(StrVal);
-  }
-}
-
-double BasicValue::toDouble() const {
-  switch (Type) {
-  default:          return 0.0;
-  case IntType:     return static_cast<double>(IntVal);
-  case DoubleType:  return DoubleVal;
-  case BoolType:    return static_cast<double>(BoolVal);
-  case StringType:  return std::stod(StrVal.c_str());
-  }
-}
-
-bool BasicValue::toBool() const {
-  switch (Type) {
-  default:          return false;
-  case IntType:     return IntVal != 0;
-  case DoubleType:  return DoubleVal != 0.0;
-  case BoolType:    return BoolVal;
-  case StringType:  return !StrVal.empty();
-  }
-}
-
-std::string BasicValue::toString(decltype(ArrayPtr) P) const {
-  if (isArray()) {
-    if (P == ArrayPtr)
-      return "[...]";
-
-    if (P == nullptr)
-      P = ArrayPtr;
-
-    return "[" +
-        std::accumulate(ArrayPtr->begin() + 1,
-                        ArrayPtr->end(),
-                        ArrayPtr->front().toString(P),
-                        [P](std::string S, BasicValue &X) {
-                          return S + ", " + X.toString(P);
-                        }) + "]";
-  }
-
-  switch (Type) {
-  default:          return "";
-  case IntType:     return std::to_string(IntVal);
-  case DoubleType:  return std::to_string(DoubleVal);
-  case BoolType:    return BoolVal ? "true" : "false";
-  case StringType:  return StrVal;
-  }
-}
-
-bool BasicValue::operator<(const BasicValue &RHS) const {
-  if (Type != RHS.Type)
-    return false;
-  switch (Type) {
-  case BoolType:
-    return !BoolVal && RHS.BoolVal;
-  case IntType:
-    return IntVal < RHS.IntVal;
-  case DoubleType:
-    return DoubleVal < RHS.DoubleVal;
-  case StringType:
-    return StrVal < RHS.StrVal;
-  default:
-    return false;
-  }
-}
-
-bool BasicValue::operator<=(const BasicValue &RHS) const {
-  return *this < RHS || *this == RHS;
-}
-
-bool BasicValue::operator==(const BasicValue &RHS) const {
-  if (Type != RHS.Type)
-    return false;
-  switch (Type) {
-  case BoolType:
-    return BoolVal == RHS.BoolVal;
-  case IntType:
-    return IntVal == RHS.IntVal;
-  case DoubleType:
-    return DoubleVal == RHS.DoubleVal;
-  case StringType:
-    return StrVal == RHS.StrVal;
-  case VoidType:
-    return true;
-  default:
-    return false;
-  }
-}
+namespace cmm {
 
-bool BasicValue::operator!=(const BasicValue &RHS) const {
-  return !(*this == RHS);
+int FrameLayout::findSlot(Symbol Name) const {
+  for (size_t Slot = 0; Slot < SlotNames.size(); ++Slot)
+    if (SlotNames[Slot] == Name)
+      return static_cast<int>(Slot);
+  return -1;
 }
 
-bool BasicValue::operator>(const BasicValue &RHS) const {
-  return RHS < *this;
+int FrameLayout::addSlot(Symbol Name) {
+  int Slot = findSlot(Name);
+  return Slot >= 0 ? Slot : appendSlot(Name);
 }
 
-bool BasicValue::operator>=(const BasicValue &RHS) const {
-  // L >= R  <===>  not L < R;
-  return !(*this < RHS);
+int FrameLayout::appendSlot(Symbol Name) {
+  SlotNames.push_back(Name);
+  return static_cast<int>(SlotNames.size() - 1);
 }
-}
-
-/******************************************************************************/
-
-namespace cmm {
 
 // bool BinaryOperatorAST::isLogical() const {
 //   return getOpKind() == LogicalAnd || getOpKind() == LogicalOr;
 // }
 
-std::unique_ptr<ExpressionAST> BinaryOperatorAST::create(
-    Token::TokenKind TokenKind,
-    std::unique_ptr<ExpressionAST> LHS, std::unique_ptr<ExpressionAST> RHS) {
+BinaryOperatorAST::QuickKind
+BinaryOperatorAST::getIntQuickKind(OperatorKind OpKind) {
+  switch (OpKind) {
+  default:           return Generic;
+  case Add:          return IntAdd;
+  case Minus:        return IntMinus;
+  case Multiply:     return IntMultiply;
+  case Division:     return IntDivision;
+  case Modulo:       return IntModulo;
+  case Less:         return IntLess;
+  case LessEqual:    return IntLessEqual;
+  case Equal:        return IntEqual;
+  case NotEqual:     return IntNotEqual;
+  case Greater:      return IntGreater;
+  case GreaterEqual: return IntGreaterEqual;
+  case BitwiseAnd:   return IntBitwiseAnd;
+  case BitwiseOr:    return IntBitwiseOr;
+  case BitwiseXor:   return IntBitwiseXor;
+  case LeftShift:    return IntLeftShift;
+  case RightShift:   return IntRightShift;
+  }
+}
+
+BinaryOperatorAST::QuickKind
+BinaryOperatorAST::getDoubleQuickKind(OperatorKind OpKind) {
+  switch (OpKind) {
+  default:           return Generic;
+  case Add:          return DoubleAdd;
+  case Minus:        return DoubleMinus;
+  case Multiply:     return DoubleMultiply;
+  case Division:     return DoubleDivision;
+  case Less:         return DoubleLess;
+  case LessEqual:    return DoubleLessEqual;
+  case Equal:        return DoubleEqual;
+  case NotEqual:     return DoubleNotEqual;
+  case Greater:      return DoubleGreater;
+  case GreaterEqual: return DoubleGreaterEqual;
+  }
+}
+
+ExpressionAST *BinaryOperatorAST::create(ASTArena &Arena,
+                                         Token::TokenKind TokenKind,
+                                         ExpressionAST *LHS,
+                                         ExpressionAST *RHS,
+                                         CMMLexer::LocTy Loc) {
 
   BinaryOperatorAST::OperatorKind OpKind;
   switch (TokenKind) {
@@ -191,20 +94,16 @@ std::unique_ptr<ExpressionAST> BinaryOperatorAST::create(
   case Token::GreaterGreater: OpKind = BinaryOperatorAST::RightShift; break;
   case Token::Equal:          OpKind = BinaryOperatorAST::Assign; break;
   }
-  return std::unique_ptr<ExpressionAST>(new BinaryOperatorAST(OpKind,
-                                                              std::move(LHS),
-                                                              std::move(RHS)));
+  return Arena.create<BinaryOperatorAST>(OpKind, LHS, RHS, Loc);
 }
 
-std::unique_ptr<StatementAST>
-IfStatementAST::create(std::unique_ptr<ExpressionAST> Condition,
-                       std::unique_ptr<StatementAST> StatementThen,
-                       std::unique_ptr<StatementAST> StatementElse) {
+StatementAST *
+IfStatementAST::create(ASTArena &Arena, ExpressionAST *Condition,
+                       StatementAST *StatementThen,
+                       StatementAST *StatementElse) {
   if (!Condition->isConstant()) {
-    auto *IfStmt = new IfStatementAST(std::move(Condition),
-                                      std::move(StatementThen),
-                                      std::move(StatementElse));
-    return std::unique_ptr<StatementAST>(IfStmt);
+    return Arena.create<IfStatementAST>(Condition, StatementThen,
+                                        StatementElse);
   }
 
   if (Condition->asBool())
@@ -217,19 +116,16 @@ IfStatementAST::create(std::unique_ptr<ExpressionAST> Condition,
   return nullptr;
 }
 
-std::unique_ptr<StatementAST>
-WhileStatementAST::create(std::unique_ptr<ExpressionAST> Condition,
-                          std::unique_ptr<StatementAST> Statement) {
+StatementAST *
+WhileStatementAST::create(ASTArena &Arena, ExpressionAST *Condition,
+                          StatementAST *Statement) {
   if (!Condition->isConstant()) {
-    auto *WhileStmt = new WhileStatementAST(std::move(Condition),
-                                            std::move(Statement));
-    return std::unique_ptr<StatementAST>(WhileStmt);
+    return Arena.create<WhileStatementAST>(Condition, Statement);
   }
 
   // Forever
   if (Condition->asBool()) {
-    auto *WhileStmt = new WhileStatementAST(nullptr,std::move(Statement));
-    return std::unique_ptr<StatementAST>(WhileStmt);
+    return Arena.create<WhileStatementAST>(nullptr, Statement);
   }
 
   // Never
@@ -237,30 +133,24 @@ WhileStatementAST::create(std::unique_ptr<ExpressionAST> Condition,
 }
 
 
-std::unique_ptr<StatementAST>
-ForStatementAST::create(std::unique_ptr<ExpressionAST> Init,
-                        std::unique_ptr<ExpressionAST> Condition,
-                        std::unique_ptr<ExpressionAST> Post,
-                        std::unique_ptr<StatementAST> Statement) {
+StatementAST *
+ForStatementAST::create(ASTArena &Arena, ExpressionAST *Init,
+                        ExpressionAST *Condition,
+                        ExpressionAST *Post,
+                        StatementAST *Statement) {
 
   if (Condition == nullptr || !Condition->isConstant()) {
-    auto *ForStmt = new ForStatementAST(std::move(Init), std::move(Condition),
-                                        std::move(Post), std::move(Statement));
-    return std::unique_ptr<StatementAST>(ForStmt);
+    return Arena.create<ForStatementAST>(Init, Condition, Post, Statement);
   }
 
   // Forever
   if (Condition->asBool()) {
-    auto *ForStmt = new ForStatementAST(std::move(Init), nullptr,
-                                        std::move(Post), std::move(Statement));
-    return std::unique_ptr<StatementAST>(ForStmt);
+    return Arena.create<ForStatementAST>(Init, nullptr, Post, Statement);
   }
 
   // Never
-  if (Init) {
-    auto *ExprStmt = new ExprStatementAST(std::move(Init));
-    return std::unique_ptr<StatementAST>(ExprStmt);
-  }
+  if (Init)
+    return Arena.create<ExprStatementAST>(Init);
   return nullptr;
 }
 
@@ -325,17 +215,51 @@ std::string ExpressionAST::asString() const {
   }
 }
 
-std::unique_ptr<ExpressionAST>
-BinaryOperatorAST::tryFoldBinOp(Token::TokenKind TokenKind,
-                                std::unique_ptr<ExpressionAST> LHS,
-                                std::unique_ptr<ExpressionAST> RHS) {
+bool ExpressionAST::mayHaveSideEffects() const {
+  switch (getKind()) {
+  default:
+    return false;
+  case FunctionCallExpression:
+  case InfixOpExpression:
+    return true;
+  case BinaryOperatorExpression: {
+    auto *BinOpExpr = as_cptr<BinaryOperatorAST>();
+    return BinOpExpr->getOpKind() == BinaryOperatorAST::Assign ||
+        BinOpExpr->getLHS()->mayHaveSideEffects() ||
+        BinOpExpr->getRHS()->mayHaveSideEffects();
+  }
+  case UnaryOperatorExpression:
+    return as_cptr<UnaryOperatorAST>()->getOperand()->mayHaveSideEffects();
+  }
+}
+
+bool StatementAST::returnsInTail() const {
+  switch (Kind) {
+  default:
+    return false;
+  case ExprStatement:
+  case BlockStatement:
+  case ReturnStatement:
+  case BreakStatement:
+  case ContinueStatement:
+    return true;
+  case IfStatement:
+    return as_cptr<IfStatementAST>()->getStatementElse() != nullptr;
+  }
+}
+
+ExpressionAST *
+BinaryOperatorAST::tryFoldBinOp(ASTArena &Arena,
+                                Token::TokenKind TokenKind,
+                                ExpressionAST *LHS,
+                                ExpressionAST *RHS,
+                                CMMLexer::LocTy Loc) {
   if (!LHS->isConstant() || !RHS->isConstant()) {
-    return BinaryOperatorAST::create(TokenKind, std::move(LHS), std::move(RHS));
+    return BinaryOperatorAST::create(Arena, TokenKind, LHS, RHS, Loc);
   }
 
   if (TokenKind == Token::Plus && (LHS->isString() || RHS->isString())) {
-    return std::unique_ptr<ExpressionAST>(new StringAST(LHS->asString() +
-        RHS->asString()));
+    return Arena.create<StringAST>(LHS->asString() + RHS->asString());
   }
 
   switch (TokenKind) {
@@ -346,34 +270,36 @@ BinaryOperatorAST::tryFoldBinOp(Token::TokenKind TokenKind,
   case Token::Minus:
   case Token::Star:
   case Token::Percent:
-    return tryFoldBinOpArith(TokenKind, std::move(LHS), std::move(RHS));
+    return tryFoldBinOpArith(Arena, TokenKind, LHS, RHS, Loc);
   case Token::AmpAmp:
   case Token::PipePipe:
-    return tryFoldBinOpLogic(TokenKind, std::move(LHS), std::move(RHS));
+    return tryFoldBinOpLogic(Arena, TokenKind, LHS, RHS, Loc);
   case Token::Less:
   case Token::LessEqual:
   case Token::EqualEqual:
   case Token::ExclaimEqual:
   case Token::GreaterEqual:
   case Token::Greater:
-    return tryFoldBinOpRelation(TokenKind, std::move(LHS), std::move(RHS));
+    return tryFoldBinOpRelation(Arena, TokenKind, LHS, RHS, Loc);
   case Token::Amp:
   case Token::Pipe:
   case Token::Caret:
   case Token::LessLess:
   case Token::GreaterGreater:
-    return tryFoldBinOpBitwise(TokenKind, std::move(LHS), std::move(RHS));
+    return tryFoldBinOpBitwise(Arena, TokenKind, LHS, RHS, Loc);
   case Token::Equal:
     break;
   }
 
-  return create(TokenKind, std::move(LHS), std::move(RHS));
+  return create(Arena, TokenKind, LHS, RHS, Loc);
 }
 
-std::unique_ptr<ExpressionAST>
-BinaryOperatorAST::tryFoldBinOpArith(Token::TokenKind TokenKind,
-                                     std::unique_ptr<ExpressionAST> LHS,
-                                     std::unique_ptr<ExpressionAST> RHS) {
+ExpressionAST *
+BinaryOperatorAST::tryFoldBinOpArith(ASTArena &Arena,
+                                     Token::TokenKind TokenKind,
+                                     ExpressionAST *LHS,
+                                     ExpressionAST *RHS,
+                                     CMMLexer::LocTy Loc) {
 
   if (LHS->isInt() && RHS->isInt()) {
     int Value;
@@ -392,7 +318,7 @@ BinaryOperatorAST::tryFoldBinOpArith(Token::TokenKind TokenKind,
       Value = R == 0 ? 0 : L % R;
       break;
     }
-    return std::unique_ptr<ExpressionAST>(new IntAST(Value));
+    return Arena.create<IntAST>(Value);
   }
 
   if (LHS->isNumeric() || RHS->isNumeric()) {
@@ -408,18 +334,20 @@ BinaryOperatorAST::tryFoldBinOpArith(Token::TokenKind TokenKind,
     case Token::Slash:    Value = L / R;  break;
     case Token::Percent:  Value = std::fmod(L, R); break;
     }
-    return std::unique_ptr<ExpressionAST>(new DoubleAST(Value));
+    return Arena.create<DoubleAST>(Value);
   }
-  return BinaryOperatorAST::create(TokenKind, std::move(LHS), std::move(RHS));
+  return BinaryOperatorAST::create(Arena, TokenKind, LHS, RHS, Loc);
 }
 
 
 /// \brief Fold two expression for logicalAnd and logicalOr
 /// LHS and RHS should be constantExpr
-std::unique_ptr<ExpressionAST>
-BinaryOperatorAST::tryFoldBinOpLogic(Token::TokenKind TokenKind,
-                                     std::unique_ptr<ExpressionAST> LHS,
-                                     std::unique_ptr<ExpressionAST> RHS) {
+ExpressionAST *
+BinaryOperatorAST::tryFoldBinOpLogic(ASTArena &Arena,
+                                     Token::TokenKind TokenKind,
+                                     ExpressionAST *LHS,
+                                     ExpressionAST *RHS,
+                                     CMMLexer::LocTy) {
   bool Value;
 
   switch (TokenKind) {
@@ -428,17 +356,19 @@ BinaryOperatorAST::tryFoldBinOpLogic(Token::TokenKind TokenKind,
   case Token::PipePipe:   Value = LHS->asBool() || RHS->asBool(); break;
   }
 
-  return std::unique_ptr<ExpressionAST>(new BoolAST(Value));
+  return Arena.create<BoolAST>(Value);
 }
 
-std::unique_ptr<ExpressionAST>
-BinaryOperatorAST::tryFoldBinOpRelation(Token::TokenKind TokenKind,
-                                        std::unique_ptr<ExpressionAST> LHS,
-                                        std::unique_ptr<ExpressionAST> RHS) {
+ExpressionAST *
+BinaryOperatorAST::tryFoldBinOpRelation(ASTArena &Arena,
+                                        Token::TokenKind TokenKind,
+                                        ExpressionAST *LHS,
+                                        ExpressionAST *RHS,
+                                        CMMLexer::LocTy Loc) {
 
 #define CASE(TOKEN_KIND, OPERATOR)                                             \
   case Token::TOKEN_KIND:                                                      \
-    return std::unique_ptr<BoolAST>(new BoolAST(L OPERATOR R))
+    return Arena.create<BoolAST>(L OPERATOR R)
 
 #define TRY_COMPARE(type, Type)                                                \
   do {                                                                         \
@@ -466,13 +396,15 @@ BinaryOperatorAST::tryFoldBinOpRelation(Token::TokenKind TokenKind,
 #undef CASE
 
   // TODO: Not very elegant, but this is ok.
-  return BinaryOperatorAST::create(TokenKind, std::move(LHS), std::move(RHS));
+  return BinaryOperatorAST::create(Arena, TokenKind, LHS, RHS, Loc);
 }
 
-std::unique_ptr<ExpressionAST>
-BinaryOperatorAST::tryFoldBinOpBitwise(Token::TokenKind TokenKind,
-                                       std::unique_ptr<ExpressionAST> LHS,
-                                       std::unique_ptr<ExpressionAST> RHS) {
+ExpressionAST *
+BinaryOperatorAST::tryFoldBinOpBitwise(ASTArena &Arena,
+                                       Token::TokenKind TokenKind,
+                                       ExpressionAST *LHS,
+                                       ExpressionAST *RHS,
+                                       CMMLexer::LocTy Loc) {
   if (LHS->isInt() && RHS->isInt()) {
     int L = LHS->as_cptr<IntAST>()->getValue();
     int R = RHS->as_cptr<IntAST>()->getValue();
@@ -480,25 +412,25 @@ BinaryOperatorAST::tryFoldBinOpBitwise(Token::TokenKind TokenKind,
     switch (TokenKind) {
     default:break;
     case Token::LessLess:
-      return std::unique_ptr<IntAST>(new IntAST(L << R));
+      return Arena.create<IntAST>(L << R);
     case Token::GreaterGreater:
-      return std::unique_ptr<IntAST>(new IntAST(L >> R));
+      return Arena.create<IntAST>(L >> R);
     case Token::Amp:
-      return std::unique_ptr<IntAST>(new IntAST(L & R));
+      return Arena.create<IntAST>(L & R);
     case Token::Pipe:
-      return std::unique_ptr<IntAST>(new IntAST(L | R));
+      return Arena.create<IntAST>(L | R);
     case Token::Caret:
-      return std::unique_ptr<IntAST>(new IntAST(L ^ R));
+      return Arena.create<IntAST>(L ^ R);
     }
   }
-  return BinaryOperatorAST::create(TokenKind, std::move(LHS), std::move(RHS));
+  return BinaryOperatorAST::create(Arena, TokenKind, LHS, RHS, Loc);
 }
 
 
 
-std::unique_ptr<ExpressionAST>
-UnaryOperatorAST::tryFoldUnaryOp(OperatorKind OpKind,
-                                 std::unique_ptr<ExpressionAST> Operand) {
+ExpressionAST *
+UnaryOperatorAST::tryFoldUnaryOp(ASTArena &Arena, OperatorKind OpKind,
+                                 ExpressionAST *Operand, CMMLexer::LocTy Loc) {
   if (Operand->isConstant()) {
     switch (OpKind) {
     default:
@@ -507,27 +439,24 @@ UnaryOperatorAST::tryFoldUnaryOp(OperatorKind OpKind,
       return Operand;
     case Minus:
       if (Operand->isInt()) {
-        return std::unique_ptr<ExpressionAST>(new IntAST(
-            -Operand->as_cptr<IntAST>()->getValue()));
+        return Arena.create<IntAST>(-Operand->as_cptr<IntAST>()->getValue());
       }
       if (Operand->isDouble()) {
-        return std::unique_ptr<ExpressionAST>(new DoubleAST(
-            -Operand->as_cptr<DoubleAST>()->getValue()));
+        return Arena.create<DoubleAST>(
+            -Operand->as_cptr<DoubleAST>()->getValue());
       }
       break;
     case BitwiseNot:
       if (Operand->isInt()) {
-        return std::unique_ptr<ExpressionAST>(new IntAST(
-            ~Operand->as_cptr<IntAST>()->getValue()));
+        return Arena.create<IntAST>(~Operand->as_cptr<IntAST>()->getValue());
       }
       break;
     case LogicalNot:
-      return std::unique_ptr<ExpressionAST>(new BoolAST(!Operand->asBool()));
+      return Arena.create<BoolAST>(!Operand->asBool());
     }
   }
 
-  return std::unique_ptr<ExpressionAST>(
-      new UnaryOperatorAST(OpKind, std::move(Operand)));
+  return Arena.create<UnaryOperatorAST>(OpKind, Operand, Loc);
 }
 
 void IntAST::dump(const std::string &prefix) const {
@@ -0,0 +1,27 @@
+#include "ASTArena.h"
+
+using namespace cmm;
+
+/// Bytes in a chunk, unless a single allocation needs more.
+static const size_t ChunkSize = 64 * 1024;
+
+void *ASTArena::allocateInNewChunk(size_t Size, size_t Align) {
+  // A large array gets a chunk of its own, and allocation goes on in the
+  // current chunk.
+  if (Size + Align > ChunkSize / 4) {
+    Chunks.emplace_back(new char[Size + Align]);
+    uintptr_t P = reinterpret_cast<uintptr_t>(Chunks.back().get());
+    P = (P + Align - 1) & ~static_cast<uintptr_t>(Align - 1);
+    return reinterpret_cast<void *>(P);
+  }
+
+  Chunks.emplace_back(new char[ChunkSize]);
+  Cur = Chunks.back().get();
+  End = Cur + ChunkSize;
+  return allocate(Size, Align);
+}
+
+ASTArena::~ASTArena() {
+  for (auto It = Destructors.rbegin(); It != Destructors.rend(); ++It)
+    It->Destroy(It->Object);
+}
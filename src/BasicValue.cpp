@@ -0,0 +1,278 @@
+#include "BasicValue.h"
+#include "CycleCollector.h"
+#include "Runtime.h"
+#include <numeric>
+#include <cmath>
+#include <limits>
+
+namespace cvm {
+
+std::string TypeToStr(BasicType Type) {
+  switch (Type) {
+  case BoolType:    return "bool";
+  case IntType:     return "int";
+  case DoubleType:  return "double";
+  case StringType:  return "string";
+  case VoidType:    return "void";
+  default:          return "T";
+  }
+}
+
+// Constructors and member functions of BasicValue
+BasicValue::BasicValue(std::string S)
+    : Type(StringType), Array(false), Depth(0), Offset(0), Bits(0) {
+  Str = nullptr;
+  if (!S.empty()) {
+    Str = new StringObject(std::move(S));
+    Str->RefCount = 1;
+  }
+}
+
+BasicValue::BasicValue(BasicType T)
+    : Type(T), Array(false), Depth(0), Offset(0), Bits(0) {
+  switch (Type) {
+  default:              Object = nullptr; break;
+  case cvm::BoolType:   BoolVal = false;  break;
+  case cvm::IntType:    IntVal = 0;       break;
+  case cvm::DoubleType: DoubleVal = 0.0;  break;
+  }
+}
+
+BasicValue::BasicValue(BasicType T, const std::list<int> &DimensionList)
+    : Type(T), Array(true), Depth(0), Offset(0), Bits(0) {
+  Arr = new ArrayObject(T, std::vector<int>(DimensionList.begin(),
+                                            DimensionList.end()));
+  Arr->RefCount = 1;
+}
+
+BasicValue::BasicValue(BasicType T, std::vector<BasicValue> Elements)
+    : Type(T), Array(true), Depth(0), Offset(0), Bits(0) {
+  Arr = new ArrayObject(T, {static_cast<int>(Elements.size())});
+  Arr->RefCount = 1;
+  Arr->box();
+  Arr->Values = std::move(Elements);
+}
+
+void BasicValue::destroyObject() {
+  if (Array)
+    delete Arr;
+  else
+    delete Str;
+}
+
+const std::string &BasicValue::getString() const {
+  static const std::string Empty;
+  return isBoxed() && !Array ? Str->Value : Empty;
+}
+
+int BasicValue::getArraySize() const {
+  return Arr->Shape[Depth];
+}
+
+BasicValue BasicValue::getElement(int I) const {
+  size_t Index = Offset + I * Arr->Strides[Depth];
+  if (Depth + 1u == Arr->Shape.size())
+    return Arr->load(Index);
+
+  BasicValue Sub(*this);
+  ++Sub.Depth;
+  Sub.Offset = static_cast<uint32_t>(Index);
+  return Sub;
+}
+
+void BasicValue::setElement(int I, const BasicValue &V) const {
+  Arr->store(Offset + static_cast<size_t>(I), V);
+}
+
+int BasicValue::toInt() const {
+  switch (Type) {
+  default:          return 0;
+  case IntType:     return getInt();
+  case DoubleType:  return static_cast<int>(getDouble());
+  case BoolType:    return getBool();
+  case StringType:  return std::stoi(getString());
+  }
+}
+
+double BasicValue::toDouble() const {
+  switch (Type) {
+  default:          return 0.0;
+  case IntType:     return static_cast<double>(getInt());
+  case DoubleType:  return getDouble();
+  case BoolType:    return static_cast<double>(getBool());
+  case StringType:  return std::stod(getString().c_str());
+  }
+}
+
+bool BasicValue::toBool() const {
+  switch (Type) {
+  default:          return false;
+  case IntType:     return getInt() != 0;
+  case DoubleType:  return getDouble() != 0.0;
+  case BoolType:    return getBool();
+  case StringType:  return !getString().empty();
+  }
+}
+
+std::string BasicValue::toString(const BasicValue *Outermost) const {
+  if (isArray()) {
+    if (Outermost && isSameArray(*Outermost))
+      return "[...]";
+
+    if (Outermost == nullptr)
+      Outermost = this;
+
+    std::string S = "[" + getElement(0).toString(Outermost);
+    for (int I = 1, E = getArraySize(); I < E; ++I)
+      S += ", " + getElement(I).toString(Outermost);
+    return S + "]";
+  }
+
+  switch (Type) {
+  default:          return "";
+  case IntType:     return std::to_string(IntVal);
+  case DoubleType:  return std::to_string(DoubleVal);
+  case BoolType:    return BoolVal ? "true" : "false";
+  case StringType:  return getString();
+  }
+}
+
+bool BasicValue::operator<(const BasicValue &RHS) const {
+  if (Type != RHS.Type)
+    return false;
+  switch (Type) {
+  case BoolType:
+    return !getBool() && RHS.getBool();
+  case IntType:
+    return getInt() < RHS.getInt();
+  case DoubleType:
+    return getDouble() < RHS.getDouble();
+  case StringType:
+    return getString() < RHS.getString();
+  default:
+    return false;
+  }
+}
+
+bool BasicValue::operator<=(const BasicValue &RHS) const {
+  return *this < RHS || *this == RHS;
+}
+
+bool BasicValue::operator==(const BasicValue &RHS) const {
+  if (Type != RHS.Type)
+    return false;
+  switch (Type) {
+  case BoolType:
+    return getBool() == RHS.getBool();
+  case IntType:
+    return getInt() == RHS.getInt();
+  case DoubleType:
+    return getDouble() == RHS.getDouble();
+  case StringType:
+    return getString() == RHS.getString();
+  case VoidType:
+    return true;
+  default:
+    return false;
+  }
+}
+
+bool BasicValue::operator!=(const BasicValue &RHS) const {
+  return !(*this == RHS);
+}
+
+bool BasicValue::operator>(const BasicValue &RHS) const {
+  return RHS < *this;
+}
+
+bool BasicValue::operator>=(const BasicValue &RHS) const {
+  // L >= R  <===>  not L < R;
+  return !(*this < RHS);
+}
+
+ArrayObject::ArrayObject(BasicType T, std::vector<int> Dims)
+    : ElementType(T), Shape(std::move(Dims)), Strides(Shape.size()),
+      Boxed(false), Tracked(false), Reachable(false), TrialRefCount(0),
+      PrevContainer(nullptr), NextContainer(nullptr) {
+  noteArrayAllocation();
+
+  // Elements are addressed by a 32-bit offset.
+  size_t Count = 1;
+  for (size_t I = Shape.size(); I-- > 0;) {
+    Strides[I] = Count;
+    if (Shape[I] && Count > UINT32_MAX / static_cast<size_t>(Shape[I])) {
+      RuntimeError("array of more than " + std::to_string(UINT32_MAX) +
+          " elements can't be allocated");
+    }
+    Count *= static_cast<size_t>(Shape[I]);
+  }
+
+  switch (ElementType) {
+  case IntType:     Ints.resize(Count);    break;
+  case DoubleType:  Doubles.resize(Count); break;
+  case BoolType:    Bools.resize(Count);   break;
+  default:
+    Boxed = true;
+    Values.resize(Count, BasicValue(ElementType));
+    break;
+  }
+}
+
+ArrayObject::~ArrayObject() {
+  if (Tracked)
+    untrackContainer(this);
+}
+
+size_t ArrayObject::getByteSize() const {
+  return sizeof(ArrayObject) + Shape.capacity() * sizeof(int) +
+      Strides.capacity() * sizeof(size_t) +
+      Ints.capacity() * sizeof(int32_t) + Doubles.capacity() * sizeof(double) +
+      Bools.capacity() * sizeof(uint8_t) +
+      Values.capacity() * sizeof(BasicValue);
+}
+
+BasicValue ArrayObject::load(size_t Index) const {
+  if (Boxed)
+    return Values[Index];
+
+  switch (ElementType) {
+  case IntType:     return static_cast<int>(Ints[Index]);
+  case DoubleType:  return Doubles[Index];
+  case BoolType:    return Bools[Index] != 0;
+  default:          return BasicValue();
+  }
+}
+
+void ArrayObject::store(size_t Index, const BasicValue &V) {
+  if (!Boxed && V.isArray())
+    box();
+
+  if (Boxed) {
+    Values[Index] = V;
+    if (V.isArray() && !Tracked)
+      trackContainer(this);
+    return;
+  }
+
+  switch (ElementType) {
+  case IntType:     Ints[Index] = V.getInt();       break;
+  case DoubleType:  Doubles[Index] = V.getDouble(); break;
+  case BoolType:    Bools[Index] = V.getBool();     break;
+  default:                                          break;
+  }
+}
+
+void ArrayObject::box() {
+  if (Boxed)
+    return;
+
+  size_t Count = Ints.size() + Doubles.size() + Bools.size();
+  Values.reserve(Count);
+  for (size_t I = 0; I < Count; ++I)
+    Values.push_back(load(I));
+  Boxed = true;
+  std::vector<int32_t>().swap(Ints);
+  std::vector<double>().swap(Doubles);
+  std::vector<uint8_t>().swap(Bools);
+}
+}
@@ -0,0 +1,161 @@
+#include "Bytecode.h"
+#include <iomanip>
+
+using namespace cmm;
+
+const char *Op::getOpcodeName(Opcode Code) {
+  switch (Code) {
+  default:              return "unknown";
+  case Const:           return "const";
+  case Pop:             return "pop";
+  case Dup2:            return "dup2";
+  case LoadLocal:       return "load.local";
+  case StoreLocal:      return "store.local";
+  case LoadGlobal:      return "load.global";
+  case StoreGlobal:     return "store.global";
+  case LoadName:        return "load.name";
+  case StoreName:       return "store.name";
+  case ClearSlots:      return "clear.slots";
+  case DeclCheck:       return "decl.check";
+  case DeclDim:         return "decl.dim";
+  case DeclArray:       return "decl.array";
+  case DeclInit:        return "decl.init";
+  case DeclDefault:     return "decl.default";
+  case CheckArray:      return "check.array";
+  case Index:           return "index";
+  case CheckElem:       return "check.elem";
+  case StoreElem:       return "store.elem";
+  case Plus:            return "plus";
+  case Negate:          return "neg";
+  case LogicalNot:      return "not";
+  case BitwiseNot:      return "bitnot";
+  case Add:             return "add";
+  case Minus:           return "sub";
+  case Multiply:        return "mul";
+  case Division:        return "div";
+  case Modulo:          return "mod";
+  case Less:            return "lt";
+  case LessEqual:       return "le";
+  case Equal:           return "eq";
+  case NotEqual:        return "ne";
+  case Greater:         return "gt";
+  case GreaterEqual:    return "ge";
+  case BitwiseAnd:      return "and";
+  case BitwiseOr:       return "or";
+  case BitwiseXor:      return "xor";
+  case LeftShift:       return "shl";
+  case RightShift:      return "shr";
+  case ToBool:          return "tobool";
+  case Jump:            return "jump";
+  case JumpIfFalse:     return "jump.false";
+  case JumpIfTrue:      return "jump.true";
+  case AndThen:         return "and.then";
+  case OrElse:          return "or.else";
+  case Call:            return "call";
+  case CallDynamic:     return "call.dynamic";
+  case CallNative:      return "call.native";
+  case CallInfixOp:     return "call.infix";
+  case Return:          return "ret";
+  case ReturnImplicit:  return "ret.implicit";
+  case ReturnVoid:      return "ret.void";
+  case Error:           return "error";
+  case Halt:            return "halt";
+  }
+}
+
+bool Op::hasExtraOperand(Opcode Code) {
+  switch (Code) {
+  default:
+    return false;
+  case ClearSlots:
+  case Call:
+  case CallDynamic:
+  case CallNative:
+    return true;
+  }
+}
+
+static std::string QuoteValue(const cvm::BasicValue &V) {
+  if (V.isString())
+    return "\"" + V.toString() + "\"";
+  return V.toString();
+}
+
+void BytecodeChunk::dump() const {
+  using std::cout;
+  static const char *KindName[] = { "toplevel", "function", "infix" };
+
+  cout << KindName[Kind] << " " << Name << " (slots: " << SlotNames.size()
+       << ", stack: " << MaxStack << ")\n";
+
+  for (size_t PC = 0; PC < Code.size(); ++PC) {
+    Op::Opcode Opc = getOpcode(Code[PC]);
+    uint32_t A = getOperand(Code[PC]);
+
+    cout << "  " << std::setw(5) << PC << "  "
+         << std::left << std::setw(14) << Op::getOpcodeName(Opc)
+         << std::right;
+
+    switch (Opc) {
+    default:
+      break;
+    case Op::Const:
+      cout << A << "  ; " << QuoteValue(Constants[A]);
+      break;
+    case Op::Error:
+      cout << A << "  ; " << Constants[A].toString();
+      break;
+    case Op::LoadLocal:
+    case Op::StoreLocal:
+      cout << A << "  ; " << SlotNames[A];
+      break;
+    case Op::LoadGlobal:
+    case Op::StoreGlobal:
+      cout << A;
+      break;
+    case Op::LoadName:
+    case Op::StoreName:
+      cout << A << "  ; " << Names[A];
+      break;
+    case Op::DeclCheck:
+    case Op::DeclDim:
+    case Op::DeclArray:
+    case Op::DeclInit:
+    case Op::DeclDefault:
+      cout << A << "  ; " << Decls[A].first->getName() << " @"
+           << Decls[A].second;
+      break;
+    case Op::Jump:
+    case Op::JumpIfFalse:
+    case Op::JumpIfTrue:
+    case Op::AndThen:
+    case Op::OrElse:
+    case Op::CallInfixOp:
+      cout << A;
+      break;
+    case Op::ClearSlots:
+    case Op::Call:
+    case Op::CallDynamic:
+    case Op::CallNative:
+      cout << A << ", " << Code[PC + 1];
+      break;
+    }
+    cout << "\n";
+
+    if (Op::hasExtraOperand(Opc))
+      ++PC;
+  }
+}
+
+void BytecodeProgram::dump() const {
+  std::cout << "natives:";
+  for (size_t I = 0; I < NativeNames.size(); ++I)
+    std::cout << " " << I << ":" << NativeNames[I];
+  std::cout << "\n\n";
+
+  for (size_t I = 0; I < Chunks.size(); ++I) {
+    std::cout << "chunk " << I << ": ";
+    Chunks[I].dump();
+    std::cout << "\n";
+  }
+}
@@ -0,0 +1,601 @@
+#include "BytecodeCompiler.h"
+
+using namespace cmm;
+
+static Op::Opcode BinaryOpcode(BinaryOperatorAST::OperatorKind OpKind) {
+  switch (OpKind) {
+  default:                              return Op::Error;
+  case BinaryOperatorAST::Add:          return Op::Add;
+  case BinaryOperatorAST::Minus:        return Op::Minus;
+  case BinaryOperatorAST::Multiply:     return Op::Multiply;
+  case BinaryOperatorAST::Division:     return Op::Division;
+  case BinaryOperatorAST::Modulo:       return Op::Modulo;
+  case BinaryOperatorAST::Less:         return Op::Less;
+  case BinaryOperatorAST::LessEqual:    return Op::LessEqual;
+  case BinaryOperatorAST::Equal:        return Op::Equal;
+  case BinaryOperatorAST::NotEqual:     return Op::NotEqual;
+  case BinaryOperatorAST::Greater:      return Op::Greater;
+  case BinaryOperatorAST::GreaterEqual: return Op::GreaterEqual;
+  case BinaryOperatorAST::BitwiseAnd:   return Op::BitwiseAnd;
+  case BinaryOperatorAST::BitwiseOr:    return Op::BitwiseOr;
+  case BinaryOperatorAST::BitwiseXor:   return Op::BitwiseXor;
+  case BinaryOperatorAST::LeftShift:    return Op::LeftShift;
+  case BinaryOperatorAST::RightShift:   return Op::RightShift;
+  }
+}
+
+static Op::Opcode UnaryOpcode(UnaryOperatorAST::OperatorKind OpKind) {
+  switch (OpKind) {
+  default:                            return Op::Error;
+  case UnaryOperatorAST::Plus:        return Op::Plus;
+  case UnaryOperatorAST::Minus:       return Op::Negate;
+  case UnaryOperatorAST::LogicalNot:  return Op::LogicalNot;
+  case UnaryOperatorAST::BitwiseNot:  return Op::BitwiseNot;
+  }
+}
+
+static bool IsLiteral(const ExpressionAST *Expr) {
+  switch (Expr->getKind()) {
+  default:
+    return false;
+  case ExpressionAST::IntExpression:
+  case ExpressionAST::DoubleExpression:
+  case ExpressionAST::BoolExpression:
+  case ExpressionAST::StringExpression:
+    return true;
+  }
+}
+
+BytecodeProgram BytecodeCompiler::compile() {
+  Program.Chunks.emplace_back(BytecodeChunk::TopLevelChunk, "<toplevel>");
+  for (auto &F : FunctionDefinition) {
+    FunctionIndex[F.first] = Program.Chunks.size();
+    Program.Chunks.emplace_back(BytecodeChunk::FunctionChunk, F.first.str());
+  }
+  for (auto &I : InfixOpDefinition) {
+    InfixOpIndex[I.first] = Program.Chunks.size();
+    Program.Chunks.emplace_back(BytecodeChunk::InfixOpChunk, I.first.str());
+  }
+
+  auto MainIt = FunctionIndex.find(Symbol::intern("main"));
+  if (MainIt != FunctionIndex.end())
+    Program.MainChunk = MainIt->second;
+  Program.GlobalCount = TopLevelBlock.getLayout().getSlotCount();
+
+  compileTopLevel();
+  for (auto &F : FunctionDefinition)
+    compileFunction(F.second);
+  for (auto &I : InfixOpDefinition)
+    compileInfixOp(I.second);
+
+  return std::move(Program);
+}
+
+void BytecodeCompiler::compileTopLevel() {
+  beginChunk(Program.Chunks[0], TopLevelBlock.getLayout());
+  for (auto &Stmt : TopLevelBlock.getStatementList())
+    compileStatement(Stmt, false);
+  emit(Op::Halt);
+}
+
+void BytecodeCompiler::compileFunction(const FunctionDefinitionAST &Function) {
+  BytecodeChunk &C = Program.Chunks[FunctionIndex[Function.getName()]];
+  C.Function = &Function;
+  beginChunk(C, Function.getLayout());
+  compileStatement(Function.getStatement(), true);
+}
+
+void BytecodeCompiler::compileInfixOp(const InfixOpDefinitionAST &InfixOp) {
+  beginChunk(Program.Chunks[InfixOpIndex[InfixOp.getSymbol()]],
+             InfixOp.getLayout());
+  compileStatement(InfixOp.getStatement(), true);
+}
+
+/// \brief Compile a statement, which returns if it is in tail position
+void BytecodeCompiler::compileStatement(const StatementAST *Stmt, bool Tail) {
+  if (!Stmt) {
+    if (Tail)
+      emit(Op::ReturnVoid);
+    return;
+  }
+
+  switch (Stmt->getKind()) {
+  case StatementAST::DeclarationStatement:
+    compileError("single declaration should not be used by user", 0);
+    return;
+  case StatementAST::DeclarationListStatement:
+    for (auto &Decl : Stmt->as_cptr<DeclarationListAST>()->getDeclarationList())
+      compileDeclaration(Decl);
+    break;
+  case StatementAST::ExprStatement:
+    compileExpression(Stmt->as_cptr<ExprStatementAST>()->getExpression());
+    emit(Tail ? Op::ReturnImplicit : Op::Pop);
+    break;
+  case StatementAST::BlockStatement:
+    compileBlock(Stmt->as_cptr<BlockAST>(), Tail);
+    break;
+  case StatementAST::IfStatement:
+    compileIfStatement(Stmt->as_cptr<IfStatementAST>(), Tail);
+    break;
+  case StatementAST::ReturnStatement:
+    if (auto *Value = Stmt->as_cptr<ReturnStatementAST>()->getReturnValue())
+      compileExpression(Value);
+    else
+      emit(Op::Const, addConstant(cvm::BasicValue()));
+    emit(Op::Return);
+    break;
+  case StatementAST::WhileStatement:
+    compileWhileStatement(Stmt->as_cptr<WhileStatementAST>());
+    break;
+  case StatementAST::ForStatement:
+    compileForStatement(Stmt->as_cptr<ForStatementAST>());
+    break;
+  case StatementAST::BreakStatement:
+    compileLoopExit(true);
+    break;
+  case StatementAST::ContinueStatement:
+    compileLoopExit(false);
+    break;
+  }
+
+  if (Tail && !Stmt->returnsInTail())
+    emit(Op::ReturnVoid);
+}
+
+void BytecodeCompiler::compileBlock(const BlockAST *Block, bool Tail) {
+  pushScope(Block->getLayout());
+
+  auto &StmtList = Block->getStatementList();
+  if (StmtList.empty() && Tail)
+    emit(Op::ReturnVoid);
+  for (auto It = StmtList.begin(); It != StmtList.end(); ++It)
+    compileStatement(*It, Tail && std::next(It) == StmtList.end());
+
+  // A block in tail position never falls through.
+  if (!Tail)
+    emitClearSlots(Scopes.back().Base);
+  Scopes.pop_back();
+}
+
+void BytecodeCompiler::compileIfStatement(const IfStatementAST *IfStmt,
+                                          bool Tail) {
+  compileExpression(IfStmt->getCondition());
+  size_t ToElse = emit(Op::JumpIfFalse);
+
+  compileStatement(IfStmt->getStatementThen(), Tail);
+
+  if (const StatementAST *StatementElse = IfStmt->getStatementElse()) {
+    size_t ToEnd = Tail ? 0 : emit(Op::Jump);
+    patchJump(ToElse, here());
+    compileStatement(StatementElse, Tail);
+    if (!Tail)
+      patchJump(ToEnd, here());
+  } else {
+    patchJump(ToElse, here());
+  }
+}
+
+/// \brief Compile a while loop with its condition at the bottom:
+///     jump Cond; Body: <body>; Cond: <cond>; jump.true Body
+void BytecodeCompiler::compileWhileStatement(
+    const WhileStatementAST *WhileStmt) {
+  const ExpressionAST *Condition = WhileStmt->getCondition();
+
+  Loops.push_back(LoopContext{Scopes.size(), {}, {}});
+  size_t ToCondition = Condition ? emit(Op::Jump) : 0;
+  size_t Body = here();
+  compileStatement(WhileStmt->getStatement(), false);
+
+  for (size_t At : Loops.back().ContinueJumps)
+    patchJump(At, here());
+  if (Condition) {
+    patchJump(ToCondition, here());
+    compileExpression(Condition);
+    emit(Op::JumpIfTrue, Body);
+  } else {
+    emit(Op::Jump, Body);
+  }
+
+  for (size_t At : Loops.back().BreakJumps)
+    patchJump(At, here());
+  Loops.pop_back();
+}
+
+void BytecodeCompiler::compileForStatement(const ForStatementAST *ForStmt) {
+  const ExpressionAST *Condition = ForStmt->getCondition();
+
+  if (const ExpressionAST *Init = ForStmt->getInit()) {
+    compileExpression(Init);
+    emit(Op::Pop);
+  }
+
+  Loops.push_back(LoopContext{Scopes.size(), {}, {}});
+  size_t ToCondition = Condition ? emit(Op::Jump) : 0;
+  size_t Body = here();
+  compileStatement(ForStmt->getStatement(), false);
+
+  for (size_t At : Loops.back().ContinueJumps)
+    patchJump(At, here());
+  if (const ExpressionAST *Post = ForStmt->getPost()) {
+    compileExpression(Post);
+    emit(Op::Pop);
+  }
+  if (Condition) {
+    patchJump(ToCondition, here());
+    compileExpression(Condition);
+    emit(Op::JumpIfTrue, Body);
+  } else {
+    emit(Op::Jump, Body);
+  }
+
+  for (size_t At : Loops.back().BreakJumps)
+    patchJump(At, here());
+  Loops.pop_back();
+}
+
+/// \brief Compile a break or continue statement
+/// Outside of a loop, it ends a function or infix operator body with void,
+/// and is an error at the top level.
+void BytecodeCompiler::compileLoopExit(bool IsBreak) {
+  if (Loops.empty()) {
+    if (Chunk->Kind == BytecodeChunk::TopLevelChunk)
+      compileError(IsBreak ? "break statement should be in a loop"
+                           : "continue statement should be in a loop", 0);
+    else
+      emit(Op::ReturnVoid);
+    return;
+  }
+
+  LoopContext &Loop = Loops.back();
+  if (Loop.ScopeDepth < Scopes.size())
+    emitClearSlots(Scopes[Loop.ScopeDepth].Base);
+  size_t At = emit(Op::Jump);
+  (IsBreak ? Loop.BreakJumps : Loop.ContinueJumps).push_back(At);
+}
+
+void BytecodeCompiler::compileDeclaration(const DeclarationAST *Decl) {
+  unsigned Index = Chunk->Decls.size();
+  Chunk->Decls.emplace_back(Decl, Scopes.back().Base + Decl->getSlot());
+
+  emit(Op::DeclCheck, Index);
+  if (Decl->isArray()) {
+    for (auto &E : Decl->getElementCountList()) {
+      compileExpression(E);
+      emit(Op::DeclDim, Index);
+    }
+    emit(Op::DeclArray, Index);
+    adjustStack(-static_cast<int>(Decl->getElementCountList().size()));
+  }
+
+  if (Decl->getInitializer()) {
+    compileExpression(Decl->getInitializer());
+    emit(Op::DeclInit, Index);
+  } else {
+    emit(Op::DeclDefault, Index);
+  }
+}
+
+void BytecodeCompiler::compileExpression(const ExpressionAST *Expr) {
+  switch (Expr->getKind()) {
+  case ExpressionAST::IntExpression:
+    emit(Op::Const, addConstant(Expr->as_cptr<IntAST>()->getValue()));
+    break;
+  case ExpressionAST::DoubleExpression:
+    emit(Op::Const, addConstant(Expr->as_cptr<DoubleAST>()->getValue()));
+    break;
+  case ExpressionAST::BoolExpression:
+    emit(Op::Const, addConstant(Expr->as_cptr<BoolAST>()->getValue()));
+    break;
+  case ExpressionAST::StringExpression:
+    emit(Op::Const, addConstant(Expr->as_cptr<StringAST>()->getValue()));
+    break;
+  case ExpressionAST::IdentifierExpression:
+    compileVariable(Expr->as_cptr<IdentifierAST>(), false);
+    break;
+  case ExpressionAST::FunctionCallExpression:
+    compileFunctionCall(Expr->as_cptr<FunctionCallAST>());
+    break;
+  case ExpressionAST::InfixOpExpression:
+    compileInfixOpExpr(Expr->as_cptr<InfixOpExprAST>());
+    break;
+  case ExpressionAST::UnaryOperatorExpression: {
+    auto *UnaryOpExpr = Expr->as_cptr<UnaryOperatorAST>();
+    compileExpression(UnaryOpExpr->getOperand());
+    emit(UnaryOpcode(UnaryOpExpr->getOpKind()));
+    break;
+  }
+  case ExpressionAST::BinaryOperatorExpression: {
+    auto *BinOpExpr = Expr->as_cptr<BinaryOperatorAST>();
+    switch (BinOpExpr->getOpKind()) {
+    default:
+      compileExpression(BinOpExpr->getLHS());
+      compileExpression(BinOpExpr->getRHS());
+      emit(BinaryOpcode(BinOpExpr->getOpKind()));
+      break;
+    case BinaryOperatorAST::Assign:
+      compileAssignment(BinOpExpr->getLHS(), BinOpExpr->getRHS());
+      break;
+    case BinaryOperatorAST::Index:
+      compileIndexTarget(BinOpExpr);
+      emit(Op::Index);
+      break;
+    case BinaryOperatorAST::LogicalAnd:
+    case BinaryOperatorAST::LogicalOr: {
+      bool IsAnd = BinOpExpr->getOpKind() == BinaryOperatorAST::LogicalAnd;
+      compileExpression(BinOpExpr->getLHS());
+      size_t ToEnd = emit(IsAnd ? Op::AndThen : Op::OrElse);
+      compileExpression(BinOpExpr->getRHS());
+      emit(Op::ToBool);
+      patchJump(ToEnd, here());
+      break;
+    }
+    }
+    break;
+  }
+  }
+}
+
+void BytecodeCompiler::compileVariable(const IdentifierAST *IdExpr,
+                                       bool Store) {
+  if (IdExpr->isResolved()) {
+    for (auto It = Scopes.rbegin(); It != Scopes.rend(); ++It) {
+      if (It->Layout == IdExpr->getScope()) {
+        emit(Store ? Op::StoreLocal : Op::LoadLocal,
+             It->Base + IdExpr->getSlot());
+        return;
+      }
+    }
+    if (IdExpr->getScope() == &TopLevelBlock.getLayout()) {
+      emit(Store ? Op::StoreGlobal : Op::LoadGlobal, IdExpr->getSlot());
+      return;
+    }
+  }
+  emit(Store ? Op::StoreName : Op::LoadName, addName(IdExpr->getName()));
+}
+
+/// \brief Leave the array and the index of an index expression on the stack
+/// Like the tree walker, the base has to be a lvalue, and is checked to be an
+/// array before the index is evaluated.
+void BytecodeCompiler::compileIndexTarget(const BinaryOperatorAST *IndexExpr) {
+  const ExpressionAST *BaseExpr = IndexExpr->getLHS();
+
+  if (BaseExpr->isIdentifierExpr()) {
+    compileVariable(BaseExpr->as_cptr<IdentifierAST>(), false);
+  } else if (BaseExpr->isBinaryOperatorExpression()) {
+    auto *BinOpExpr = BaseExpr->as_cptr<BinaryOperatorAST>();
+    if (BinOpExpr->getOpKind() == BinaryOperatorAST::Index) {
+      compileIndexTarget(BinOpExpr);
+      emit(Op::Index);
+    } else if (BinOpExpr->getOpKind() == BinaryOperatorAST::Assign) {
+      compileAssignment(BinOpExpr->getLHS(), BinOpExpr->getRHS());
+    } else {
+      compileError("try to evaluate a rvalue binOpExpr as lvalue", 1);
+    }
+  } else {
+    compileError("try to evaluate a rvalue expression as lvalue", 1);
+  }
+
+  // A literal index can't run anything before the check done by Index.
+  if (!IsLiteral(IndexExpr->getRHS()))
+    emit(Op::CheckArray);
+  compileExpression(IndexExpr->getRHS());
+}
+
+/// \brief Compile the lvalue an assignment stores to
+/// Return the variable assigned to, or null if it is an array element whose
+/// array and index are left on the stack.
+const IdentifierAST *
+BytecodeCompiler::compileAssignTarget(const ExpressionAST *RefExpr,
+                                      const ExpressionAST *ValExpr) {
+  if (RefExpr->isIdentifierExpr()) {
+    auto *IdExpr = RefExpr->as_cptr<IdentifierAST>();
+    // The walker finds the variable before evaluating the value; do the same
+    // whenever the value could run code first.
+    if (ValExpr->mayHaveSideEffects()) {
+      compileVariable(IdExpr, false);
+      emit(Op::Pop);
+    }
+    return IdExpr;
+  }
+
+  if (RefExpr->isBinaryOperatorExpression()) {
+    auto *BinOpExpr = RefExpr->as_cptr<BinaryOperatorAST>();
+    if (BinOpExpr->getOpKind() == BinaryOperatorAST::Index) {
+      compileIndexTarget(BinOpExpr);
+      emit(Op::CheckElem);
+      return nullptr;
+    }
+
+    if (BinOpExpr->getOpKind() == BinaryOperatorAST::Assign) {
+      // (a = b) = c: assign b, then c, to the same lvalue.
+      const ExpressionAST *InnerValExpr = BinOpExpr->getRHS();
+      if (const IdentifierAST *IdExpr =
+              compileAssignTarget(BinOpExpr->getLHS(), InnerValExpr)) {
+        compileExpression(InnerValExpr);
+        compileVariable(IdExpr, true);
+        emit(Op::Pop);
+        return IdExpr;
+      }
+      emit(Op::Dup2);
+      compileExpression(InnerValExpr);
+      emit(Op::StoreElem);
+      emit(Op::Pop);
+      return nullptr;
+    }
+
+    compileError("try to evaluate a rvalue binOpExpr as lvalue", 2);
+    return nullptr;
+  }
+
+  compileError("try to evaluate a rvalue expression as lvalue", 2);
+  return nullptr;
+}
+
+void BytecodeCompiler::compileAssignment(const ExpressionAST *RefExpr,
+                                         const ExpressionAST *ValExpr) {
+  const IdentifierAST *IdExpr = compileAssignTarget(RefExpr, ValExpr);
+  compileExpression(ValExpr);
+  if (IdExpr)
+    compileVariable(IdExpr, true);
+  else
+    emit(Op::StoreElem);
+}
+
+void BytecodeCompiler::compileFunctionCall(const FunctionCallAST *FuncCall) {
+  Symbol Callee = FuncCall->getCallee();
+  int ArgCount = static_cast<int>(FuncCall->getArguments().size());
+  Op::Opcode Code;
+  unsigned Index;
+
+  // The resolver has bound the callee and reported undefined ones.
+  if (FuncCall->getFunction()) {
+    Code = FuncCall->isDynamicBound() ? Op::CallDynamic : Op::Call;
+    Index = FunctionIndex.at(Callee);
+  } else if (cvm::NativeFunction Native = FuncCall->getNativeFunction()) {
+    auto NativeIt = NativeIndex.find(Callee);
+    Code = Op::CallNative;
+    if (NativeIt != NativeIndex.end()) {
+      Index = NativeIt->second;
+    } else {
+      Index = NativeIndex[Callee] = Program.Natives.size();
+      Program.Natives.push_back(Native);
+      Program.NativeNames.push_back(Callee.str());
+    }
+  } else {
+    compileError("function `" + Callee.str() + "' is undefined", 1);
+    return;
+  }
+
+  for (auto &Arg : FuncCall->getArguments())
+    compileExpression(Arg);
+  emit(Code, Index);
+  emitExtra(ArgCount);
+  adjustStack(1 - ArgCount);
+}
+
+void BytecodeCompiler::compileInfixOpExpr(const InfixOpExprAST *Expr) {
+  auto InfixOpIt = InfixOpIndex.find(Expr->getSymbol());
+  if (InfixOpIt == InfixOpIndex.end()) {
+    compileError("Infix operator " + Expr->getSymbol().str() + " is undefined",
+                 1);
+    return;
+  }
+
+  compileExpression(Expr->getLHS());
+  compileExpression(Expr->getRHS());
+  emit(Op::CallInfixOp, InfixOpIt->second);
+}
+
+/// \brief Compile an error the walker would only report when reaching it
+void BytecodeCompiler::compileError(const std::string &Msg, int StackDelta) {
+  emit(Op::Error, addConstant(Msg));
+  adjustStack(StackDelta);
+}
+
+void BytecodeCompiler::beginChunk(BytecodeChunk &C, const FrameLayout &Layout) {
+  Chunk = &C;
+  Scopes.clear();
+  Loops.clear();
+  StackDepth = 0;
+  pushScope(Layout);
+}
+
+/// \brief Give the slots of Layout a range on top of the frame
+void BytecodeCompiler::pushScope(const FrameLayout &Layout) {
+  unsigned Base = Chunk->SlotNames.size();
+
+  for (size_t Slot = 0; Slot < Layout.getSlotCount(); ++Slot) {
+    Symbol Name = Layout.getSlotName(Slot);
+    // Lookups by name only ever find the first slot of a name.
+    bool Visible = Layout.findSlot(Name) == static_cast<int>(Slot);
+    Chunk->SlotNames.push_back(Visible ? Name : Symbol());
+  }
+  Scopes.push_back(Scope{&Layout, Base});
+}
+
+/// \brief Void the slots of the scopes from the one starting at First on
+void BytecodeCompiler::emitClearSlots(unsigned First) {
+  const Scope &Innermost = Scopes.back();
+  unsigned End = Innermost.Base + Innermost.Layout->getSlotCount();
+  if (End > First) {
+    emit(Op::ClearSlots, First);
+    emitExtra(End - First);
+  }
+}
+
+size_t BytecodeCompiler::emit(Op::Opcode Code, uint32_t Operand) {
+  switch (Code) {
+  default:
+    break;
+  case Op::Const:
+  case Op::LoadLocal:
+  case Op::LoadGlobal:
+  case Op::LoadName:
+    adjustStack(1);
+    break;
+  case Op::Dup2:
+    adjustStack(2);
+    break;
+  case Op::Pop:
+  case Op::DeclInit:
+  case Op::Index:
+  case Op::Add:
+  case Op::Minus:
+  case Op::Multiply:
+  case Op::Division:
+  case Op::Modulo:
+  case Op::Less:
+  case Op::LessEqual:
+  case Op::Equal:
+  case Op::NotEqual:
+  case Op::Greater:
+  case Op::GreaterEqual:
+  case Op::BitwiseAnd:
+  case Op::BitwiseOr:
+  case Op::BitwiseXor:
+  case Op::LeftShift:
+  case Op::RightShift:
+  case Op::JumpIfFalse:
+  case Op::JumpIfTrue:
+  case Op::AndThen:
+  case Op::OrElse:
+  case Op::CallInfixOp:
+  case Op::Return:
+  case Op::ReturnImplicit:
+    adjustStack(-1);
+    break;
+  case Op::StoreElem:
+    adjustStack(-2);
+    break;
+  }
+
+  Chunk->Code.push_back(makeInstruction(Code, Operand));
+  return Chunk->Code.size() - 1;
+}
+
+void BytecodeCompiler::emitExtra(uint32_t Operand) {
+  Chunk->Code.push_back(Operand);
+}
+
+void BytecodeCompiler::patchJump(size_t At, size_t Target) {
+  Chunk->Code[At] = makeInstruction(getOpcode(Chunk->Code[At]), Target);
+}
+
+void BytecodeCompiler::adjustStack(int Delta) {
+  StackDepth += Delta;
+  if (StackDepth > static_cast<int>(Chunk->MaxStack))
+    Chunk->MaxStack = StackDepth;
+}
+
+unsigned BytecodeCompiler::addConstant(const cvm::BasicValue &Value) {
+  Chunk->Constants.push_back(Value);
+  return Chunk->Constants.size() - 1;
+}
+
+unsigned BytecodeCompiler::addName(Symbol Name) {
+  for (size_t I = 0; I < Chunk->Names.size(); ++I)
+    if (Chunk->Names[I] == Name)
+      return I;
+  Chunk->Names.push_back(Name);
+  return Chunk->Names.size() - 1;
+}
@@ -0,0 +1,505 @@
+#include "BytecodeVM.h"
+#include "CMMInterpreter.h"
+#include "Runtime.h"
+
+using namespace cmm;
+
+typedef CMMInterpreter Walker;
+
+/// \brief Assign Value to Variable, leaving the stored value in Value
+static inline void StoreValue(cvm::BasicValue &Variable,
+                              cvm::BasicValue &Value) {
+  if (Variable.isInt() && Value.isInt() &&
+      !Variable.isArray() && !Value.isArray()) {
+    Variable = Value.getInt();
+    return;
+  }
+  Value = Walker::assignValue(Variable, Value);
+}
+
+/// \brief Return the truth of the condition popped off into Cond, clearing
+/// the cell so that the dead stack doesn't keep an array from the collector
+static inline bool PopCondition(cvm::BasicValue &Cond) {
+  if (Cond.isBool())
+    return Cond.getBool();
+  bool Res = Cond.toBool();
+  Cond = cvm::BasicValue();
+  return Res;
+}
+
+int BytecodeVM::run(int Argc, char *Argv[]) {
+  const BytecodeChunk &TopLevel = Program.Chunks[0];
+
+  Slots.reserve(1024);
+  Stack.resize(TopLevel.MaxStack + 1);
+  Slots.resize(TopLevel.SlotNames.size());
+  Frames.push_back(Frame{&TopLevel, TopLevel.Code.data(), 0, 0, 0, false});
+
+  // First run top level statements.
+  cvm::BasicValue Res = execute(0);
+  if (TopLevelReturned)
+    return Res.getInt();
+
+  // Invoke main function is there is one
+  if (Program.MainChunk < 0)
+    return 0;
+
+  const BytecodeChunk &Main = Program.Chunks[Program.MainChunk];
+  size_t ArgCount = 0;
+  if (Main.Function->getParameterCount() != 0) {
+    std::vector<cvm::BasicValue> ArgVector;
+    ArgVector.reserve(static_cast<size_t>(Argc));
+    for (int I = 0; I < Argc; ++I)
+      ArgVector.emplace_back(std::string(Argv[I]));
+    Stack[0] = cvm::BasicValue(cvm::StringType, std::move(ArgVector));
+    ArgCount = 1;
+  }
+  checkArguments(Main, Stack.data(), ArgCount);
+  pushFrame(Main, 0, ArgCount, false);
+  return execute(1).toInt();
+}
+
+cvm::BasicValue BytecodeVM::call(unsigned Index, const cvm::BasicValue *Args,
+                                 size_t ArgCount) {
+  size_t ArgBase = CallerTop;
+  if (Stack.size() < ArgBase + ArgCount)
+    Stack.resize(2 * (ArgBase + ArgCount));
+  std::copy(Args, Args + ArgCount, Stack.begin() + ArgBase);
+
+  size_t Depth = Frames.size();
+  pushFrame(Program.Chunks[Index], ArgBase, ArgCount, false);
+  cvm::BasicValue Ret = execute(Depth);
+  // Calls run from here may have moved it.
+  CallerTop = ArgBase;
+  return Ret;
+}
+
+/// \brief Run from the innermost frame until the top level code halts or
+/// returns, or until returning would leave only BaseDepth frames
+cvm::BasicValue BytecodeVM::execute(size_t BaseDepth) {
+  const BytecodeChunk *C;
+  const Instruction *PC;
+  cvm::BasicValue *Locals;
+  cvm::BasicValue *SP;
+  cvm::BasicValue Ret;
+
+#define LOAD_FRAME()                                                           \
+  do {                                                                         \
+    C = Frames.back().Chunk;                                                   \
+    PC = Frames.back().PC;                                                     \
+    Locals = Slots.data() + Frames.back().SlotBase;                            \
+  } while (0)
+
+  LOAD_FRAME();
+  SP = Stack.data() + Frames.back().StackBase;
+
+// Binary operators with an int fast path; everything else goes through the
+// tree walker's evaluateBinaryCalc.
+#define BINARY_OP(OPCODE, KIND, INT_RESULT)                                    \
+  case Op::OPCODE: {                                                           \
+    cvm::BasicValue &L = SP[-2], &R = SP[-1];                                  \
+    if (L.isInt() && R.isInt() && !L.isArray() && !R.isArray()) {              \
+      INT_RESULT;                                                              \
+    } else {                                                                   \
+      L = Walker::evaluateBinaryCalc(BinaryOperatorAST::KIND, std::move(L),    \
+                                     std::move(R));                            \
+    }                                                                          \
+    --SP;                                                                      \
+    break;                                                                     \
+  }
+#define INT_ARITH(EXPR) L = static_cast<int>(EXPR)
+// An int comparison followed by a conditional jump takes the branch right
+// away, without pushing the bool and dispatching the jump.
+#define INT_RELATION(EXPR)                                                     \
+  do {                                                                         \
+    bool Res = (EXPR);                                                         \
+    Op::Opcode Next = getOpcode(*PC);                                          \
+    if (Next != Op::JumpIfFalse && Next != Op::JumpIfTrue) {                   \
+      L = Res;                                                                 \
+      break;                                                                   \
+    }                                                                          \
+    if (Res == (Next == Op::JumpIfTrue))                                       \
+      PC = C->Code.data() + getOperand(*PC);                                   \
+    else                                                                       \
+      ++PC;                                                                    \
+    --SP;                                                                      \
+  } while (0)
+#define GENERIC_BINARY_OP(OPCODE, KIND)                                        \
+  case Op::OPCODE:                                                             \
+    SP[-2] = Walker::evaluateBinaryCalc(BinaryOperatorAST::KIND,               \
+                                        std::move(SP[-2]), std::move(SP[-1])); \
+    --SP;                                                                      \
+    break;
+
+  for (;;) {
+    Instruction I = *PC++;
+
+    switch (getOpcode(I)) {
+    default:
+      Walker::RuntimeError("bad opcode " + std::to_string(getOpcode(I)));
+
+    case Op::Const:
+      *SP++ = C->Constants[getOperand(I)];
+      break;
+
+    case Op::Pop:
+      *--SP = cvm::BasicValue();
+      break;
+
+    case Op::Dup2:
+      SP[0] = SP[-2];
+      SP[1] = SP[-1];
+      SP += 2;
+      break;
+
+    case Op::LoadLocal: {
+      cvm::BasicValue &V = Locals[getOperand(I)];
+      *SP++ = !V.isVoid() ? V : searchVariable(C->SlotNames[getOperand(I)]);
+      break;
+    }
+
+    case Op::StoreLocal: {
+      cvm::BasicValue &V = Locals[getOperand(I)];
+      StoreValue(!V.isVoid() ? V : searchVariable(C->SlotNames[getOperand(I)]),
+                 SP[-1]);
+      break;
+    }
+
+    case Op::LoadGlobal: {
+      cvm::BasicValue &V = Slots[getOperand(I)];
+      if (!Frames.back().Dynamic && !V.isVoid())
+        *SP++ = V;
+      else
+        *SP++ = searchVariable(Program.Chunks[0].SlotNames[getOperand(I)]);
+      break;
+    }
+
+    case Op::StoreGlobal: {
+      cvm::BasicValue &V = Slots[getOperand(I)];
+      if (!Frames.back().Dynamic && !V.isVoid())
+        StoreValue(V, SP[-1]);
+      else
+        StoreValue(searchVariable(Program.Chunks[0].SlotNames[getOperand(I)]),
+                   SP[-1]);
+      break;
+    }
+
+    case Op::LoadName:
+      *SP++ = searchVariable(C->Names[getOperand(I)]);
+      break;
+
+    case Op::StoreName:
+      StoreValue(searchVariable(C->Names[getOperand(I)]), SP[-1]);
+      break;
+
+    case Op::ClearSlots: {
+      cvm::BasicValue *Slot = Locals + getOperand(I);
+      for (cvm::BasicValue *End = Slot + *PC++; Slot != End; ++Slot)
+        *Slot = cvm::BasicValue();
+      break;
+    }
+
+    case Op::DeclCheck: {
+      const auto &Decl = C->Decls[getOperand(I)];
+      if (!Locals[Decl.second].isVoid()) {
+        Walker::RuntimeError("variable `" + Decl.first->getName().str() +
+            "' is already defined in current scope");
+      }
+      break;
+    }
+
+    case Op::DeclDim:
+      SP[-1] = Walker::checkDimension(C->Decls[getOperand(I)].first, SP[-1]);
+      break;
+
+    case Op::DeclArray: {
+      const auto &Decl = C->Decls[getOperand(I)];
+      size_t Count = Decl.first->getElementCountList().size();
+      std::list<int> DimensionList;
+      for (cvm::BasicValue *Dim = SP - Count; Dim != SP; ++Dim)
+        DimensionList.push_back(Dim->getInt());
+      SP -= Count;
+      Locals[Decl.second] = cvm::BasicValue(Decl.first->getType(),
+                                            DimensionList);
+      break;
+    }
+
+    case Op::DeclInit: {
+      const auto &Decl = C->Decls[getOperand(I)];
+      cvm::BasicValue Val = std::move(*--SP);
+      Walker::coerceInitializer(Decl.first, Val);
+      if (Locals[Decl.second].isVoid())
+        Locals[Decl.second] = std::move(Val);
+      break;
+    }
+
+    case Op::DeclDefault: {
+      const auto &Decl = C->Decls[getOperand(I)];
+      if (Locals[Decl.second].isVoid())
+        Locals[Decl.second] = cvm::BasicValue(Decl.first->getType());
+      break;
+    }
+
+    case Op::CheckArray:
+      Walker::checkIndexBase(SP[-1]);
+      break;
+
+    case Op::Index:
+      // The element holds its own reference, so it can replace the array.
+      SP[-2] = SP[-2].getElement(Walker::checkIndex(SP[-2], SP[-1]));
+      --SP;
+      break;
+
+    case Op::CheckElem:
+      Walker::checkIndex(SP[-2], SP[-1]);
+      break;
+
+    case Op::StoreElem:
+      SP[-3] = Walker::storeElement(SP[-3], Walker::checkIndex(SP[-3], SP[-2]),
+                                    SP[-1]);
+      SP[-1] = cvm::BasicValue();
+      SP -= 2;
+      break;
+
+    case Op::Plus:
+      SP[-1] = Walker::evaluateUnaryArith(UnaryOperatorAST::Plus,
+                                          std::move(SP[-1]));
+      break;
+
+    case Op::Negate:
+      if (SP[-1].isInt() && !SP[-1].isArray())
+        SP[-1] = -SP[-1].getInt();
+      else
+        SP[-1] = Walker::evaluateUnaryArith(UnaryOperatorAST::Minus,
+                                            std::move(SP[-1]));
+      break;
+
+    case Op::LogicalNot:
+      SP[-1] = Walker::evaluateUnaryLogical(UnaryOperatorAST::LogicalNot,
+                                            std::move(SP[-1]));
+      break;
+
+    case Op::BitwiseNot:
+      SP[-1] = Walker::evaluateUnaryBitwise(UnaryOperatorAST::BitwiseNot,
+                                            std::move(SP[-1]));
+      break;
+
+    BINARY_OP(Add, Add, INT_ARITH(L.getInt() + R.getInt()))
+    BINARY_OP(Minus, Minus, INT_ARITH(L.getInt() - R.getInt()))
+    BINARY_OP(Multiply, Multiply, INT_ARITH(L.getInt() * R.getInt()))
+    BINARY_OP(Less, Less, INT_RELATION(L.getInt() < R.getInt()))
+    BINARY_OP(LessEqual, LessEqual, INT_RELATION(L.getInt() <= R.getInt()))
+    BINARY_OP(Equal, Equal, INT_RELATION(L.getInt() == R.getInt()))
+    BINARY_OP(NotEqual, NotEqual, INT_RELATION(L.getInt() != R.getInt()))
+    BINARY_OP(Greater, Greater, INT_RELATION(L.getInt() > R.getInt()))
+    BINARY_OP(GreaterEqual, GreaterEqual, INT_RELATION(L.getInt() >= R.getInt()))
+    GENERIC_BINARY_OP(Division, Division)
+    GENERIC_BINARY_OP(Modulo, Modulo)
+    GENERIC_BINARY_OP(BitwiseAnd, BitwiseAnd)
+    GENERIC_BINARY_OP(BitwiseOr, BitwiseOr)
+    GENERIC_BINARY_OP(BitwiseXor, BitwiseXor)
+    GENERIC_BINARY_OP(LeftShift, LeftShift)
+    GENERIC_BINARY_OP(RightShift, RightShift)
+
+    case Op::ToBool:
+      SP[-1] = SP[-1].toBool();
+      break;
+
+    case Op::Jump:
+      PC = C->Code.data() + getOperand(I);
+      break;
+
+    case Op::JumpIfFalse:
+      if (!PopCondition(*--SP))
+        PC = C->Code.data() + getOperand(I);
+      break;
+
+    case Op::JumpIfTrue:
+      if (PopCondition(*--SP))
+        PC = C->Code.data() + getOperand(I);
+      break;
+
+    case Op::AndThen:
+      if (!SP[-1].toBool()) {
+        SP[-1] = false;
+        PC = C->Code.data() + getOperand(I);
+      } else {
+        *--SP = cvm::BasicValue();
+      }
+      break;
+
+    case Op::OrElse:
+      if (SP[-1].toBool()) {
+        SP[-1] = true;
+        PC = C->Code.data() + getOperand(I);
+      } else {
+        *--SP = cvm::BasicValue();
+      }
+      break;
+
+    case Op::Call:
+    case Op::CallDynamic: {
+      const BytecodeChunk &Callee = Program.Chunks[getOperand(I)];
+      size_t ArgCount = *PC++;
+      cvm::BasicValue *Args = SP - ArgCount;
+      checkArguments(Callee, Args, ArgCount);
+
+      if (JIT) {
+        // Compiled code may hand calls back, growing the slots and the stack.
+        size_t ArgBase = Args - Stack.data();
+        CallerTop = ArgBase + ArgCount;
+        bool Ran = JIT->tryCall(getOperand(I), Args, ArgCount, Ret);
+        Locals = Slots.data() + Frames.back().SlotBase;
+        Args = Stack.data() + ArgBase;
+        SP = Args + ArgCount;
+        if (Ran) {
+          while (ArgCount-- > 0)
+            *--SP = cvm::BasicValue();
+          *SP++ = std::move(Ret);
+          break;
+        }
+      }
+
+      Frames.back().PC = PC;
+      pushFrame(Callee, Args - Stack.data(), ArgCount,
+                getOpcode(I) == Op::CallDynamic);
+      LOAD_FRAME();
+      SP = Stack.data() + Frames.back().StackBase;
+      break;
+    }
+
+    case Op::CallInfixOp: {
+      const BytecodeChunk &Callee = Program.Chunks[getOperand(I)];
+      Frames.back().PC = PC;
+      pushFrame(Callee, (SP - 2) - Stack.data(), 2, false);
+      LOAD_FRAME();
+      SP = Stack.data() + Frames.back().StackBase;
+      break;
+    }
+
+    case Op::CallNative: {
+      size_t ArgCount = *PC++;
+      cvm::BasicValue Res =
+          Program.Natives[getOperand(I)](cvm::ArgumentList(SP - ArgCount, SP));
+      while (ArgCount-- > 0)
+        *--SP = cvm::BasicValue();
+      *SP++ = std::move(Res);
+      break;
+    }
+
+    case Op::Return:
+      Ret = std::move(*--SP);
+      switch (C->Kind) {
+      case BytecodeChunk::TopLevelChunk:
+        cvm::checkTopLevelReturn(Ret);
+        TopLevelReturned = true;
+        return Ret;
+      case BytecodeChunk::FunctionChunk:
+        Walker::checkReturnValue(*C->Function, Ret);
+        break;
+      case BytecodeChunk::InfixOpChunk:
+        Walker::checkInfixOpValue(Ret);
+        break;
+      }
+      goto ReturnFromFrame;
+
+    case Op::ReturnImplicit:
+      Ret = std::move(*--SP);
+      if (C->Kind == BytecodeChunk::InfixOpChunk)
+        Walker::checkInfixOpValue(Ret);
+      goto ReturnFromFrame;
+
+    case Op::ReturnVoid:
+      Ret = cvm::BasicValue();
+      if (C->Kind == BytecodeChunk::InfixOpChunk)
+        Walker::checkInfixOpValue(Ret);
+      goto ReturnFromFrame;
+
+    ReturnFromFrame: {
+      size_t StackBase = Frames.back().StackBase;
+      for (cvm::BasicValue *Slot = Locals, *End = Slot + C->SlotNames.size();
+           Slot != End; ++Slot)
+        *Slot = cvm::BasicValue();
+      Frames.pop_back();
+      if (Frames.size() == BaseDepth)
+        return Ret;
+
+      LOAD_FRAME();
+      SP = Stack.data() + StackBase;
+      *SP++ = std::move(Ret);
+      break;
+    }
+
+    case Op::Error:
+      Walker::RuntimeError(C->Constants[getOperand(I)].getString());
+
+    case Op::Halt:
+      Frames.back().PC = PC - 1;
+      return cvm::BasicValue();
+    }
+  }
+
+#undef GENERIC_BINARY_OP
+#undef INT_RELATION
+#undef INT_ARITH
+#undef BINARY_OP
+#undef LOAD_FRAME
+}
+
+/// \brief Enter Callee, moving its arguments from the stack into its slots
+/// The slots past the ones of the innermost frame are void, so they can be
+/// handed out without being cleared.
+void BytecodeVM::pushFrame(const BytecodeChunk &Callee, size_t ArgBase,
+                           size_t ArgCount, bool Dynamic) {
+  size_t SlotBase = Frames.back().SlotBase +
+                    Frames.back().Chunk->SlotNames.size();
+  size_t SlotsNeeded = SlotBase + Callee.SlotNames.size();
+  if (Slots.size() < SlotsNeeded)
+    Slots.resize(2 * SlotsNeeded);
+  for (size_t I = 0; I < ArgCount; ++I)
+    Slots[SlotBase + I] = std::move(Stack[ArgBase + I]);
+
+  size_t Outer = Dynamic ? Frames.size() - 1 : 0;
+  Frames.push_back(Frame{&Callee, Callee.Code.data(), SlotBase, ArgBase,
+                         Outer, Dynamic});
+
+  size_t StackNeeded = ArgBase + Callee.MaxStack + 1;
+  if (Stack.size() < StackNeeded)
+    Stack.resize(2 * StackNeeded);
+}
+
+void BytecodeVM::checkArguments(const BytecodeChunk &Callee,
+                                cvm::BasicValue *Args, size_t ArgCount) {
+  const FunctionDefinitionAST &Function = *Callee.Function;
+  Walker::checkArgumentCount(Function, ArgCount);
+
+  auto It = Function.getParameterList().cbegin();
+  for (size_t I = 0; I < ArgCount; ++I)
+    Walker::coerceArgument(Function, *It++, Args[I]);
+}
+
+/// \brief Find a declared variable by name, like the tree walker does
+/// Slots of inner blocks come after the ones of their enclosing block, and
+/// blocks not being run are void, so scanning a frame downwards finds the
+/// innermost declaration. Only the globals of the top level frame are seen
+/// from a function, unless the top level called it dynamically.
+cvm::BasicValue &BytecodeVM::searchVariable(Symbol Name) {
+  size_t F = Frames.size() - 1;
+  bool WholeFrame = true;
+
+  for (;;) {
+    const Frame &Fr = Frames[F];
+    size_t Slot = WholeFrame ? Fr.Chunk->SlotNames.size() : Program.GlobalCount;
+    while (Slot-- > 0) {
+      cvm::BasicValue &V = Slots[Fr.SlotBase + Slot];
+      if (!V.isVoid() && Fr.Chunk->SlotNames[Slot] == Name)
+        return V;
+    }
+    if (F == 0)
+      break;
+    WholeFrame = Fr.Dynamic;
+    F = Fr.Outer;
+  }
+
+  Walker::RuntimeError("variable `" + Name.str() + "' is undefined");
+}
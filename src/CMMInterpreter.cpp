@@ -1,13 +1,14 @@
 #include "CMMInterpreter.h"
 #include "NativeFunctions.h"
-#include <cmath>
+#include "Runtime.h"
+#include <algorithm>
 
 using namespace cmm;
 
 int CMMInterpreter::interpret(int Argc, char *Argv[]) {
   // First run top level statements.
   for (auto &Stmt : TopLevelBlock.getStatementList()) {
-    ExecutionResult Res = executeStatement(&TopLevelEnv, Stmt.get());
+    ExecutionResult Res = executeStatement(&TopLevelEnv, Stmt);
 
     switch (Res.Kind) {
     default:
@@ -17,109 +18,44 @@ int CMMInterpreter::interpret(int Argc, char *Argv[]) {
     case ExecutionResult::ContinueStatementResult:
       RuntimeError("continue statement should be in a loop");
     case ExecutionResult::ReturnStatementResult:
-      if (Res.ReturnValue.isInt())
-        return Res.ReturnValue.IntVal;
-      RuntimeError("top level return statement should return integers, but " +
-          cvm::TypeToStr(Res.ReturnValue.Type) + Res.ReturnValue.toString() +
-          " is returned");
+      return cvm::checkTopLevelReturn(Res.ReturnValue);
     case ExecutionResult::NormalStatementResult:
       break;
     }
   }
 
   // Invoke main function is there is one
-  auto MainIt = UserFunctionMap.find("main");
+  auto MainIt = UserFunctionMap.find(Symbol::intern("main"));
   if (MainIt != UserFunctionMap.end()) {
-    std::list<cvm::BasicValue> Args;
-
-    if (MainIt->second.getParameterCount() == 0)
-      return callUserFunction(MainIt->second, Args).toInt();
+    if (MainIt->second.getParameterCount() == 0) {
+      return callUserFunction(MainIt->second,
+                              cvm::ArgumentList(nullptr, nullptr)).toInt();
+    }
 
-    auto ArgsPtr = std::make_shared<std::vector<cvm::BasicValue>>();
-    ArgsPtr->reserve(static_cast<size_t>(Argc));
+    std::vector<cvm::BasicValue> ArgVector;
+    ArgVector.reserve(static_cast<size_t>(Argc));
     for (int I = 0; I < Argc; ++I)
-      ArgsPtr->emplace_back(std::string(Argv[I]));
-    Args.emplace_back(cvm::StringType, ArgsPtr);
-    return callUserFunction(MainIt->second, Args).toInt();
+      ArgVector.emplace_back(std::string(Argv[I]));
+    cvm::BasicValue Args(cvm::StringType, std::move(ArgVector));
+    return callUserFunction(MainIt->second,
+                            cvm::ArgumentList(&Args, &Args + 1)).toInt();
   }
 
   return 0;
 }
 
-void CMMInterpreter::addNativeFunctions() {
-  NativeFunctionMap["typeof"] = cvm::Native::TypeOf;
-  NativeFunctionMap["len"] = cvm::Native::Length;
-  NativeFunctionMap["strlen"] = cvm::Native::StrLength;
-  NativeFunctionMap["print"] = cvm::Native::Print;
-  NativeFunctionMap["println"] = cvm::Native::PrintLn;
-  NativeFunctionMap["puts"] = cvm::Native::PrintLn;
-  NativeFunctionMap["system"] = cvm::Native::System;
-  NativeFunctionMap["random"] = cvm::Native::Random;
-  NativeFunctionMap["rand"] = cvm::Native::Random;
-  NativeFunctionMap["srand"] = cvm::Native::Srand;
-  NativeFunctionMap["time"] = cvm::Native::Time;
-  NativeFunctionMap["exit"] = cvm::Native::Exit;
-  NativeFunctionMap["toint"] = cvm::Native::ToInt;
-  NativeFunctionMap["todouble"] = cvm::Native::ToDouble;
-  NativeFunctionMap["tostring"] = cvm::Native::ToString;
-  NativeFunctionMap["str"] = cvm::Native::ToString;
-  NativeFunctionMap["tobool"] = cvm::Native::ToBool;
-  NativeFunctionMap["read"] = cvm::Native::Read;
-  NativeFunctionMap["readln"] = cvm::Native::ReadLn;
-  NativeFunctionMap["readint"] = cvm::Native::ReadInt;
-  NativeFunctionMap["sqrt"] = cvm::Native::Sqrt;
-  NativeFunctionMap["pow"] = cvm::Native::Pow;
-  NativeFunctionMap["exp"] = cvm::Native::Exp;
-  NativeFunctionMap["log"] = cvm::Native::Log;
-  NativeFunctionMap["log10"] = cvm::Native::Log10;
-
-#if defined(__APPLE__) || defined(__linux__)
-  NativeFunctionMap["UnixFork"] = cvm::Unix::Fork;
-
-  NativeFunctionMap["NcEndWin"] = cvm::Ncurses::EndWindow;
-  NativeFunctionMap["NcInitScr"] = cvm::Ncurses::InitScreen;
-  NativeFunctionMap["NcNoEcho"] = cvm::Ncurses::NoEcho;
-  NativeFunctionMap["NcCursSet"] = cvm::Ncurses::CursSet;
-  NativeFunctionMap["NcKeypad"] = cvm::Ncurses::Keypad;
-  NativeFunctionMap["NcTimeout"] = cvm::Ncurses::Timeout;
-  NativeFunctionMap["NcGetCh"] = cvm::Ncurses::GetChar;
-  NativeFunctionMap["NcMvAddCh"] = cvm::Ncurses::MoveAddChar;
-  NativeFunctionMap["NcMvAddStr"] = cvm::Ncurses::MoveAddString;
-  NativeFunctionMap["NcGetMaxY"] = cvm::Ncurses::GetMaxY;
-  NativeFunctionMap["NcGetMaxX"] = cvm::Ncurses::GetMaxX;
-  NativeFunctionMap["NcStartColor"] = cvm::Ncurses::StartColor;
-  NativeFunctionMap["NcInitPair"] = cvm::Ncurses::InitPair;
-  NativeFunctionMap["NcAttrOn"] = cvm::Ncurses::AttrOn;
-  NativeFunctionMap["NcAttrOff"] = cvm::Ncurses::AttrOff;
-  NativeFunctionMap["NcColorPair"] = cvm::Ncurses::ColorPair;
-
-#endif // defined(__APPLE__) || defined(__linux__)
-}
-
 void CMMInterpreter::RuntimeError(const std::string &Msg) {
-#if defined(__APPLE__) || defined(__linux__)
-  const char *StartColor = "\033[1;31m";
-  const char *EndColor = "\033[0m";
-  std::cerr << StartColor;
-#endif // defined(__APPLE__) || defined(__linux__)
-
-  std::cerr << "CMM Runtime Error: ";
-
-#if defined(__APPLE__) || defined(__linux__)
-  std::cerr << EndColor;
-#endif // defined(__APPLE__) || defined(__linux__)
-  std::cerr << Msg << std::endl;
-  std::exit(EXIT_FAILURE);
+  cvm::RuntimeError(Msg);
 }
 
 CMMInterpreter::ExecutionResult
 CMMInterpreter::executeBlock(VariableEnv *OuterEnv, const BlockAST *Block) {
 
   ExecutionResult Res;  // Stores last execution result.
-  VariableEnv CurrentEnv(OuterEnv);
+  VariableEnv CurrentEnv(Arena, Block->getLayout(), OuterEnv);
 
   for (auto &Stmt : Block->getStatementList()) {
-    Res = executeStatement(&CurrentEnv, Stmt.get());
+    Res = executeStatement(&CurrentEnv, Stmt);
     if (Res.Kind != ExecutionResult::NormalStatementResult)
       return Res;
   }
@@ -160,7 +96,7 @@ CMMInterpreter::executeStatement(VariableEnv *Env, const StatementAST *Stmt) {
 CMMInterpreter::ExecutionResult
 CMMInterpreter::executeIfStatement(VariableEnv *Env,
                                    const IfStatementAST *Stmt) {
-  if (evaluateExpression(Env, Stmt->getCondition()).toBool()) {
+  if (evaluateCondition(Env, Stmt->getCondition())) {
     return executeStatement(Env, Stmt->getStatementThen());
   }
   if (const StatementAST *StatementElse = Stmt->getStatementElse()) {
@@ -180,7 +116,7 @@ CMMInterpreter::executeForStatement(VariableEnv *Env,
     evaluateExpression(Env, Init);
   }
 
-  while (!Condition || evaluateExpression(Env, Condition).toBool()) {
+  while (!Condition || evaluateCondition(Env, Condition)) {
     ExecutionResult Res = executeStatement(Env, Statement);
 
     if (Res.Kind == Res.ReturnStatementResult)
@@ -200,7 +136,7 @@ CMMInterpreter::executeWhileStatement(VariableEnv *Env,
   const ExpressionAST *Condition = WhileStmt->getCondition();
   const StatementAST *Statement = WhileStmt->getStatement();
 
-  while (!Condition || evaluateExpression(Env, Condition).toBool()) {
+  while (!Condition || evaluateCondition(Env, Condition)) {
     ExecutionResult Res = executeStatement(Env, Statement);
 
     if (Res.Kind == Res.ReturnStatementResult)
@@ -214,8 +150,13 @@ CMMInterpreter::executeWhileStatement(VariableEnv *Env,
 CMMInterpreter::ExecutionResult
 CMMInterpreter::executeExprStatement(VariableEnv *Env,
                                      const ExprStatementAST *Stmt) {
+  const ExpressionAST *Expr = Stmt->getExpression();
+  if (Expr->getKind() == ExpressionAST::FunctionCallExpression &&
+      Expr->as_cptr<FunctionCallAST>()->isTailCall())
+    return prepareTailCall(Env, ExecutionResult::NormalStatementResult,
+                           Expr->as_cptr<FunctionCallAST>());
   return ExecutionResult(ExecutionResult::NormalStatementResult,
-                         evaluateExpression(Env, Stmt->getExpression()));
+                         evaluateExpression(Env, Expr));
 }
 
 CMMInterpreter::ExecutionResult
@@ -224,8 +165,13 @@ CMMInterpreter::executeReturnStatement(VariableEnv *Env,
   ExecutionResult Res(ExecutionResult::ReturnStatementResult);
 
   // ReturnValueExpr can be null.
-  if (const ExpressionAST *ReturnValueExpr = Stmt->getReturnValue())
+  if (const ExpressionAST *ReturnValueExpr = Stmt->getReturnValue()) {
+    if (ReturnValueExpr->getKind() == ExpressionAST::FunctionCallExpression &&
+        ReturnValueExpr->as_cptr<FunctionCallAST>()->isTailCall())
+      return prepareTailCall(Env, ExecutionResult::ReturnStatementResult,
+                             ReturnValueExpr->as_cptr<FunctionCallAST>());
     Res.ReturnValue = evaluateExpression(Env, ReturnValueExpr);
+  }
   return Res;
 }
 
@@ -245,7 +191,7 @@ CMMInterpreter::ExecutionResult
 CMMInterpreter::executeDeclarationList(VariableEnv *Env,
                                        const DeclarationListAST *DeclList) {
   for (auto &Declaration : DeclList->getDeclarationList()) {
-    executeDeclaration(Env, Declaration.get());
+    executeDeclaration(Env, Declaration);
   }
   return ExecutionResult();
 }
@@ -253,11 +199,12 @@ CMMInterpreter::executeDeclarationList(VariableEnv *Env,
 CMMInterpreter::ExecutionResult
 CMMInterpreter::executeDeclaration(VariableEnv *Env,
                                    const DeclarationAST *Decl) {
-  const std::string& Name = Decl->getName();
+  const std::string &Name = Decl->getName().str();
   cvm::BasicType Type = Decl->getType();
+  int Slot = Decl->getSlot();
 
-  if (Env->contain(Name)) {
-    RuntimeError("variable `" + Decl->getName() +
+  if (Env->contain(Slot)) {
+    RuntimeError("variable `" + Name +
         "' is already defined in current scope");
   }
 
@@ -265,47 +212,46 @@ CMMInterpreter::executeDeclaration(VariableEnv *Env,
     std::list<int> DimensionList;
 
     for (auto &E : Decl->getElementCountList()) {
-      cvm::BasicValue Dimension = evaluateExpression(Env, E.get());
-
-      if (!Dimension.isInt()) {
-        RuntimeError("expressions in array declaration `" + Name +
-            "' should be integral type");
-      }
-
-      if (Dimension.IntVal <= 0) {
-        RuntimeError("dimension of array `" + Name + "' declared to be " +
-            std::to_string(Dimension.IntVal) + "; positive number expected");
-      }
-
-      DimensionList.push_back(Dimension.IntVal);
+      cvm::BasicValue Temp;
+      DimensionList.push_back(
+          checkDimension(Decl, borrowExpression(Env, E, Temp)));
     }
 
-    Env->VarMap.emplace(std::make_pair(Name,
-                                       cvm::BasicValue(Type, DimensionList)));
+    Env->Slots[Slot] = cvm::BasicValue(Type, DimensionList);
   }
 
   // Now it's a normal variable.
   if (Decl->getInitializer()) {
     cvm::BasicValue Val = evaluateExpression(Env, Decl->getInitializer());
-
-    if (Val.Type != Decl->getType()) {
-      if (Decl->getType() == cvm::DoubleType && Val.isInt()) {
-        Val.Type = cvm::DoubleType;
-        Val.DoubleVal = static_cast<double>(Val.IntVal);
-      } else {
-        RuntimeError("variable `" + Name + "' is declared to be " +
-            cvm::TypeToStr(Decl->getType()) + ", but is initialized to be " +
-            cvm::TypeToStr(Val.Type));
-      }
+    switch (Decl->getInitializerCoercion()) {
+    case Coercion::Unchecked:
+      coerceInitializer(Decl, Val);
+      break;
+    case Coercion::IntToDouble:
+      Val = static_cast<double>(Val.getInt());
+      break;
+    case Coercion::Identity:
+      break;
     }
-    Env->VarMap.emplace(std::make_pair(Name, Val));
-  } else {
-    Env->VarMap.emplace(std::make_pair(Name, Decl->getType()));
+    if (!Env->contain(Slot))
+      Env->Slots[Slot] = std::move(Val);
+  } else if (!Env->contain(Slot)) {
+    Env->Slots[Slot] = cvm::BasicValue(Decl->getType());
   }
 
   return ExecutionResult();
 }
 
+int CMMInterpreter::checkDimension(const DeclarationAST *Decl,
+                                   const cvm::BasicValue &Dimension) {
+  return cvm::checkDimension(Decl->getName().str(), Dimension);
+}
+
+void CMMInterpreter::coerceInitializer(const DeclarationAST *Decl,
+                                       cvm::BasicValue &Val) {
+  cvm::coerceInitializer(Decl->getName().str(), Decl->getType(), Val);
+}
+
 cvm::BasicValue
 CMMInterpreter::evaluateExpression(VariableEnv *Env,
                                    const ExpressionAST *Expr) {
@@ -343,24 +289,41 @@ CMMInterpreter::evaluateExpression(VariableEnv *Env,
   }
 }
 
+/// \brief Evaluate Expr without copying the value of a variable
+/// The result is either the variable or Temp, and is only good until code that
+/// may assign the variable runs.
+const cvm::BasicValue &
+CMMInterpreter::borrowExpression(VariableEnv *Env, const ExpressionAST *Expr,
+                                 cvm::BasicValue &Temp) {
+  if (Expr->isIdentifierExpr())
+    return evaluateIdentifierExpr(Env, Expr->as_cptr<IdentifierAST>());
+  return Temp = evaluateExpression(Env, Expr);
+}
+
+bool CMMInterpreter::evaluateCondition(VariableEnv *Env,
+                                       const ExpressionAST *Expr) {
+  cvm::BasicValue Temp;
+  return borrowExpression(Env, Expr, Temp).toBool();
+}
+
 cvm::BasicValue
 CMMInterpreter::evaluateFunctionCallExpr(VariableEnv *Env,
                                          const FunctionCallAST *FuncCall) {
-  auto UserFuncIt = UserFunctionMap.find(FuncCall->getCallee());
-  if (UserFuncIt != UserFunctionMap.end()) {
-    auto Args(evaluateArgumentList(Env, FuncCall->getArguments()));
-    return callUserFunction(UserFuncIt->second, Args,
-                            FuncCall->isDynamicBound() ? Env : nullptr);
-  }
-
-  auto NativeFuncIt = NativeFunctionMap.find(FuncCall->getCallee());
-  if (NativeFuncIt != NativeFunctionMap.end()) {
-    auto Args(evaluateArgumentList(Env, FuncCall->getArguments()));
-    return callNativeFunction(NativeFuncIt->second, Args);
-  }
-
-  RuntimeError("function `" + FuncCall->getCallee() + "' is undefined");
-  return evaluateFunctionCallExpr(nullptr, nullptr); // Make the compiler happy.
+  const FunctionDefinitionAST *Function = FuncCall->getFunction();
+  NativeFunction Native = FuncCall->getNativeFunction();
+  if (!Function && !Native)
+    RuntimeError("function `" + FuncCall->getCallee().str() +
+                 "' is undefined");
+
+  size_t ArgBase = ArgumentStack.size();
+  cvm::ArgumentList Args = evaluateArgumentList(Env, FuncCall->getArguments());
+  cvm::BasicValue Res =
+      Function ? callUserFunction(*Function, Args,
+                                  FuncCall->isDynamicBound() ? Env : nullptr,
+                                  FuncCall->hasCheckedArguments())
+               : callNativeFunction(Native, Args);
+  ArgumentStack.resize(ArgBase);
+  return Res;
 }
 
 /// \brief Return a lvalue of an expression if possible
@@ -368,7 +331,7 @@ CMMInterpreter::evaluateFunctionCallExpr(VariableEnv *Env,
 /// 1. IdentifierExpression
 /// 2. ArrayIdentifier [ IndexExpression ]
 /// 3. IdentifierExpression = Expression
-cvm::BasicValue &
+CMMInterpreter::Lvalue
 CMMInterpreter::evaluateLvalueExpr(VariableEnv *Env,
                                    const ExpressionAST *Expr) {
   if (Expr->isIdentifierExpr())
@@ -381,29 +344,43 @@ CMMInterpreter::evaluateLvalueExpr(VariableEnv *Env,
     if (BinOpExpr->getOpKind() == BinaryOperatorAST::Index)
       return evaluateIndexExpr(Env, BinOpExpr->getLHS(), BinOpExpr->getRHS());
     if (BinOpExpr->getOpKind() == BinaryOperatorAST::Assign)
-      return evaluateAssignment(Env, BinOpExpr->getLHS(), BinOpExpr->getRHS());
+      return evaluateAssignment(Env, BinOpExpr);
 
     RuntimeError("try to evaluate a rvalue binOpExpr as lvalue");
   }
 
   RuntimeError("try to evaluate a rvalue expression as lvalue");
-  return evaluateLvalueExpr(nullptr, nullptr);  // Make the compiler happy.
 }
 
 /// \brief Return the reference of an identifier
+/// The resolver gives the frame and slot, unless the frame found at that depth
+/// belongs to a caller (`foo!()` dynamic binding) or the slot isn't declared
+/// yet; then fall back to a lookup by name.
 cvm::BasicValue &
 CMMInterpreter::evaluateIdentifierExpr(VariableEnv *Env,
                                        const IdentifierAST *IdExpr) {
-  return searchVariable(Env, IdExpr->getName())->second;
+  VariableEnv *E = Env;
+  for (int Depth = IdExpr->getDepth(); Depth > 0; --Depth)
+    E = E->OuterEnv;
+
+  if (E->Layout == IdExpr->getScope() && E->contain(IdExpr->getSlot()))
+    return E->Slots[IdExpr->getSlot()];
+  return searchVariable(Env, IdExpr->getName());
 }
 
 cvm::BasicValue
 CMMInterpreter::evaluateUnaryOpExpr(VariableEnv *Env,
                                     const UnaryOperatorAST *Expr) {
 
-  cvm::BasicValue Operand = evaluateExpression(Env, Expr->getOperand());
+  cvm::BasicValue Temp;
+  return evaluateUnaryCalc(Expr->getOpKind(),
+                           borrowExpression(Env, Expr->getOperand(), Temp));
+}
 
-  switch (auto OpKind = Expr->getOpKind()) {
+cvm::BasicValue
+CMMInterpreter::evaluateUnaryCalc(UnaryOperatorAST::OperatorKind OpKind,
+                                  const cvm::BasicValue &Operand) {
+  switch (OpKind) {
   default:
     RuntimeError("unknown unary operator kind (code :" +
         std::to_string(OpKind) + ")");
@@ -420,50 +397,36 @@ CMMInterpreter::evaluateUnaryOpExpr(VariableEnv *Env,
   }
 }
 
-/// \brief Perform unary arithmetic operation (+,-) on value
 cvm::BasicValue
 CMMInterpreter::evaluateUnaryArith(UnaryOperatorAST::OperatorKind OpKind,
-                                   cvm::BasicValue Operand) {
-  if (!Operand.isNumeric()) {
-    RuntimeError("operands of unary arithmetic operations should be numeric");
-  }
+                                   const cvm::BasicValue &Operand) {
   if (OpKind == UnaryOperatorAST::Plus)
-    return Operand;
-  if (OpKind == UnaryOperatorAST::Minus) {
-    if (Operand.isInt())
-      return -Operand.IntVal;
-    else
-      return -Operand.DoubleVal;
-  }
+    return cvm::unaryPlus(Operand);
+  if (OpKind == UnaryOperatorAST::Minus)
+    return cvm::unaryMinus(Operand);
 
   RuntimeError(std::to_string(OpKind) +
       " is not valid unary arithmetic operation kind");
-  return cvm::BasicValue(); // Make the compiler happy.
 }
 
-/// \brief Perform unary bitwise operation (!) on value
 cvm::BasicValue
 CMMInterpreter::evaluateUnaryLogical(UnaryOperatorAST::OperatorKind OpKind,
-                                     cvm::BasicValue Operand) {
+                                     const cvm::BasicValue &Operand) {
   if (OpKind != UnaryOperatorAST::LogicalNot) {
     RuntimeError(std::to_string(OpKind) +
         " is not valid unary logical operation kind");
   }
-  return !Operand.toBool();
+  return cvm::logicalNot(Operand);
 }
 
-/// \brief Perform unary bitwise operation (~) on value
 cvm::BasicValue
 CMMInterpreter::evaluateUnaryBitwise(UnaryOperatorAST::OperatorKind OpKind,
-                                     cvm::BasicValue Operand) {
+                                     const cvm::BasicValue &Operand) {
   if (OpKind != UnaryOperatorAST::BitwiseNot) {
     RuntimeError(std::to_string(OpKind) +
         " is not valid unary bitwise operation kind");
   }
-  if (!Operand.isInt()) {
-    RuntimeError("operand of unary bitwise operation should be int");
-  }
-  return ~Operand.IntVal;
+  return cvm::bitwiseNot(Operand);
 }
 
 cvm::BasicValue
@@ -471,14 +434,55 @@ CMMInterpreter::evaluateBinaryOpExpr(VariableEnv *Env,
                                      const BinaryOperatorAST *Expr) {
   switch (Expr->getOpKind()) {
   default: {
-    cvm::BasicValue LHS = evaluateExpression(Env, Expr->getLHS());
-    cvm::BasicValue RHS = evaluateExpression(Env, Expr->getRHS());
+    // The left operand may only refer to a variable if evaluating the right
+    // one can't assign it.
+    cvm::BasicValue LTemp, RTemp;
+    const ExpressionAST *RHSExpr = Expr->getRHS();
+    bool BorrowLHS = RHSExpr->isIdentifierExpr() || RHSExpr->isConstant();
+    const cvm::BasicValue &LHS =
+        BorrowLHS ? borrowExpression(Env, Expr->getLHS(), LTemp)
+                  : (LTemp = evaluateExpression(Env, Expr->getLHS()));
+    const cvm::BasicValue &RHS = borrowExpression(Env, RHSExpr, RTemp);
+
+    if (LHS.isInt() && RHS.isInt()) {
+      int L = LHS.getInt(), R = RHS.getInt();
+      switch (Expr->getQuickKind()) {
+      case BinaryOperatorAST::IntAdd:          return L + R;
+      case BinaryOperatorAST::IntMinus:        return L - R;
+      case BinaryOperatorAST::IntMultiply:     return L * R;
+      case BinaryOperatorAST::IntDivision:
+        if (R == 0)
+          RuntimeError("int division by zero");
+        return L / R;
+      case BinaryOperatorAST::IntModulo:
+        if (R == 0)
+          RuntimeError("int modulo by zero");
+        return L % R;
+      case BinaryOperatorAST::IntLess:         return L < R;
+      case BinaryOperatorAST::IntLessEqual:    return L <= R;
+      case BinaryOperatorAST::IntEqual:        return L == R;
+      case BinaryOperatorAST::IntNotEqual:     return L != R;
+      case BinaryOperatorAST::IntGreater:      return L > R;
+      case BinaryOperatorAST::IntGreaterEqual: return L >= R;
+      case BinaryOperatorAST::IntBitwiseAnd:   return L & R;
+      case BinaryOperatorAST::IntBitwiseOr:    return L | R;
+      case BinaryOperatorAST::IntBitwiseXor:   return L ^ R;
+      case BinaryOperatorAST::IntLeftShift:    return L << R;
+      case BinaryOperatorAST::IntRightShift:   return L >> R;
+      default:
+        break;
+      }
+    }
+    if (Expr->getQuickKind() >= BinaryOperatorAST::DoubleAdd)
+      return evaluateDoubleOp(Expr->getQuickKind(), LHS, RHS);
+    if (Expr->getQuickKind() != BinaryOperatorAST::Generic)
+      quickenBinaryOpExpr(Expr, LHS, RHS);
     return evaluateBinaryCalc(Expr->getOpKind(), LHS, RHS);
   }
   case BinaryOperatorAST::Assign:
-    return evaluateAssignment(Env, Expr->getLHS(), Expr->getRHS());
+    return evaluateAssignment(Env, Expr).load();
   case BinaryOperatorAST::Index:
-    return evaluateIndexExpr(Env, Expr->getLHS(), Expr->getRHS());
+    return evaluateIndexExpr(Env, Expr->getLHS(), Expr->getRHS()).load();
   case BinaryOperatorAST::LogicalAnd:
     return evaluateLogicalAnd(Env, Expr->getLHS(), Expr->getRHS());
   case BinaryOperatorAST::LogicalOr:
@@ -486,39 +490,81 @@ CMMInterpreter::evaluateBinaryOpExpr(VariableEnv *Env,
   }
 }
 
-cvm::BasicValue &
+/// \brief Rewrite Expr for the operands it got, or to Generic if a quickened
+/// Expr got operands it can't handle
+void CMMInterpreter::quickenBinaryOpExpr(const BinaryOperatorAST *Expr,
+                                         const cvm::BasicValue &LHS,
+                                         const cvm::BasicValue &RHS) {
+  BinaryOperatorAST::QuickKind K = BinaryOperatorAST::Generic;
+  if (Expr->getQuickKind() == BinaryOperatorAST::Unquickened &&
+      LHS.isInt() && RHS.isInt())
+    K = BinaryOperatorAST::getIntQuickKind(Expr->getOpKind());
+  Expr->quicken(K);
+}
+
+/// \brief Compute a Double* quickened operator, whose operands the
+/// TypeChecker proved to be numbers
+cvm::BasicValue
+CMMInterpreter::evaluateDoubleOp(BinaryOperatorAST::QuickKind K,
+                                 const cvm::BasicValue &LHS,
+                                 const cvm::BasicValue &RHS) {
+  double L = LHS.isInt() ? LHS.getInt() : LHS.getDouble();
+  double R = RHS.isInt() ? RHS.getInt() : RHS.getDouble();
+  switch (K) {
+  default:
+    RuntimeError("bad quickened operator kind (code :" + std::to_string(K) +
+        ")");
+  case BinaryOperatorAST::DoubleAdd:          return L + R;
+  case BinaryOperatorAST::DoubleMinus:        return L - R;
+  case BinaryOperatorAST::DoubleMultiply:     return L * R;
+  case BinaryOperatorAST::DoubleDivision:     return L / R;
+  case BinaryOperatorAST::DoubleLess:         return L < R;
+  case BinaryOperatorAST::DoubleLessEqual:    return L <= R;
+  case BinaryOperatorAST::DoubleEqual:        return L == R;
+  case BinaryOperatorAST::DoubleNotEqual:     return L != R;
+  case BinaryOperatorAST::DoubleGreater:      return L > R;
+  // Like BasicValue, which holds NaN >= anything.
+  case BinaryOperatorAST::DoubleGreaterEqual: return !(L < R);
+  }
+}
+
+CMMInterpreter::Lvalue
 CMMInterpreter::evaluateIndexExpr(VariableEnv *Env,
                                   const ExpressionAST *BaseExpr,
                                   const ExpressionAST *IndexExpr) {
 
-  cvm::BasicValue &Base = evaluateLvalueExpr(Env, BaseExpr);
-  if (!Base.isArray())
-    RuntimeError("too many index or index expression didn't start with array");
+  cvm::BasicValue Base = evaluateLvalueExpr(Env, BaseExpr).load();
+  checkIndexBase(Base);
 
-  cvm::BasicValue Index = evaluateExpression(Env, IndexExpr);
-  if (!Index.isInt())
-    RuntimeError("non-int index in index expression");
+  cvm::BasicValue Temp;
+  return Lvalue(Base,
+                checkIndex(Base, borrowExpression(Env, IndexExpr, Temp)));
+}
 
-  size_t ArraySize = Base.ArrayPtr->size();
-  if (Index.IntVal < 0 || Index.IntVal >= static_cast<int>(ArraySize)) {
-    RuntimeError("index out of range: should within [0," +
-        std::to_string(ArraySize) + "); actually got index " +
-        std::to_string(Index .IntVal));
-  }
-  return Base.ArrayPtr->at(static_cast<size_t>(Index.IntVal));
+void CMMInterpreter::checkIndexBase(const cvm::BasicValue &Base) {
+  cvm::checkIndexBase(Base);
+}
+
+int CMMInterpreter::checkIndex(const cvm::BasicValue &Base,
+                               const cvm::BasicValue &Index) {
+  return cvm::checkIndex(Base, Index);
+}
+
+cvm::BasicValue CMMInterpreter::storeElement(const cvm::BasicValue &Base,
+                                             int Index,
+                                             const cvm::BasicValue &Value) {
+  return cvm::storeElement(Base, Index, Value);
 }
 
 cvm::BasicValue
 CMMInterpreter::evaluateBinaryCalc(BinaryOperatorAST::OperatorKind OpKind,
-                                   cvm::BasicValue LHS, cvm::BasicValue RHS) {
+                                   const cvm::BasicValue &LHS,
+                                   const cvm::BasicValue &RHS) {
   switch (OpKind) {
   default:
     RuntimeError("unknown binary operator kind (code :" +
         std::to_string(OpKind) + ")");
   case BinaryOperatorAST::Add:
-    if (LHS.isString() || RHS.isString())
-      return LHS.toString() + RHS.toString();
-    /* fall Through */
   case BinaryOperatorAST::Minus:
   case BinaryOperatorAST::Multiply:
   case BinaryOperatorAST::Division:
@@ -547,57 +593,28 @@ CMMInterpreter::evaluateBinaryCalc(BinaryOperatorAST::OperatorKind OpKind,
     RuntimeError("assignment/index/logicalBinOp "
                      "should be handled in evaluateBinaryOpExpr");
   }
-  return cvm::BasicValue(); // Make the compiler happy.
 }
 
-/// \brief Perform binary arithmetic operation (+,-,*,/) on values
+/// \brief Perform binary arithmetic operation (+,-,*,/,%) on values
 cvm::BasicValue
 CMMInterpreter::evaluateBinArith(BinaryOperatorAST::OperatorKind OpKind,
-                                 cvm::BasicValue LHS, cvm::BasicValue RHS) {
-  if (!LHS.isNumeric() || !RHS.isNumeric()) {
-    RuntimeError("operands of binary arithmetic operations should be numeric");
-  }
-
-  if (LHS.isInt() && RHS.isInt()) {
-    switch (OpKind) {
-    default:
-      RuntimeError(std::to_string(OpKind) +
-          " is not valid binary arithmetic operation kind");
-    case BinaryOperatorAST::Add:
-      return LHS.IntVal + RHS.IntVal;
-    case BinaryOperatorAST::Minus:
-      return LHS.IntVal - RHS.IntVal;
-    case BinaryOperatorAST::Multiply:
-      return LHS.IntVal * RHS.IntVal;
-    case BinaryOperatorAST::Modulo:
-      if (RHS.IntVal == 0)
-        RuntimeError("int modulo by zero");
-      return LHS.IntVal % RHS.IntVal;
-    case BinaryOperatorAST::Division:
-      if (RHS.IntVal == 0)
-        RuntimeError("int division by zero");
-      return LHS.IntVal / RHS.IntVal;
-    }
-  }
-
-  double L = LHS.toDouble(), R = RHS.toDouble();
+                                 const cvm::BasicValue &LHS,
+                                 const cvm::BasicValue &RHS) {
   switch (OpKind) {
   default:
     RuntimeError(std::to_string(OpKind) +
         " is not a valid binary arithmetic operation kind");
   case BinaryOperatorAST::Add:
-    return L + R;
+    return cvm::add(LHS, RHS);
   case BinaryOperatorAST::Minus:
-    return L - R;
+    return cvm::subtract(LHS, RHS);
   case BinaryOperatorAST::Multiply:
-    return L * R;
+    return cvm::multiply(LHS, RHS);
   case BinaryOperatorAST::Division:
-    return L / R;
+    return cvm::divide(LHS, RHS);
   case BinaryOperatorAST::Modulo:
-    //RuntimeError("operands of modulo operator should be int");
-    return std::fmod(L, R);
+    return cvm::modulo(LHS, RHS);
   }
-  return cvm::BasicValue(); // Make the compiler happy.
 }
 
 /// \brief Perform binary logical and (&&) on expressions
@@ -606,8 +623,7 @@ cvm::BasicValue
 CMMInterpreter::evaluateLogicalAnd(VariableEnv *Env,
                                    const ExpressionAST *LHS,
                                    const ExpressionAST *RHS) {
-  return evaluateExpression(Env, LHS).toBool() &&
-      evaluateExpression(Env, RHS).toBool();
+  return evaluateCondition(Env, LHS) && evaluateCondition(Env, RHS);
 }
 
 /// \brief Perform binary logical or (||) on expressions
@@ -616,182 +632,261 @@ cvm::BasicValue
 CMMInterpreter::evaluateLogicalOr(VariableEnv *Env,
                                    const ExpressionAST *LHS,
                                    const ExpressionAST *RHS) {
-  return evaluateExpression(Env, LHS).toBool() ||
-      evaluateExpression(Env, RHS).toBool();
+  return evaluateCondition(Env, LHS) || evaluateCondition(Env, RHS);
 }
 
 /// \brief Perform binary relational operation (<, <=, ==, !=, >, >=) on values
 cvm::BasicValue
 CMMInterpreter::evaluateBinRelation(BinaryOperatorAST::OperatorKind OpKind,
-                                    cvm::BasicValue LHS, cvm::BasicValue RHS) {
-  if (LHS.Type != RHS.Type) {
-    if (LHS.isNumeric() && RHS.isNumeric()) {
-      return evaluateBinRelation(OpKind, LHS.toDouble(), RHS.toDouble());
-    }
-    RuntimeError("relational operator should apply to identical type");
-  }
-
+                                    const cvm::BasicValue &LHS,
+                                    const cvm::BasicValue &RHS) {
   switch (OpKind) {
   default:
     RuntimeError(std::to_string(OpKind) +
         " is not a valid binary relational operation kind");
   case cmm::BinaryOperatorAST::Less:
-    return LHS < RHS;
+    return cvm::less(LHS, RHS);
   case cmm::BinaryOperatorAST::LessEqual:
-    return LHS <= RHS;
+    return cvm::lessEqual(LHS, RHS);
   case cmm::BinaryOperatorAST::Equal:
-    return LHS == RHS;
+    return cvm::equal(LHS, RHS);
   case cmm::BinaryOperatorAST::NotEqual:
-    return LHS != RHS;
+    return cvm::notEqual(LHS, RHS);
   case cmm::BinaryOperatorAST::Greater:
-    return LHS > RHS;
+    return cvm::greater(LHS, RHS);
   case cmm::BinaryOperatorAST::GreaterEqual:
-    return LHS >= RHS;
+    return cvm::greaterEqual(LHS, RHS);
   }
 }
 
-/// \brief Perform binary bitwise operation (<<,>>,&,|) on values
+/// \brief Perform binary bitwise operation (<<,>>,&,|,^) on values
 cvm::BasicValue
 CMMInterpreter::evaluateBinBitwise(BinaryOperatorAST::OperatorKind OpKind,
-                                   cvm::BasicValue LHS, cvm::BasicValue RHS) {
-  if (!LHS.isInt() || !RHS.isInt()) {
-    RuntimeError("operands of bitwise operations should be int");
-  }
-
+                                   const cvm::BasicValue &LHS,
+                                   const cvm::BasicValue &RHS) {
   switch (OpKind) {
   default:
     RuntimeError(std::to_string(OpKind) +
         " is not a valid binary bitwise operation kind");
   case cmm::BinaryOperatorAST::BitwiseAnd:
-    return LHS.IntVal & RHS.IntVal;
+    return cvm::bitwiseAnd(LHS, RHS);
   case cmm::BinaryOperatorAST::BitwiseOr:
-    return LHS.IntVal | RHS.IntVal;
+    return cvm::bitwiseOr(LHS, RHS);
   case cmm::BinaryOperatorAST::BitwiseXor:
-    return LHS.IntVal ^ RHS.IntVal;
+    return cvm::bitwiseXor(LHS, RHS);
   case cmm::BinaryOperatorAST::LeftShift:
-    return LHS.IntVal << RHS.IntVal;
+    return cvm::leftShift(LHS, RHS);
   case cmm::BinaryOperatorAST::RightShift:
-    return LHS.IntVal >> RHS.IntVal;
+    return cvm::rightShift(LHS, RHS);
   }
 }
 
 
-std::map<std::string, cvm::BasicValue>::iterator
-CMMInterpreter::searchVariable(VariableEnv *Env, const std::string &Name) {
+cvm::BasicValue &
+CMMInterpreter::searchVariable(VariableEnv *Env, Symbol Name) {
 
   for (VariableEnv *E = Env; E != nullptr; E = E->OuterEnv) {
-    std::map<std::string, cvm::BasicValue>::iterator It = E->VarMap.find(Name);
-    if (It != E->VarMap.end())
-      return It;
+    int Slot = E->Layout->findSlot(Name);
+    if (Slot >= 0 && E->contain(Slot))
+      return E->Slots[Slot];
   }
-  RuntimeError("variable `" + Name + "' is undefined");
-  return searchVariable(nullptr, nullptr); // Make the compiler happy.
+  RuntimeError("variable `" + Name.str() + "' is undefined");
 }
 
-std::list<cvm::BasicValue>
-CMMInterpreter::evaluateArgumentList(VariableEnv *Env, const std::list
-    <std::unique_ptr<ExpressionAST>> &Args) {
+cvm::ArgumentList
+CMMInterpreter::evaluateArgumentList(VariableEnv *Env,
+                                     ASTArray<ExpressionAST *> Args) {
 
-  std::list<cvm::BasicValue> Res;
-  for (auto &P : Args) {
-    Res.emplace_back(evaluateExpression(Env, P.get()));
+  size_t Base = ArgumentStack.size();
+  for (ExpressionAST *P : Args) {
+    ArgumentStack.push_back(evaluateExpression(Env, P));
   }
-  return Res;
+  return cvm::ArgumentList(ArgumentStack.data() + Base,
+                           ArgumentStack.data() + ArgumentStack.size());
 }
 
 cvm::BasicValue
 CMMInterpreter::callNativeFunction(const NativeFunction &Function,
-                                   std::list<cvm::BasicValue> &Args) {
-  return Function(Args);
+                                   cvm::ArgumentList Args) {
+  if (!Prof)
+    return Function(Args);
+
+  Prof->enterNative(Function);
+  cvm::BasicValue Res = Function(Args);
+  Prof->leave();
+  return Res;
 }
 
 cvm::BasicValue
 CMMInterpreter::evaluateInfixOpExpr(VariableEnv *Env,
                                     const InfixOpExprAST *Expr) {
-  auto InfixOpIt = InfixOpMap.find(Expr->getSymbol());
-
-  if (InfixOpIt == InfixOpMap.end()) {
-    RuntimeError("Infix operator " + Expr->getSymbol() + " is undefined");
+  if (!Expr->getDefinition()) {
+    RuntimeError("Infix operator " + Expr->getSymbol().str() +
+                 " is undefined");
   }
 
-  const InfixOpDefinitionAST &InfixOpDef = InfixOpIt->second;
-  VariableEnv InfixOpEnv(&TopLevelEnv);
+  const InfixOpDefinitionAST &InfixOpDef = *Expr->getDefinition();
+  VariableEnv InfixOpEnv(Arena, InfixOpDef.getLayout(), &TopLevelEnv);
 
-  cvm::BasicValue LHSVal = evaluateExpression(Env, Expr->getLHS());
-  cvm::BasicValue RHSVal = evaluateExpression(Env, Expr->getRHS());
-  InfixOpEnv.VarMap.emplace(std::make_pair(InfixOpDef.getLHSName(), LHSVal));
-  InfixOpEnv.VarMap.emplace(std::make_pair(InfixOpDef.getRHSName(), RHSVal));
+  // Operands take the first two slots of the layout.
+  InfixOpEnv.Slots[0] = evaluateExpression(Env, Expr->getLHS());
+  InfixOpEnv.Slots[1] = evaluateExpression(Env, Expr->getRHS());
 
+  if (Prof)
+    Prof->enterInfixOp(InfixOpDef);
   ExecutionResult Result = executeStatement(&InfixOpEnv,
                                             InfixOpDef.getStatement());
+  if (Prof)
+    Prof->leave();
 
-  if (Result.ReturnValue.isVoid()) {
-    RuntimeError("infix operator didn't return any value");
-  }
+  checkInfixOpValue(Result.ReturnValue);
   return Result.ReturnValue;
 }
 
+void CMMInterpreter::checkInfixOpValue(const cvm::BasicValue &Value) {
+  cvm::checkInfixOpValue(Value);
+}
+
+/// \brief Evaluate the arguments of a tail call onto ArgumentStack and return
+/// the result asking callUserFunction to make the call
+/// The frames of the caller are gone by the time it does, so the call doesn't
+/// grow the C++ stack.
+CMMInterpreter::ExecutionResult
+CMMInterpreter::prepareTailCall(VariableEnv *Env,
+                                ExecutionResult::ExecutionResultKind Kind,
+                                const FunctionCallAST *FuncCall) {
+  evaluateArgumentList(Env, FuncCall->getArguments());
+  ExecutionResult Res(Kind);
+  Res.TailCall = FuncCall;
+  return Res;
+}
+
+/// \brief Call Function with Args, in a frame whose outer frame is Env, or the
+/// top level frame if Env is null
+/// CheckedArguments tells that the TypeChecker proved every argument to have
+/// the type of its parameter.
 cvm::BasicValue
 CMMInterpreter::callUserFunction(const FunctionDefinitionAST &Function,
-                                 std::list<cvm::BasicValue> &Args,
-                                 VariableEnv *Env) {
-  if (Args.size() != Function.getParameterCount()) {
-    RuntimeError("Function `" + Function.getName() + "' expects " +
-        std::to_string(Function.getParameterCount()) + " parameter(s), " +
-        std::to_string(Args.size()) + " argument(s) provided");
-  }
-
-  VariableEnv FuncEnv(Env ? Env : &TopLevelEnv);
+                                 cvm::ArgumentList Args, VariableEnv *Env,
+                                 bool CheckedArguments) {
+  checkArgumentCount(Function, Args.size());
+
+  VariableEnv FuncEnv(Arena, Function.getLayout(),
+                      Env ? Env : &TopLevelEnv);
+  bindArguments(Function, FuncEnv, Args, CheckedArguments);
+  if (Prof)
+    Prof->enterFunction(Function);
+
+  // Run tail calls in the same frame until a function returns a value.
+  const FunctionDefinitionAST *Callee = &Function;
+  size_t CheckBase = ReturnChecks.size();
+  for (;;) {
+    ExecutionResult Result = executeStatement(&FuncEnv, Callee->getStatement());
+    if (!Result.TailCall) {
+      if (Result.Kind == ExecutionResult::ReturnStatementResult &&
+          !Callee->hasCheckedReturns())
+        checkReturnValue(*Callee, Result.ReturnValue);
+      // The innermost pending check comes first, as if the calls returned.
+      for (size_t I = ReturnChecks.size(); I-- > CheckBase;)
+        checkReturnValue(*ReturnChecks[I], Result.ReturnValue);
+      ReturnChecks.resize(CheckBase);
+      if (Prof)
+        Prof->leave();
+      return Result.ReturnValue;
+    }
 
-  auto It = Function.getParameterList().cbegin();
-  auto End = Function.getParameterList().cend();
-  for (cvm::BasicValue &Arg : Args) {
-    if (It->getType() != Arg.Type) {
-      if (Arg.isInt() && It->getType() == cvm::DoubleType) {
-        Arg.DoubleVal = Arg.IntVal;
-        Arg.Type = cvm::DoubleType;
-      } else {
-        RuntimeError("in function `" + Function.getName() + "', parameter `" +
-          It->getName() + "' has type " + cvm::TypeToStr(It->getType()) +
-          ", but argument is " + cvm::TypeToStr(Arg.Type));
-      }
+    // Checking twice against the same function adds nothing, so self
+    // recursion keeps a single entry.
+    if (Result.Kind == ExecutionResult::ReturnStatementResult &&
+        !Callee->hasCheckedReturns()) {
+      auto It = std::find(ReturnChecks.begin() + CheckBase, ReturnChecks.end(),
+                          Callee);
+      if (It != ReturnChecks.end())
+        ReturnChecks.erase(It);
+      ReturnChecks.push_back(Callee);
     }
 
-    if (!It->getName().empty()) // We allow empty parameter name.
-      FuncEnv.VarMap.emplace(It->getName(), Arg);
-    ++It;
+    Callee = Result.TailCall->getFunction();
+    size_t ArgBase =
+        ArgumentStack.size() - Result.TailCall->getArguments().size();
+    cvm::ArgumentList TailArgs(ArgumentStack.data() + ArgBase,
+                               ArgumentStack.data() + ArgumentStack.size());
+    checkArgumentCount(*Callee, TailArgs.size());
+    FuncEnv.reset(Callee->getLayout(), &TopLevelEnv);
+    bindArguments(*Callee, FuncEnv, TailArgs,
+                  Result.TailCall->hasCheckedArguments());
+    ArgumentStack.resize(ArgBase);
+    // The callee replaces the caller on the shadow stack too.
+    if (Prof) {
+      Prof->leave();
+      Prof->enterFunction(*Callee);
+    }
   }
+}
 
-  ExecutionResult Result = executeStatement(&FuncEnv, Function.getStatement());
-  if (Result.Kind == ExecutionResult::ReturnStatementResult &&
-      Result.ReturnValue.Type != Function.getType()) {
-    RuntimeError("function `" + Function.getName() + "' ought to return " +
-        cvm::TypeToStr(Function.getType()) + ", but got " +
-        cvm::TypeToStr(Result.ReturnValue.Type));
+/// \brief Move Args into the parameter slots of FuncEnv, checking them
+/// unless Checked
+/// Args may point into ArgumentStack, so it must not be used once the body
+/// runs.
+void CMMInterpreter::bindArguments(const FunctionDefinitionAST &Function,
+                                   VariableEnv &FuncEnv,
+                                   cvm::ArgumentList Args, bool Checked) {
+  // Parameters take the leading slots of the layout, in order.
+  auto It = Function.getParameterList().cbegin();
+  size_t Slot = 0;
+  for (cvm::BasicValue &Arg : Args) {
+    const Parameter &Param = *It++;
+    if (!Checked)
+      coerceArgument(Function, Param, Arg);
+    FuncEnv.Slots[Slot++] = std::move(Arg);
   }
-  return Result.ReturnValue;
 }
 
-cvm::BasicValue &
+void CMMInterpreter::checkArgumentCount(const FunctionDefinitionAST &Function,
+                                        size_t Count) {
+  if (Count != Function.getParameterCount())
+    cvm::checkArgumentCount(Function.getName().str(),
+                            Function.getParameterCount(), Count);
+}
+
+void CMMInterpreter::coerceArgument(const FunctionDefinitionAST &Function,
+                                    const Parameter &Param,
+                                    cvm::BasicValue &Arg) {
+  if (Arg.getType() != Param.getType())
+    cvm::coerceArgument(Function.getName().str(), Param.getName().str(),
+                        Param.getType(), Arg);
+}
+
+void CMMInterpreter::checkReturnValue(const FunctionDefinitionAST &Function,
+                                      const cvm::BasicValue &Value) {
+  if (Value.getType() != Function.getType())
+    cvm::checkReturnValue(Function.getName().str(), Function.getType(), Value);
+}
+
+/// \brief Perform an assignment and return what it assigned
+/// The variable keeps its type, and a value the TypeChecker proved to have it
+/// is stored without checks; an array still can't be assigned to.
+CMMInterpreter::Lvalue
 CMMInterpreter::evaluateAssignment(VariableEnv *Env,
-                                   const ExpressionAST *RefExpr,
-                                   const ExpressionAST *ValExpr) {
-  cvm::BasicValue &Variable = evaluateLvalueExpr(Env, RefExpr);
-  cvm::BasicValue Value = evaluateExpression(Env, ValExpr);
-
-  if (Variable.isArray()) {
-    RuntimeError("cannot assign value to array directly");
-  }
-
-  if (Variable.Type != Value.Type) {
-    if (Variable.isDouble() && Value.isInt()) {
-      Variable.DoubleVal = Value.IntVal;
-      return Variable;
-    } else {
-      RuntimeError("assignment to " + cvm::TypeToStr(Variable.Type) +
-          " variable with " + cvm::TypeToStr(Value.Type) + " expression");
-    }
+                                   const BinaryOperatorAST *Expr) {
+  Lvalue Ref = evaluateLvalueExpr(Env, Expr->getLHS());
+  cvm::BasicValue Value = evaluateExpression(Env, Expr->getRHS());
+  if (!Ref.Variable) {
+    storeElement(Ref.Array, Ref.Index, Value);
+    return Ref;
   }
-  return Variable = Value;
+
+  Coercion C = Expr->getAssignCoercion();
+  if (C == Coercion::Unchecked || Ref.Variable->isArray())
+    assignValue(*Ref.Variable, std::move(Value));
+  else if (C == Coercion::IntToDouble)
+    *Ref.Variable = static_cast<double>(Value.getInt());
+  else
+    *Ref.Variable = std::move(Value);
+  return Ref;
 }
 
+cvm::BasicValue &CMMInterpreter::assignValue(cvm::BasicValue &Variable,
+                                             cvm::BasicValue Value) {
+  return cvm::assignValue(Variable, std::move(Value));
+}
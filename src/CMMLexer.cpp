@@ -1,9 +1,92 @@
 #include "CMMLexer.h"
 #include <iostream>
-#include <cctype>
+#include <cstring>
 
 using namespace cmm;
 
+namespace {
+/// Classes of a source character, as bits of CharClasses.
+enum CharClass : unsigned char {
+  Blank = 1,  ///< skipped between tokens
+  Space = 2,  ///< std::isspace
+  Alpha = 4,
+  Digit = 8,
+  Hex = 16,   ///< a-f and A-F
+  Under = 32  ///< _
+};
+
+/// Bytes above 0x7f belong to no class.
+const unsigned char CharClasses[256] = {
+  Blank, 0, 0, 0, 0, 0, 0, 0,
+  0, Blank|Space, Blank|Space, Space, Space, Blank|Space, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0,
+  Blank|Space, 0, 0, 0, 0, 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0,
+  Digit, Digit, Digit, Digit, Digit, Digit, Digit, Digit,
+  Digit, Digit, 0, 0, 0, 0, 0, 0,
+  0, Alpha|Hex, Alpha|Hex, Alpha|Hex, Alpha|Hex, Alpha|Hex, Alpha|Hex, Alpha,
+  Alpha, Alpha, Alpha, Alpha, Alpha, Alpha, Alpha, Alpha,
+  Alpha, Alpha, Alpha, Alpha, Alpha, Alpha, Alpha, Alpha,
+  Alpha, Alpha, Alpha, 0, 0, 0, 0, Under,
+  0, Alpha|Hex, Alpha|Hex, Alpha|Hex, Alpha|Hex, Alpha|Hex, Alpha|Hex, Alpha,
+  Alpha, Alpha, Alpha, Alpha, Alpha, Alpha, Alpha, Alpha,
+  Alpha, Alpha, Alpha, Alpha, Alpha, Alpha, Alpha, Alpha,
+  Alpha, Alpha, Alpha, 0, 0, 0, 0, 0
+};
+
+/// Characters are ints as getNextChar() returns them; EOF is in no class.
+inline bool isCharClass(int C, unsigned Classes) {
+  return CharClasses[static_cast<unsigned char>(C)] & Classes;
+}
+
+inline bool isDigitChar(int C) { return isCharClass(C, Digit); }
+inline bool isHexDigitChar(int C) { return isCharClass(C, Digit | Hex); }
+inline bool isIdentifierChar(int C) {
+  return isCharClass(C, Alpha | Digit | Under);
+}
+
+struct Keyword {
+  const char *Spelling;
+  Token::TokenKind Kind;
+};
+
+/// Keywords by keywordHash(); the hash has no collision among them, so one
+/// comparison tells a keyword from an identifier. Empty slots are nullptr.
+const Keyword Keywords[32] = {
+  {nullptr, Token::Identifier},    {nullptr, Token::Identifier},
+  {"int", Token::Kw_int},          {"string", Token::Kw_string},
+  {"infix", Token::Kw_infix},      {"continue", Token::Kw_continue},
+  {nullptr, Token::Identifier},    {nullptr, Token::Identifier},
+  {nullptr, Token::Identifier},    {nullptr, Token::Identifier},
+  {"double", Token::Kw_double},    {"break", Token::Kw_break},
+  {nullptr, Token::Identifier},    {nullptr, Token::Identifier},
+  {"while", Token::Kw_while},      {"else", Token::Kw_else},
+  {nullptr, Token::Identifier},    {"if", Token::Kw_if},
+  {"bool", Token::Kw_bool},        {nullptr, Token::Identifier},
+  {"return", Token::Kw_return},    {nullptr, Token::Identifier},
+  {"do", Token::Kw_do},            {"false", Token::Boolean},
+  {"true", Token::Boolean},        {nullptr, Token::Identifier},
+  {nullptr, Token::Identifier},    {nullptr, Token::Identifier},
+  {nullptr, Token::Identifier},    {"for", Token::Kw_for},
+  {"void", Token::Kw_void},        {nullptr, Token::Identifier}
+};
+
+inline unsigned keywordHash(const char *Start, size_t Len) {
+  return (Len + 7 * static_cast<unsigned char>(Start[0]) +
+          8 * static_cast<unsigned char>(Start[Len - 1])) & 31;
+}
+
+/// \brief Return the keyword spelled by [Start, Start + Len), or nullptr
+const Keyword *LookupKeyword(const char *Start, size_t Len) {
+  const Keyword &K = Keywords[keywordHash(Start, Len)];
+  if (K.Spelling && !std::strncmp(K.Spelling, Start, Len) &&
+      K.Spelling[Len] == '\0')
+    return &K;
+  return nullptr;
+}
+}
+
 bool CMMLexer::Error(LocTy ErrorLoc, const std::string &Msg) {
   SrcMgr.Error(ErrorLoc, Msg);
   return true;
@@ -70,12 +153,30 @@ static void UnEscapeLexed(std::string &Str) {
  */
 
 Token CMMLexer::LexToken() {
-  TokStartLoc = SrcMgr.getLoc();
-  int CurChar = getNextChar();
+  int CurChar;
+  for (;;) {
+    TokStartLoc = getCurLoc();
+    CurChar = getNextChar();
+    if (isCharClass(CurChar, Blank)) {
+      skipBlanks();
+      continue;
+    }
+    if (CurChar != '/')
+      break;
+    if (peekNextChar() == '/') {
+      getNextChar();
+      skipLineComment();
+    } else if (peekNextChar() == '*') {
+      getNextChar();
+      skipBlockComment();
+    } else {
+      return Token::Slash;
+    }
+  }
 
   switch (CurChar) {
   default:
-    if (std::isalpha(static_cast<unsigned char>(CurChar)) || CurChar == '_') {
+    if (isCharClass(CurChar, Alpha | Under)) {
       ungetChar();
       return LexIdentifier();
     }
@@ -85,23 +186,6 @@ Token CMMLexer::LexToken() {
   case std::char_traits<char>::eof():
     return Token::Eof;
 
-  case '\0': case ' ': case '\t': case '\n': case '\r':
-    return LexToken();
-
-  case '/': {
-    int NextChar = getNextChar();
-    if (NextChar == '/') {
-      skipLineComment();
-      return LexToken();
-    }
-    if (NextChar == '*') {
-      skipBlockComment();
-      return LexToken();
-    }
-    ungetChar();
-    return Token::Slash;
-  }
-
   case '\'':  return LexChar();
   case '"':   return LexString();
   case '(':   return Token::LParen;
@@ -175,47 +259,33 @@ Token CMMLexer::LexToken() {
   }
 }
 
+void CMMLexer::skipBlanks() {
+  while (CurPtr != BufferEnd && isCharClass(*CurPtr, Blank))
+    ++CurPtr;
+}
+
 // Assume the '//' is eaten
 void CMMLexer::skipLineComment() {
-  for (;;) {
-    if (peekNextChar() == '\n' || peekNextChar() == '\r' ||
-        peekNextChar() == std::char_traits<char>::eof())
-      return;
-    getNextChar();
-  }
+  while (CurPtr != BufferEnd && *CurPtr != '\n' && *CurPtr != '\r')
+    ++CurPtr;
 }
 
 Token CMMLexer::LexIdentifier() {
-  StrVal.clear();
+  const char *Start = CurPtr;
   do {
-    StrVal.push_back(static_cast<char>(getNextChar()));
-  } while (std::isalnum(peekNextChar()) || peekNextChar() == '_');
-
-#define KEYWORD(STR) do {                                                      \
-                       if (StrVal == #STR)                                     \
-                         return Token::Kw_##STR;                               \
-                     } while (0)
-  KEYWORD(if);
-  KEYWORD(else);
-  KEYWORD(for);
-  KEYWORD(while);
-  KEYWORD(do);
-  KEYWORD(break);
-  KEYWORD(continue);
-  KEYWORD(return);
-  KEYWORD(int);
-  KEYWORD(double);
-  KEYWORD(bool);
-  KEYWORD(void);
-  KEYWORD(string);
-  KEYWORD(infix);
-#undef KEYWORD
-
-  if (StrVal == "true")  { BoolVal = true;  return Token::Boolean; }
-  if (StrVal == "false") { BoolVal = false; return Token::Boolean; }
-
-  if (StrVal.back() == '_')
-    Warning(SrcMgr.getLoc(), "identifier end with _");
+    ++CurPtr;
+  } while (CurPtr != BufferEnd && isIdentifierChar(*CurPtr));
+
+  size_t Len = CurPtr - Start;
+  if (const Keyword *K = LookupKeyword(Start, Len)) {
+    if (K->Kind == Token::Boolean)
+      BoolVal = K->Spelling[0] == 't';
+    return K->Kind;
+  }
+
+  SymVal = Symbol::intern(Start, Len);
+  if (Start[Len - 1] == '_')
+    Warning(getCurLoc(), "identifier end with _");
 
   return Token::Identifier;
 }
@@ -230,7 +300,7 @@ Token CMMLexer::LexChar() {
   }
 
   if (CurChar == '\\') {
-    LocTy CharLoc = SrcMgr.getLoc();
+    LocTy CharLoc = getCurLoc();
     CurChar = getNextChar();
 
     if (CurChar == std::char_traits<char>::eof()) {
@@ -253,7 +323,7 @@ Token CMMLexer::LexChar() {
   }
 
   LocTy QuoteLoc;
-  while (QuoteLoc = SrcMgr.getLoc(), getNextChar() != '\'')
+  while (QuoteLoc = getCurLoc(), getNextChar() != '\'')
     Warning(QuoteLoc, "extra character in single quote");
 
   return Token::Integer;
@@ -276,7 +346,7 @@ Token CMMLexer::LexString() {
     }
 
     if (CurChar == '\\') {
-      LocTy Loc = SrcMgr.getLoc();
+      LocTy Loc = getCurLoc();
 
       CurChar = getNextChar();
 
@@ -309,14 +379,14 @@ Token CMMLexer::LexDigit() {
       if (NewIntVal < 0) {
         Warning(DigitStartLoc, "hexadecimal integer literal is too large");
 
-        while (std::isxdigit(getNextChar())) ;
+        while (isHexDigitChar(getNextChar())) ;
         ungetChar();
 
         break;
       }
 
       IntVal = NewIntVal;
-    } while (std::isxdigit(peekNextChar()));
+    } while (isHexDigitChar(peekNextChar()));
     return Token::Integer;
   }
 
@@ -328,14 +398,14 @@ Token CMMLexer::LexDigit() {
     if (NewIntVal < 0) {
       Warning(DigitStartLoc, "decimal integer literal is too large");
 
-      while (std::isdigit(getNextChar()));
+      while (isDigitChar(getNextChar()));
       ungetChar();
 
       break;
     }
 
     IntVal = NewIntVal;
-  } while (std::isdigit(peekNextChar()));
+  } while (isDigitChar(peekNextChar()));
 
 
   if (getNextChar() != '.') { // Eat the dot
@@ -347,10 +417,10 @@ Token CMMLexer::LexDigit() {
   unsigned int Frac = 0, Scale = 1;
   int DigitChar;
 
-  while (std::isdigit(DigitChar = getNextChar())) {
+  while (isDigitChar(DigitChar = getNextChar())) {
     if (Scale > 100000) {
       Warning(DigitStartLoc, "long floating number may lost precision");
-      while (std::isdigit(getNextChar()));
+      while (isDigitChar(getNextChar()));
       break;
     }
 
@@ -363,57 +433,44 @@ Token CMMLexer::LexDigit() {
   return Token::Double;
 }
 
+// Assume the head character is eaten
 Token CMMLexer::LexInfixOp(int HeadChar) {
-  StrVal.assign(1, static_cast<char>(HeadChar));
+  const char *Start = CurPtr - 1;
 
   for (;;) {
     int NextChar = peekNextChar();
 
-    if (std::isspace(NextChar) || std::isalnum(NextChar) ||
-        NextChar == std::char_traits<char>::eof()) {
-      return Token::InfixOp;
-    }
-
-    StrVal.push_back(static_cast<char>(getNextChar()));
+    if (isCharClass(NextChar, Space | Alpha | Digit) ||
+        NextChar == std::char_traits<char>::eof())
+      break;
 
+    ++CurPtr;
     if (NextChar == HeadChar)
-      return Token::InfixOp;
+      break;
   }
+
+  SymVal = Symbol::intern(Start, CurPtr - Start);
+  return Token::InfixOp;
 }
 
 // Assume the '/*' is eaten
 bool CMMLexer::skipBlockComment() {
-  int CurChar;
-  do {
-    auto CurLoc = SrcMgr.getLoc();
-    CurChar = getNextChar();
+  // Every '/*' inside a comment opens a nested one.
+  unsigned Depth = 1;
+  while (Depth) {
+    auto CurLoc = getCurLoc();
+    int CurChar = getNextChar();
     if (CurChar == std::char_traits<char>::eof())
       return Error("unterminated /* comment");
 
     if (CurChar == '/' && peekNextChar() == '*') {
       Warning(CurLoc, "block comments can't be nested");
       getNextChar();
-      skipBlockComment();
+      ++Depth;
+    } else if (CurChar == '*' && peekNextChar() == '/') {
+      getNextChar();
+      --Depth;
     }
-  } while (CurChar != '*');
-
-  // Now next char is the one after '*'
-  if (peekNextChar() == '/') {
-    getNextChar();
-    return false;
-  } else {
-    return skipBlockComment();
   }
-}
-
-int CMMLexer::peekNextChar() {
-  return SrcMgr.peek();
-}
-
-int CMMLexer::getNextChar() {
-  return SrcMgr.get();
-}
-
-void CMMLexer::ungetChar() {
-  SrcMgr.unget();
+  return false;
 }
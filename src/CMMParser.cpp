@@ -1,16 +1,43 @@
 #include "CMMParser.h"
+#include "CMMResolver.h"
+#include "LoopOptimizer.h"
+#include "TypeChecker.h"
 #include <cassert>
 
 using namespace cmm;
 
 bool CMMParser::parse() {
   Lex();
-  while (!Lexer.isOneOf(Token::Eof, Token::Error))
+  while (!Tokens.isOneOf(Token::Eof, Token::Error))
     if (parseTopLevel())
       return true;
+
+  // Statements of the top level block are pending until the end.
+  TopLevelBlock.setStatementList(takePending(PendingStatements, 0));
+
+  return resolve();
+}
+
+bool CMMParser::resolve() {
+  if (CMMResolver(SrcMgr, TopLevelBlock, FunctionDefinition,
+                  InfixOpDefinition).resolve())
+    return true;
+
+  Propagator.propagate();
+  if (TypeChecker(SrcMgr, TopLevelBlock, FunctionDefinition,
+                  InfixOpDefinition).check())
+    return true;
   return false;
 }
 
+void CMMParser::optimize(unsigned InlineLimit) {
+  if (InlineLimit)
+    Inliner(Arena, TopLevelBlock, FunctionDefinition, InfixOpDefinition,
+            InlineLimit).inlineCalls();
+  LoopOptimizer(Arena, TopLevelBlock, FunctionDefinition, InfixOpDefinition)
+      .optimize();
+}
+
 void CMMParser::dumpAST() const {
 
   if (FunctionDefinition.empty()) {
@@ -54,10 +81,11 @@ void CMMParser::dumpAST() const {
 bool CMMParser::parseTopLevel() {
   switch (getKind()) {
   default: {
-    std::unique_ptr<StatementAST> Statement;
+    StatementAST *Statement = nullptr;
     if (parseStatement(Statement))
       return true;
-    TopLevelBlock.addStatement(std::move(Statement));
+    if (Statement)
+      PendingStatements.push_back(Statement);
     return false;
   }
   case Token::Kw_infix:
@@ -72,23 +100,21 @@ bool CMMParser::parseTopLevel() {
     if (parseTypeSpecifier(Type))
       return true;
 
-    LocTy Loc = Lexer.getLoc();
-
-    if (Lexer.isNot(Token::Identifier))
+    if (Tokens.isNot(Token::Identifier))
       return Error("expect identifier after type");
-    std::string Name = Lexer.getStrVal();
-    Lex();  // Eat the identifier.
 
-    if (Lexer.is(Token::LParen))
-      return parseFunctionDefinition(Type, Name); // It's function definition.
+    if (Tokens.lookAhead(1).is(Token::LParen)) {
+      // It's function definition.
+      Symbol Name = Tokens.getSymbolVal();
+      Lex();  // Eat the identifier.
+      return parseFunctionDefinition(Type, Name);
+    }
 
     // It's a variable declaration.
-    Lexer.seekLoc(Loc);
-    Lex();
-    std::unique_ptr<StatementAST> DeclStatement;
+    StatementAST *DeclStatement = nullptr;
     if (parseDeclarationStatement(Type, DeclStatement))
       return true;
-    TopLevelBlock.addStatement(std::move(DeclStatement));
+    PendingStatements.push_back(DeclStatement);
     return false;
   }
   }
@@ -99,37 +125,37 @@ bool CMMParser::parseTopLevel() {
 /// infixOpDefinition ::= Kw_infix [Integer] Id infixOp Id ["="] ExprStatement
 /// E.g., infix [12] a@b [=] a * b;
 bool CMMParser::parseInfixOpDefinition() {
-  assert(Lexer.is(Token::Kw_infix));
-  LocTy Loc = Lexer.getLoc();
+  assert(Tokens.is(Token::Kw_infix));
+  LocTy Loc = Tokens.getLoc();
   Lex();  // Eat the 'infix'.
 
   int Precedence;
 
-  if (Lexer.is(Token::Integer)) {
-    Precedence = Lexer.getIntVal();
+  if (Tokens.is(Token::Integer)) {
+    Precedence = Tokens.getIntVal();
     Lex();  // Eat the int.
   } else {
     Precedence = InfixOpDefinitionAST::DefaultPrecedence;
   }
 
-  if (Lexer.isNot(Token::Identifier))
+  if (Tokens.isNot(Token::Identifier))
     return Error("left hand operand name for infix operator expected");
-  std::string LHS = Lexer.getStrVal();
+  Symbol LHS = Tokens.getSymbolVal();
   Lex();  // eat the LHS operand identifier.
 
-  if (Lexer.isNot(Token::InfixOp))
+  if (Tokens.isNot(Token::InfixOp))
     return Error("symbol of infix operator expected");
-  std::string Symbol = Lexer.getStrVal();
+  Symbol Sym = Tokens.getSymbolVal();
   Lex();  // eat the infix operator.
 
-  if (Lexer.isNot(Token::Identifier))
+  if (Tokens.isNot(Token::Identifier))
     return Error("right hand operand name for infix operator expected");
-  std::string RHS = Lexer.getStrVal();
+  Symbol RHS = Tokens.getSymbolVal();
   Lex();  // eat the RHS operand identifier.
 
-  std::unique_ptr<StatementAST> Statement;
+  StatementAST *Statement = nullptr;
   bool Err;
-  if (Lexer.is(Token::Equal)) {
+  if (Tokens.is(Token::Equal)) {
     Lex();  // eat the '='
     Err = parseExprStatement(Statement);
   } else {
@@ -138,12 +164,10 @@ bool CMMParser::parseInfixOpDefinition() {
   if (Err)
     return true;
 
-  if (!BinOpPrecedence.emplace(Symbol,
-                               static_cast<int8_t>(Precedence)).second) {
-    Warning(Loc, "infix operator " + Symbol + " overrides another");
-  }
-  InfixOpDefinition.emplace(Symbol, InfixOpDefinitionAST(Symbol, LHS, RHS,
-                                                         std::move(Statement)));
+  if (!BinOpPrecedence.emplace(Sym, static_cast<int8_t>(Precedence)).second)
+    Warning(Loc, "infix operator " + Sym.str() + " overrides another");
+  InfixOpDefinition.emplace(Sym, InfixOpDefinitionAST(Sym, LHS, RHS,
+                                                      Statement));
   return false;
 }
 
@@ -155,10 +179,10 @@ bool CMMParser::parseFunctionDefinition() {
   if (parseTypeSpecifier(RetType))
     return true;
 
-  if (Lexer.isNot(Token::Identifier))
+  if (Tokens.isNot(Token::Identifier))
     return Error("expect identifier in function definition");
 
-  std::string Identifier = Lexer.getStrVal();
+  Symbol Identifier = Tokens.getSymbolVal();
   Lex();  // eat the identifier of function.
 
   return parseFunctionDefinition(RetType, Identifier);
@@ -168,26 +192,26 @@ bool CMMParser::parseFunctionDefinition() {
 /// _functionDefinition ::= "(" ")" Statement
 /// _functionDefinition ::= "(" parameterList ")" Statement
 bool CMMParser::parseFunctionDefinition(cvm::BasicType RetType,
-                                        const std::string &Name) {
-  assert(Lexer.is(Token::LParen) && "parseFunctionDefinition: unknown token");
-  LocTy Loc = Lexer.getLoc();
+                                        Symbol Name) {
+  assert(Tokens.is(Token::LParen) && "parseFunctionDefinition: unknown token");
+  LocTy Loc = Tokens.getLoc();
   Lex();  // Eat LParen '('.
 
-  std::list<Parameter> ParameterList;
-  if (Lexer.isNot(Token::RParen))
+  std::vector<Parameter> ParameterList;
+  if (Tokens.isNot(Token::RParen))
     parseParameterList(ParameterList);
-  if (Lexer.isNot(Token::RParen))
+  if (Tokens.isNot(Token::RParen))
     return Error("right parenthesis expected");
   Lex();  // Eat RParen ')'.
 
-  std::unique_ptr<StatementAST> Statement;
+  StatementAST *Statement = nullptr;
   if (parseStatement(Statement))
     return true;
 
   FunctionDefinitionAST FuncDef(Name, RetType, std::move(ParameterList),
-                                std::move(Statement));
+                                Statement);
   if (!FunctionDefinition.emplace(Name, std::move(FuncDef)).second) {
-    Warning(Loc, "function `" + Name + "' overrides another one");
+    Warning(Loc, "function `" + Name.str() + "' overrides another one");
   }
   return false;
 }
@@ -195,29 +219,29 @@ bool CMMParser::parseFunctionDefinition(cvm::BasicType RetType,
 /// \brief Parse a parameter list
 /// parameterList ::= "void"
 /// parameterList ::= TypeSpecifier Identifier ("," TypeSpecifier Identifier)*
-bool CMMParser::parseParameterList(std::list<Parameter> &ParameterList) {
-  if (Lexer.is(Token::Kw_void)) {
+bool CMMParser::parseParameterList(std::vector<Parameter> &ParameterList) {
+  if (Tokens.is(Token::Kw_void)) {
     Lex();
     return false;
   }
   for (;;) {
-    std::string Identifier;
+    Symbol Identifier;
     cvm::BasicType Type;
     LocTy Loc;
 
     if (parseTypeSpecifier(Type))
       return true;
 
-    Loc = Lexer.getLoc();
-    if (Lexer.is(Token::Identifier)) {
-      Identifier = Lexer.getStrVal();
+    Loc = Tokens.getLoc();
+    if (Tokens.is(Token::Identifier)) {
+      Identifier = Tokens.getSymbolVal();
       Lex();  // Eat the identifier.
     } else {
       Warning("missing identifier after type");
     }
     ParameterList.emplace_back(Identifier, Type, Loc);
 
-    if (Lexer.isNot(Token::Comma))
+    if (Tokens.isNot(Token::Comma))
       break;
     Lex();  // Eat the comma.
   }
@@ -226,21 +250,24 @@ bool CMMParser::parseParameterList(std::list<Parameter> &ParameterList) {
 
 /// \brief Parse a block as a statement.
 /// block ::= "{" statement* "}"
-bool CMMParser::parseBlock(std::unique_ptr<StatementAST> &Res) {
-  CurrentBlock = new BlockAST(CurrentBlock);
-  Res.reset(CurrentBlock);
+bool CMMParser::parseBlock(StatementAST *&Res) {
+  CurrentBlock = Arena.create<BlockAST>(CurrentBlock);
+  Res = CurrentBlock;
+  size_t Mark = PendingStatements.size();
 
-  assert(Lexer.is(Token::LCurly) && "first token in parseBlock()");
+  assert(Tokens.is(Token::LCurly) && "first token in parseBlock()");
   Lex(); // eat the LCurly '{'
 
-  while (Lexer.isNot(Token::RCurly)) {
-    std::unique_ptr<StatementAST> Statement;
+  while (Tokens.isNot(Token::RCurly)) {
+    StatementAST *Statement = nullptr;
     if (parseStatement(Statement))
       return true;
-    CurrentBlock->addStatement(std::move(Statement));
+    if (Statement)
+      PendingStatements.push_back(Statement);
   }
 
-  assert(CurrentBlock == Res.get() && "block mismatch");
+  assert(CurrentBlock == Res && "block mismatch");
+  CurrentBlock->setStatementList(takePending(PendingStatements, Mark));
   CurrentBlock = CurrentBlock->getOuterBlock();
 
   Lex(); // eat the RCurly '}'
@@ -265,32 +292,32 @@ bool CMMParser::parseTypeSpecifier(cvm::BasicType &Type) {
 /// \brief Parse an optional argument list.
 /// OptionalArgList ::= epsilon
 /// OptionalArgList ::= argumentList
-bool CMMParser::parseOptionalArgList(std::list<std::unique_ptr<ExpressionAST>>
-                                     &ArgList) {
-  if (Lexer.is(Token::RParen))
+bool CMMParser::parseOptionalArgList(ASTArray<ExpressionAST *> &ArgList) {
+  if (Tokens.is(Token::RParen))
     return false;
   return parseArgumentList(ArgList);
 }
 
 /// \brief Parse an argument list.
 /// argumentList ::= Expression ("," Expression)*
-bool CMMParser::parseArgumentList(std::list<std::unique_ptr<ExpressionAST>>
-                                  &ArgList) {
+bool CMMParser::parseArgumentList(ASTArray<ExpressionAST *> &ArgList) {
+  size_t Mark = PendingExpressions.size();
   for (;;) {
-    std::unique_ptr<ExpressionAST> Expression;
+    ExpressionAST *Expression = nullptr;
     if (parseExpression(Expression))
       return true;
-    ArgList.emplace_back(std::move(Expression));
-    if (Lexer.isNot(Token::Comma))
+    PendingExpressions.push_back(Expression);
+    if (Tokens.isNot(Token::Comma))
       break;
     Lex(); // Eat the comma.
   }
+  ArgList = takePending(PendingExpressions, Mark);
   return false;
 }
 
 /// \brief Parse an empty statement.
 /// EmptyStatement ::= ";"
-bool CMMParser::parseEmptyStatement(std::unique_ptr<StatementAST> &Res) {
+bool CMMParser::parseEmptyStatement(StatementAST *&Res) {
   Warning("empty statement");
   Res = nullptr;
   Lex(); // eat the semicolon;
@@ -308,7 +335,7 @@ bool CMMParser::parseEmptyStatement(std::unique_ptr<StatementAST> &Res) {
 /// Statement ::= EmptyStatement
 /// Statement ::= DeclarationStatement
 /// Statement ::= ExprStatement
-bool CMMParser::parseStatement(std::unique_ptr<StatementAST> &Res) {
+bool CMMParser::parseStatement(StatementAST *&Res) {
   switch (getKind()) {
   default:
     return Error("unexpected token in statement");
@@ -338,7 +365,7 @@ bool CMMParser::parseStatement(std::unique_ptr<StatementAST> &Res) {
 
 /// \brief Parse an expression.
 /// expression ::= primaryExpr BinOpRHS*
-bool CMMParser::parseExpression(std::unique_ptr<ExpressionAST> &Res) {
+bool CMMParser::parseExpression(ExpressionAST *&Res) {
   return parsePrimaryExpression(Res) || parseBinOpRHS(1, Res);
 }
 
@@ -370,7 +397,7 @@ int8_t CMMParser::getBinOpPrecedence() {
   case Token::Percent:
     return 11;
   case Token::InfixOp: {
-    auto It = BinOpPrecedence.find(Lexer.getStrVal());
+    auto It = BinOpPrecedence.find(Tokens.getSymbolVal());
     if (It != BinOpPrecedence.end())
       return It->second;
     break;
@@ -381,11 +408,11 @@ int8_t CMMParser::getBinOpPrecedence() {
 
 /// \brief Parse a paren expression and return it.
 /// parenExpr ::= "(" expression ")"
-bool CMMParser::parseParenExpression(std::unique_ptr<ExpressionAST> &Res) {
+bool CMMParser::parseParenExpression(ExpressionAST *&Res) {
   Lex(); // eat the '('.
   if (parseExpression(Res))
     return true;
-  if (Lexer.isNot(Token::RParen))
+  if (Tokens.isNot(Token::RParen))
     return Error("expected ')' in parentheses expression");
   Lex(); // eat the ')'.
   return false;
@@ -397,9 +424,9 @@ bool CMMParser::parseParenExpression(std::unique_ptr<ExpressionAST> &Res) {
 ///  primaryExpr ::= identifierExpr ("[" Expression "]")+
 ///  primaryExpr ::= constantExpr
 ///  primaryExpr ::= "~","+","-","!" primaryExpr
-bool CMMParser::parsePrimaryExpression(std::unique_ptr<ExpressionAST> &Res) {
+bool CMMParser::parsePrimaryExpression(ExpressionAST *&Res) {
   UnaryOperatorAST::OperatorKind UnaryOpKind;
-  std::unique_ptr<ExpressionAST> Operand;
+  ExpressionAST *Operand = nullptr;
 
   switch (getKind()) {
   default:
@@ -411,20 +438,20 @@ bool CMMParser::parsePrimaryExpression(std::unique_ptr<ExpressionAST> &Res) {
   case Token::Identifier:
     if (parseIdentifierExpression(Res))
       return true;
-    while (Lexer.is(Token::LBrac)) {
+    while (Tokens.is(Token::LBrac)) {
+      LocTy BracLoc = Tokens.getLoc();
       Lex(); // Eat the ']'.
 
-      std::unique_ptr<ExpressionAST> IndexExpr, TmpRHS;
+      ExpressionAST *IndexExpr = nullptr;
       if (parseExpression(IndexExpr))
         return true;
 
-      if (Lexer.isNot(Token::RBrac))
+      if (Tokens.isNot(Token::RBrac))
         return Error("RBrac ']' expected in index expression");
       Lex(); // Eat the ']'.
 
-      std::swap(Res, TmpRHS);
-      Res.reset(new BinaryOperatorAST(
-          BinaryOperatorAST::Index, std::move(TmpRHS), std::move(IndexExpr)));
+      Res = Arena.create<BinaryOperatorAST>(BinaryOperatorAST::Index, Res,
+                                            IndexExpr, BracLoc);
     }
     return false;
 
@@ -440,26 +467,27 @@ bool CMMParser::parsePrimaryExpression(std::unique_ptr<ExpressionAST> &Res) {
   case Token::Exclaim:  UnaryOpKind = UnaryOperatorAST::LogicalNot; break;
   }
 
+  LocTy OpLoc = Tokens.getLoc();
   Lex(); // Eat the operator: +,-,~,!
   if (parsePrimaryExpression(Operand))
     return true;
-  Res = UnaryOperatorAST::tryFoldUnaryOp(UnaryOpKind, std::move(Operand));
+  Res = UnaryOperatorAST::tryFoldUnaryOp(Arena, UnaryOpKind, Operand, OpLoc);
   return false;
 }
 
 /// \brief Parse the right hand side of a binary expression
 /// if the current binOp's precedence is greater or equal to ExprPrec.
 bool CMMParser::parseBinOpRHS(int8_t ExprPrec,
-                              std::unique_ptr<ExpressionAST> &Res) {
-  std::unique_ptr<ExpressionAST> RHS;
+                              ExpressionAST *&Res) {
+  ExpressionAST *RHS = nullptr;
 
   // Handle assignment expression first.
-  if (Lexer.getTok().is(Token::Equal)) {
+  if (Tokens.getTok().is(Token::Equal)) {
+    LocTy EqualLoc = Tokens.getLoc();
     Lex();
     if (parseExpression(RHS))
       return true;
-    Res = BinaryOperatorAST::create(Token::Equal,
-                                    std::move(Res), std::move(RHS));
+    Res = BinaryOperatorAST::create(Arena, Token::Equal, Res, RHS, EqualLoc);
     return false;
   }
   for (;;) {
@@ -473,7 +501,8 @@ bool CMMParser::parseBinOpRHS(int8_t ExprPrec,
       return false;
 
     // Save the potential symbol before lex.
-    std::string Symbol = Lexer.getStrVal();
+    Symbol Sym = Tokens.getSymbolVal();
+    LocTy OpLoc = Tokens.getLoc();
     // Eat the binary operator.
     Lex();
     // Eat the next primary expression.
@@ -488,10 +517,10 @@ bool CMMParser::parseBinOpRHS(int8_t ExprPrec,
 
     // Merge LHS and RHS according to operator.
     if (TokenKind == Token::InfixOp)
-      Res.reset(new InfixOpExprAST(Symbol, std::move(Res), std::move(RHS)));
+      Res = Arena.create<InfixOpExprAST>(Sym, Res, RHS);
     else
-      Res = BinaryOperatorAST::tryFoldBinOp(TokenKind, std::move(Res),
-                                             std::move(RHS));
+      Res = BinaryOperatorAST::tryFoldBinOp(Arena, TokenKind, Res, RHS,
+                                            OpLoc);
   }
 }
 
@@ -500,35 +529,37 @@ bool CMMParser::parseBinOpRHS(int8_t ExprPrec,
 /// \brief Parse an identifier expression
 /// identifierExpression ::= identifier
 /// identifierExpression ::= identifier  "("  optionalArgList  ")"
-bool CMMParser::parseIdentifierExpression(std::unique_ptr<ExpressionAST> &Res) {
-  assert(Lexer.is(Token::Identifier) &&
+bool CMMParser::parseIdentifierExpression(ExpressionAST *&Res) {
+  assert(Tokens.is(Token::Identifier) &&
       "parseIdentifierExpression: unknown token");
 
-  std::string Identifier = Lexer.getStrVal();
+  Symbol Identifier = Tokens.getSymbolVal();
+  LocTy IdentifierLoc = Tokens.getLoc();
   Lex();  // eat the identifier
 
   LocTy ExclaimLoc;
   bool Dynamic;
-  if ((Dynamic = Lexer.is(Token::Exclaim))) {
-    ExclaimLoc = Lexer.getLoc();
+  if ((Dynamic = Tokens.is(Token::Exclaim))) {
+    ExclaimLoc = Tokens.getLoc();
     Lex();  // eat the '!'
   }
 
-  if (Lexer.is(Token::LParen)) {
+  if (Tokens.is(Token::LParen)) {
     Lex();  // eat the '('
 
-    std::list<std::unique_ptr<ExpressionAST>> Args;
+    ASTArray<ExpressionAST *> Args;
     if (parseOptionalArgList(Args))
       return true;
 
-    if (Lexer.isNot(Token::RParen))
+    if (Tokens.isNot(Token::RParen))
       return Error("expect ')' in function call");
     Lex(); // eat the ')'
-    Res.reset(new FunctionCallAST(Identifier, std::move(Args), Dynamic));
+    Res = Arena.create<FunctionCallAST>(Identifier, Args, Dynamic,
+                                  IdentifierLoc);
   } else {
     if (Dynamic)
       Warning(ExclaimLoc, "trailing `!' is ignored in identifier");
-    Res.reset(new IdentifierAST(Identifier));
+    Res = Arena.create<IdentifierAST>(Identifier);
   }
 
   return false;
@@ -539,13 +570,21 @@ bool CMMParser::parseIdentifierExpression(std::unique_ptr<ExpressionAST> &Res) {
 /// constantExpr ::= DoubleExpression
 /// constantExpr ::= BoolExpression
 /// constantExpr ::= StringExpression
-bool CMMParser::parseConstantExpression(std::unique_ptr<ExpressionAST> &Res) {
+bool CMMParser::parseConstantExpression(ExpressionAST *&Res) {
   switch (getKind()) {
   default:  return Error("unknown token in literal constant expression");
-  case Token::Integer:  Res.reset(new IntAST(Lexer.getIntVal())); break;
-  case Token::Double:   Res.reset(new DoubleAST(Lexer.getDoubleVal())); break;
-  case Token::Boolean:  Res.reset(new BoolAST(Lexer.getBoolVal())); break;
-  case Token::String:   Res.reset(new StringAST(Lexer.getStrVal())); break;
+  case Token::Integer:
+    Res = Arena.create<IntAST>(Tokens.getIntVal());
+    break;
+  case Token::Double:
+    Res = Arena.create<DoubleAST>(Tokens.getDoubleVal());
+    break;
+  case Token::Boolean:
+    Res = Arena.create<BoolAST>(Tokens.getBoolVal());
+    break;
+  case Token::String:
+    Res = Arena.create<StringAST>(Tokens.getStrVal());
+    break;
   }
   Lex(); // eat the string,bool,int,double.
   return false;
@@ -554,20 +593,20 @@ bool CMMParser::parseConstantExpression(std::unique_ptr<ExpressionAST> &Res) {
 /// \brief Parse an if statement.
 /// ifStatement ::= "if"  "(" Expr ")"  Statement
 /// ifStatement ::= "if"  "(" Expr ")"  Statement  "else"  Statement
-bool CMMParser::parseIfStatement(std::unique_ptr<StatementAST> &Res) {
-  std::unique_ptr<ExpressionAST> Condition;
-  std::unique_ptr<StatementAST> StatementThen, StatementElse;
+bool CMMParser::parseIfStatement(StatementAST *&Res) {
+  ExpressionAST *Condition = nullptr;
+  StatementAST *StatementThen = nullptr, *StatementElse = nullptr;
 
-  assert(Lexer.is(Token::Kw_if) && "parseIfStatement: unknown token");
+  assert(Tokens.is(Token::Kw_if) && "parseIfStatement: unknown token");
   Lex();  // eat 'if'.
 
-  if (Lexer.isNot(Token::LParen))
+  if (Tokens.isNot(Token::LParen))
     return Error("left parenthesis expected");
   Lex();  // eat LParen '('.
 
   if (parseExpression(Condition))
     return true;
-  if (Lexer.isNot(Token::RParen))
+  if (Tokens.isNot(Token::RParen))
     return Error("right parenthesis expected");
   Lex();  // eat RParen ')'.
 
@@ -575,141 +614,140 @@ bool CMMParser::parseIfStatement(std::unique_ptr<StatementAST> &Res) {
     return true;
 
   // Parse the else branch is there is one.
-  if (Lexer.is(Token::Kw_else)) {
+  if (Tokens.is(Token::Kw_else)) {
     Lex();  // eat 'else'
     if (parseStatement(StatementElse))
       return true;
   }
 
-  Res = IfStatementAST::create(std::move(Condition),
-                               std::move(StatementThen),
-                               std::move(StatementElse));
+  Res = IfStatementAST::create(Arena, Condition, StatementThen,
+                               StatementElse);
   return false;
 }
 
 /// \brief Parse a for statement.
 /// forStatement ::= "for"  "("  Expr  ";"  Expr  ";"  Expr  ")"  Statement
-bool CMMParser::parseForStatement(std::unique_ptr<StatementAST> &Res) {
-  std::unique_ptr<ExpressionAST> Init, Condition, Post;
-  std::unique_ptr<StatementAST> Statement;
+bool CMMParser::parseForStatement(StatementAST *&Res) {
+  ExpressionAST *Init = nullptr, *Condition = nullptr, *Post = nullptr;
+  StatementAST *Statement = nullptr;
 
-  assert(Lexer.is(Token::Kw_for) && "parseIfStatement: unknown token");
+  assert(Tokens.is(Token::Kw_for) && "parseIfStatement: unknown token");
   Lex();  // eat the 'for'.
-  if (Lexer.isNot(Token::LParen))
+  if (Tokens.isNot(Token::LParen))
     return Error("left parenthesis expected in for loop");
   Lex();  // eat the LParen '('.
 
-  if (Lexer.isNot(Token::Semicolon) && parseExpression(Init))
+  if (Tokens.isNot(Token::Semicolon) && parseExpression(Init))
     return true;
-  if (Lexer.isNot(Token::Semicolon))
+  if (Tokens.isNot(Token::Semicolon))
     return Error("missing semicolon for initial expression in for loop");
   Lex();  // eat the semicolon.
 
-  if (Lexer.isNot(Token::Semicolon) && parseExpression(Condition))
+  if (Tokens.isNot(Token::Semicolon) && parseExpression(Condition))
     return true;
-  if (Lexer.isNot(Token::Semicolon))
+  if (Tokens.isNot(Token::Semicolon))
     return Error("missing semicolon for conditional expression in for loop");
   Lex();  // eat the semicolon.
 
-  if (Lexer.isNot(Token::RParen) && parseExpression(Post))
+  if (Tokens.isNot(Token::RParen) && parseExpression(Post))
     return true;
-  if (Lexer.isNot(Token::RParen))
+  if (Tokens.isNot(Token::RParen))
     return Error("missing semicolon for post expression in for loop");
   Lex();  // eat the ')'.
 
   if (parseStatement(Statement))
     return true;
 
-  Res = ForStatementAST::create(std::move(Init), std::move(Condition),
-                                std::move(Post), std::move(Statement));
+  Res = ForStatementAST::create(Arena, Init, Condition, Post, Statement);
   return false;
 }
 
 /// \brief Parse a while statement.
 /// whileStatement ::= "while"  "("  Expression  ")"  Statement
-bool CMMParser::parseWhileStatement(std::unique_ptr<StatementAST> &Res) {
-  std::unique_ptr<ExpressionAST> Condition;
-  std::unique_ptr<StatementAST> Statement;
+bool CMMParser::parseWhileStatement(StatementAST *&Res) {
+  ExpressionAST *Condition = nullptr;
+  StatementAST *Statement = nullptr;
 
-  assert(Lexer.is(Token::Kw_while) &&
+  assert(Tokens.is(Token::Kw_while) &&
       "parseIfStatement: unknown token, 'while' expexted");
   Lex();  // eat 'while'
 
-  if (Lexer.isNot(Token::LParen))
+  if (Tokens.isNot(Token::LParen))
     return Error("left parenthesis expected in while loop");
   Lex();  // eat LParen '('.
 
   if (parseExpression(Condition))
     return true;
 
-  if (Lexer.isNot(Token::RParen))
+  if (Tokens.isNot(Token::RParen))
     return Error("right parenthesis expected in while loop");
   Lex();  // eat RParen ')'.
 
   if (parseStatement(Statement))
     return true;
 
-  Res = WhileStatementAST::create(std::move(Condition), std::move(Statement));
+  Res = WhileStatementAST::create(Arena, Condition, Statement);
   return false;
 }
 
 /// \brief Parse an expression statement.
 /// exprStatement ::= Expression ";"
-bool CMMParser::parseExprStatement(std::unique_ptr<StatementAST> &Res) {
-  std::unique_ptr<ExpressionAST> Expression;
+bool CMMParser::parseExprStatement(StatementAST *&Res) {
+  ExpressionAST *Expression = nullptr;
   if (parseExpression(Expression))
     return true;
-  if (Lexer.isNot(Token::Semicolon))
+  if (Tokens.isNot(Token::Semicolon))
     return Error("missing semicolon in statement");
   Lex();  // eat the semicolon
-  Res.reset(new ExprStatementAST(std::move(Expression)));
+  Res = Arena.create<ExprStatementAST>(Expression);
   return false;
 }
 
 /// \brief Parse a return statement.
 /// returnStatement ::= "return" ";"
 /// returnStatement ::= "return" Expression ";"
-bool CMMParser::parseReturnStatement(std::unique_ptr<StatementAST> &Res) {
-  std::unique_ptr<ExpressionAST> ReturnValue;
+bool CMMParser::parseReturnStatement(StatementAST *&Res) {
+  ExpressionAST *ReturnValue = nullptr;
 
-  assert(Lexer.is(Token::Kw_return) && "parseIfStatement: unknown token");
+  assert(Tokens.is(Token::Kw_return) && "parseIfStatement: unknown token");
+  LocTy ReturnLoc = Tokens.getLoc();
   Lex();  // eat the 'return'.
 
-  if (Lexer.isNot(Token::Semicolon) && parseExpression(ReturnValue))
+  if (Tokens.isNot(Token::Semicolon) && parseExpression(ReturnValue))
     return true;
-  if (Lexer.isNot(Token::Semicolon))
+  if (Tokens.isNot(Token::Semicolon))
     return Error("unexpected token after return value");
   Lex();  // eat the semicolon.
-  Res.reset(new ReturnStatementAST(std::move(ReturnValue)));
+  Res = Arena.create<ReturnStatementAST>(ReturnValue, ReturnLoc);
   return false;
 }
 
 /// \brief Parse a break statement.
 /// breakStatement ::= "break" ";"
-bool CMMParser::parseBreakStatement(std::unique_ptr<StatementAST> &Res) {
-  assert(Lexer.is(Token::Kw_break) && "parseIfStatement: unknown token");
+bool CMMParser::parseBreakStatement(StatementAST *&Res) {
+  assert(Tokens.is(Token::Kw_break) && "parseIfStatement: unknown token");
   Lex();  // eat the 'break'.
-  if (Lexer.isNot(Token::Semicolon))
+  if (Tokens.isNot(Token::Semicolon))
     return Error("unexpected token after break");
   Lex();  // eat the semicolon.
-  Res.reset(new BreakStatementAST);
+  Res = Arena.create<BreakStatementAST>();
   return false;
 }
 
 /// \brief Parse a continue statement.
 /// continueStatement ::= "continue" ";"
-bool CMMParser::parseContinueStatement(std::unique_ptr<StatementAST> &Res) {
-  assert(Lexer.is(Token::Kw_continue) && "parseIfStatement: unknown token");
+bool CMMParser::parseContinueStatement(StatementAST *&Res) {
+  assert(Tokens.is(Token::Kw_continue) && "parseIfStatement: unknown token");
   Lex();  // eat the 'continue'.
-  if (Lexer.isNot(Token::Semicolon))
+  if (Tokens.isNot(Token::Semicolon))
     return Error("unexpected token after continue");
   Lex();  // eat the semicolon
-  Res.reset(new ContinueStatementAST);
+  Res = Arena.create<ContinueStatementAST>();
   return false;
 }
 
 /// DeclarationStatement ::= TypeSpecifier _DeclarationStatement
-bool CMMParser::parseDeclarationStatement(std::unique_ptr<StatementAST> &Res) {
+bool CMMParser::parseDeclarationStatement(StatementAST *&Res) {
   cvm::BasicType Type;
   if (parseTypeSpecifier(Type))
     return true;
@@ -721,44 +759,48 @@ bool CMMParser::parseDeclarationStatement(std::unique_ptr<StatementAST> &Res) {
 /// SingleDeclaration ::= identifier "=" Expression
 /// SingleDeclaration ::= identifier ("[" Expression "]")+
 bool CMMParser::parseDeclarationStatement(cvm::BasicType Type,
-                                          std::unique_ptr<StatementAST> &Res) {
-  auto DeclList = new DeclarationListAST(Type);
+                                          StatementAST *&Res) {
+  auto DeclList = Arena.create<DeclarationListAST>(Type);
+  size_t DeclMark = PendingDeclarations.size();
 
   for (;;) {
-    if (Lexer.isNot(Token::Identifier))
+    if (Tokens.isNot(Token::Identifier))
       return Error("identifier expected");
-    std::string Name = Lexer.getStrVal();
+    Symbol Name = Tokens.getSymbolVal();
+    LocTy NameLoc = Tokens.getLoc();
     Lex(); // eat the identifier
 
-    std::unique_ptr<ExpressionAST> InitExpr;
-    std::list<std::unique_ptr<ExpressionAST>> CountExprList;
-    while (Lexer.is(Token::LBrac)) {
+    ExpressionAST *InitExpr = nullptr;
+    size_t CountMark = PendingExpressions.size();
+    while (Tokens.is(Token::LBrac)) {
       Lex(); // eat the '['
-      std::unique_ptr<ExpressionAST> CountExpr;
+      ExpressionAST *CountExpr = nullptr;
       if (parseExpression(CountExpr))
         return true;
-      if (Lexer.isNot(Token::RBrac))
+      if (Tokens.isNot(Token::RBrac))
         return Error("RBrac ']' expected in array declaration");
       Lex(); // eat the ']'
-      CountExprList.emplace_back(std::move(CountExpr));
+      PendingExpressions.push_back(CountExpr);
     }
-    if (Lexer.is(Token::Equal)) {
+    if (Tokens.is(Token::Equal)) {
       Lex(); // eat the '='
       if (parseExpression(InitExpr))
         return true;
     }
 
     // Emit
-    DeclList->addDeclaration(Name,
-                             std::move(InitExpr), std::move(CountExprList));
+    PendingDeclarations.push_back(Arena.create<DeclarationAST>(
+        Name, Type, InitExpr, takePending(PendingExpressions, CountMark),
+        NameLoc));
 
-    if (Lexer.isNot(Token::Comma))
+    if (Tokens.isNot(Token::Comma))
       break;
     Lex(); // Eat the ','
   }
-  if (Lexer.isNot(Token::Semicolon))
+  if (Tokens.isNot(Token::Semicolon))
     return Error("expected semicolon in the declaration");
   Lex(); // Eat the semicolon
-  Res.reset(DeclList);
+  DeclList->setDeclarationList(takePending(PendingDeclarations, DeclMark));
+  Res = DeclList;
   return false;
 }
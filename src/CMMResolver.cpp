@@ -0,0 +1,235 @@
+#include "CMMResolver.h"
+#include "NativeFunctions.h"
+
+using namespace cmm;
+
+bool CMMResolver::resolve() {
+  // Top level statements run directly in the top level frame, in order, so
+  // only globals declared above a use are visible to it.
+  FrameLayout &Globals = TopLevelBlock.getLayout();
+  Globals.clear();
+  Scopes.assign(1, &Globals);
+  for (auto &Stmt : TopLevelBlock.getStatementList())
+    resolveStatement(Stmt);
+
+  // Functions and infix operators run after the globals they use have been
+  // declared, so resolve them against the complete top level layout.
+  for (auto &F : FunctionDefinition)
+    resolveFunction(F.second);
+  for (auto &I : InfixOpDefinition)
+    resolveInfixOp(I.second);
+  return HadError;
+}
+
+void CMMResolver::resolveFunction(FunctionDefinitionAST &Function) {
+  FrameLayout &Layout = Function.getLayout();
+  Layout.clear();
+  for (const auto &Param : Function.getParameterList())
+    Layout.appendSlot(Param.getName());
+
+  Scopes.assign(1, &TopLevelBlock.getLayout());
+  Scopes.push_back(&Layout);
+  resolveStatement(Function.getStatement());
+  markTailCalls(Function.getStatement(), true);
+}
+
+void CMMResolver::resolveInfixOp(InfixOpDefinitionAST &InfixOp) {
+  FrameLayout &Layout = InfixOp.getLayout();
+  Layout.clear();
+  Layout.appendSlot(InfixOp.getLHSName());
+  Layout.appendSlot(InfixOp.getRHSName());
+
+  Scopes.assign(1, &TopLevelBlock.getLayout());
+  Scopes.push_back(&Layout);
+  resolveStatement(InfixOp.getStatement());
+}
+
+void CMMResolver::resolveStatement(StatementAST *Stmt) {
+  if (!Stmt)
+    return;
+
+  switch (Stmt->getKind()) {
+  case StatementAST::BreakStatement:
+  case StatementAST::ContinueStatement:
+    break;
+  case StatementAST::BlockStatement:
+    resolveBlock(Stmt->as_ptr<BlockAST>());
+    break;
+  case StatementAST::DeclarationStatement:
+    resolveDeclaration(Stmt->as_ptr<DeclarationAST>());
+    break;
+  case StatementAST::DeclarationListStatement:
+    for (auto &Decl : Stmt->as_ptr<DeclarationListAST>()->getDeclarationList())
+      resolveDeclaration(Decl);
+    break;
+  case StatementAST::ExprStatement:
+    resolveExpression(Stmt->as_ptr<ExprStatementAST>()->getExpression());
+    break;
+  case StatementAST::ReturnStatement:
+    if (auto *Value = Stmt->as_ptr<ReturnStatementAST>()->getReturnValue())
+      resolveExpression(Value);
+    break;
+  case StatementAST::IfStatement: {
+    auto *IfStmt = Stmt->as_ptr<IfStatementAST>();
+    resolveExpression(IfStmt->getCondition());
+    resolveStatement(IfStmt->getStatementThen());
+    resolveStatement(IfStmt->getStatementElse());
+    break;
+  }
+  case StatementAST::WhileStatement: {
+    auto *WhileStmt = Stmt->as_ptr<WhileStatementAST>();
+    if (WhileStmt->getCondition())
+      resolveExpression(WhileStmt->getCondition());
+    resolveStatement(WhileStmt->getStatement());
+    break;
+  }
+  case StatementAST::ForStatement: {
+    auto *ForStmt = Stmt->as_ptr<ForStatementAST>();
+    if (ForStmt->getInit())
+      resolveExpression(ForStmt->getInit());
+    if (ForStmt->getCondition())
+      resolveExpression(ForStmt->getCondition());
+    if (ForStmt->getPost())
+      resolveExpression(ForStmt->getPost());
+    resolveStatement(ForStmt->getStatement());
+    break;
+  }
+  }
+}
+
+void CMMResolver::resolveBlock(BlockAST *Block) {
+  FrameLayout &Layout = Block->getLayout();
+  Layout.clear();
+  Scopes.push_back(&Layout);
+  for (auto &Stmt : Block->getStatementList())
+    resolveStatement(Stmt);
+  Scopes.pop_back();
+}
+
+void CMMResolver::resolveDeclaration(DeclarationAST *Decl) {
+  // The name is not visible to its own dimensions and initializer.
+  for (auto &E : Decl->getElementCountList())
+    resolveExpression(E);
+  if (Decl->getInitializer())
+    resolveExpression(Decl->getInitializer());
+
+  Decl->setSlot(Scopes.back()->addSlot(Decl->getName()));
+}
+
+void CMMResolver::resolveExpression(ExpressionAST *Expr) {
+  switch (Expr->getKind()) {
+  case ExpressionAST::IntExpression:
+  case ExpressionAST::DoubleExpression:
+  case ExpressionAST::BoolExpression:
+  case ExpressionAST::StringExpression:
+    break;
+  case ExpressionAST::IdentifierExpression:
+    resolveIdentifier(Expr->as_ptr<IdentifierAST>());
+    break;
+  case ExpressionAST::FunctionCallExpression:
+    resolveFunctionCall(Expr->as_ptr<FunctionCallAST>());
+    break;
+  case ExpressionAST::InfixOpExpression:
+    resolveInfixOpExpr(Expr->as_ptr<InfixOpExprAST>());
+    break;
+  case ExpressionAST::BinaryOperatorExpression:
+    resolveExpression(Expr->as_ptr<BinaryOperatorAST>()->getLHS());
+    resolveExpression(Expr->as_ptr<BinaryOperatorAST>()->getRHS());
+    break;
+  case ExpressionAST::UnaryOperatorExpression:
+    resolveExpression(Expr->as_ptr<UnaryOperatorAST>()->getOperand());
+    break;
+  }
+}
+
+void CMMResolver::resolveIdentifier(IdentifierAST *IdExpr) {
+  int Depth = 0;
+  for (auto It = Scopes.rbegin(); It != Scopes.rend(); ++It, ++Depth) {
+    int Slot = (*It)->findSlot(IdExpr->getName());
+    if (Slot >= 0) {
+      IdExpr->setBinding(Depth, Slot, *It);
+      return;
+    }
+  }
+  // Unbound: leave it to the lookup by name at run time.
+  IdExpr->setBinding(0, -1, nullptr);
+}
+
+void CMMResolver::resolveFunctionCall(FunctionCallAST *FuncCall) {
+  for (auto &Arg : FuncCall->getArguments())
+    resolveExpression(Arg);
+
+  auto FuncIt = FunctionDefinition.find(FuncCall->getCallee());
+  if (FuncIt != FunctionDefinition.end()) {
+    FuncCall->bind(&FuncIt->second);
+    return;
+  }
+
+  // Natives belong to the runtime library, which knows them by name.
+  auto &NativeFunctionMap = cvm::getNativeFunctionMap();
+  auto NativeIt = NativeFunctionMap.find(FuncCall->getCallee().str());
+  if (NativeIt != NativeFunctionMap.end()) {
+    FuncCall->bind(NativeIt->second);
+    return;
+  }
+
+  SrcMgr.Error(FuncCall->getLoc(),
+               "function `" + FuncCall->getCallee().str() + "' is undefined");
+  HadError = true;
+}
+
+void CMMResolver::resolveInfixOpExpr(InfixOpExprAST *Expr) {
+  resolveExpression(Expr->getLHS());
+  resolveExpression(Expr->getRHS());
+
+  // The parser only accepts symbols of defined operators.
+  auto InfixOpIt = InfixOpDefinition.find(Expr->getSymbol());
+  if (InfixOpIt != InfixOpDefinition.end())
+    Expr->setDefinition(&InfixOpIt->second);
+}
+
+/// \brief Mark the calls whose value Stmt returns from its function
+/// Those are the values of return statements, and of the expression statement
+/// a function ends with, since it is returned implicitly. Tail tells whether
+/// Stmt is the last statement the function runs.
+void CMMResolver::markTailCalls(StatementAST *Stmt, bool Tail) {
+  if (!Stmt)
+    return;
+
+  ExpressionAST *Value = nullptr;
+  switch (Stmt->getKind()) {
+  default:
+    return;
+  case StatementAST::ExprStatement:
+    if (Tail)
+      Value = Stmt->as_ptr<ExprStatementAST>()->getExpression();
+    break;
+  case StatementAST::ReturnStatement:
+    Value = Stmt->as_ptr<ReturnStatementAST>()->getReturnValue();
+    break;
+  case StatementAST::BlockStatement: {
+    auto &StmtList = Stmt->as_ptr<BlockAST>()->getStatementList();
+    for (auto It = StmtList.begin(); It != StmtList.end(); ++It)
+      markTailCalls(*It, Tail && std::next(It) == StmtList.end());
+    return;
+  }
+  case StatementAST::IfStatement:
+    markTailCalls(Stmt->as_ptr<IfStatementAST>()->getStatementThen(), Tail);
+    markTailCalls(Stmt->as_ptr<IfStatementAST>()->getStatementElse(), Tail);
+    return;
+  case StatementAST::WhileStatement:
+    markTailCalls(Stmt->as_ptr<WhileStatementAST>()->getStatement(), false);
+    return;
+  case StatementAST::ForStatement:
+    markTailCalls(Stmt->as_ptr<ForStatementAST>()->getStatement(), false);
+    return;
+  }
+
+  // A dynamically bound callee sees the caller's variables, so the caller's
+  // frame has to stay.
+  if (Value && Value->getKind() == ExpressionAST::FunctionCallExpression) {
+    auto *FuncCall = Value->as_ptr<FunctionCallAST>();
+    FuncCall->setTailCall(FuncCall->getFunction() &&
+                          !FuncCall->isDynamicBound());
+  }
+}
@@ -0,0 +1,482 @@
+#include "ConstantPropagator.h"
+#include "NativeFunctions.h"
+#include "Runtime.h"
+#include <iostream>
+
+using namespace cmm;
+
+static cvm::BasicValue ToValue(const ExpressionAST *Expr) {
+  switch (Expr->getKind()) {
+  default:
+    return cvm::BasicValue();
+  case ExpressionAST::IntExpression:
+    return Expr->as_cptr<IntAST>()->getValue();
+  case ExpressionAST::DoubleExpression:
+    return Expr->as_cptr<DoubleAST>()->getValue();
+  case ExpressionAST::BoolExpression:
+    return Expr->as_cptr<BoolAST>()->getValue();
+  case ExpressionAST::StringExpression:
+    return Expr->as_cptr<StringAST>()->getValue();
+  }
+}
+
+/// \brief Return a literal of Value, or null if it is not a scalar
+static ExpressionAST *ToConstant(ASTArena &Arena,
+                                 const cvm::BasicValue &Value) {
+  if (Value.isArray())
+    return nullptr;
+  switch (Value.getType()) {
+  default:
+    return nullptr;
+  case cvm::IntType:
+    return Arena.create<IntAST>(Value.getInt());
+  case cvm::DoubleType:
+    return Arena.create<DoubleAST>(Value.getDouble());
+  case cvm::BoolType:
+    return Arena.create<BoolAST>(Value.getBool());
+  case cvm::StringType:
+    return Arena.create<StringAST>(Value.getString());
+  }
+}
+
+/// \brief Return true if the runtime computes OpKind of L and R without
+/// reporting an error
+static bool CanFold(BinaryOperatorAST::OperatorKind OpKind,
+                    const cvm::BasicValue &L, const cvm::BasicValue &R) {
+  switch (OpKind) {
+  default:
+    return false;
+  case BinaryOperatorAST::Add:
+    return L.isString() || R.isString() || (L.isNumeric() && R.isNumeric());
+  case BinaryOperatorAST::Minus:
+  case BinaryOperatorAST::Multiply:
+    return L.isNumeric() && R.isNumeric();
+  case BinaryOperatorAST::Division:
+  case BinaryOperatorAST::Modulo:
+    return L.isNumeric() && R.isNumeric() &&
+           !(L.isInt() && R.isInt() && R.getInt() == 0);
+  case BinaryOperatorAST::LogicalAnd:
+  case BinaryOperatorAST::LogicalOr:
+    return true;
+  case BinaryOperatorAST::Less:
+  case BinaryOperatorAST::LessEqual:
+  case BinaryOperatorAST::Equal:
+  case BinaryOperatorAST::NotEqual:
+  case BinaryOperatorAST::Greater:
+  case BinaryOperatorAST::GreaterEqual:
+    return L.getType() == R.getType() || (L.isNumeric() && R.isNumeric());
+  case BinaryOperatorAST::BitwiseAnd:
+  case BinaryOperatorAST::BitwiseOr:
+  case BinaryOperatorAST::BitwiseXor:
+    return L.isInt() && R.isInt();
+  case BinaryOperatorAST::LeftShift:
+  case BinaryOperatorAST::RightShift:
+    // Leave shifts C++ doesn't define to run time.
+    return L.isInt() && R.isInt() && R.getInt() >= 0 && R.getInt() < 32;
+  }
+}
+
+static cvm::BasicValue Compute(BinaryOperatorAST::OperatorKind OpKind,
+                               const cvm::BasicValue &L,
+                               const cvm::BasicValue &R) {
+  switch (OpKind) {
+  default:                              return cvm::BasicValue();
+  case BinaryOperatorAST::Add:          return cvm::add(L, R);
+  case BinaryOperatorAST::Minus:        return cvm::subtract(L, R);
+  case BinaryOperatorAST::Multiply:     return cvm::multiply(L, R);
+  case BinaryOperatorAST::Division:     return cvm::divide(L, R);
+  case BinaryOperatorAST::Modulo:       return cvm::modulo(L, R);
+  case BinaryOperatorAST::LogicalAnd:   return L.toBool() && R.toBool();
+  case BinaryOperatorAST::LogicalOr:    return L.toBool() || R.toBool();
+  case BinaryOperatorAST::Less:         return cvm::less(L, R);
+  case BinaryOperatorAST::LessEqual:    return cvm::lessEqual(L, R);
+  case BinaryOperatorAST::Equal:        return cvm::equal(L, R);
+  case BinaryOperatorAST::NotEqual:     return cvm::notEqual(L, R);
+  case BinaryOperatorAST::Greater:      return cvm::greater(L, R);
+  case BinaryOperatorAST::GreaterEqual: return cvm::greaterEqual(L, R);
+  case BinaryOperatorAST::BitwiseAnd:   return cvm::bitwiseAnd(L, R);
+  case BinaryOperatorAST::BitwiseOr:    return cvm::bitwiseOr(L, R);
+  case BinaryOperatorAST::BitwiseXor:   return cvm::bitwiseXor(L, R);
+  case BinaryOperatorAST::LeftShift:    return cvm::leftShift(L, R);
+  case BinaryOperatorAST::RightShift:   return cvm::rightShift(L, R);
+  }
+}
+
+static bool IsAdd(const ExpressionAST *Expr) {
+  return Expr->isBinaryOperatorExpression() &&
+         Expr->as_cptr<BinaryOperatorAST>()->getOpKind() ==
+             BinaryOperatorAST::Add;
+}
+
+ConstantPropagator::ConstantPropagator(
+    SourceMgr &SrcMgr, ASTArena &Arena, BlockAST &TopLevelBlock,
+    std::map<Symbol, FunctionDefinitionAST> &F,
+    std::map<Symbol, InfixOpDefinitionAST> &I)
+    : SrcMgr(SrcMgr), Arena(Arena), TopLevelBlock(TopLevelBlock),
+      FunctionDefinition(F), InfixOpDefinition(I), Globals(TopLevelBlock),
+      Function(nullptr), InBody(false) {}
+
+void ConstantPropagator::propagate() {
+  Variables.clear();
+  AssignedByName.clear();
+  DynamicCallees.clear();
+  AssignedIdentifiers.clear();
+  Foldings.clear();
+
+  collect();
+  for (const auto &Assigned : AssignedIdentifiers) {
+    const IdentifierAST *IdExpr = Assigned.first;
+    if (!IdExpr->isResolved() || DynamicCallees.count(Assigned.second))
+      AssignedByName.insert(IdExpr->getName());
+    if (IdExpr->isResolved())
+      Variables[VariableKey(IdExpr->getScope(), IdExpr->getSlot())]
+          .Assigned = true;
+  }
+  fold();
+}
+
+/*===------------------------------- Collect ------------------------------===*/
+
+void ConstantPropagator::collect() {
+  Globals.compute();
+  walkProgram(TopLevelBlock, FunctionDefinition, InfixOpDefinition);
+}
+
+void ConstantPropagator::enterFunction(const FunctionDefinitionAST &F) {
+  Function = &F;
+}
+
+void ConstantPropagator::leaveFunction(const FunctionDefinitionAST &F) {
+  Function = nullptr;
+}
+
+void ConstantPropagator::visitDeclaration(const DeclarationAST *Decl,
+                                          bool InBlock) {
+  // A declaration nested in a statement may not run before the reads of its
+  // slot.
+  VariableInfo &Info = Variables[VariableKey(Scopes.back(), Decl->getSlot())];
+  ++Info.DeclarationCount;
+  Info.Candidate = InBlock && !Decl->isArray() && Decl->getInitializer();
+}
+
+void ConstantPropagator::visitExpression(const ExpressionAST *Expr) {
+  switch (Expr->getKind()) {
+  default:
+    break;
+  case ExpressionAST::FunctionCallExpression: {
+    auto *FuncCall = Expr->as_cptr<FunctionCallAST>();
+    if (FuncCall->getFunction() && FuncCall->isDynamicBound())
+      DynamicCallees.insert(FuncCall->getFunction());
+    break;
+  }
+  case ExpressionAST::BinaryOperatorExpression: {
+    auto *BinOp = Expr->as_cptr<BinaryOperatorAST>();
+    if (BinOp->getOpKind() == BinaryOperatorAST::Assign &&
+        BinOp->getLHS()->isIdentifierExpr())
+      AssignedIdentifiers.emplace_back(
+          BinOp->getLHS()->as_cptr<IdentifierAST>(), Function);
+    break;
+  }
+  }
+}
+
+/*===--------------------------------- Fold -------------------------------===*/
+
+void ConstantPropagator::fold() {
+  Function = nullptr;
+  InBody = false;
+  Scopes.assign(1, &TopLevelBlock.getLayout());
+  for (auto &S : TopLevelBlock.getStatementList())
+    foldStatement(S);
+
+  // Bodies run after the top level code has declared the globals.
+  InBody = true;
+  for (auto &F : FunctionDefinition) {
+    Function = &F.second;
+    foldBody(F.second.getStatement(), F.second.getLayout());
+  }
+  Function = nullptr;
+  for (auto &I : InfixOpDefinition)
+    foldBody(I.second.getStatement(), I.second.getLayout());
+}
+
+void ConstantPropagator::foldBody(StatementAST *Stmt,
+                                  const FrameLayout &Layout) {
+  Scopes.assign(1, &TopLevelBlock.getLayout());
+  Scopes.push_back(&Layout);
+  foldStatement(Stmt);
+}
+
+void ConstantPropagator::foldStatement(StatementAST *Stmt) {
+  if (!Stmt)
+    return;
+
+  switch (Stmt->getKind()) {
+  case StatementAST::BreakStatement:
+  case StatementAST::ContinueStatement:
+    break;
+  case StatementAST::BlockStatement: {
+    auto *Block = Stmt->as_ptr<BlockAST>();
+    Scopes.push_back(&Block->getLayout());
+    for (auto &S : Block->getStatementList())
+      foldStatement(S);
+    Scopes.pop_back();
+    break;
+  }
+  case StatementAST::DeclarationStatement:
+    foldDeclaration(Stmt->as_ptr<DeclarationAST>());
+    break;
+  case StatementAST::DeclarationListStatement:
+    for (auto &Decl : Stmt->as_ptr<DeclarationListAST>()->getDeclarationList())
+      foldDeclaration(Decl);
+    break;
+  case StatementAST::ExprStatement: {
+    auto *ExprStmt = Stmt->as_ptr<ExprStatementAST>();
+    ExprStmt->setExpression(foldExpression(ExprStmt->getExpression()));
+    break;
+  }
+  case StatementAST::ReturnStatement: {
+    auto *Return = Stmt->as_ptr<ReturnStatementAST>();
+    if (Return->getReturnValue())
+      Return->setReturnValue(foldExpression(Return->getReturnValue()));
+    break;
+  }
+  case StatementAST::IfStatement: {
+    auto *IfStmt = Stmt->as_ptr<IfStatementAST>();
+    IfStmt->setCondition(foldExpression(IfStmt->getCondition()));
+    foldStatement(IfStmt->getStatementThen());
+    foldStatement(IfStmt->getStatementElse());
+    break;
+  }
+  case StatementAST::WhileStatement: {
+    auto *WhileStmt = Stmt->as_ptr<WhileStatementAST>();
+    if (WhileStmt->getCondition())
+      WhileStmt->setCondition(foldExpression(WhileStmt->getCondition()));
+    foldStatement(WhileStmt->getStatement());
+    break;
+  }
+  case StatementAST::ForStatement: {
+    auto *ForStmt = Stmt->as_ptr<ForStatementAST>();
+    if (ForStmt->getInit())
+      ForStmt->setInit(foldExpression(ForStmt->getInit()));
+    if (ForStmt->getCondition())
+      ForStmt->setCondition(foldExpression(ForStmt->getCondition()));
+    if (ForStmt->getPost())
+      ForStmt->setPost(foldExpression(ForStmt->getPost()));
+    foldStatement(ForStmt->getStatement());
+    break;
+  }
+  }
+}
+
+void ConstantPropagator::foldDeclaration(DeclarationAST *Decl) {
+  for (auto &E : Decl->getElementCountList())
+    E = foldExpression(E);
+  ExpressionAST *Init = Decl->getInitializer();
+  if (!Init)
+    return;
+  Init = foldExpression(Init);
+  Decl->setInitializer(Init);
+
+  VariableInfo &Info = Variables[VariableKey(Scopes.back(), Decl->getSlot())];
+  if (!Info.Candidate || Info.DeclarationCount != 1 || Info.Assigned ||
+      AssignedByName.count(Decl->getName()) || !Init->isConstant())
+    return;
+
+  // Take the value the declaration stores, or leave its error to run time.
+  cvm::BasicValue Value = ToValue(Init);
+  if (Decl->getType() == cvm::DoubleType && Value.isInt())
+    Info.Value = Arena.create<DoubleAST>(Value.getInt());
+  else if (Decl->getType() == Value.getType())
+    Info.Value = Init;
+  else
+    return;
+
+  Info.FoldingIndex = Foldings.size();
+  Foldings.push_back(
+      Folding{Folding::Variable, Decl->getName(), 0, Info.Value, 0});
+}
+
+ExpressionAST *ConstantPropagator::foldExpression(ExpressionAST *Expr) {
+  switch (Expr->getKind()) {
+  case ExpressionAST::IntExpression:
+  case ExpressionAST::DoubleExpression:
+  case ExpressionAST::BoolExpression:
+  case ExpressionAST::StringExpression:
+    return Expr;
+  case ExpressionAST::IdentifierExpression:
+    return foldIdentifier(Expr->as_ptr<IdentifierAST>());
+  case ExpressionAST::FunctionCallExpression:
+    return foldFunctionCall(Expr->as_ptr<FunctionCallAST>());
+  case ExpressionAST::InfixOpExpression: {
+    auto *InfixOp = Expr->as_ptr<InfixOpExprAST>();
+    InfixOp->setLHS(foldExpression(InfixOp->getLHS()));
+    InfixOp->setRHS(foldExpression(InfixOp->getRHS()));
+    return Expr;
+  }
+  case ExpressionAST::BinaryOperatorExpression:
+    return foldBinaryOperator(Expr->as_ptr<BinaryOperatorAST>());
+  case ExpressionAST::UnaryOperatorExpression:
+    return foldUnaryOperator(Expr->as_ptr<UnaryOperatorAST>());
+  }
+  return Expr;
+}
+
+/// \brief Fold the subexpressions of an expression evaluated as a lvalue,
+/// keeping the variable it refers to
+ExpressionAST *ConstantPropagator::foldLvalue(ExpressionAST *Expr) {
+  if (Expr->isIdentifierExpr())
+    return Expr;
+  if (Expr->isBinaryOperatorExpression() &&
+      Expr->as_ptr<BinaryOperatorAST>()->getOpKind() ==
+          BinaryOperatorAST::Index) {
+    auto *BinOp = Expr->as_ptr<BinaryOperatorAST>();
+    BinOp->setLHS(foldLvalue(BinOp->getLHS()));
+    BinOp->setRHS(foldExpression(BinOp->getRHS()));
+    return Expr;
+  }
+  return foldExpression(Expr);
+}
+
+ExpressionAST *ConstantPropagator::foldIdentifier(IdentifierAST *IdExpr) {
+  if (!IdExpr->isResolved() || DynamicCallees.count(Function))
+    return IdExpr;
+
+  auto It = Variables.find(VariableKey(IdExpr->getScope(), IdExpr->getSlot()));
+  if (It == Variables.end() || !It->second.Value)
+    return IdExpr;
+
+  if (!Globals.isDeclared(IdExpr, InBody))
+    return IdExpr;
+
+  ++Foldings[It->second.FoldingIndex].Uses;
+  return It->second.Value;
+}
+
+ExpressionAST *ConstantPropagator::foldFunctionCall(FunctionCallAST *FuncCall) {
+  bool AllConstant = true;
+  for (auto &Arg : FuncCall->getArguments()) {
+    Arg = foldExpression(Arg);
+    AllConstant = AllConstant && Arg->isConstant();
+  }
+
+  cvm::NativeFunction Native = FuncCall->getNativeFunction();
+  if (!Native || FuncCall->isDynamicBound() || !AllConstant)
+    return FuncCall;
+  cvm::NativeTraits::ArgumentUse Use = cvm::getNativeTraits(Native).Use;
+  if (Use == cvm::NativeTraits::Impure)
+    return FuncCall;
+
+  // Converting a string to a number may throw.
+  std::vector<cvm::BasicValue> Args;
+  for (const ExpressionAST *Arg : FuncCall->getArguments()) {
+    if (Arg->isString() && Use == cvm::NativeTraits::ToNumber)
+      return FuncCall;
+    Args.push_back(ToValue(Arg));
+  }
+  ExpressionAST *Res = ToConstant(
+      Arena, Native(cvm::ArgumentList(Args.data(), Args.data() + Args.size())));
+  if (!Res)
+    return FuncCall;
+
+  Foldings.push_back(Folding{Folding::NativeCall, FuncCall->getCallee(),
+                             FuncCall->getLoc(), Res, 0});
+  return Res;
+}
+
+ExpressionAST *
+ConstantPropagator::foldBinaryOperator(BinaryOperatorAST *BinOp) {
+  BinaryOperatorAST::OperatorKind OpKind = BinOp->getOpKind();
+  if (OpKind == BinaryOperatorAST::Assign ||
+      OpKind == BinaryOperatorAST::Index) {
+    BinOp->setLHS(foldLvalue(BinOp->getLHS()));
+    BinOp->setRHS(foldExpression(BinOp->getRHS()));
+    return BinOp;
+  }
+
+  ExpressionAST *LHS = foldExpression(BinOp->getLHS());
+  ExpressionAST *RHS = foldExpression(BinOp->getRHS());
+  BinOp->setLHS(LHS);
+  BinOp->setRHS(RHS);
+
+  if (LHS->isConstant() && RHS->isConstant()) {
+    cvm::BasicValue L = ToValue(LHS), R = ToValue(RHS);
+    if (!CanFold(OpKind, L, R))
+      return BinOp;
+    ExpressionAST *Res = ToConstant(Arena, Compute(OpKind, L, R));
+    if (!Res)
+      return BinOp;
+    if (OpKind == BinaryOperatorAST::Add && Res->isString())
+      Foldings.push_back(
+          Folding{Folding::Concatenation, Symbol(), 0, Res, 0});
+    return Res;
+  }
+
+  // (X + "a") + "b" is X + "ab": either way X is converted to a string and
+  // the literals are appended.
+  if (OpKind == BinaryOperatorAST::Add && RHS->isString() && IsAdd(LHS) &&
+      LHS->as_ptr<BinaryOperatorAST>()->getRHS()->isString()) {
+    auto *Inner = LHS->as_ptr<BinaryOperatorAST>();
+    ExpressionAST *Res = Arena.create<StringAST>(
+        Inner->getRHS()->as_cptr<StringAST>()->getValue() +
+        RHS->as_cptr<StringAST>()->getValue());
+    Foldings.push_back(Folding{Folding::Concatenation, Symbol(), 0, Res, 0});
+    Inner->setRHS(Res);
+    return Inner;
+  }
+  return BinOp;
+}
+
+ExpressionAST *
+ConstantPropagator::foldUnaryOperator(UnaryOperatorAST *UnaryOp) {
+  ExpressionAST *Operand = foldExpression(UnaryOp->getOperand());
+  UnaryOp->setOperand(Operand);
+  if (!Operand->isConstant())
+    return UnaryOp;
+
+  cvm::BasicValue Value = ToValue(Operand);
+  switch (UnaryOp->getOpKind()) {
+  case UnaryOperatorAST::Plus:
+    return Value.isNumeric() ? Operand : UnaryOp;
+  case UnaryOperatorAST::Minus:
+    if (!Value.isNumeric())
+      return UnaryOp;
+    return ToConstant(Arena, cvm::unaryMinus(Value));
+  case UnaryOperatorAST::LogicalNot:
+    return ToConstant(Arena, cvm::logicalNot(Value));
+  case UnaryOperatorAST::BitwiseNot:
+    if (!Value.isInt())
+      return UnaryOp;
+    return ToConstant(Arena, cvm::bitwiseNot(Value));
+  }
+  return UnaryOp;
+}
+
+void ConstantPropagator::dump() const {
+  size_t Count = 0;
+  for (const Folding &F : Foldings) {
+    if (F.Kind == Folding::Variable && F.Uses == 0)
+      continue;
+    if (Count++ == 0)
+      std::cout << "{----   Folded constants   ----}\n";
+
+    switch (F.Kind) {
+    case Folding::Variable:
+      std::cout << "variable " << F.Name << ", " << F.Uses
+                << (F.Uses == 1 ? " use: " : " uses: ");
+      break;
+    case Folding::NativeCall: {
+      auto LineCol = SrcMgr.getLineColByLoc(F.Loc);
+      std::cout << "call to " << F.Name << " at (Line " << LineCol.first + 1
+                << ", Col " << LineCol.second + 1 << "): ";
+      break;
+    }
+    case Folding::Concatenation:
+      std::cout << "concatenation: ";
+      break;
+    }
+    F.Value->dump();
+  }
+  if (Count == 0)
+    std::cout << "Note: nothing folded\n";
+}
@@ -0,0 +1,1274 @@
+#include "CppEmitter.h"
+#include <cmath>
+#include <cstdio>
+#include <iomanip>
+#include <limits>
+#include <sstream>
+
+using namespace cmm;
+
+/// \brief Return true if evaluating Exprs in an order C++ allows could differ
+/// visibly from evaluating them left to right
+/// An operand that may assign variables or fail must not move across another
+/// one that reads anything.
+static bool NeedsSequencing(const std::vector<const ExpressionAST *> &Exprs) {
+  for (size_t I = 0; I < Exprs.size(); ++I) {
+    for (size_t J = I + 1; J < Exprs.size(); ++J) {
+      if ((Exprs[I]->mayHaveSideEffects() && !Exprs[J]->isConstant()) ||
+          (!Exprs[I]->isConstant() && Exprs[J]->mayHaveSideEffects()))
+        return true;
+    }
+  }
+  return false;
+}
+
+static bool IsNativeType(cvm::BasicType Type) {
+  return Type == cvm::IntType || Type == cvm::DoubleType ||
+      Type == cvm::BoolType;
+}
+
+static const char *GetTypeEnum(cvm::BasicType Type) {
+  switch (Type) {
+  case cvm::BoolType:   return "cvm::BoolType";
+  case cvm::IntType:    return "cvm::IntType";
+  case cvm::DoubleType: return "cvm::DoubleType";
+  case cvm::StringType: return "cvm::StringType";
+  case cvm::VoidType:   return "cvm::VoidType";
+  }
+  return "cvm::VoidType";
+}
+
+static std::string IntLiteral(int I) {
+  if (I == std::numeric_limits<int>::min())
+    return "(-2147483647 - 1)";
+  return I < 0 ? "(" + std::to_string(I) + ")" : std::to_string(I);
+}
+
+static std::string DoubleLiteral(double D) {
+  // The runtime prints the sign of a NaN, like a folded 0.0 / 0.0 has.
+  if (std::isnan(D)) {
+    return std::signbit(D) ? "(-std::numeric_limits<double>::quiet_NaN())"
+                           : "std::numeric_limits<double>::quiet_NaN()";
+  }
+  if (std::isinf(D)) {
+    return D > 0 ? "std::numeric_limits<double>::infinity()"
+                 : "(-std::numeric_limits<double>::infinity())";
+  }
+
+  std::ostringstream OS;
+  OS << std::setprecision(17) << D;
+  std::string S = OS.str();
+  if (S.find_first_of(".e") == std::string::npos)
+    S += ".0";
+  return std::signbit(D) ? "(" + S + ")" : S;
+}
+
+/// \brief Return the C++ operator and the runtime function for OpKind
+static std::pair<const char *, const char *>
+GetBinaryOperator(BinaryOperatorAST::OperatorKind OpKind) {
+  switch (OpKind) {
+  default:                              return {"", ""};
+  case BinaryOperatorAST::Add:          return {"+", "add"};
+  case BinaryOperatorAST::Minus:        return {"-", "subtract"};
+  case BinaryOperatorAST::Multiply:     return {"*", "multiply"};
+  case BinaryOperatorAST::Division:     return {"/", "divide"};
+  case BinaryOperatorAST::Modulo:       return {"%", "modulo"};
+  case BinaryOperatorAST::Less:         return {"<", "less"};
+  case BinaryOperatorAST::LessEqual:    return {"<=", "lessEqual"};
+  case BinaryOperatorAST::Equal:        return {"==", "equal"};
+  case BinaryOperatorAST::NotEqual:     return {"!=", "notEqual"};
+  case BinaryOperatorAST::Greater:      return {">", "greater"};
+  case BinaryOperatorAST::GreaterEqual: return {">=", "greaterEqual"};
+  case BinaryOperatorAST::BitwiseAnd:   return {"&", "bitwiseAnd"};
+  case BinaryOperatorAST::BitwiseOr:    return {"|", "bitwiseOr"};
+  case BinaryOperatorAST::BitwiseXor:   return {"^", "bitwiseXor"};
+  case BinaryOperatorAST::LeftShift:    return {"<<", "leftShift"};
+  case BinaryOperatorAST::RightShift:   return {">>", "rightShift"};
+  }
+}
+
+bool CppEmitter::emit(std::ostream &OS) {
+  collectVariables();
+  if (HadError)
+    return true;
+
+  // Start from the most native program possible; every pass weakens the
+  // assumptions it finds broken until one pass finds none.
+  for (auto &F : FunctionDefinition)
+    if (IsNativeType(F.second.getType()))
+      NativeReturns.insert(&F.second);
+
+  std::string Program;
+  do {
+    Changed = false;
+    Program = emitProgram();
+  } while (Changed);
+
+  OS << Program;
+  return false;
+}
+
+/*===----------------------- Variables and checks -------------------------===*/
+
+void CppEmitter::collectVariables() {
+  Function = nullptr;
+  InfixOp = nullptr;
+  NameCounts.clear();
+  walkProgram(TopLevelBlock, FunctionDefinition, InfixOpDefinition);
+}
+
+void CppEmitter::enterFunction(const FunctionDefinitionAST &F) {
+  Function = &F;
+  NameCounts.clear();
+  int Slot = 0;
+  for (const Parameter &Param : F.getParameterList())
+    addVariable(&F.getLayout(), Slot++, Param.getName().str(), Param.getType(),
+                0, false);
+}
+
+void CppEmitter::leaveFunction(const FunctionDefinitionAST &F) {
+  Function = nullptr;
+}
+
+void CppEmitter::enterInfixOp(const InfixOpDefinitionAST &I) {
+  InfixOp = &I;
+  InfixOpIndex[InfixOp] = InfixOpIndex.size();
+  NameCounts.clear();
+  // Operands have no declared type.
+  addVariable(&I.getLayout(), 0, I.getLHSName().str(), cvm::VoidType, 0,
+              false);
+  addVariable(&I.getLayout(), 1, I.getRHSName().str(), cvm::VoidType, 0,
+              false);
+}
+
+void CppEmitter::leaveInfixOp(const InfixOpDefinitionAST &I) {
+  InfixOp = nullptr;
+}
+
+/// \brief Reject the statements that have no C++ counterpart
+/// C++ gives a declaration directly in a block the same lifetime as CMM does.
+void CppEmitter::visitStatement(const StatementAST *Stmt, bool InBlock) {
+  switch (Stmt->getKind()) {
+  default:
+    break;
+  case StatementAST::DeclarationListStatement:
+    if (!InBlock)
+      reportUnsupported(Stmt->as_cptr<DeclarationListAST>()
+                            ->getDeclarationList().front()->getLoc(),
+                        "a declaration that isn't directly in a block");
+    break;
+  case StatementAST::ReturnStatement: {
+    auto *Value = Stmt->as_cptr<ReturnStatementAST>()->getReturnValue();
+    if (Value && getSelfTailCall(Value))
+      CheckedTailCalls.insert(Function);
+    break;
+  }
+  }
+}
+
+void CppEmitter::visitDeclaration(const DeclarationAST *Decl, bool InBlock) {
+  const FrameLayout *Layout = Scopes.back();
+  addVariable(Layout, Decl->getSlot(), Decl->getName().str(), Decl->getType(),
+              Decl->getElementCountList().size(),
+              Layout == &TopLevelBlock.getLayout());
+}
+
+void CppEmitter::visitExpression(const ExpressionAST *Expr) {
+  switch (Expr->getKind()) {
+  default:
+    break;
+  case ExpressionAST::FunctionCallExpression: {
+    auto *FuncCall = Expr->as_cptr<FunctionCallAST>();
+    if (FuncCall->isDynamicBound()) {
+      SrcMgr.Error(FuncCall->getLoc(), "dynamically bound call `" +
+          FuncCall->getCallee().str() + "!()' can't be compiled to C++");
+      HadError = true;
+    }
+    break;
+  }
+  case ExpressionAST::BinaryOperatorExpression: {
+    auto *BinOpExpr = Expr->as_cptr<BinaryOperatorAST>();
+    const ExpressionAST *LHS = BinOpExpr->getLHS();
+    // The walker accepts an assignment as a lvalue; C++ code here doesn't.
+    if ((BinOpExpr->getOpKind() == BinaryOperatorAST::Assign ||
+         BinOpExpr->getOpKind() == BinaryOperatorAST::Index) &&
+        LHS->isBinaryOperatorExpression() &&
+        LHS->as_cptr<BinaryOperatorAST>()->getOpKind() ==
+            BinaryOperatorAST::Assign)
+      reportUnsupported(LHS->as_cptr<BinaryOperatorAST>()->getLoc(),
+                        "an assignment used as a lvalue");
+    break;
+  }
+  }
+}
+
+void CppEmitter::addVariable(const FrameLayout *Layout, int Slot,
+                             const std::string &Name, cvm::BasicType Type,
+                             size_t Rank, bool Global) {
+  VariableKey Key(Layout, Slot);
+  if (Variables.count(Key))
+    return;
+
+  // Names are unique within a body, so a declaration never hides a variable
+  // its initializer reads, and parameters never clash with locals.
+  std::string CppName;
+  if (Global) {
+    CppName = "g_" + Name;
+  } else {
+    unsigned Count = ++NameCounts[Name];
+    CppName = (Count == 1 ? "v" : "v" + std::to_string(Count)) + "_" + Name;
+  }
+  Variables[Key] = VariableInfo{CppName, Type, static_cast<unsigned>(Rank),
+                                false, Global};
+}
+
+void CppEmitter::reportUnsupported(CMMLexer::LocTy Loc,
+                                   const std::string &What) {
+  SrcMgr.Error(Loc, What + " can't be compiled to C++");
+  HadError = true;
+}
+
+const CppEmitter::VariableInfo *
+CppEmitter::findVariable(const IdentifierAST *IdExpr) const {
+  if (!IdExpr->isResolved())
+    return nullptr;
+  auto It = Variables.find(VariableKey(IdExpr->getScope(), IdExpr->getSlot()));
+  return It == Variables.end() ? nullptr : &It->second;
+}
+
+bool CppEmitter::isNativeStorage(const VariableInfo &Var) {
+  return Var.Rank == 0 && !Var.Boxed && IsNativeType(Var.Type);
+}
+
+CppEmitter::ValueType
+CppEmitter::getVariableType(const VariableInfo &Var) const {
+  if (Var.Rank != 0)
+    return ValueType(ValueType::Array, Var.Type, Var.Rank);
+  if (Var.Boxed)
+    return ValueType::dynamicArray();
+  return getValueKind(Var.Type);
+}
+
+CppEmitter::ValueType::KindTy CppEmitter::getValueKind(cvm::BasicType Type) {
+  switch (Type) {
+  case cvm::IntType:    return ValueType::Int;
+  case cvm::DoubleType: return ValueType::Double;
+  case cvm::BoolType:   return ValueType::Bool;
+  case cvm::StringType: return ValueType::String;
+  default:              return ValueType::Dynamic;
+  }
+}
+
+std::string CppEmitter::getCppType(ValueType::KindTy Kind) {
+  switch (Kind) {
+  case ValueType::Int:    return "int";
+  case ValueType::Double: return "double";
+  case ValueType::Bool:   return "bool";
+  default:                return "cvm::BasicValue";
+  }
+}
+
+std::string CppEmitter::getCppType(const VariableInfo &Var) {
+  return isNativeStorage(Var) ? getCppType(getValueKind(Var.Type))
+                              : "cvm::BasicValue";
+}
+
+/// \brief Note that Value is stored into Var, which then can't stay native
+/// if Value is an array
+void CppEmitter::noteStore(VariableInfo &Var, const CppExpr &Value) {
+  if (Value.Type.mayBeArray() && Var.Rank == 0 && !Var.Boxed) {
+    Var.Boxed = true;
+    Changed = true;
+  }
+}
+
+std::string CppEmitter::box(const CppExpr &Value) {
+  if (Value.Type.isNative())
+    return "cvm::BasicValue(" + Value.Code + ")";
+  return Value.Code;
+}
+
+/// \brief Return Value as a native Kind if C++ converts it the way CMM does
+bool CppEmitter::convertsImplicitly(const ValueType &From,
+                                    ValueType::KindTy To) {
+  return From.Kind == To ||
+      (To == ValueType::Double && From.Kind == ValueType::Int);
+}
+
+std::string CppEmitter::quote(const std::string &S) {
+  std::string Quoted = "\"";
+  for (unsigned char C : S) {
+    switch (C) {
+    case '"':  Quoted += "\\\""; break;
+    case '\\': Quoted += "\\\\"; break;
+    case '?':  Quoted += "\\?"; break;
+    case '\n': Quoted += "\\n"; break;
+    case '\t': Quoted += "\\t"; break;
+    default:
+      if (C < 0x20 || C >= 0x7f) {
+        char Buf[8];
+        std::snprintf(Buf, sizeof(Buf), "\\%03o", C);
+        Quoted += Buf;
+      } else {
+        Quoted += static_cast<char>(C);
+      }
+    }
+  }
+  return Quoted + "\"";
+}
+
+std::string CppEmitter::stringConstant(const std::string &S) {
+  auto It = StringIndex.emplace(S, StringIndex.size()).first;
+  return "s" + std::to_string(It->second);
+}
+
+std::string CppEmitter::nativeFunction(const std::string &Name) {
+  return NativeNames[Name] = "n_" + Name;
+}
+
+std::string CppEmitter::newTemp() {
+  return "t" + std::to_string(TempCount++);
+}
+
+/*===------------------------ Program structure ---------------------------===*/
+
+std::string CppEmitter::emitProgram() {
+  StringIndex.clear();
+  NativeNames.clear();
+  CalledFunctions.clear();
+  CalledInfixOps.clear();
+  UnreadVariables.clear();
+  TempCount = 0;
+  Out.clear();
+
+  // Bodies are emitted once some emitted code calls them, so a function whose
+  // calls were all inlined leaves no unused definition behind.
+  emitTopLevel();
+  std::string Main;
+  Main.swap(Out);
+  std::map<const FunctionDefinitionAST *, std::string> FunctionBodies;
+  std::map<const InfixOpDefinitionAST *, std::string> InfixOpBodies;
+  for (bool Emitted = true; Emitted;) {
+    Emitted = false;
+    for (auto &F : FunctionDefinition) {
+      if (!CalledFunctions.count(&F.second) || FunctionBodies.count(&F.second))
+        continue;
+      emitFunction(F.second);
+      FunctionBodies[&F.second].swap(Out);
+      Emitted = true;
+    }
+    for (auto &I : InfixOpDefinition) {
+      if (!CalledInfixOps.count(&I.second) || InfixOpBodies.count(&I.second))
+        continue;
+      emitInfixOp(I.second);
+      InfixOpBodies[&I.second].swap(Out);
+      Emitted = true;
+    }
+  }
+
+  std::ostringstream OS;
+  OS << "// Generated by cmm --emit-cpp. Build with\n"
+        "//   c++ -std=c++11 -O2 -I<cmm>/include <this file> "
+        "<cmm build>/libcmmrt.a -lncurses\n\n"
+        "#include \"NativeFunctions.h\"\n"
+        "#include \"Runtime.h\"\n"
+        "#include <cmath>\n"
+        "#include <limits>\n\n"
+        "namespace {\n";
+
+  std::vector<const std::string *> Strings(StringIndex.size());
+  for (auto &S : StringIndex)
+    Strings[S.second] = &S.first;
+  for (size_t I = 0; I < Strings.size(); ++I) {
+    OS << "const cvm::BasicValue s" << I << "(std::string("
+       << quote(*Strings[I]) << ", " << Strings[I]->size() << "));\n";
+  }
+  for (auto &N : NativeNames) {
+    OS << "const cvm::NativeFunction " << N.second
+       << " = cvm::getNativeFunctionMap().at(" << quote(N.first) << ");\n";
+  }
+  for (auto &V : Variables) {
+    if (V.second.Global) {
+      OS << getCppType(V.second) << " " << V.second.CppName << ";\n"
+         << "bool " << V.second.CppName << "_declared;\n";
+    }
+  }
+  OS << "\n";
+
+  for (auto &F : FunctionDefinition)
+    if (FunctionBodies.count(&F.second))
+      OS << getSignature(F.second) << ";\n";
+  for (auto &I : InfixOpDefinition)
+    if (InfixOpBodies.count(&I.second))
+      OS << getSignature(I.second) << ";\n";
+  OS << "\n";
+  for (auto &F : FunctionDefinition)
+    if (FunctionBodies.count(&F.second))
+      OS << FunctionBodies[&F.second];
+  for (auto &I : InfixOpDefinition)
+    if (InfixOpBodies.count(&I.second))
+      OS << InfixOpBodies[&I.second];
+  OS << "} // namespace\n\n" << Main;
+  return OS.str();
+}
+
+std::string CppEmitter::getSignature(const FunctionDefinitionAST &F) const {
+  std::string Sig = getCppType(hasNativeReturn(&F) ? getValueKind(F.getType())
+                                                   : ValueType::Dynamic);
+  Sig += " f_" + F.getName().str() + "(";
+  for (size_t Slot = 0; Slot < F.getParameterCount(); ++Slot) {
+    const VariableInfo &Var =
+        Variables.at(VariableKey(&F.getLayout(), static_cast<int>(Slot)));
+    Sig += (Slot ? ", " : "") + getCppType(Var) + " " + Var.CppName;
+  }
+  return Sig + ")";
+}
+
+std::string CppEmitter::getSignature(const InfixOpDefinitionAST &I) const {
+  const VariableInfo &LHS = Variables.at(VariableKey(&I.getLayout(), 0));
+  const VariableInfo &RHS = Variables.at(VariableKey(&I.getLayout(), 1));
+  return "cvm::BasicValue i" + std::to_string(InfixOpIndex.at(&I)) +
+      "(cvm::BasicValue " + LHS.CppName + ", cvm::BasicValue " + RHS.CppName +
+      ")";
+}
+
+void CppEmitter::beginBody(const FrameLayout &Layout, size_t ParamCount) {
+  Declared.clear();
+  CurrentLayout = nullptr;
+  LoopDepth = 0;
+  Indent = 1;
+  for (size_t Slot = 0; Slot < ParamCount; ++Slot) {
+    VariableKey Key(&Layout, static_cast<int>(Slot));
+    Declared.insert(Key);
+    noteUnread(Key, Variables.at(Key));
+  }
+}
+
+/// \brief Cast a local nothing reads to void
+/// Folding and inlining may leave a local, or a parameter, that is only
+/// stored to, and the C++ compiler would warn about it.
+void CppEmitter::noteUnread(const VariableKey &Key, const VariableInfo &Var) {
+  if (ReadVariables.count(Key))
+    return;
+  line("(void)" + Var.CppName + ";");
+  UnreadVariables.insert(Key);
+}
+
+/// \brief Emit the definition of F
+/// Self tail calls jump back to the top of the body. A function that returns
+/// one with `return` still checks the value it ends up returning against its
+/// declared type, even where the body ends with an unchecked expression.
+void CppEmitter::emitFunction(const FunctionDefinitionAST &F) {
+  Function = &F;
+  InfixOp = nullptr;
+  Out += getSignature(F) + " {\n";
+  size_t BodyStart = Out.size();
+  beginBody(F.getLayout(), F.getParameterCount());
+  HasSelfTailCall = false;
+  emitBody(F.getStatement(), true);
+  if (HasSelfTailCall) {
+    std::string Head;
+    if (needsTailCheck())
+      Head += "  bool tail_checked = false;\n";
+    Out.insert(BodyStart, Head + "tail_call:\n");
+  }
+  Out += "}\n\n";
+}
+
+void CppEmitter::emitInfixOp(const InfixOpDefinitionAST &I) {
+  Function = nullptr;
+  InfixOp = &I;
+  Out += getSignature(I) + " {\n";
+  beginBody(I.getLayout(), 2);
+  emitBody(I.getStatement(), true);
+  Out += "}\n\n";
+}
+
+/// \brief Emit main(): the top level statements, then the CMM main function
+/// with the command line arguments, if it exists
+void CppEmitter::emitTopLevel() {
+  Function = nullptr;
+  InfixOp = nullptr;
+  beginBody(TopLevelBlock.getLayout(), 0);
+  CurrentLayout = &TopLevelBlock.getLayout();
+  auto MainIt = FunctionDefinition.find(Symbol::intern("main"));
+  bool TakesArguments = MainIt != FunctionDefinition.end() &&
+                        MainIt->second.getParameterCount() != 0;
+  Out += TakesArguments ? "int main(int argc, char *argv[]) {\n"
+                        : "int main() {\n";
+  for (auto &Stmt : TopLevelBlock.getStatementList())
+    emitStatement(Stmt, false);
+
+  if (MainIt != FunctionDefinition.end()) {
+    std::vector<CppExpr> Args;
+    if (TakesArguments)
+      Args.push_back({"cvm::makeArgumentArray(argc - 1, argv + 1)",
+                      ValueType::Dynamic});
+    line("return cvm::BasicValue(" + emitCall(MainIt->second, Args).Code +
+         ").toInt();");
+  } else {
+    line("return 0;");
+  }
+  Out += "}\n";
+}
+
+/*===----------------------------- Statements -----------------------------===*/
+
+void CppEmitter::line(const std::string &Code) {
+  Out += std::string(Indent * 2, ' ') + Code + "\n";
+}
+
+/// \brief Emit a statement inside braces the caller has opened
+void CppEmitter::emitBody(const StatementAST *Stmt, bool Tail) {
+  if (Stmt && Stmt->getKind() == StatementAST::BlockStatement)
+    emitBlock(Stmt->as_cptr<BlockAST>(), Tail, false);
+  else
+    emitStatement(Stmt, Tail);
+}
+
+/// \brief Emit a statement, which returns if it is in tail position
+void CppEmitter::emitStatement(const StatementAST *Stmt, bool Tail) {
+  if (!Stmt) {
+    if (Tail)
+      emitVoidExit();
+    return;
+  }
+
+  switch (Stmt->getKind()) {
+  case StatementAST::DeclarationStatement:
+    line("cvm::RuntimeError(" +
+         quote("single declaration should not be used by user") + ");");
+    break;
+  case StatementAST::DeclarationListStatement:
+    for (auto &Decl : Stmt->as_cptr<DeclarationListAST>()->getDeclarationList())
+      emitDeclaration(Decl);
+    break;
+  case StatementAST::ExprStatement: {
+    const ExpressionAST *Expr =
+        Stmt->as_cptr<ExprStatementAST>()->getExpression();
+    if (Tail && emitSelfTailCall(Expr, false))
+      break;
+    CppExpr Value = emitExpression(Expr);
+    if (Tail)
+      emitTailValue(Value);
+    else if (Expr->mayHaveSideEffects())
+      line(Value.Code + ";");
+    else
+      line("(void)" + Value.Code + ";");
+    break;
+  }
+  case StatementAST::BlockStatement:
+    emitBlock(Stmt->as_cptr<BlockAST>(), Tail, true);
+    break;
+  case StatementAST::IfStatement: {
+    auto *IfStmt = Stmt->as_cptr<IfStatementAST>();
+    line("if (" + emitCondition(IfStmt->getCondition()) + ") {");
+    ++Indent;
+    emitBody(IfStmt->getStatementThen(), Tail);
+    --Indent;
+    if (const StatementAST *StatementElse = IfStmt->getStatementElse()) {
+      line("} else {");
+      ++Indent;
+      emitBody(StatementElse, Tail);
+      --Indent;
+    }
+    line("}");
+    break;
+  }
+  case StatementAST::ReturnStatement:
+    emitReturn(Stmt->as_cptr<ReturnStatementAST>()->getReturnValue());
+    break;
+  case StatementAST::WhileStatement: {
+    auto *WhileStmt = Stmt->as_cptr<WhileStatementAST>();
+    if (const ExpressionAST *Condition = WhileStmt->getCondition())
+      line("while (" + emitCondition(Condition) + ") {");
+    else
+      line("for (;;) {");
+    ++Indent;
+    ++LoopDepth;
+    emitBody(WhileStmt->getStatement(), false);
+    --LoopDepth;
+    --Indent;
+    line("}");
+    break;
+  }
+  case StatementAST::ForStatement: {
+    auto *ForStmt = Stmt->as_cptr<ForStatementAST>();
+    std::string Head = "for (";
+    if (const ExpressionAST *Init = ForStmt->getInit())
+      Head += "(void)" + emitExpression(Init).Code;
+    Head += "; ";
+    if (const ExpressionAST *Condition = ForStmt->getCondition())
+      Head += emitCondition(Condition);
+    Head += "; ";
+    if (const ExpressionAST *Post = ForStmt->getPost())
+      Head += "(void)" + emitExpression(Post).Code;
+    line(Head + ") {");
+    ++Indent;
+    ++LoopDepth;
+    emitBody(ForStmt->getStatement(), false);
+    --LoopDepth;
+    --Indent;
+    line("}");
+    break;
+  }
+  case StatementAST::BreakStatement:
+  case StatementAST::ContinueStatement: {
+    bool IsBreak = Stmt->getKind() == StatementAST::BreakStatement;
+    // Outside of a loop, it ends a function or infix operator body with void,
+    // and is an error at the top level.
+    if (LoopDepth)
+      line(IsBreak ? "break;" : "continue;");
+    else if (!Function && !InfixOp)
+      line("cvm::RuntimeError(" + quote(IsBreak
+          ? "break statement should be in a loop"
+          : "continue statement should be in a loop") + ");");
+    else
+      emitVoidExit();
+    break;
+  }
+  }
+
+  if (Tail && !Stmt->returnsInTail())
+    emitVoidExit();
+}
+
+void CppEmitter::emitBlock(const BlockAST *Block, bool Tail, bool Braces) {
+  const FrameLayout *OuterLayout = CurrentLayout;
+  CurrentLayout = &Block->getLayout();
+  if (Braces) {
+    line("{");
+    ++Indent;
+  }
+
+  auto &StmtList = Block->getStatementList();
+  if (StmtList.empty() && Tail)
+    emitVoidExit();
+  for (auto It = StmtList.begin(); It != StmtList.end(); ++It)
+    emitStatement(*It, Tail && std::next(It) == StmtList.end());
+
+  if (Braces) {
+    --Indent;
+    line("}");
+  }
+  CurrentLayout = OuterLayout;
+}
+
+void CppEmitter::emitDeclaration(const DeclarationAST *Decl) {
+  VariableKey Key(CurrentLayout, Decl->getSlot());
+  VariableInfo &Var = Variables.at(Key);
+  const std::string &Name = Decl->getName().str();
+
+  if (Declared.count(Key)) {
+    line("cvm::RuntimeError(" + quote("variable `" + Name +
+         "' is already defined in current scope") + ");");
+    return;
+  }
+
+  // Globals are defined at file scope; their declaration just sets them.
+  std::string Target =
+      Var.Global ? Var.CppName : getCppType(Var) + " " + Var.CppName;
+
+  if (Decl->isArray()) {
+    std::string Dimensions;
+    for (auto &E : Decl->getElementCountList()) {
+      Dimensions += (Dimensions.empty() ? "" : ", ") +
+          ("cvm::checkDimension(" + quote(Name) + ", " +
+           box(emitExpression(E)) + ")");
+    }
+    line(Target + " = cvm::BasicValue(" + GetTypeEnum(Var.Type) +
+         ", std::list<int>{" + Dimensions + "});");
+    // An array keeps its elements; the initializer is only checked.
+    if (Decl->getInitializer()) {
+      line("(void)cvm::initialized(" +
+           box(emitExpression(Decl->getInitializer())) + ", " + quote(Name) +
+           ", " + GetTypeEnum(Var.Type) + ");");
+    }
+  } else if (Decl->getInitializer()) {
+    CppExpr Init = emitExpression(Decl->getInitializer());
+    noteStore(Var, Init);
+    std::string Value;
+    if (isNativeStorage(Var)) {
+      ValueType::KindTy Kind = getValueKind(Var.Type);
+      Value = convertsImplicitly(Init.Type, Kind)
+          ? Init.Code
+          : "cvm::initializeNative<" + getCppType(Kind) + ">(" + box(Init) +
+                ", " + quote(Name) + ")";
+    } else if (!Var.Boxed && Var.Type == cvm::StringType &&
+               Init.Type.Kind == ValueType::String) {
+      Value = Init.Code;
+    } else {
+      Value = "cvm::initialized(" + box(Init) + ", " + quote(Name) + ", " +
+          GetTypeEnum(Var.Type) + ")";
+    }
+    line(Target + " = " + Value + ";");
+  } else if (isNativeStorage(Var)) {
+    line(Target + " = " + (Var.Type == cvm::IntType ? "0"
+                           : Var.Type == cvm::DoubleType ? "0.0"
+                           : "false") + ";");
+  } else {
+    line(Target + " = cvm::BasicValue(" +
+         std::string(GetTypeEnum(Var.Type)) + ");");
+  }
+
+  if (Var.Global)
+    line(Var.CppName + "_declared = true;");
+  else
+    noteUnread(Key, Var);
+  Declared.insert(Key);
+}
+
+void CppEmitter::emitReturn(const ExpressionAST *ValueExpr) {
+  if (ValueExpr && emitSelfTailCall(ValueExpr, true))
+    return;
+  CppExpr Value = ValueExpr ? emitExpression(ValueExpr)
+                            : CppExpr{"cvm::BasicValue()", ValueType::Dynamic};
+  noteResult(Value);
+  if (InfixOp) {
+    line("return " + box(Value) + ";");
+  } else if (!Function) {
+    line("return cvm::checkTopLevelReturn(" + box(Value) + ");");
+  } else if (hasNativeReturn(Function)) {
+    ValueType::KindTy Kind = getValueKind(Function->getType());
+    // Unlike initialization, returning does not promote int to double.
+    if (ValueExpr && Value.Type.Kind == Kind)
+      line("return " + Value.Code + ";");
+    else
+      line("return cvm::returnNative<" + getCppType(Kind) + ">(" + box(Value) +
+           ", " + quote(Function->getName().str()) + ");");
+  } else {
+    line("return cvm::checkedReturn(" + box(Value) + ", " +
+         quote(Function->getName().str()) + ", " +
+         GetTypeEnum(Function->getType()) + ");");
+  }
+}
+
+/// \brief Return the value of the expression statement a body ends with
+/// It isn't checked against the declared type, so a function only returns
+/// natively if the value has exactly that type.
+void CppEmitter::emitTailValue(const CppExpr &Value) {
+  noteResult(Value);
+  if (Function && hasNativeReturn(Function)) {
+    if (Value.Type.Kind == getValueKind(Function->getType())) {
+      line("return " + Value.Code + ";");
+      return;
+    }
+    NativeReturns.erase(Function);
+    Changed = true;
+  }
+  emitUncheckedReturn(box(Value));
+}
+
+/// \brief Return Value, which isn't checked unless the function got here
+/// through a self tail call that a return statement returned
+void CppEmitter::emitUncheckedReturn(const std::string &Value) {
+  if (needsTailCheck())
+    line("return tail_checked ? cvm::checkedReturn(" + Value + ", " +
+         quote(Function->getName().str()) + ", " +
+         GetTypeEnum(Function->getType()) + ") : " + Value + ";");
+  else
+    line("return " + Value + ";");
+}
+
+/// \brief Return the call Value makes to the function being collected or
+/// emitted if it is a tail call, or null
+const FunctionCallAST *
+CppEmitter::getSelfTailCall(const ExpressionAST *Value) const {
+  if (!Function || Value->getKind() != ExpressionAST::FunctionCallExpression)
+    return nullptr;
+  auto *FuncCall = Value->as_cptr<FunctionCallAST>();
+  if (!FuncCall->isTailCall() || FuncCall->getFunction() != Function ||
+      FuncCall->getArguments().size() != Function->getParameterCount())
+    return nullptr;
+  return FuncCall;
+}
+
+/// \brief Emit Value as a jump back to the top of the function with the
+/// arguments in place of the parameters if it is a self tail call
+/// Return false if it isn't. IsReturn tells that a return statement returns
+/// the call, so the function checks what it ends up returning.
+bool CppEmitter::emitSelfTailCall(const ExpressionAST *Value, bool IsReturn) {
+  const FunctionCallAST *FuncCall = getSelfTailCall(Value);
+  if (!FuncCall)
+    return false;
+
+  std::vector<const ExpressionAST *> ArgExprs;
+  for (auto &Arg : FuncCall->getArguments())
+    ArgExprs.push_back(Arg);
+  std::string Prologue;
+  std::vector<CppExpr> Args = emitOperands(ArgExprs, Prologue);
+
+  // Every argument is evaluated before a parameter it may read is assigned.
+  line("{");
+  ++Indent;
+  if (!Prologue.empty())
+    line(Prologue);
+  std::vector<std::string> Temps;
+  for (int Slot = 0; Slot < static_cast<int>(Args.size()); ++Slot) {
+    VariableInfo &Var = Variables.at(VariableKey(&Function->getLayout(), Slot));
+    std::string Type = getCppType(Var);
+    std::string Code = emitArgument(*Function, Slot, Args[Slot]);
+    Temps.push_back(newTemp());
+    line(Type + " " + Temps.back() + " = " + Code + ";");
+  }
+  for (int Slot = 0; Slot < static_cast<int>(Args.size()); ++Slot) {
+    const VariableInfo &Var =
+        Variables.at(VariableKey(&Function->getLayout(), Slot));
+    line(Var.CppName + " = " + Temps[Slot] + ";");
+  }
+  if (IsReturn && needsTailCheck())
+    line("tail_checked = true;");
+  --Indent;
+  line("}");
+  line("goto tail_call;");
+  HasSelfTailCall = true;
+  return true;
+}
+
+bool CppEmitter::needsTailCheck() const {
+  return Function && !hasNativeReturn(Function) &&
+      CheckedTailCalls.count(Function);
+}
+
+/// \brief Note that the function or infix operator being emitted may yield
+/// Value, which it then can't return natively if Value may be an array
+void CppEmitter::noteResult(const CppExpr &Value) {
+  if (!Value.Type.mayBeArray())
+    return;
+  if (InfixOp && InfixArrayReturns.insert(InfixOp).second)
+    Changed = true;
+  if (Function && ArrayReturns.insert(Function).second) {
+    NativeReturns.erase(Function);
+    Changed = true;
+  }
+}
+
+void CppEmitter::emitVoidExit() {
+  if (Function && hasNativeReturn(Function)) {
+    NativeReturns.erase(Function);
+    Changed = true;
+  }
+  emitUncheckedReturn("cvm::BasicValue()");
+}
+
+/*===---------------------------- Expressions -----------------------------===*/
+
+std::string CppEmitter::emitCondition(const ExpressionAST *Expr) {
+  CppExpr Value = emitExpression(Expr);
+  if (Value.Type.Kind == ValueType::Bool)
+    return Value.Code;
+  return "cvm::truth(" + Value.Code + ")";
+}
+
+CppEmitter::CppExpr CppEmitter::emitError(const std::string &Msg) {
+  return {"(cvm::RuntimeError(" + quote(Msg) + "), cvm::BasicValue())",
+          ValueType::Dynamic};
+}
+
+CppEmitter::CppExpr CppEmitter::emitExpression(const ExpressionAST *Expr) {
+  switch (Expr->getKind()) {
+  case ExpressionAST::IntExpression:
+    return {IntLiteral(Expr->as_cptr<IntAST>()->getValue()), ValueType::Int};
+  case ExpressionAST::DoubleExpression:
+    return {DoubleLiteral(Expr->as_cptr<DoubleAST>()->getValue()),
+            ValueType::Double};
+  case ExpressionAST::BoolExpression:
+    return {Expr->as_cptr<BoolAST>()->getValue() ? "true" : "false",
+            ValueType::Bool};
+  case ExpressionAST::StringExpression:
+    return {stringConstant(Expr->as_cptr<StringAST>()->getValue()),
+            ValueType::String};
+  case ExpressionAST::IdentifierExpression:
+    return emitVariable(Expr->as_cptr<IdentifierAST>());
+  case ExpressionAST::FunctionCallExpression:
+    return emitFunctionCall(Expr->as_cptr<FunctionCallAST>());
+  case ExpressionAST::InfixOpExpression:
+    return emitInfixOpExpr(Expr->as_cptr<InfixOpExprAST>());
+  case ExpressionAST::UnaryOperatorExpression:
+    return emitUnary(Expr->as_cptr<UnaryOperatorAST>());
+  case ExpressionAST::BinaryOperatorExpression:
+    return emitBinary(Expr->as_cptr<BinaryOperatorAST>());
+  }
+  return emitError("unknown expression kind");
+}
+
+/// \brief Emit the variable IdExpr refers to, as a C++ lvalue
+/// A global read before the top level code has declared it is checked at
+/// run time; anything else that isn't declared yet is undefined, since
+/// without dynamic binding the lookup by name can't find anything else.
+CppEmitter::CppExpr CppEmitter::emitVariable(const IdentifierAST *IdExpr) {
+  const VariableInfo *Var = findVariable(IdExpr);
+  VariableKey Key(IdExpr->getScope(), IdExpr->getSlot());
+  if (!Var || (!Var->Global && !Declared.count(Key)))
+    return emitError("variable `" + IdExpr->getName().str() + "' is undefined");
+
+  // A read found after the variable was cast to void takes another pass.
+  if (ReadVariables.insert(Key).second && UnreadVariables.count(Key))
+    Changed = true;
+  CppExpr Value{Var->CppName, getVariableType(*Var)};
+  if (Var->Global && !Declared.count(Key)) {
+    Value.Code = "(cvm::checkDeclared(" + Var->CppName + "_declared, " +
+        quote(IdExpr->getName().str()) + "), " + Var->CppName + ")";
+  }
+  return Value;
+}
+
+/// \brief Emit the expression an index expression indexes
+/// Like the tree walker, it has to be a lvalue.
+CppEmitter::CppExpr CppEmitter::emitIndexBase(const ExpressionAST *BaseExpr) {
+  if (BaseExpr->isIdentifierExpr())
+    return emitVariable(BaseExpr->as_cptr<IdentifierAST>());
+  if (BaseExpr->isBinaryOperatorExpression()) {
+    auto *BinOpExpr = BaseExpr->as_cptr<BinaryOperatorAST>();
+    if (BinOpExpr->getOpKind() == BinaryOperatorAST::Index)
+      return emitIndex(BinOpExpr);
+    return emitError("try to evaluate a rvalue binOpExpr as lvalue");
+  }
+  return emitError("try to evaluate a rvalue expression as lvalue");
+}
+
+CppEmitter::CppExpr CppEmitter::emitIndex(const BinaryOperatorAST *IndexExpr) {
+  const ExpressionAST *BaseExpr = IndexExpr->getLHS();
+  const ExpressionAST *IdxExpr = IndexExpr->getRHS();
+  CppExpr Base = emitIndexBase(BaseExpr);
+  CppExpr Index = emitExpression(IdxExpr);
+
+  // The base is checked to be an array before the index is evaluated, which
+  // only needs a temporary if evaluating the index can do anything.
+  CppExpr Element{"", ValueType::dynamicArray()};
+  if (IdxExpr->isConstant() ||
+      (IdxExpr->isIdentifierExpr() && !BaseExpr->mayHaveSideEffects() &&
+       Index.Code.find('(') == std::string::npos)) {
+    Element.Code = "cvm::loadElement(" + box(Base) + ", " + box(Index) + ")";
+  } else {
+    std::string Temp = newTemp();
+    Element.Code = "[&]() -> cvm::BasicValue { cvm::BasicValue " + Temp +
+        " = " + box(Base) + "; cvm::checkIndexBase(" + Temp +
+        "); return cvm::loadElement(" + Temp + ", " + box(Index) + "); }()";
+  }
+
+  if (Base.Type.Kind != ValueType::Array)
+    return Element;
+  if (Base.Type.Rank > 1) {
+    Element.Type = ValueType(ValueType::Array, Base.Type.ElementType,
+                             Base.Type.Rank - 1);
+    return Element;
+  }
+  if (ArraysInElements)
+    return Element;
+  Element.Type = getValueKind(Base.Type.ElementType);
+  if (Element.Type.isNative()) {
+    Element.Code = "cvm::nativeValue<" + getCppType(Element.Type.Kind) + ">(" +
+        Element.Code + ")";
+  }
+  return Element;
+}
+
+CppEmitter::CppExpr
+CppEmitter::emitAssignment(const ExpressionAST *RefExpr,
+                           const ExpressionAST *ValExpr) {
+  if (RefExpr->isIdentifierExpr()) {
+    auto *IdExpr = RefExpr->as_cptr<IdentifierAST>();
+    VariableKey Key(IdExpr->getScope(), IdExpr->getSlot());
+    auto It = Variables.find(Key);
+    // The walker finds the variable before evaluating the value.
+    if (!IdExpr->isResolved() || It == Variables.end() ||
+        (!It->second.Global && !Declared.count(Key)))
+      return emitError("variable `" + IdExpr->getName().str() +
+                       "' is undefined");
+
+    VariableInfo &Var = It->second;
+    std::string Check;
+    if (Var.Global && !Declared.count(Key)) {
+      Check = "cvm::checkDeclared(" + Var.CppName + "_declared, " +
+          quote(IdExpr->getName().str()) + "), ";
+    }
+
+    CppExpr Value = emitExpression(ValExpr);
+    noteStore(Var, Value);
+    if (isNativeStorage(Var)) {
+      ValueType::KindTy Kind = getValueKind(Var.Type);
+      std::string Code = convertsImplicitly(Value.Type, Kind)
+          ? Value.Code
+          : "cvm::assignNative<" + getCppType(Kind) + ">(" + box(Value) + ")";
+      return {"(" + Check + Var.CppName + " = " + Code + ")", Kind};
+    }
+    if (Var.Rank == 0 && !Var.Boxed && Var.Type == cvm::StringType &&
+        Value.Type.Kind == ValueType::String)
+      return {"(" + Check + Var.CppName + " = " + Value.Code + ")",
+              ValueType::String};
+    return {"(" + Check + "cvm::assignValue(" + Var.CppName + ", " +
+                box(Value) + "))",
+            getVariableType(Var)};
+  }
+
+  if (RefExpr->isBinaryOperatorExpression()) {
+    auto *IndexExpr = RefExpr->as_cptr<BinaryOperatorAST>();
+    if (IndexExpr->getOpKind() != BinaryOperatorAST::Index)
+      return emitError("try to evaluate a rvalue binOpExpr as lvalue");
+
+    CppExpr Base = emitIndexBase(IndexExpr->getLHS());
+    CppExpr Index = emitExpression(IndexExpr->getRHS());
+    CppExpr Value = emitExpression(ValExpr);
+    if (Value.Type.mayBeArray() && !ArraysInElements) {
+      ArraysInElements = true;
+      Changed = true;
+    }
+
+    std::string Array = newTemp();
+    std::string Code = "[&]() -> cvm::BasicValue { cvm::BasicValue " + Array +
+        " = " + box(Base) + "; ";
+    if (!IndexExpr->getRHS()->isConstant())
+      Code += "cvm::checkIndexBase(" + Array + "); ";
+    std::string I = newTemp();
+    Code += "int " + I + " = cvm::checkIndex(" + Array + ", " + box(Index) +
+        "); return cvm::storeElement(" + Array + ", " + I + ", " +
+        box(Value) + "); }()";
+    return {Code, ValueType::Dynamic};
+  }
+
+  return emitError("try to evaluate a rvalue expression as lvalue");
+}
+
+CppEmitter::CppExpr CppEmitter::emitUnary(const UnaryOperatorAST *Expr) {
+  CppExpr Operand = emitExpression(Expr->getOperand());
+  switch (Expr->getOpKind()) {
+  case UnaryOperatorAST::Plus:
+    if (Operand.Type.isNumeric())
+      return Operand;
+    return {"cvm::unaryPlus(" + box(Operand) + ")", ValueType::Dynamic};
+  case UnaryOperatorAST::Minus:
+    if (Operand.Type.isNumeric())
+      return {"(-" + Operand.Code + ")", Operand.Type};
+    return {"cvm::unaryMinus(" + box(Operand) + ")", ValueType::Dynamic};
+  case UnaryOperatorAST::LogicalNot:
+    if (Operand.Type.Kind == ValueType::Bool)
+      return {"(!" + Operand.Code + ")", ValueType::Bool};
+    return {"(!cvm::truth(" + Operand.Code + "))", ValueType::Bool};
+  case UnaryOperatorAST::BitwiseNot:
+    if (Operand.Type.Kind == ValueType::Int)
+      return {"(~" + Operand.Code + ")", ValueType::Int};
+    return {"cvm::bitwiseNot(" + box(Operand) + ").getInt()", ValueType::Int};
+  }
+  return emitError("unknown unary operator kind");
+}
+
+CppEmitter::CppExpr CppEmitter::emitBinary(const BinaryOperatorAST *Expr) {
+  switch (Expr->getOpKind()) {
+  default:
+    break;
+  case BinaryOperatorAST::Assign:
+    return emitAssignment(Expr->getLHS(), Expr->getRHS());
+  case BinaryOperatorAST::Index:
+    return emitIndex(Expr);
+  case BinaryOperatorAST::LogicalAnd:
+  case BinaryOperatorAST::LogicalOr: {
+    const char *Op =
+        Expr->getOpKind() == BinaryOperatorAST::LogicalAnd ? " && " : " || ";
+    return {"(" + emitCondition(Expr->getLHS()) + Op +
+                emitCondition(Expr->getRHS()) + ")",
+            ValueType::Bool};
+  }
+  }
+
+  std::string Prologue;
+  std::vector<CppExpr> Operands =
+      emitOperands({Expr->getLHS(), Expr->getRHS()}, Prologue);
+  return sequence(Prologue,
+                  emitBinaryValue(Expr->getOpKind(), Operands[0], Operands[1]));
+}
+
+/// \brief Emit a binary arithmetic, relational or bitwise operation
+/// Natively typed operands use C++ operators wherever they agree with CMM;
+/// the rest is left to the runtime, which also reports type errors.
+CppEmitter::CppExpr
+CppEmitter::emitBinaryValue(BinaryOperatorAST::OperatorKind OpKind,
+                            const CppExpr &LHS, const CppExpr &RHS) {
+  auto Op = GetBinaryOperator(OpKind);
+  const ValueType &L = LHS.Type, &R = RHS.Type;
+  bool Numeric = L.isNumeric() && R.isNumeric();
+  ValueType::KindTy ArithKind =
+      L.Kind == ValueType::Int && R.Kind == ValueType::Int ? ValueType::Int
+                                                           : ValueType::Double;
+  std::string Native = "(" + LHS.Code + " " + Op.first + " " + RHS.Code + ")";
+
+  switch (OpKind) {
+  default:
+    return emitError("unknown binary operator kind");
+  case BinaryOperatorAST::Add:
+  case BinaryOperatorAST::Minus:
+  case BinaryOperatorAST::Multiply:
+    if (Numeric)
+      return {Native, ArithKind};
+    break;
+  case BinaryOperatorAST::Division:
+    if (Numeric && ArithKind == ValueType::Int)
+      return {"cvm::divideInt(" + LHS.Code + ", " + RHS.Code + ")",
+              ValueType::Int};
+    if (Numeric)
+      return {Native, ValueType::Double};
+    break;
+  case BinaryOperatorAST::Modulo:
+    if (Numeric && ArithKind == ValueType::Int)
+      return {"cvm::moduloInt(" + LHS.Code + ", " + RHS.Code + ")",
+              ValueType::Int};
+    if (Numeric)
+      return {"std::fmod(" + LHS.Code + ", " + RHS.Code + ")",
+              ValueType::Double};
+    break;
+  case BinaryOperatorAST::Less:
+  case BinaryOperatorAST::LessEqual:
+  case BinaryOperatorAST::Equal:
+  case BinaryOperatorAST::NotEqual:
+  case BinaryOperatorAST::Greater:
+  case BinaryOperatorAST::GreaterEqual:
+    if (Numeric || (L.Kind == ValueType::Bool && R.Kind == ValueType::Bool)) {
+      // CMM defines a >= b as !(a < b), which differs for NaN.
+      if (OpKind == BinaryOperatorAST::GreaterEqual &&
+          (L.Kind == ValueType::Double || R.Kind == ValueType::Double))
+        return {"(!(" + LHS.Code + " < " + RHS.Code + "))", ValueType::Bool};
+      return {Native, ValueType::Bool};
+    }
+    return {"cvm::" + std::string(Op.second) + "(" + box(LHS) + ", " +
+                box(RHS) + ").getBool()",
+            ValueType::Bool};
+  case BinaryOperatorAST::BitwiseAnd:
+  case BinaryOperatorAST::BitwiseOr:
+  case BinaryOperatorAST::BitwiseXor:
+  case BinaryOperatorAST::LeftShift:
+  case BinaryOperatorAST::RightShift:
+    if (L.Kind == ValueType::Int && R.Kind == ValueType::Int)
+      return {Native, ValueType::Int};
+    return {"cvm::" + std::string(Op.second) + "(" + box(LHS) + ", " +
+                box(RHS) + ").getInt()",
+            ValueType::Int};
+  }
+
+  // Adding anything to a string concatenates.
+  ValueType::KindTy Kind = OpKind == BinaryOperatorAST::Add &&
+      (L.Kind == ValueType::String || R.Kind == ValueType::String)
+      ? ValueType::String : ValueType::Dynamic;
+  return {"cvm::" + std::string(Op.second) + "(" + box(LHS) + ", " +
+              box(RHS) + ")",
+          Kind};
+}
+
+/// \brief Emit operands the walker evaluates left to right
+/// If C++ could reorder them visibly, all but the last are evaluated into
+/// temporaries by Prologue, which sequence() runs first.
+std::vector<CppEmitter::CppExpr>
+CppEmitter::emitOperands(const std::vector<const ExpressionAST *> &Exprs,
+                         std::string &Prologue) {
+  bool Sequenced = NeedsSequencing(Exprs);
+  std::vector<CppExpr> Operands;
+  for (size_t I = 0; I < Exprs.size(); ++I) {
+    CppExpr Operand = emitExpression(Exprs[I]);
+    if (Sequenced && I + 1 != Exprs.size() && !Exprs[I]->isConstant()) {
+      std::string Temp = newTemp();
+      Prologue += getCppType(Operand.Type.Kind) + " " + Temp + " = " +
+          Operand.Code + "; ";
+      Operand.Code = Temp;
+    }
+    Operands.push_back(Operand);
+  }
+  return Operands;
+}
+
+CppEmitter::CppExpr CppEmitter::sequence(const std::string &Prologue,
+                                         CppExpr Value) {
+  if (!Prologue.empty()) {
+    Value.Code = "[&]() -> " + getCppType(Value.Type.Kind) + " { " +
+        Prologue + "return " + Value.Code + "; }()";
+  }
+  return Value;
+}
+
+CppEmitter::CppExpr
+CppEmitter::emitFunctionCall(const FunctionCallAST *FuncCall) {
+  std::vector<const ExpressionAST *> ArgExprs;
+  for (auto &Arg : FuncCall->getArguments())
+    ArgExprs.push_back(Arg);
+
+  std::string Prologue;
+  std::vector<CppExpr> Args = emitOperands(ArgExprs, Prologue);
+
+  if (const FunctionDefinitionAST *F = FuncCall->getFunction())
+    return sequence(Prologue, emitCall(*F, Args));
+
+  if (FuncCall->getNativeFunction()) {
+    std::string Code = "cvm::callNative(" +
+        nativeFunction(FuncCall->getCallee().str());
+    for (const CppExpr &Arg : Args)
+      Code += ", " + box(Arg);
+    return sequence(Prologue, CppExpr{Code + ")", ValueType::Dynamic});
+  }
+
+  return emitError("function `" + FuncCall->getCallee().str() +
+                   "' is undefined");
+}
+
+/// \brief Emit a call of F with the evaluated Args, checked and converted
+/// the way the walker binds them to the parameters
+CppEmitter::CppExpr CppEmitter::emitCall(const FunctionDefinitionAST &F,
+                                         const std::vector<CppExpr> &Args) {
+  if (Args.size() != F.getParameterCount()) {
+    std::string Code = "(";
+    for (const CppExpr &Arg : Args)
+      Code += "(void)" + Arg.Code + ", ";
+    Code += "cvm::checkArgumentCount(" + quote(F.getName().str()) + ", " +
+        std::to_string(F.getParameterCount()) + ", " +
+        std::to_string(Args.size()) + "), cvm::BasicValue())";
+    return {Code, ValueType::Dynamic};
+  }
+
+  CalledFunctions.insert(&F);
+  std::string Code = "f_" + F.getName().str() + "(";
+  for (int Slot = 0; Slot < static_cast<int>(Args.size()); ++Slot)
+    Code += (Slot ? ", " : "") + emitArgument(F, Slot, Args[Slot]);
+  Code += ")";
+
+  if (hasNativeReturn(&F))
+    return {Code, getValueKind(F.getType())};
+  if (ArrayReturns.count(&F))
+    return {Code, ValueType::dynamicArray()};
+  return {Code, ValueType::Dynamic};
+}
+
+/// \brief Emit Arg checked and converted for the parameter of F in Slot
+std::string CppEmitter::emitArgument(const FunctionDefinitionAST &F, int Slot,
+                                     const CppExpr &Arg) {
+  VariableInfo &Var = Variables.at(VariableKey(&F.getLayout(), Slot));
+  noteStore(Var, Arg);
+
+  std::string Names = quote(F.getName().str()) + ", " +
+      quote(F.getParameterList()[Slot].getName().str());
+  if (isNativeStorage(Var)) {
+    ValueType::KindTy Kind = getValueKind(Var.Type);
+    return convertsImplicitly(Arg.Type, Kind)
+        ? Arg.Code
+        : "cvm::argumentNative<" + getCppType(Kind) + ">(" + box(Arg) + ", " +
+              Names + ")";
+  }
+  if (!Var.Boxed && Var.Type == cvm::StringType &&
+      Arg.Type.Kind == ValueType::String)
+    return Arg.Code;
+  return "cvm::coercedArgument(" + box(Arg) + ", " + Names + ", " +
+      GetTypeEnum(Var.Type) + ")";
+}
+
+CppEmitter::CppExpr CppEmitter::emitInfixOpExpr(const InfixOpExprAST *Expr) {
+  const InfixOpDefinitionAST *Definition = Expr->getDefinition();
+  if (!Definition)
+    return emitError("Infix operator " + Expr->getSymbol().str() +
+                     " is undefined");
+
+  CalledInfixOps.insert(Definition);
+  std::string Prologue;
+  std::vector<CppExpr> Operands =
+      emitOperands({Expr->getLHS(), Expr->getRHS()}, Prologue);
+  return sequence(Prologue, CppExpr{"cvm::infixOpValue(i" +
+      std::to_string(InfixOpIndex.at(Definition)) + "(" + box(Operands[0]) +
+      ", " + box(Operands[1]) + "))",
+      InfixArrayReturns.count(Definition) ? ValueType::dynamicArray()
+                                          : ValueType::Dynamic});
+}
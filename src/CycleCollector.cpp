@@ -0,0 +1,113 @@
+#include "CycleCollector.h"
+#include <algorithm>
+#include <vector>
+
+namespace cvm {
+
+/// Collect after this many array allocations, or after twice the number of
+/// containers that survived the last collection if that is larger.
+static const size_t MinCollectThreshold = 1000;
+
+static ArrayObject *Containers = nullptr;
+static size_t ContainerCount = 0;
+static size_t AllocationsSinceCollect = 0;
+static size_t CollectThreshold = MinCollectThreshold;
+static CollectorStatistics Statistics = {0, 0, 0};
+
+void trackContainer(ArrayObject *A) {
+  A->Tracked = true;
+  A->PrevContainer = nullptr;
+  A->NextContainer = Containers;
+  if (Containers)
+    Containers->PrevContainer = A;
+  Containers = A;
+  ++ContainerCount;
+}
+
+void untrackContainer(ArrayObject *A) {
+  if (A->PrevContainer)
+    A->PrevContainer->NextContainer = A->NextContainer;
+  else
+    Containers = A->NextContainer;
+  if (A->NextContainer)
+    A->NextContainer->PrevContainer = A->PrevContainer;
+  A->Tracked = false;
+  --ContainerCount;
+}
+
+void noteArrayAllocation() {
+  if (++AllocationsSinceCollect >= CollectThreshold && Containers)
+    collectCycles();
+}
+
+/// \brief Mark A and every container reachable from it
+static void markReachable(ArrayObject *A) {
+  std::vector<ArrayObject *> Worklist(1, A);
+  A->Reachable = true;
+  while (!Worklist.empty()) {
+    ArrayObject *Cur = Worklist.back();
+    Worklist.pop_back();
+    for (const BasicValue &V : Cur->Values) {
+      ArrayObject *Elem = V.getArrayObject();
+      if (Elem && Elem->Tracked && !Elem->Reachable) {
+        Elem->Reachable = true;
+        Worklist.push_back(Elem);
+      }
+    }
+  }
+}
+
+size_t collectCycles() {
+  AllocationsSinceCollect = 0;
+  ++Statistics.Collections;
+
+  // Count the references each container gets from outside the containers.
+  for (ArrayObject *A = Containers; A; A = A->NextContainer) {
+    A->TrialRefCount = A->RefCount;
+    A->Reachable = false;
+  }
+  for (ArrayObject *A = Containers; A; A = A->NextContainer)
+    for (const BasicValue &V : A->Values) {
+      ArrayObject *Elem = V.getArrayObject();
+      if (Elem && Elem->Tracked)
+        --Elem->TrialRefCount;
+    }
+
+  for (ArrayObject *A = Containers; A; A = A->NextContainer)
+    if (A->TrialRefCount > 0 && !A->Reachable)
+      markReachable(A);
+
+  // Hold the garbage while breaking its references, so that nothing is freed
+  // under our feet, then let it go.
+  std::vector<ArrayObject *> Garbage;
+  for (ArrayObject *A = Containers; A; A = A->NextContainer)
+    if (!A->Reachable) {
+      ++A->RefCount;
+      Garbage.push_back(A);
+    }
+
+  size_t Bytes = 0;
+  for (ArrayObject *A : Garbage) {
+    Bytes += A->getByteSize();
+    std::vector<BasicValue>().swap(A->Values);
+  }
+  for (ArrayObject *A : Garbage)
+    if (--A->RefCount == 0)
+      delete A;
+
+  Statistics.ArraysFreed += Garbage.size();
+  Statistics.BytesFreed += Bytes;
+  CollectThreshold = std::max(MinCollectThreshold, 2 * ContainerCount);
+  return Bytes;
+}
+
+const CollectorStatistics &getCollectorStatistics() {
+  return Statistics;
+}
+
+void dumpCollectorStatistics(std::ostream &OS) {
+  OS << "cycle collector: " << Statistics.Collections << " collections, "
+     << Statistics.ArraysFreed << " arrays (" << Statistics.BytesFreed
+     << " bytes) freed, " << ContainerCount << " containers tracked\n";
+}
+}
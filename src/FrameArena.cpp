@@ -0,0 +1,23 @@
+#include "FrameArena.h"
+#include <algorithm>
+
+using namespace cmm;
+
+/// Slots in a chunk, unless a single frame needs more.
+static const size_t ChunkSize = 4096;
+
+cvm::BasicValue *FrameArena::allocateInNextChunk(size_t Count) {
+  size_t Next = Chunks.empty() ? 0 : CurChunk + 1;
+
+  // Chunks above the top are empty, so one too small is simply replaced.
+  if (Next == Chunks.size())
+    Chunks.push_back(Chunk());
+  if (!Chunks[Next].Slots || Chunks[Next].Size < Count) {
+    Chunks[Next].Size = std::max(ChunkSize, Count);
+    Chunks[Next].Slots.reset(new cvm::BasicValue[Chunks[Next].Size]);
+  }
+
+  CurChunk = Next;
+  Top = Count;
+  return Chunks[Next].Slots.get();
+}
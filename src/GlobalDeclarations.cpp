@@ -0,0 +1,116 @@
+#include "GlobalDeclarations.h"
+
+using namespace cmm;
+
+void GlobalDeclarations::compute() {
+  GlobalIndex.clear();
+  auto &StmtList = TopLevelBlock.getStatementList();
+  FirstCallingStatement = StmtList.size();
+  for (size_t Index = 0; Index < StmtList.size(); ++Index) {
+    const StatementAST *Stmt = StmtList[Index];
+    if (Stmt && Stmt->getKind() == StatementAST::DeclarationListStatement)
+      for (auto &Decl :
+           Stmt->as_cptr<DeclarationListAST>()->getDeclarationList())
+        GlobalIndex.emplace(Decl->getSlot(), Index);
+    if (mayCallUserCode(Stmt)) {
+      FirstCallingStatement = Index;
+      break;
+    }
+  }
+}
+
+bool GlobalDeclarations::isDeclared(const IdentifierAST *IdExpr,
+                                    bool InBody) const {
+  if (!IdExpr->isResolved())
+    return false;
+  if (!InBody || IdExpr->getScope() != &TopLevelBlock.getLayout())
+    return true;
+  auto It = GlobalIndex.find(IdExpr->getSlot());
+  return It != GlobalIndex.end() && It->second < FirstCallingStatement;
+}
+
+bool GlobalDeclarations::mayCallUserCode(const StatementAST *Stmt) {
+  if (!Stmt)
+    return false;
+
+  switch (Stmt->getKind()) {
+  case StatementAST::BreakStatement:
+  case StatementAST::ContinueStatement:
+    return false;
+  case StatementAST::BlockStatement:
+    for (const StatementAST *S : Stmt->as_cptr<BlockAST>()->getStatementList())
+      if (mayCallUserCode(S))
+        return true;
+    return false;
+  case StatementAST::DeclarationStatement:
+    return mayCallUserCode(Stmt->as_cptr<DeclarationAST>());
+  case StatementAST::DeclarationListStatement:
+    for (const DeclarationAST *Decl :
+         Stmt->as_cptr<DeclarationListAST>()->getDeclarationList())
+      if (mayCallUserCode(Decl))
+        return true;
+    return false;
+  case StatementAST::ExprStatement:
+    return mayCallUserCode(Stmt->as_cptr<ExprStatementAST>()->getExpression());
+  case StatementAST::ReturnStatement: {
+    auto *Value = Stmt->as_cptr<ReturnStatementAST>()->getReturnValue();
+    return Value && mayCallUserCode(Value);
+  }
+  case StatementAST::IfStatement: {
+    auto *IfStmt = Stmt->as_cptr<IfStatementAST>();
+    return mayCallUserCode(IfStmt->getCondition()) ||
+           mayCallUserCode(IfStmt->getStatementThen()) ||
+           mayCallUserCode(IfStmt->getStatementElse());
+  }
+  case StatementAST::WhileStatement: {
+    auto *WhileStmt = Stmt->as_cptr<WhileStatementAST>();
+    return (WhileStmt->getCondition() &&
+            mayCallUserCode(WhileStmt->getCondition())) ||
+           mayCallUserCode(WhileStmt->getStatement());
+  }
+  case StatementAST::ForStatement: {
+    auto *ForStmt = Stmt->as_cptr<ForStatementAST>();
+    return (ForStmt->getInit() && mayCallUserCode(ForStmt->getInit())) ||
+           (ForStmt->getCondition() &&
+            mayCallUserCode(ForStmt->getCondition())) ||
+           (ForStmt->getPost() && mayCallUserCode(ForStmt->getPost())) ||
+           mayCallUserCode(ForStmt->getStatement());
+  }
+  }
+  return false;
+}
+
+bool GlobalDeclarations::mayCallUserCode(const DeclarationAST *Decl) {
+  for (const ExpressionAST *E : Decl->getElementCountList())
+    if (mayCallUserCode(E))
+      return true;
+  return Decl->getInitializer() && mayCallUserCode(Decl->getInitializer());
+}
+
+bool GlobalDeclarations::mayCallUserCode(const ExpressionAST *Expr) {
+  switch (Expr->getKind()) {
+  case ExpressionAST::IntExpression:
+  case ExpressionAST::DoubleExpression:
+  case ExpressionAST::BoolExpression:
+  case ExpressionAST::StringExpression:
+  case ExpressionAST::IdentifierExpression:
+    return false;
+  case ExpressionAST::FunctionCallExpression: {
+    auto *FuncCall = Expr->as_cptr<FunctionCallAST>();
+    if (FuncCall->getFunction())
+      return true;
+    for (const ExpressionAST *Arg : FuncCall->getArguments())
+      if (mayCallUserCode(Arg))
+        return true;
+    return false;
+  }
+  case ExpressionAST::InfixOpExpression:
+    return true;
+  case ExpressionAST::BinaryOperatorExpression:
+    return mayCallUserCode(Expr->as_cptr<BinaryOperatorAST>()->getLHS()) ||
+           mayCallUserCode(Expr->as_cptr<BinaryOperatorAST>()->getRHS());
+  case ExpressionAST::UnaryOperatorExpression:
+    return mayCallUserCode(Expr->as_cptr<UnaryOperatorAST>()->getOperand());
+  }
+  return false;
+}
@@ -0,0 +1,774 @@
+#include "Inliner.h"
+#include <string>
+
+using namespace cmm;
+
+Inliner::Inliner(ASTArena &Arena, BlockAST &TopLevelBlock,
+                 std::map<Symbol, FunctionDefinitionAST> &F,
+                 std::map<Symbol, InfixOpDefinitionAST> &I, unsigned Limit)
+    : Arena(Arena), TopLevelBlock(TopLevelBlock), FunctionDefinition(F),
+      InfixOpDefinition(I), Limit(Limit), Globals(TopLevelBlock),
+      InlineCount(0), Function(nullptr), InBody(false),
+      CalleeLayout(nullptr), BodyLayout(nullptr), Target(nullptr),
+      GlobalDepth(0), Nesting(0) {}
+
+void Inliner::inlineCalls() {
+  collect();
+
+  Function = nullptr;
+  InBody = false;
+  Scopes.assign(1, &TopLevelBlock.getLayout());
+  inlineBlock(&TopLevelBlock);
+
+  // A dynamically bound callee runs in the frames of its caller, where the
+  // globals aren't at a known depth.
+  InBody = true;
+  for (auto &F : FunctionDefinition) {
+    if (DynamicCallees.count(&F.second))
+      continue;
+    Function = &F.second;
+    Scopes.assign(1, &TopLevelBlock.getLayout());
+    Scopes.push_back(&F.second.getLayout());
+    inlineStatement(F.second.getStatement());
+  }
+  Function = nullptr;
+  for (auto &I : InfixOpDefinition) {
+    Scopes.assign(1, &TopLevelBlock.getLayout());
+    Scopes.push_back(&I.second.getLayout());
+    inlineStatement(I.second.getStatement());
+  }
+}
+
+/*===------------------------------- Collect ------------------------------===*/
+
+void Inliner::collect() {
+  DynamicCallees.clear();
+  InlineCount = 0;
+  Globals.compute();
+  walkProgram(TopLevelBlock, FunctionDefinition, InfixOpDefinition);
+}
+
+void Inliner::visitExpression(const ExpressionAST *Expr) {
+  if (Expr->getKind() != ExpressionAST::FunctionCallExpression)
+    return;
+  auto *FuncCall = Expr->as_cptr<FunctionCallAST>();
+  if (FuncCall->getFunction() && FuncCall->isDynamicBound())
+    DynamicCallees.insert(FuncCall->getFunction());
+}
+
+/*===-------------------------------- Inline ------------------------------===*/
+
+void Inliner::inlineStatement(StatementAST *Stmt) {
+  if (!Stmt)
+    return;
+
+  switch (Stmt->getKind()) {
+  case StatementAST::BreakStatement:
+  case StatementAST::ContinueStatement:
+    break;
+  case StatementAST::BlockStatement:
+    Scopes.push_back(&Stmt->as_ptr<BlockAST>()->getLayout());
+    inlineBlock(Stmt->as_ptr<BlockAST>());
+    Scopes.pop_back();
+    break;
+  case StatementAST::DeclarationStatement:
+    inlineDeclaration(Stmt->as_ptr<DeclarationAST>());
+    break;
+  case StatementAST::DeclarationListStatement:
+    for (auto &Decl : Stmt->as_ptr<DeclarationListAST>()->getDeclarationList())
+      inlineDeclaration(Decl);
+    break;
+  case StatementAST::ExprStatement: {
+    auto *ExprStmt = Stmt->as_ptr<ExprStatementAST>();
+    ExprStmt->setExpression(inlineExpression(ExprStmt->getExpression()));
+    break;
+  }
+  case StatementAST::ReturnStatement: {
+    auto *Return = Stmt->as_ptr<ReturnStatementAST>();
+    if (Return->getReturnValue())
+      Return->setReturnValue(inlineExpression(Return->getReturnValue()));
+    break;
+  }
+  case StatementAST::IfStatement: {
+    auto *IfStmt = Stmt->as_ptr<IfStatementAST>();
+    IfStmt->setCondition(inlineExpression(IfStmt->getCondition()));
+    inlineStatement(IfStmt->getStatementThen());
+    inlineStatement(IfStmt->getStatementElse());
+    break;
+  }
+  case StatementAST::WhileStatement: {
+    auto *WhileStmt = Stmt->as_ptr<WhileStatementAST>();
+    if (WhileStmt->getCondition())
+      WhileStmt->setCondition(inlineExpression(WhileStmt->getCondition()));
+    inlineStatement(WhileStmt->getStatement());
+    break;
+  }
+  case StatementAST::ForStatement: {
+    auto *ForStmt = Stmt->as_ptr<ForStatementAST>();
+    if (ForStmt->getInit())
+      ForStmt->setInit(inlineExpression(ForStmt->getInit()));
+    if (ForStmt->getCondition())
+      ForStmt->setCondition(inlineExpression(ForStmt->getCondition()));
+    if (ForStmt->getPost())
+      ForStmt->setPost(inlineExpression(ForStmt->getPost()));
+    inlineStatement(ForStmt->getStatement());
+    break;
+  }
+  }
+}
+
+/// \brief Inline the calls in the statements of Block, whose layout is the
+/// innermost of Scopes, and splice the calls made as statements
+void Inliner::inlineBlock(BlockAST *Block) {
+  std::vector<StatementAST *> List;
+  bool Changed = false;
+  const auto &StmtList = Block->getStatementList();
+  for (size_t Index = 0; Index < StmtList.size(); ++Index) {
+    StatementAST *Stmt = StmtList[Index];
+    inlineStatement(Stmt);
+    if (Stmt && Stmt->getKind() == StatementAST::ExprStatement) {
+      ExpressionAST *Expr = Stmt->as_ptr<ExprStatementAST>()->getExpression();
+      if (Expr->getKind() == ExpressionAST::FunctionCallExpression &&
+          splice(Expr->as_ptr<FunctionCallAST>(), Block,
+                 Index + 1 == StmtList.size(), List)) {
+        Changed = true;
+        continue;
+      }
+    }
+    List.push_back(Stmt);
+  }
+  if (Changed)
+    Block->setStatementList(Arena.copyArray(List.data(), List.size()));
+}
+
+void Inliner::inlineDeclaration(DeclarationAST *Decl) {
+  for (auto &E : Decl->getElementCountList())
+    E = inlineExpression(E);
+  if (Decl->getInitializer())
+    Decl->setInitializer(inlineExpression(Decl->getInitializer()));
+}
+
+/// \brief Return Expr with the calls in it inlined, innermost first
+ExpressionAST *Inliner::inlineExpression(ExpressionAST *Expr) {
+  switch (Expr->getKind()) {
+  default:
+    break;
+  case ExpressionAST::FunctionCallExpression: {
+    auto *FuncCall = Expr->as_ptr<FunctionCallAST>();
+    for (auto &Arg : FuncCall->getArguments())
+      Arg = inlineExpression(Arg);
+    return inlineFunctionCall(FuncCall);
+  }
+  case ExpressionAST::InfixOpExpression: {
+    auto *InfixOp = Expr->as_ptr<InfixOpExprAST>();
+    InfixOp->setLHS(inlineExpression(InfixOp->getLHS()));
+    InfixOp->setRHS(inlineExpression(InfixOp->getRHS()));
+    return inlineInfixOp(InfixOp);
+  }
+  case ExpressionAST::BinaryOperatorExpression: {
+    auto *BinOp = Expr->as_ptr<BinaryOperatorAST>();
+    BinOp->setLHS(inlineExpression(BinOp->getLHS()));
+    BinOp->setRHS(inlineExpression(BinOp->getRHS()));
+    break;
+  }
+  case ExpressionAST::UnaryOperatorExpression: {
+    auto *UnaryOp = Expr->as_ptr<UnaryOperatorAST>();
+    UnaryOp->setOperand(inlineExpression(UnaryOp->getOperand()));
+    break;
+  }
+  }
+  return Expr;
+}
+
+/// \brief Return the value of the body of the callee of FuncCall in place of
+/// the call if it only computes one, or else FuncCall
+ExpressionAST *Inliner::inlineFunctionCall(FunctionCallAST *FuncCall) {
+  // Arguments of other types would be converted, or rejected.
+  const FunctionDefinitionAST *F = FuncCall->getFunction();
+  if (!F || F == Function || FuncCall->isDynamicBound() ||
+      !FuncCall->hasCheckedArguments() || !isSmall(F->getStatement()))
+    return FuncCall;
+  const ExpressionAST *Value =
+      getValue(F->getStatement(), F->hasCheckedReturns());
+  if (!Value)
+    return FuncCall;
+  for (const ExpressionAST *Arg : FuncCall->getArguments())
+    if (!isSimple(Arg))
+      return FuncCall;
+
+  CalleeLayout = &F->getLayout();
+  BodyLayout = nullptr;
+  if (!canSubstitute(Value, true))
+    return FuncCall;
+  Operands = FuncCall->getArguments();
+  Target = nullptr;
+  GlobalDepth = static_cast<int>(Scopes.size()) - 1;
+  Nesting = 0;
+  return cloneExpression(Value);
+}
+
+ExpressionAST *Inliner::inlineInfixOp(InfixOpExprAST *InfixOp) {
+  // The value of an infix operator is checked not to be void, which only a
+  // call may yield.
+  const InfixOpDefinitionAST *I = InfixOp->getDefinition();
+  if (!I || !isSmall(I->getStatement()) || !isSimple(InfixOp->getLHS()) ||
+      !isSimple(InfixOp->getRHS()))
+    return InfixOp;
+  const ExpressionAST *Value = getValue(I->getStatement(), true);
+  if (!Value || Value->getKind() == ExpressionAST::FunctionCallExpression)
+    return InfixOp;
+
+  CalleeLayout = &I->getLayout();
+  BodyLayout = nullptr;
+  if (!canSubstitute(Value, true))
+    return InfixOp;
+  ExpressionAST *Operand[] = {InfixOp->getLHS(), InfixOp->getRHS()};
+  Operands = Arena.copyArray(Operand, 2);
+  Target = nullptr;
+  GlobalDepth = static_cast<int>(Scopes.size()) - 1;
+  Nesting = 0;
+  return cloneExpression(Value);
+}
+
+/// \brief Append to List the statements running the body of the callee of
+/// the statement FuncCall of Block in its place, and return true, if the
+/// callee can be spliced. IsLast is true for the last statement of Block.
+bool Inliner::splice(FunctionCallAST *FuncCall, BlockAST *Block, bool IsLast,
+                     std::vector<StatementAST *> &List) {
+  const FunctionDefinitionAST *F = FuncCall->getFunction();
+  const StatementAST *Body = F ? F->getStatement() : nullptr;
+  if (!Body || F == Function || FuncCall->isDynamicBound() ||
+      !FuncCall->hasCheckedArguments() || !isSmall(Body))
+    return false;
+
+  std::vector<const StatementAST *> StmtList;
+  BodyLayout = nullptr;
+  if (Body->getKind() == StatementAST::BlockStatement) {
+    auto *BodyBlock = Body->as_cptr<BlockAST>();
+    BodyLayout = &BodyBlock->getLayout();
+    StmtList.assign(BodyBlock->getStatementList().begin(),
+                    BodyBlock->getStatementList().end());
+  } else {
+    StmtList.push_back(Body);
+  }
+
+  // A return at the end leaves its value to the statement replacing it. The
+  // value of the call is that of the last statement the body runs, and so is
+  // that of Block if the call ends it.
+  const ExpressionAST *Value = nullptr;
+  bool ValueIsVoid = StmtList.empty();
+  if (!StmtList.empty() &&
+      StmtList.back()->getKind() == StatementAST::ReturnStatement) {
+    if (!F->hasCheckedReturns())
+      return false;
+    Value = StmtList.back()->as_cptr<ReturnStatementAST>()->getReturnValue();
+    ValueIsVoid = !Value;
+    StmtList.pop_back();
+  }
+  if (ValueIsVoid && IsLast)
+    return false;
+
+  // The variables of the body block are renamed, so the errors naming them
+  // must not happen.
+  CalleeLayout = &F->getLayout();
+  for (const StatementAST *Stmt : StmtList) {
+    if (!canSplice(Stmt, BodyLayout != nullptr, false))
+      return false;
+    if (Stmt->getKind() == StatementAST::DeclarationListStatement)
+      for (const DeclarationAST *Decl :
+           Stmt->as_cptr<DeclarationListAST>()->getDeclarationList())
+        if (Decl->isArray() ||
+            (Decl->getInitializer() &&
+             Decl->getInitializerCoercion() == Coercion::Unchecked))
+          return false;
+  }
+  if (Value && !canSubstitute(Value, false))
+    return false;
+
+  Target = &Block->getLayout();
+  GlobalDepth = static_cast<int>(Scopes.size()) - 1;
+  Nesting = 0;
+  ClonedLayouts.clear();
+  ParameterVariables.clear();
+  const auto &Params = F->getParameterList();
+  for (size_t Index = 0; Index < Params.size(); ++Index) {
+    ParameterVariables.push_back(makeVariable(Params[Index].getName()));
+    List.push_back(makeDeclaration(ParameterVariables.back(),
+                                   Params[Index].getType(),
+                                   FuncCall->getArguments()[Index]));
+  }
+  BodyVariables.clear();
+  if (BodyLayout)
+    for (size_t Slot = 0; Slot < BodyLayout->getSlotCount(); ++Slot)
+      BodyVariables.push_back(makeVariable(BodyLayout->getSlotName(Slot)));
+
+  for (const StatementAST *Stmt : StmtList)
+    List.push_back(cloneStatement(Stmt));
+  if (Value)
+    List.push_back(Arena.create<ExprStatementAST>(cloneExpression(Value)));
+  ++InlineCount;
+  return true;
+}
+
+/*===------------------------------ Analysis ------------------------------===*/
+
+/// \brief Return the expression the body Body does nothing but compute, or
+/// null
+const ExpressionAST *Inliner::getValue(const StatementAST *Body,
+                                       bool CheckedReturns) const {
+  if (Body && Body->getKind() == StatementAST::BlockStatement &&
+      Body->as_cptr<BlockAST>()->getStatementList().size() == 1)
+    Body = Body->as_cptr<BlockAST>()->getStatementList()[0];
+  if (!Body)
+    return nullptr;
+  if (Body->getKind() == StatementAST::ExprStatement)
+    return Body->as_cptr<ExprStatementAST>()->getExpression();
+  if (Body->getKind() == StatementAST::ReturnStatement && CheckedReturns)
+    return Body->as_cptr<ReturnStatementAST>()->getReturnValue();
+  return nullptr;
+}
+
+bool Inliner::isSmall(const StatementAST *Body) const {
+  return getSize(Body) <= Limit;
+}
+
+/// \brief Return true if Expr yields the same value wherever it is evaluated
+/// at the call site, and can't fail
+bool Inliner::isSimple(const ExpressionAST *Expr) const {
+  return Expr->isConstant() ||
+         (Expr->isIdentifierExpr() &&
+          isDeclared(Expr->as_cptr<IdentifierAST>()));
+}
+
+/// \brief Return true if IdExpr is sure to be declared wherever the code being
+/// walked is
+bool Inliner::isDeclared(const IdentifierAST *IdExpr) const {
+  return IdExpr->hasStaticType() && Globals.isDeclared(IdExpr, InBody);
+}
+
+/// \brief Return true if Expr of the body of the callee reads the same
+/// variables anywhere Scopes may call it, and if ValueOnly, computes nothing
+/// but a value from the parameters and the globals
+bool Inliner::canSubstitute(const ExpressionAST *Expr, bool ValueOnly) const {
+  switch (Expr->getKind()) {
+  case ExpressionAST::IntExpression:
+  case ExpressionAST::DoubleExpression:
+  case ExpressionAST::BoolExpression:
+  case ExpressionAST::StringExpression:
+    return true;
+  case ExpressionAST::IdentifierExpression: {
+    auto *IdExpr = Expr->as_cptr<IdentifierAST>();
+    if (!IdExpr->isResolved())
+      return false;
+    if (IdExpr->getScope() != &TopLevelBlock.getLayout())
+      return !ValueOnly || IdExpr->getScope() == CalleeLayout;
+    for (size_t Index = 1; Index < Scopes.size(); ++Index)
+      if (Scopes[Index]->findSlot(IdExpr->getName()) >= 0)
+        return false;
+    return true;
+  }
+  case ExpressionAST::FunctionCallExpression: {
+    auto *FuncCall = Expr->as_cptr<FunctionCallAST>();
+    if (FuncCall->isDynamicBound() ||
+        (ValueOnly && !FuncCall->getNativeFunction()))
+      return false;
+    for (const ExpressionAST *Arg : FuncCall->getArguments())
+      if (!canSubstitute(Arg, ValueOnly))
+        return false;
+    return true;
+  }
+  case ExpressionAST::InfixOpExpression: {
+    auto *InfixOp = Expr->as_cptr<InfixOpExprAST>();
+    return !ValueOnly && canSubstitute(InfixOp->getLHS(), false) &&
+           canSubstitute(InfixOp->getRHS(), false);
+  }
+  case ExpressionAST::BinaryOperatorExpression: {
+    auto *BinOp = Expr->as_cptr<BinaryOperatorAST>();
+    if (ValueOnly && BinOp->getOpKind() == BinaryOperatorAST::Assign)
+      return false;
+    return canSubstitute(BinOp->getLHS(), ValueOnly) &&
+           canSubstitute(BinOp->getRHS(), ValueOnly);
+  }
+  case ExpressionAST::UnaryOperatorExpression:
+    return canSubstitute(Expr->as_cptr<UnaryOperatorAST>()->getOperand(),
+                         ValueOnly);
+  }
+  return false;
+}
+
+/// \brief Return true if the statement Stmt of the body of the callee runs the
+/// same in the block of a call. InBlock is true if it is directly in a block,
+/// and InLoop if it is in a loop of the body.
+bool Inliner::canSplice(const StatementAST *Stmt, bool InBlock,
+                        bool InLoop) const {
+  if (!Stmt)
+    return true;
+
+  switch (Stmt->getKind()) {
+  case StatementAST::BreakStatement:
+  case StatementAST::ContinueStatement:
+    return InLoop;
+  case StatementAST::ReturnStatement:
+    return false;
+  case StatementAST::BlockStatement:
+    for (const StatementAST *S : Stmt->as_cptr<BlockAST>()->getStatementList())
+      if (!canSplice(S, true, InLoop))
+        return false;
+    return true;
+  case StatementAST::DeclarationStatement:
+    return canSpliceDeclaration(Stmt->as_cptr<DeclarationAST>(), InBlock);
+  case StatementAST::DeclarationListStatement:
+    for (const DeclarationAST *Decl :
+         Stmt->as_cptr<DeclarationListAST>()->getDeclarationList())
+      if (!canSpliceDeclaration(Decl, InBlock))
+        return false;
+    return true;
+  case StatementAST::ExprStatement:
+    return canSubstitute(Stmt->as_cptr<ExprStatementAST>()->getExpression(),
+                         false);
+  case StatementAST::IfStatement: {
+    auto *IfStmt = Stmt->as_cptr<IfStatementAST>();
+    return canSubstitute(IfStmt->getCondition(), false) &&
+           canSplice(IfStmt->getStatementThen(), false, InLoop) &&
+           canSplice(IfStmt->getStatementElse(), false, InLoop);
+  }
+  case StatementAST::WhileStatement: {
+    auto *WhileStmt = Stmt->as_cptr<WhileStatementAST>();
+    return (!WhileStmt->getCondition() ||
+            canSubstitute(WhileStmt->getCondition(), false)) &&
+           canSplice(WhileStmt->getStatement(), false, true);
+  }
+  case StatementAST::ForStatement: {
+    auto *ForStmt = Stmt->as_cptr<ForStatementAST>();
+    return (!ForStmt->getInit() || canSubstitute(ForStmt->getInit(), false)) &&
+           (!ForStmt->getCondition() ||
+            canSubstitute(ForStmt->getCondition(), false)) &&
+           (!ForStmt->getPost() || canSubstitute(ForStmt->getPost(), false)) &&
+           canSplice(ForStmt->getStatement(), false, true);
+  }
+  }
+  return false;
+}
+
+/// \brief A declaration that isn't directly in a block may leave its name
+/// looked up at run time
+bool Inliner::canSpliceDeclaration(const DeclarationAST *Decl,
+                                   bool InBlock) const {
+  if (!InBlock)
+    return false;
+  for (const ExpressionAST *E : Decl->getElementCountList())
+    if (!canSubstitute(E, false))
+      return false;
+  return !Decl->getInitializer() ||
+         canSubstitute(Decl->getInitializer(), false);
+}
+
+/*===-------------------------------- Clone -------------------------------===*/
+
+StatementAST *Inliner::cloneStatement(const StatementAST *Stmt) {
+  if (!Stmt)
+    return nullptr;
+
+  switch (Stmt->getKind()) {
+  case StatementAST::BreakStatement:
+    return Arena.create<BreakStatementAST>();
+  case StatementAST::ContinueStatement:
+    return Arena.create<ContinueStatementAST>();
+  case StatementAST::BlockStatement: {
+    auto *Block = Stmt->as_cptr<BlockAST>();
+    auto *Clone = Arena.create<BlockAST>();
+    Clone->getLayout() = Block->getLayout();
+    ClonedLayouts[&Block->getLayout()] = &Clone->getLayout();
+    std::vector<StatementAST *> List;
+    ++Nesting;
+    for (const StatementAST *S : Block->getStatementList())
+      List.push_back(cloneStatement(S));
+    --Nesting;
+    Clone->setStatementList(Arena.copyArray(List.data(), List.size()));
+    return Clone;
+  }
+  case StatementAST::DeclarationStatement:
+    return cloneDeclaration(Stmt->as_cptr<DeclarationAST>());
+  case StatementAST::DeclarationListStatement: {
+    std::vector<DeclarationAST *> List;
+    for (const DeclarationAST *Decl :
+         Stmt->as_cptr<DeclarationListAST>()->getDeclarationList())
+      List.push_back(cloneDeclaration(Decl));
+    auto *Clone = Arena.create<DeclarationListAST>(
+        List.empty() ? cvm::VoidType : List.front()->getType());
+    Clone->setDeclarationList(Arena.copyArray(List.data(), List.size()));
+    return Clone;
+  }
+  case StatementAST::ExprStatement:
+    return Arena.create<ExprStatementAST>(
+        cloneExpression(Stmt->as_cptr<ExprStatementAST>()->getExpression()));
+  case StatementAST::ReturnStatement: {
+    auto *Return = Stmt->as_cptr<ReturnStatementAST>();
+    auto *Value = Return->getReturnValue();
+    return Arena.create<ReturnStatementAST>(
+        Value ? cloneExpression(Value) : nullptr, Return->getLoc());
+  }
+  case StatementAST::IfStatement: {
+    auto *IfStmt = Stmt->as_cptr<IfStatementAST>();
+    ExpressionAST *Cond = cloneExpression(IfStmt->getCondition());
+    StatementAST *Then = cloneStatement(IfStmt->getStatementThen());
+    return Arena.create<IfStatementAST>(
+        Cond, Then, cloneStatement(IfStmt->getStatementElse()));
+  }
+  case StatementAST::WhileStatement: {
+    auto *WhileStmt = Stmt->as_cptr<WhileStatementAST>();
+    ExpressionAST *Cond = WhileStmt->getCondition()
+                              ? cloneExpression(WhileStmt->getCondition())
+                              : nullptr;
+    return Arena.create<WhileStatementAST>(
+        Cond, cloneStatement(WhileStmt->getStatement()));
+  }
+  case StatementAST::ForStatement: {
+    auto *ForStmt = Stmt->as_cptr<ForStatementAST>();
+    ExpressionAST *Init =
+        ForStmt->getInit() ? cloneExpression(ForStmt->getInit()) : nullptr;
+    ExpressionAST *Cond = ForStmt->getCondition()
+                              ? cloneExpression(ForStmt->getCondition())
+                              : nullptr;
+    ExpressionAST *Post =
+        ForStmt->getPost() ? cloneExpression(ForStmt->getPost()) : nullptr;
+    return Arena.create<ForStatementAST>(
+        Init, Cond, Post, cloneStatement(ForStmt->getStatement()));
+  }
+  }
+  return nullptr;
+}
+
+/// \brief Clone Decl, moving it into Target if it is directly in the body
+/// block
+DeclarationAST *Inliner::cloneDeclaration(const DeclarationAST *Decl) {
+  Symbol Name = Decl->getName();
+  int Slot = Decl->getSlot();
+  if (Nesting == 0) {
+    Name = BodyVariables[Slot].first;
+    Slot = BodyVariables[Slot].second;
+  }
+  ExpressionAST *Init =
+      Decl->getInitializer() ? cloneExpression(Decl->getInitializer())
+                             : nullptr;
+  auto *Clone = Arena.create<DeclarationAST>(
+      Name, Decl->getType(), Init,
+      cloneExpressionList(Decl->getElementCountList()), Decl->getLoc());
+  Clone->setSlot(Slot);
+  Clone->setInitializerCoercion(Decl->getInitializerCoercion());
+  return Clone;
+}
+
+/// \brief Clone Expr of the body of the callee, keeping what the
+/// TypeChecker proved of it, to evaluate it at the call site
+ExpressionAST *Inliner::cloneExpression(const ExpressionAST *Expr) {
+  ExpressionAST *Clone = nullptr;
+  switch (Expr->getKind()) {
+  case ExpressionAST::IntExpression:
+    Clone = Arena.create<IntAST>(Expr->as_cptr<IntAST>()->getValue());
+    break;
+  case ExpressionAST::DoubleExpression:
+    Clone = Arena.create<DoubleAST>(Expr->as_cptr<DoubleAST>()->getValue());
+    break;
+  case ExpressionAST::BoolExpression:
+    Clone = Arena.create<BoolAST>(Expr->as_cptr<BoolAST>()->getValue());
+    break;
+  case ExpressionAST::StringExpression:
+    Clone = Arena.create<StringAST>(Expr->as_cptr<StringAST>()->getValue());
+    break;
+  case ExpressionAST::IdentifierExpression:
+    return cloneIdentifier(Expr->as_cptr<IdentifierAST>());
+  case ExpressionAST::FunctionCallExpression: {
+    // The call no longer ends the function it was in.
+    auto *FuncCall = Expr->as_cptr<FunctionCallAST>();
+    auto *Call = Arena.create<FunctionCallAST>(
+        FuncCall->getCallee(), cloneExpressionList(FuncCall->getArguments()),
+        false, FuncCall->getLoc());
+    if (FuncCall->getFunction())
+      Call->bind(FuncCall->getFunction());
+    else if (FuncCall->getNativeFunction())
+      Call->bind(FuncCall->getNativeFunction());
+    Call->setCheckedArguments(FuncCall->hasCheckedArguments());
+    Clone = Call;
+    break;
+  }
+  case ExpressionAST::InfixOpExpression: {
+    auto *InfixOp = Expr->as_cptr<InfixOpExprAST>();
+    ExpressionAST *LHS = cloneExpression(InfixOp->getLHS());
+    auto *Op = Arena.create<InfixOpExprAST>(InfixOp->getSymbol(), LHS,
+                                            cloneExpression(InfixOp->getRHS()));
+    Op->setDefinition(InfixOp->getDefinition());
+    Clone = Op;
+    break;
+  }
+  case ExpressionAST::BinaryOperatorExpression: {
+    auto *BinOp = Expr->as_cptr<BinaryOperatorAST>();
+    ExpressionAST *LHS = cloneExpression(BinOp->getLHS());
+    auto *Op = Arena.create<BinaryOperatorAST>(BinOp->getOpKind(), LHS,
+                                               cloneExpression(BinOp->getRHS()),
+                                               BinOp->getLoc());
+    Op->quicken(BinOp->getQuickKind());
+    Op->setAssignCoercion(BinOp->getAssignCoercion());
+    Clone = Op;
+    break;
+  }
+  case ExpressionAST::UnaryOperatorExpression: {
+    auto *UnaryOp = Expr->as_cptr<UnaryOperatorAST>();
+    Clone = Arena.create<UnaryOperatorAST>(
+        UnaryOp->getOpKind(), cloneExpression(UnaryOp->getOperand()),
+        UnaryOp->getLoc());
+    break;
+  }
+  }
+  if (Expr->hasStaticType())
+    Clone->setStaticType(Expr->getStaticType());
+  return Clone;
+}
+
+/// \brief Clone a read of the body of the callee, or of a parameter whose
+/// value is substituted, into one of the same variable from the call site
+ExpressionAST *Inliner::cloneIdentifier(const IdentifierAST *IdExpr) {
+  Symbol Name = IdExpr->getName();
+  int Depth = IdExpr->getDepth(), Slot = IdExpr->getSlot();
+  const FrameLayout *Scope = IdExpr->getScope();
+  if (Scope == CalleeLayout && !Target) {
+    const ExpressionAST *Operand = Operands[Slot];
+    if (!Operand->isIdentifierExpr())
+      return cloneExpression(Operand);
+    IdExpr = Operand->as_cptr<IdentifierAST>();
+    Name = IdExpr->getName();
+    Depth = IdExpr->getDepth();
+    Slot = IdExpr->getSlot();
+    Scope = IdExpr->getScope();
+  } else if (Scope == CalleeLayout || (BodyLayout && Scope == BodyLayout)) {
+    const Variable &Var =
+        (Scope == CalleeLayout ? ParameterVariables : BodyVariables)[Slot];
+    Name = Var.first;
+    Depth = Nesting;
+    Slot = Var.second;
+    Scope = Target;
+  } else if (Scope == &TopLevelBlock.getLayout()) {
+    Depth = Nesting + GlobalDepth;
+  } else {
+    Scope = ClonedLayouts.at(Scope);
+  }
+
+  auto *Clone = Arena.create<IdentifierAST>(Name);
+  Clone->setBinding(Depth, Slot, Scope);
+  if (IdExpr->hasStaticType())
+    Clone->setStaticType(IdExpr->getStaticType());
+  return Clone;
+}
+
+ASTArray<ExpressionAST *>
+Inliner::cloneExpressionList(const ASTArray<ExpressionAST *> &List) {
+  std::vector<ExpressionAST *> Clones;
+  for (const ExpressionAST *E : List)
+    Clones.push_back(cloneExpression(E));
+  return Arena.copyArray(Clones.data(), Clones.size());
+}
+
+/*===------------------------------- Helpers ------------------------------===*/
+
+/// \brief Append a slot to Target for the variable Name of the callee being
+/// spliced
+Inliner::Variable Inliner::makeVariable(Symbol Name) {
+  Symbol Temp =
+      Symbol::intern(std::to_string(InlineCount) + "_inline_" + Name.str());
+  return Variable(Temp, Target->appendSlot(Temp));
+}
+
+DeclarationListAST *Inliner::makeDeclaration(const Variable &Var,
+                                             cvm::BasicType Type,
+                                             ExpressionAST *Init) {
+  auto *Decl = Arena.create<DeclarationAST>(Var.first, Type, Init,
+                                            ASTArray<ExpressionAST *>());
+  Decl->setSlot(Var.second);
+  Decl->setInitializerCoercion(Coercion::Identity);
+  auto *List = Arena.create<DeclarationListAST>(Type);
+  List->setDeclarationList(Arena.copyArray(&Decl, 1));
+  return List;
+}
+
+unsigned Inliner::getSize(const StatementAST *Stmt) {
+  if (!Stmt)
+    return 0;
+
+  unsigned Size = 1;
+  switch (Stmt->getKind()) {
+  case StatementAST::BreakStatement:
+  case StatementAST::ContinueStatement:
+    break;
+  case StatementAST::BlockStatement:
+    for (const StatementAST *S : Stmt->as_cptr<BlockAST>()->getStatementList())
+      Size += getSize(S);
+    break;
+  case StatementAST::DeclarationStatement:
+    Size += getSize(Stmt->as_cptr<DeclarationAST>());
+    break;
+  case StatementAST::DeclarationListStatement:
+    for (const DeclarationAST *Decl :
+         Stmt->as_cptr<DeclarationListAST>()->getDeclarationList())
+      Size += getSize(Decl);
+    break;
+  case StatementAST::ExprStatement:
+    Size += getSize(Stmt->as_cptr<ExprStatementAST>()->getExpression());
+    break;
+  case StatementAST::ReturnStatement:
+    if (auto *Value = Stmt->as_cptr<ReturnStatementAST>()->getReturnValue())
+      Size += getSize(Value);
+    break;
+  case StatementAST::IfStatement: {
+    auto *IfStmt = Stmt->as_cptr<IfStatementAST>();
+    Size += getSize(IfStmt->getCondition()) +
+            getSize(IfStmt->getStatementThen()) +
+            getSize(IfStmt->getStatementElse());
+    break;
+  }
+  case StatementAST::WhileStatement: {
+    auto *WhileStmt = Stmt->as_cptr<WhileStatementAST>();
+    Size += getSize(WhileStmt->getCondition()) +
+            getSize(WhileStmt->getStatement());
+    break;
+  }
+  case StatementAST::ForStatement: {
+    auto *ForStmt = Stmt->as_cptr<ForStatementAST>();
+    Size += getSize(ForStmt->getInit()) + getSize(ForStmt->getCondition()) +
+            getSize(ForStmt->getPost()) + getSize(ForStmt->getStatement());
+    break;
+  }
+  }
+  return Size;
+}
+
+unsigned Inliner::getSize(const DeclarationAST *Decl) {
+  unsigned Size = 0;
+  for (const ExpressionAST *E : Decl->getElementCountList())
+    Size += getSize(E);
+  return Size + getSize(Decl->getInitializer());
+}
+
+unsigned Inliner::getSize(const ExpressionAST *Expr) {
+  if (!Expr)
+    return 0;
+
+  switch (Expr->getKind()) {
+  default:
+    return 1;
+  case ExpressionAST::FunctionCallExpression: {
+    unsigned Size = 1;
+    for (const ExpressionAST *Arg :
+         Expr->as_cptr<FunctionCallAST>()->getArguments())
+      Size += getSize(Arg);
+    return Size;
+  }
+  case ExpressionAST::InfixOpExpression:
+    return 1 + getSize(Expr->as_cptr<InfixOpExprAST>()->getLHS()) +
+           getSize(Expr->as_cptr<InfixOpExprAST>()->getRHS());
+  case ExpressionAST::BinaryOperatorExpression:
+    return 1 + getSize(Expr->as_cptr<BinaryOperatorAST>()->getLHS()) +
+           getSize(Expr->as_cptr<BinaryOperatorAST>()->getRHS());
+  case ExpressionAST::UnaryOperatorExpression:
+    return 1 + getSize(Expr->as_cptr<UnaryOperatorAST>()->getOperand());
+  }
+}
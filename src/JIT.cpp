@@ -0,0 +1,1085 @@
+#include "JIT.h"
+#include "BytecodeVM.h"
+#include "CMMInterpreter.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <memory>
+
+#ifdef CMM_HAS_JIT
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#endif
+
+using namespace cmm;
+
+#ifdef CMM_HAS_JIT
+namespace {
+bool IsScalar(cvm::BasicType T) {
+  return T == cvm::IntType || T == cvm::DoubleType || T == cvm::BoolType;
+}
+
+bool IsNumeric(cvm::BasicType T) {
+  return T == cvm::IntType || T == cvm::DoubleType;
+}
+
+/// \brief Return true if a Value can be assigned to a Variable without error
+bool IsAssignable(cvm::BasicType Variable, cvm::BasicType Value) {
+  return Variable == Value ||
+      (Variable == cvm::DoubleType && Value == cvm::IntType);
+}
+
+size_t InstructionSize(Instruction I) {
+  return Op::hasExtraOperand(getOpcode(I)) ? 2 : 1;
+}
+
+/// \brief Whether a slot holds a declared variable at some point of a chunk.
+enum SlotState : uint8_t { Undeclared, Declared, MaybeDeclared };
+
+/// \brief What is known before an instruction: the types of the operands on
+/// the stack and which slots are declared.
+struct AbstractState {
+  bool Reached = false;
+  std::vector<cvm::BasicType> Stack;
+  std::vector<SlotState> Slots;
+};
+
+/// \brief Type the values of a function chunk, or find out why it can't be
+/// compiled.
+/// Every reachable instruction gets the state before it. Paths joining must
+/// agree on the operand types; a slot declared on some of them only becomes
+/// MaybeDeclared, which makes reading it (and so a lookup by name) a reason
+/// to leave the function to the VM.
+class ChunkAnalysis {
+public:
+  const BytecodeProgram &Program;
+  const BytecodeChunk &Chunk;
+  std::vector<cvm::BasicType> SlotTypes;
+  std::vector<AbstractState> States;
+  std::vector<unsigned> Callees;
+  size_t MaxStack;
+
+  ChunkAnalysis(const BytecodeProgram &Program, unsigned Index)
+      : Program(Program), Chunk(Program.Chunks[Index]), MaxStack(0) {}
+
+  bool analyze();
+
+private:
+  std::vector<size_t> Worklist;
+
+  bool flowTo(size_t PC, const AbstractState &S);
+  bool step(size_t PC, AbstractState &S, bool &FallsThrough);
+};
+
+bool ChunkAnalysis::analyze() {
+  if (Chunk.Kind != BytecodeChunk::FunctionChunk)
+    return false;
+  const FunctionDefinitionAST &Function = *Chunk.Function;
+  if (!IsScalar(Function.getType()))
+    return false;
+
+  size_t SlotCount = Chunk.SlotNames.size();
+  SlotTypes.assign(SlotCount, cvm::VoidType);
+  AbstractState Entry;
+  Entry.Reached = true;
+  Entry.Slots.assign(SlotCount, Undeclared);
+
+  size_t Slot = 0;
+  for (const Parameter &Param : Function.getParameterList()) {
+    if (!IsScalar(Param.getType()))
+      return false;
+    SlotTypes[Slot] = Param.getType();
+    Entry.Slots[Slot++] = Declared;
+  }
+  for (auto &Decl : Chunk.Decls) {
+    cvm::BasicType T = Decl.first->getType();
+    if (Decl.first->isArray() || !IsScalar(T))
+      return false;
+    if (SlotTypes[Decl.second] != cvm::VoidType && SlotTypes[Decl.second] != T)
+      return false;
+    SlotTypes[Decl.second] = T;
+  }
+
+  States.assign(Chunk.Code.size(), AbstractState());
+  if (!flowTo(0, Entry))
+    return false;
+
+  while (!Worklist.empty()) {
+    size_t PC = Worklist.back();
+    Worklist.pop_back();
+
+    AbstractState S = States[PC];
+    bool FallsThrough = true;
+    if (!step(PC, S, FallsThrough))
+      return false;
+    if (FallsThrough && !flowTo(PC + InstructionSize(Chunk.Code[PC]), S))
+      return false;
+  }
+  return true;
+}
+
+/// \brief Merge S into the state before PC
+bool ChunkAnalysis::flowTo(size_t PC, const AbstractState &S) {
+  if (PC >= States.size())
+    return false;
+  MaxStack = std::max(MaxStack, S.Stack.size());
+
+  AbstractState &Target = States[PC];
+  if (!Target.Reached) {
+    Target = S;
+    Target.Reached = true;
+    Worklist.push_back(PC);
+    return true;
+  }
+
+  if (Target.Stack != S.Stack)
+    return false;
+  bool Changed = false;
+  for (size_t I = 0; I < S.Slots.size(); ++I) {
+    if (Target.Slots[I] != S.Slots[I] && Target.Slots[I] != MaybeDeclared) {
+      Target.Slots[I] = MaybeDeclared;
+      Changed = true;
+    }
+  }
+  if (Changed)
+    Worklist.push_back(PC);
+  return true;
+}
+
+/// \brief Apply the instruction at PC to S
+/// Return false if it can't be compiled.
+bool ChunkAnalysis::step(size_t PC, AbstractState &S, bool &FallsThrough) {
+  Instruction I = Chunk.Code[PC];
+  uint32_t A = getOperand(I);
+  std::vector<cvm::BasicType> &Stack = S.Stack;
+
+  switch (getOpcode(I)) {
+  default:
+    return false;
+
+  case Op::Const: {
+    const cvm::BasicValue &V = Chunk.Constants[A];
+    if (V.isArray() || !IsScalar(V.getType()))
+      return false;
+    Stack.push_back(V.getType());
+    return true;
+  }
+
+  case Op::Pop:
+    Stack.pop_back();
+    return true;
+
+  case Op::LoadLocal:
+    if (S.Slots[A] != Declared)
+      return false;
+    Stack.push_back(SlotTypes[A]);
+    return true;
+
+  case Op::StoreLocal:
+    if (S.Slots[A] != Declared || !IsAssignable(SlotTypes[A], Stack.back()))
+      return false;
+    Stack.back() = SlotTypes[A];
+    return true;
+
+  case Op::ClearSlots:
+    for (uint32_t Slot = A, End = A + Chunk.Code[PC + 1]; Slot != End; ++Slot)
+      S.Slots[Slot] = Undeclared;
+    return true;
+
+  case Op::DeclCheck:
+    return S.Slots[Chunk.Decls[A].second] == Undeclared;
+
+  case Op::DeclInit:
+  case Op::DeclDefault: {
+    unsigned Slot = Chunk.Decls[A].second;
+    if (S.Slots[Slot] != Undeclared)
+      return false;
+    if (getOpcode(I) == Op::DeclInit) {
+      if (!IsAssignable(SlotTypes[Slot], Stack.back()))
+        return false;
+      Stack.pop_back();
+    }
+    S.Slots[Slot] = Declared;
+    return true;
+  }
+
+  case Op::Plus:
+  case Op::Negate:
+    return IsNumeric(Stack.back());
+
+  case Op::LogicalNot:
+  case Op::ToBool:
+    Stack.back() = cvm::BoolType;
+    return true;
+
+  case Op::BitwiseNot:
+    return Stack.back() == cvm::IntType;
+
+  case Op::Add:
+  case Op::Minus:
+  case Op::Multiply:
+  case Op::Division:
+  case Op::Modulo: {
+    cvm::BasicType R = Stack.back();
+    Stack.pop_back();
+    cvm::BasicType L = Stack.back();
+    if (!IsNumeric(L) || !IsNumeric(R))
+      return false;
+    Stack.back() = L == cvm::IntType && R == cvm::IntType ? cvm::IntType
+                                                            : cvm::DoubleType;
+    return true;
+  }
+
+  case Op::Less:
+  case Op::LessEqual:
+  case Op::Equal:
+  case Op::NotEqual:
+  case Op::Greater:
+  case Op::GreaterEqual: {
+    cvm::BasicType R = Stack.back();
+    Stack.pop_back();
+    cvm::BasicType L = Stack.back();
+    if (L != R && !(IsNumeric(L) && IsNumeric(R)))
+      return false;
+    Stack.back() = cvm::BoolType;
+    return true;
+  }
+
+  case Op::BitwiseAnd:
+  case Op::BitwiseOr:
+  case Op::BitwiseXor:
+  case Op::LeftShift:
+  case Op::RightShift: {
+    cvm::BasicType R = Stack.back();
+    Stack.pop_back();
+    return R == cvm::IntType && Stack.back() == cvm::IntType;
+  }
+
+  case Op::Jump:
+    FallsThrough = false;
+    return flowTo(A, S);
+
+  case Op::JumpIfFalse:
+  case Op::JumpIfTrue:
+    Stack.pop_back();
+    return flowTo(A, S);
+
+  case Op::AndThen:
+  case Op::OrElse: {
+    Stack.back() = cvm::BoolType;
+    if (!flowTo(A, S))
+      return false;
+    Stack.pop_back();
+    return true;
+  }
+
+  case Op::Call: {
+    const BytecodeChunk &Callee = Program.Chunks[A];
+    const FunctionDefinitionAST &Function = *Callee.Function;
+    size_t ArgCount = Chunk.Code[PC + 1];
+    if (Function.getParameterCount() != ArgCount ||
+        !IsScalar(Function.getType()))
+      return false;
+
+    size_t ArgBase = Stack.size() - ArgCount;
+    auto It = Function.getParameterList().cbegin();
+    for (size_t Arg = 0; Arg < ArgCount; ++Arg, ++It)
+      if (!IsAssignable(It->getType(), Stack[ArgBase + Arg]))
+        return false;
+    Stack.resize(ArgBase);
+    Stack.push_back(Function.getType());
+    Callees.push_back(A);
+    return true;
+  }
+
+  case Op::Return:
+  case Op::ReturnImplicit:
+    // Only values of the declared type give the callers a static type.
+    FallsThrough = false;
+    return Stack.back() == Chunk.Function->getType();
+
+  case Op::Error:
+    FallsThrough = false;
+    return true;
+  }
+}
+
+enum Reg : uint8_t {
+  RAX = 0, RCX = 1, RDX = 2, RSP = 4, RBP = 5, RSI = 6, RDI = 7
+};
+enum XmmReg : uint8_t { XMM0 = 0, XMM1 = 1 };
+
+/// Condition codes of jcc and setcc.
+enum Condition : uint8_t {
+  CondB = 0x2, CondAE = 0x3, CondE = 0x4, CondNE = 0x5, CondBE = 0x6,
+  CondA = 0x7, CondP = 0xA, CondNP = 0xB, CondL = 0xC, CondGE = 0xD,
+  CondLE = 0xE, CondG = 0xF
+};
+
+/// \brief Just the x86-64 instructions the JIT needs.
+/// Memory operands are always [rbp + disp32].
+class X86Assembler {
+public:
+  std::vector<uint8_t> Code;
+
+  size_t size() const { return Code.size(); }
+
+  void byte(uint8_t B) { Code.push_back(B); }
+  void bytes(std::initializer_list<uint8_t> Bs) {
+    Code.insert(Code.end(), Bs);
+  }
+  void imm32(uint32_t V) {
+    for (int I = 0; I < 4; ++I)
+      byte(static_cast<uint8_t>(V >> (8 * I)));
+  }
+  void imm64(uint64_t V) {
+    for (int I = 0; I < 8; ++I)
+      byte(static_cast<uint8_t>(V >> (8 * I)));
+  }
+
+  void load32(Reg R, int32_t Disp) { byte(0x8B); frameOperand(R, Disp); }
+  void store32(int32_t Disp, Reg R) { byte(0x89); frameOperand(R, Disp); }
+  void load64(Reg R, int32_t Disp) {
+    bytes({0x48, 0x8B});
+    frameOperand(R, Disp);
+  }
+  void store64(int32_t Disp, Reg R) {
+    bytes({0x48, 0x89});
+    frameOperand(R, Disp);
+  }
+  void loadSD(XmmReg X, int32_t Disp) {
+    bytes({0xF2, 0x0F, 0x10});
+    frameOperand(X, Disp);
+  }
+  void storeSD(int32_t Disp, XmmReg X) {
+    bytes({0xF2, 0x0F, 0x11});
+    frameOperand(X, Disp);
+  }
+  void movImm32(Reg R, uint32_t V) { byte(0xB8 + R); imm32(V); }
+  void movImm64(Reg R, uint64_t V) {
+    bytes({0x48, uint8_t(0xB8 + R)});
+    imm64(V);
+  }
+  void movImm64(Reg R, const void *P) {
+    movImm64(R, static_cast<uint64_t>(reinterpret_cast<uintptr_t>(P)));
+  }
+
+  /// 32 bit "Opcode Dst, Src" of the add/sub/and/or/xor/cmp/test/mov family.
+  void alu(uint8_t Opcode, Reg Dst, Reg Src) {
+    bytes({Opcode, uint8_t(0xC0 | (Src << 3) | Dst)});
+  }
+  void add(Reg Dst, Reg Src) { alu(0x01, Dst, Src); }
+  void sub(Reg Dst, Reg Src) { alu(0x29, Dst, Src); }
+  void and_(Reg Dst, Reg Src) { alu(0x21, Dst, Src); }
+  void or_(Reg Dst, Reg Src) { alu(0x09, Dst, Src); }
+  void xor_(Reg Dst, Reg Src) { alu(0x31, Dst, Src); }
+  void cmp(Reg Dst, Reg Src) { alu(0x39, Dst, Src); }
+  void test(Reg Dst, Reg Src) { alu(0x85, Dst, Src); }
+  void mov(Reg Dst, Reg Src) { alu(0x89, Dst, Src); }
+  void imul(Reg Dst, Reg Src) {
+    bytes({0x0F, 0xAF, uint8_t(0xC0 | (Dst << 3) | Src)});
+  }
+  void shlCL(Reg R) { bytes({0xD3, uint8_t(0xE0 | R)}); }
+  void sarCL(Reg R) { bytes({0xD3, uint8_t(0xF8 | R)}); }
+  void neg(Reg R) { bytes({0xF7, uint8_t(0xD8 | R)}); }
+  void not_(Reg R) { bytes({0xF7, uint8_t(0xD0 | R)}); }
+  void xorImm8(Reg R, uint8_t V) { bytes({0x83, uint8_t(0xF0 | R), V}); }
+  void cdq() { byte(0x99); }
+  void idiv(Reg R) { bytes({0xF7, uint8_t(0xF8 | R)}); }
+  /// setcc on the low byte of R.
+  void setcc(Condition C, Reg R) {
+    bytes({0x0F, uint8_t(0x90 | C), uint8_t(0xC0 | R)});
+  }
+  void andAL_CL() { bytes({0x20, 0xC8}); }
+  void orAL_CL() { bytes({0x08, 0xC8}); }
+  void movzxEAX_AL() { bytes({0x0F, 0xB6, 0xC0}); }
+  /// Flip the sign bit of rax.
+  void btcRAX63() { bytes({0x48, 0x0F, 0xBA, 0xF8, 0x3F}); }
+
+  void sse(uint8_t Prefix, uint8_t Opcode, XmmReg Dst, XmmReg Src) {
+    bytes({Prefix, 0x0F, Opcode, uint8_t(0xC0 | (Dst << 3) | Src)});
+  }
+  void addsd(XmmReg Dst, XmmReg Src) { sse(0xF2, 0x58, Dst, Src); }
+  void subsd(XmmReg Dst, XmmReg Src) { sse(0xF2, 0x5C, Dst, Src); }
+  void mulsd(XmmReg Dst, XmmReg Src) { sse(0xF2, 0x59, Dst, Src); }
+  void divsd(XmmReg Dst, XmmReg Src) { sse(0xF2, 0x5E, Dst, Src); }
+  void ucomisd(XmmReg L, XmmReg R) { sse(0x66, 0x2E, L, R); }
+  void xorpd(XmmReg Dst, XmmReg Src) { sse(0x66, 0x57, Dst, Src); }
+  void cvtsi2sd(XmmReg Dst, Reg Src) {
+    bytes({0xF2, 0x0F, 0x2A, uint8_t(0xC0 | (Dst << 3) | Src)});
+  }
+
+  /// Emit a jmp or jcc to be patched, and return where its offset is.
+  size_t jmp() { byte(0xE9); imm32(0); return size() - 4; }
+  size_t jcc(Condition C) {
+    bytes({0x0F, uint8_t(0x80 | C)});
+    imm32(0);
+    return size() - 4;
+  }
+  void patch(size_t At, size_t Target) {
+    uint32_t Rel = static_cast<uint32_t>(
+        static_cast<int64_t>(Target) - static_cast<int64_t>(At + 4));
+    std::memcpy(&Code[At], &Rel, 4);
+  }
+
+  void callRAX() { bytes({0xFF, 0xD0}); }
+  void callMemRAX() { bytes({0xFF, 0x10}); }
+  void ud2() { bytes({0x0F, 0x0B}); }
+
+  void prologue(uint32_t FrameSize) {
+    bytes({0x55, 0x48, 0x89, 0xE5}); // push rbp; mov rbp, rsp
+    bytes({0x48, 0x81, 0xEC});       // sub rsp, FrameSize
+    imm32(FrameSize);
+  }
+  void leaveRet() { bytes({0xC9, 0xC3}); }
+  /// cmp rsp, [rax]
+  void cmpRSPMemRAX() { bytes({0x48, 0x3B, 0x20}); }
+  /// lea rdi, [rbp + Disp]
+  void leaRDI(int32_t Disp) { bytes({0x48, 0x8D}); frameOperand(RDI, Disp); }
+  /// mov rax, [rdi + Disp]
+  void loadArg(int32_t Disp) { bytes({0x48, 0x8B, 0x87}); imm32(Disp); }
+
+private:
+  void frameOperand(uint8_t R, int32_t Disp) {
+    byte(0x80 | (R << 3) | RBP);
+    imm32(static_cast<uint32_t>(Disp));
+  }
+};
+
+/// Lowest address compiled code may grow the native stack to, set on every
+/// entry for the thread entering.
+uintptr_t StackLimit;
+
+/// \brief Return the lowest address compiled code may grow the native stack
+/// of the calling thread to
+/// The rest of the stack is left to the VM the calls past it run on, and to
+/// reporting errors.
+uintptr_t GetStackLimit() {
+  static thread_local uintptr_t Limit = 0;
+  if (Limit)
+    return Limit;
+
+  uintptr_t Low = 0;
+  size_t Size = 0;
+#if defined(__linux__)
+  pthread_attr_t Attr;
+  if (pthread_getattr_np(pthread_self(), &Attr) == 0) {
+    void *Addr;
+    if (pthread_attr_getstack(&Attr, &Addr, &Size) == 0)
+      Low = reinterpret_cast<uintptr_t>(Addr);
+    pthread_attr_destroy(&Attr);
+  }
+#else
+  Size = pthread_get_stacksize_np(pthread_self());
+  Low = reinterpret_cast<uintptr_t>(pthread_get_stackaddr_np(pthread_self())) -
+      Size;
+#endif
+
+  if (!Low) {
+    // Assume the stack started not far above here, sized by the limit.
+    char Here;
+    Size = 8 << 20;
+    rlimit RLimit;
+    if (getrlimit(RLIMIT_STACK, &RLimit) == 0 &&
+        RLimit.rlim_cur != RLIM_INFINITY && RLimit.rlim_cur < Size)
+      Size = RLimit.rlim_cur;
+    Low = reinterpret_cast<uintptr_t>(&Here) - Size;
+  }
+  Limit = Low + Size / 4;
+  return Limit;
+}
+
+[[noreturn]] void JITRuntimeError(const std::string *Msg) {
+  CMMInterpreter::RuntimeError(*Msg);
+}
+
+uint64_t JITCallVM(const uint64_t *Args, BaselineJIT *JIT, unsigned Index) {
+  return JIT->callOnVM(Index, Args);
+}
+
+double JITFMod(double L, double R) {
+  return std::fmod(L, R);
+}
+
+/// \brief Translate one analysed chunk into machine code.
+///
+/// The native frame holds every slot, then every operand stack cell, one
+/// 8 byte word each; all of them sit at fixed offsets from rbp. Ints and
+/// bools use the low 32 bits of their word, doubles all of it.
+class ChunkCodeGen {
+  const ChunkAnalysis &Analysis;
+  const BytecodeChunk &Chunk;
+  unsigned Index;
+  BaselineJIT &JIT;
+  std::deque<std::string> &Messages;
+  const std::vector<BaselineJIT::CompiledFunction> &Entries;
+  X86Assembler Asm;
+  int32_t FrameSize;
+
+public:
+  ChunkCodeGen(const ChunkAnalysis &Analysis, BaselineJIT &JIT,
+               std::deque<std::string> &Messages,
+               const std::vector<BaselineJIT::CompiledFunction> &Entries)
+      : Analysis(Analysis), Chunk(Analysis.Chunk),
+        Index(static_cast<unsigned>(&Chunk - Analysis.Program.Chunks.data())),
+        JIT(JIT), Messages(Messages), Entries(Entries) {
+    size_t Words = Chunk.SlotNames.size() + Analysis.MaxStack;
+    FrameSize = static_cast<int32_t>((Words * 8 + 15) & ~size_t(15));
+  }
+
+  std::vector<uint8_t> generate();
+
+private:
+  int32_t slot(size_t Slot) const {
+    return -FrameSize + static_cast<int32_t>(8 * Slot);
+  }
+  int32_t cell(size_t Depth) const {
+    return slot(Chunk.SlotNames.size() + Depth);
+  }
+
+  void loadDouble(XmmReg X, int32_t Disp, cvm::BasicType T);
+  void loadBool(int32_t Disp, cvm::BasicType T);
+  void store(int32_t To, int32_t From, cvm::BasicType ToType,
+             cvm::BasicType FromType);
+  void emitError(const std::string &Msg);
+  void emitInstruction(size_t PC,
+                       std::vector<std::pair<size_t, size_t>> &Jumps);
+  void emitArith(Op::Opcode Code, size_t Depth, cvm::BasicType L,
+                 cvm::BasicType R);
+  void emitRelation(Op::Opcode Code, size_t Depth, cvm::BasicType L,
+                    cvm::BasicType R);
+};
+
+std::vector<uint8_t> ChunkCodeGen::generate() {
+  Asm.prologue(static_cast<uint32_t>(FrameSize));
+  Asm.movImm64(RAX, &StackLimit);
+  Asm.cmpRSPMemRAX();
+  size_t ToOverflow = Asm.jcc(CondB);
+
+  size_t ParamCount = Chunk.Function->getParameterCount();
+  for (size_t Param = 0; Param < ParamCount; ++Param) {
+    Asm.loadArg(static_cast<int32_t>(8 * Param));
+    Asm.store64(slot(Param), RAX);
+  }
+
+  std::vector<size_t> Labels(Chunk.Code.size(), 0);
+  std::vector<std::pair<size_t, size_t>> Jumps;
+  for (size_t PC = 0; PC < Chunk.Code.size();
+       PC += InstructionSize(Chunk.Code[PC])) {
+    if (!Analysis.States[PC].Reached)
+      continue;
+    Labels[PC] = Asm.size();
+    emitInstruction(PC, Jumps);
+  }
+  for (auto &J : Jumps)
+    Asm.patch(J.first, Labels[J.second]);
+
+  // Out of stack, the VM makes the call instead; rdi still points to the
+  // arguments.
+  Asm.patch(ToOverflow, Asm.size());
+  Asm.movImm64(RSI, &JIT);
+  Asm.movImm32(RDX, Index);
+  Asm.movImm64(RAX, reinterpret_cast<const void *>(&JITCallVM));
+  Asm.callRAX();
+  Asm.leaveRet();
+  return std::move(Asm.Code);
+}
+
+void ChunkCodeGen::loadDouble(XmmReg X, int32_t Disp, cvm::BasicType T) {
+  if (T == cvm::IntType) {
+    Asm.load32(RAX, Disp);
+    Asm.cvtsi2sd(X, RAX);
+  } else {
+    Asm.loadSD(X, Disp);
+  }
+}
+
+/// \brief Load toBool() of the value at Disp into eax
+void ChunkCodeGen::loadBool(int32_t Disp, cvm::BasicType T) {
+  switch (T) {
+  default:
+    Asm.load32(RAX, Disp);
+    break;
+  case cvm::IntType:
+    Asm.load32(RCX, Disp);
+    Asm.xor_(RAX, RAX);
+    Asm.test(RCX, RCX);
+    Asm.setcc(CondNE, RAX);
+    break;
+  case cvm::DoubleType:
+    // NaN is true as well.
+    Asm.loadSD(XMM0, Disp);
+    Asm.xorpd(XMM1, XMM1);
+    Asm.ucomisd(XMM0, XMM1);
+    Asm.setcc(CondNE, RAX);
+    Asm.setcc(CondP, RCX);
+    Asm.orAL_CL();
+    Asm.movzxEAX_AL();
+    break;
+  }
+}
+
+/// \brief Copy a value, promoting an int to double like assignValue does
+void ChunkCodeGen::store(int32_t To, int32_t From, cvm::BasicType ToType,
+                         cvm::BasicType FromType) {
+  if (ToType == cvm::DoubleType && FromType == cvm::IntType) {
+    Asm.load32(RAX, From);
+    Asm.cvtsi2sd(XMM0, RAX);
+    Asm.storeSD(To, XMM0);
+  } else {
+    Asm.load64(RAX, From);
+    Asm.store64(To, RAX);
+  }
+}
+
+void ChunkCodeGen::emitError(const std::string &Msg) {
+  Messages.push_back(Msg);
+  Asm.movImm64(RDI, &Messages.back());
+  Asm.movImm64(RAX, reinterpret_cast<const void *>(&JITRuntimeError));
+  Asm.callRAX();
+  Asm.ud2();
+}
+
+void ChunkCodeGen::emitInstruction(
+    size_t PC, std::vector<std::pair<size_t, size_t>> &Jumps) {
+  Instruction I = Chunk.Code[PC];
+  uint32_t A = getOperand(I);
+  const std::vector<cvm::BasicType> &Stack = Analysis.States[PC].Stack;
+  size_t Depth = Stack.size();
+
+  switch (getOpcode(I)) {
+  default:
+    // Pop, ClearSlots, DeclCheck and Plus only change static state.
+    break;
+
+  case Op::Const: {
+    const cvm::BasicValue &V = Chunk.Constants[A];
+    if (V.isDouble()) {
+      double D = V.getDouble();
+      uint64_t Bits;
+      std::memcpy(&Bits, &D, sizeof(Bits));
+      Asm.movImm64(RAX, Bits);
+      Asm.store64(cell(Depth), RAX);
+    } else {
+      Asm.movImm32(RAX, V.isInt() ? static_cast<uint32_t>(V.getInt())
+                                  : V.getBool());
+      Asm.store32(cell(Depth), RAX);
+    }
+    break;
+  }
+
+  case Op::LoadLocal:
+    Asm.load64(RAX, slot(A));
+    Asm.store64(cell(Depth), RAX);
+    break;
+
+  case Op::StoreLocal: {
+    cvm::BasicType T = Analysis.SlotTypes[A];
+    store(slot(A), cell(Depth - 1), T, Stack.back());
+    if (T != Stack.back())
+      Asm.storeSD(cell(Depth - 1), XMM0);
+    break;
+  }
+
+  case Op::DeclInit: {
+    unsigned Slot = Chunk.Decls[A].second;
+    store(slot(Slot), cell(Depth - 1), Analysis.SlotTypes[Slot], Stack.back());
+    break;
+  }
+
+  case Op::DeclDefault:
+    Asm.xor_(RAX, RAX);
+    Asm.store64(slot(Chunk.Decls[A].second), RAX);
+    break;
+
+  case Op::Negate:
+    if (Stack.back() == cvm::IntType) {
+      Asm.load32(RAX, cell(Depth - 1));
+      Asm.neg(RAX);
+      Asm.store32(cell(Depth - 1), RAX);
+    } else {
+      Asm.load64(RAX, cell(Depth - 1));
+      Asm.btcRAX63();
+      Asm.store64(cell(Depth - 1), RAX);
+    }
+    break;
+
+  case Op::LogicalNot:
+    loadBool(cell(Depth - 1), Stack.back());
+    Asm.xorImm8(RAX, 1);
+    Asm.store32(cell(Depth - 1), RAX);
+    break;
+
+  case Op::ToBool:
+    loadBool(cell(Depth - 1), Stack.back());
+    Asm.store32(cell(Depth - 1), RAX);
+    break;
+
+  case Op::BitwiseNot:
+    Asm.load32(RAX, cell(Depth - 1));
+    Asm.not_(RAX);
+    Asm.store32(cell(Depth - 1), RAX);
+    break;
+
+  case Op::Add:
+  case Op::Minus:
+  case Op::Multiply:
+  case Op::Division:
+  case Op::Modulo:
+  case Op::BitwiseAnd:
+  case Op::BitwiseOr:
+  case Op::BitwiseXor:
+  case Op::LeftShift:
+  case Op::RightShift:
+    emitArith(getOpcode(I), Depth, Stack[Depth - 2], Stack[Depth - 1]);
+    break;
+
+  case Op::Less:
+  case Op::LessEqual:
+  case Op::Equal:
+  case Op::NotEqual:
+  case Op::Greater:
+  case Op::GreaterEqual:
+    emitRelation(getOpcode(I), Depth, Stack[Depth - 2], Stack[Depth - 1]);
+    break;
+
+  case Op::Jump:
+    Jumps.emplace_back(Asm.jmp(), A);
+    break;
+
+  case Op::JumpIfFalse:
+  case Op::JumpIfTrue:
+    loadBool(cell(Depth - 1), Stack.back());
+    Asm.test(RAX, RAX);
+    Jumps.emplace_back(
+        Asm.jcc(getOpcode(I) == Op::JumpIfFalse ? CondE : CondNE), A);
+    break;
+
+  case Op::AndThen:
+  case Op::OrElse:
+    // The operand becomes the bool result if the jump is taken.
+    loadBool(cell(Depth - 1), Stack.back());
+    Asm.store32(cell(Depth - 1), RAX);
+    Asm.test(RAX, RAX);
+    Jumps.emplace_back(Asm.jcc(getOpcode(I) == Op::AndThen ? CondE : CondNE),
+                       A);
+    break;
+
+  case Op::Call: {
+    const FunctionDefinitionAST &Function =
+        *Analysis.Program.Chunks[A].Function;
+    size_t ArgCount = Chunk.Code[PC + 1];
+    size_t ArgBase = Depth - ArgCount;
+    auto It = Function.getParameterList().cbegin();
+    for (size_t Arg = 0; Arg < ArgCount; ++Arg, ++It)
+      if (It->getType() != Stack[ArgBase + Arg])
+        store(cell(ArgBase + Arg), cell(ArgBase + Arg), It->getType(),
+              Stack[ArgBase + Arg]);
+
+    // A call of the function to itself that it returns the value of starts
+    // its body over with the arguments as parameters.
+    Op::Opcode Next = PC + 2 < Chunk.Code.size()
+                          ? getOpcode(Chunk.Code[PC + 2])
+                          : Op::Error;
+    if (A == Index && (Next == Op::Return || Next == Op::ReturnImplicit)) {
+      for (size_t Arg = 0; Arg < ArgCount; ++Arg) {
+        Asm.load64(RAX, cell(ArgBase + Arg));
+        Asm.store64(slot(Arg), RAX);
+      }
+      Jumps.emplace_back(Asm.jmp(), 0);
+      break;
+    }
+
+    Asm.leaRDI(cell(ArgBase));
+    Asm.movImm64(RAX, &Entries[A]);
+    Asm.callMemRAX();
+    Asm.store64(cell(ArgBase), RAX);
+    break;
+  }
+
+  case Op::Return:
+  case Op::ReturnImplicit:
+    Asm.load64(RAX, cell(Depth - 1));
+    Asm.leaveRet();
+    break;
+
+  case Op::Error:
+    emitError(Chunk.Constants[A].getString());
+    break;
+  }
+}
+
+void ChunkCodeGen::emitArith(Op::Opcode Code, size_t Depth, cvm::BasicType L,
+                             cvm::BasicType R) {
+  int32_t LHS = cell(Depth - 2), RHS = cell(Depth - 1);
+
+  if (L == cvm::IntType && R == cvm::IntType) {
+    Asm.load32(RAX, LHS);
+    Asm.load32(RCX, RHS);
+    switch (Code) {
+    default:
+      break;
+    case Op::Add:        Asm.add(RAX, RCX); break;
+    case Op::Minus:      Asm.sub(RAX, RCX); break;
+    case Op::Multiply:   Asm.imul(RAX, RCX); break;
+    case Op::BitwiseAnd: Asm.and_(RAX, RCX); break;
+    case Op::BitwiseOr:  Asm.or_(RAX, RCX); break;
+    case Op::BitwiseXor: Asm.xor_(RAX, RCX); break;
+    case Op::LeftShift:  Asm.shlCL(RAX); break;
+    case Op::RightShift: Asm.sarCL(RAX); break;
+    case Op::Division:
+    case Op::Modulo: {
+      Asm.test(RCX, RCX);
+      size_t ToDivide = Asm.jcc(CondNE);
+      emitError(Code == Op::Division ? "int division by zero"
+                                     : "int modulo by zero");
+      Asm.patch(ToDivide, Asm.size());
+      Asm.cdq();
+      Asm.idiv(RCX);
+      if (Code == Op::Modulo)
+        Asm.mov(RAX, RDX);
+      break;
+    }
+    }
+    Asm.store32(LHS, RAX);
+    return;
+  }
+
+  loadDouble(XMM0, LHS, L);
+  loadDouble(XMM1, RHS, R);
+  switch (Code) {
+  default:
+    break;
+  case Op::Add:      Asm.addsd(XMM0, XMM1); break;
+  case Op::Minus:    Asm.subsd(XMM0, XMM1); break;
+  case Op::Multiply: Asm.mulsd(XMM0, XMM1); break;
+  case Op::Division: Asm.divsd(XMM0, XMM1); break;
+  case Op::Modulo:
+    Asm.movImm64(RAX, reinterpret_cast<const void *>(&JITFMod));
+    Asm.callRAX();
+    break;
+  }
+  Asm.storeSD(LHS, XMM0);
+}
+
+/// \brief Compare like the BasicValue operators: ints and bools as signed
+/// ints, mixed numbers as doubles, with >= being !(<) so that it holds for NaN
+void ChunkCodeGen::emitRelation(Op::Opcode Code, size_t Depth,
+                                cvm::BasicType L, cvm::BasicType R) {
+  int32_t LHS = cell(Depth - 2), RHS = cell(Depth - 1);
+
+  if (L == R && L != cvm::DoubleType) {
+    Asm.load32(RAX, LHS);
+    Asm.load32(RCX, RHS);
+    Asm.cmp(RAX, RCX);
+    Condition C = CondE;
+    switch (Code) {
+    default:                break;
+    case Op::Less:          C = CondL; break;
+    case Op::LessEqual:     C = CondLE; break;
+    case Op::Equal:         C = CondE; break;
+    case Op::NotEqual:      C = CondNE; break;
+    case Op::Greater:       C = CondG; break;
+    case Op::GreaterEqual:  C = CondGE; break;
+    }
+    Asm.setcc(C, RAX);
+  } else {
+    loadDouble(XMM0, LHS, L);
+    loadDouble(XMM1, RHS, R);
+    switch (Code) {
+    default:
+      break;
+    case Op::Less:
+      Asm.ucomisd(XMM1, XMM0);
+      Asm.setcc(CondA, RAX);
+      break;
+    case Op::LessEqual:
+      Asm.ucomisd(XMM1, XMM0);
+      Asm.setcc(CondAE, RAX);
+      break;
+    case Op::Greater:
+      Asm.ucomisd(XMM0, XMM1);
+      Asm.setcc(CondA, RAX);
+      break;
+    case Op::GreaterEqual:
+      Asm.ucomisd(XMM1, XMM0);
+      Asm.setcc(CondBE, RAX);
+      break;
+    case Op::Equal:
+      Asm.ucomisd(XMM0, XMM1);
+      Asm.setcc(CondE, RAX);
+      Asm.setcc(CondNP, RCX);
+      Asm.andAL_CL();
+      break;
+    case Op::NotEqual:
+      Asm.ucomisd(XMM0, XMM1);
+      Asm.setcc(CondNE, RAX);
+      Asm.setcc(CondP, RCX);
+      Asm.orAL_CL();
+      break;
+    }
+  }
+  Asm.movzxEAX_AL();
+  Asm.store32(LHS, RAX);
+}
+}
+#endif // CMM_HAS_JIT
+
+/// \brief Return the raw word compiled code keeps the scalar V in
+static uint64_t ToWord(const cvm::BasicValue &V) {
+  if (V.isDouble()) {
+    double D = V.getDouble();
+    uint64_t Word;
+    std::memcpy(&Word, &D, sizeof(D));
+    return Word;
+  }
+  return static_cast<uint32_t>(V.isInt() ? V.getInt() : V.getBool());
+}
+
+/// \brief Return the value of type T compiled code keeps in Word
+static cvm::BasicValue FromWord(uint64_t Word, cvm::BasicType T) {
+  switch (T) {
+  default:
+  case cvm::IntType:
+    return static_cast<int>(static_cast<uint32_t>(Word));
+  case cvm::DoubleType: {
+    double D;
+    std::memcpy(&D, &Word, sizeof(D));
+    return D;
+  }
+  case cvm::BoolType:
+    return static_cast<uint32_t>(Word) != 0;
+  }
+}
+
+BaselineJIT::BaselineJIT(const BytecodeProgram &Program)
+    : Program(Program), States(Program.Chunks.size(), Cold),
+      CallCounts(Program.Chunks.size(), 0),
+      Entries(Program.Chunks.size(), nullptr), VM(nullptr) {}
+
+BaselineJIT::~BaselineJIT() {
+#ifdef CMM_HAS_JIT
+  for (auto &Block : CodeBlocks)
+    munmap(Block.first, Block.second);
+#endif
+}
+
+bool BaselineJIT::tryCall(unsigned Index, const cvm::BasicValue *Args,
+                          size_t ArgCount, cvm::BasicValue &Result) {
+  if (States[Index] != Compiled) {
+    if (States[Index] == Rejected || ++CallCounts[Index] < HotCallCount ||
+        !compile(Index))
+      return false;
+  }
+
+#ifdef CMM_HAS_JIT
+  // Past the limit, compiled code would only hand the call back.
+  char Here;
+  uintptr_t Limit = GetStackLimit();
+  if (reinterpret_cast<uintptr_t>(&Here) < Limit)
+    return false;
+  StackLimit = Limit;
+#endif
+
+  // An array passes the type check of a parameter of its element type.
+  uint64_t Raw[16];
+  std::unique_ptr<uint64_t[]> HeapRaw;
+  uint64_t *Words = Raw;
+  if (ArgCount > 16) {
+    HeapRaw.reset(new uint64_t[ArgCount]);
+    Words = HeapRaw.get();
+  }
+  for (size_t I = 0; I < ArgCount; ++I) {
+    if (Args[I].isArray())
+      return false;
+    Words[I] = ToWord(Args[I]);
+  }
+
+  uint64_t Ret = Entries[Index](Words);
+  Result = FromWord(Ret, Program.Chunks[Index].Function->getType());
+  return true;
+}
+
+uint64_t BaselineJIT::callOnVM(unsigned Index, const uint64_t *Args) {
+  const FunctionDefinitionAST &Function = *Program.Chunks[Index].Function;
+  std::vector<cvm::BasicValue> Values;
+  Values.reserve(Function.getParameterCount());
+  for (const Parameter &Param : Function.getParameterList())
+    Values.push_back(FromWord(*Args++, Param.getType()));
+  return ToWord(VM->call(Index, Values.data(), Values.size()));
+}
+
+/// \brief Compile chunk Index along with every function it may call
+/// If any of them can't be compiled, Index is left to the VM for good.
+bool BaselineJIT::compile(unsigned Index) {
+#ifdef CMM_HAS_JIT
+  std::vector<std::unique_ptr<ChunkAnalysis>> Group;
+  std::vector<bool> InGroup(Program.Chunks.size(), false);
+  std::vector<unsigned> Pending(1, Index);
+  InGroup[Index] = true;
+
+  while (!Pending.empty()) {
+    unsigned Chunk = Pending.back();
+    Pending.pop_back();
+
+    std::unique_ptr<ChunkAnalysis> Analysis(new ChunkAnalysis(Program, Chunk));
+    if (States[Chunk] == Rejected || !Analysis->analyze()) {
+      States[Index] = Rejected;
+      return false;
+    }
+    for (unsigned Callee : Analysis->Callees) {
+      if (States[Callee] == Rejected) {
+        States[Index] = Rejected;
+        return false;
+      }
+      if (States[Callee] != Compiled && !InGroup[Callee]) {
+        InGroup[Callee] = true;
+        Pending.push_back(Callee);
+      }
+    }
+    Group.push_back(std::move(Analysis));
+  }
+
+  std::vector<std::pair<unsigned, void *>> Code;
+  for (auto &Analysis : Group) {
+    std::vector<uint8_t> Bytes =
+        ChunkCodeGen(*Analysis, *this, Messages, Entries).generate();
+    void *Address = emitCode(Bytes);
+    if (!Address) {
+      States[Index] = Rejected;
+      return false;
+    }
+    Code.emplace_back(&Analysis->Chunk - Program.Chunks.data(), Address);
+  }
+  for (auto &C : Code) {
+    Entries[C.first] = reinterpret_cast<CompiledFunction>(C.second);
+    States[C.first] = Compiled;
+  }
+  return true;
+#else
+  States[Index] = Rejected;
+  return false;
+#endif
+}
+
+/// \brief Copy Code into executable memory, and return where it is
+void *BaselineJIT::emitCode(const std::vector<uint8_t> &Code) {
+#ifdef CMM_HAS_JIT
+  size_t Size = Code.size();
+  void *Block = mmap(nullptr, Size, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (Block == MAP_FAILED)
+    return nullptr;
+  std::memcpy(Block, Code.data(), Size);
+  if (mprotect(Block, Size, PROT_READ | PROT_EXEC) != 0) {
+    munmap(Block, Size);
+    return nullptr;
+  }
+  CodeBlocks.emplace_back(Block, Size);
+  return Block;
+#else
+  (void)Code;
+  return nullptr;
+#endif
+}
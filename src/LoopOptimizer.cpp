@@ -0,0 +1,1025 @@
+#include "LoopOptimizer.h"
+#include "NativeFunctions.h"
+#include <string>
+
+using namespace cmm;
+
+static bool IsBinaryOperator(const ExpressionAST *Expr,
+                             BinaryOperatorAST::OperatorKind OpKind) {
+  return Expr->isBinaryOperatorExpression() &&
+         Expr->as_cptr<BinaryOperatorAST>()->getOpKind() == OpKind;
+}
+
+/// \brief Return true if Expr is an int literal that neither divides by zero
+/// nor overflows dividing INT_MIN
+static bool IsSafeDivisor(const ExpressionAST *Expr) {
+  if (Expr->getKind() != ExpressionAST::IntExpression)
+    return false;
+  int Value = Expr->as_cptr<IntAST>()->getValue();
+  return Value != 0 && Value != -1;
+}
+
+static int WrappingMultiply(int L, int R) {
+  return static_cast<int>(static_cast<unsigned>(L) *
+                          static_cast<unsigned>(R));
+}
+
+bool LoopOptimizer::Effects::merge(const Effects &Callee) {
+  size_t Size = Writes.size() + Reads.size();
+  Writes.insert(Callee.Writes.begin(), Callee.Writes.end());
+  Reads.insert(Callee.Reads.begin(), Callee.Reads.end());
+  bool Changed = Writes.size() + Reads.size() != Size;
+  if (Callee.StoresElements && !StoresElements)
+    StoresElements = Changed = true;
+  if (!Callee.Pure && Pure) {
+    Pure = false;
+    Changed = true;
+  }
+  return Changed;
+}
+
+LoopOptimizer::LoopOptimizer(ASTArena &Arena, BlockAST &TopLevelBlock,
+                             std::map<Symbol, FunctionDefinitionAST> &F,
+                             std::map<Symbol, InfixOpDefinitionAST> &I)
+    : Arena(Arena), TopLevelBlock(TopLevelBlock), FunctionDefinition(F),
+      InfixOpDefinition(I), Globals(TopLevelBlock), TempCount(0), InBody(false), CollectingBody(false), Loop(nullptr),
+      LoopBlock(nullptr), Nesting(0), ConditionClean(false),
+      Induction(nullptr), Replacing(false) {}
+
+void LoopOptimizer::optimize() {
+  collect();
+
+  // Summarize every body, then let the summaries of callers take in those of
+  // their callees until nothing changes.
+  FunctionEffects.clear();
+  InfixOpEffects.clear();
+  for (auto &F : FunctionDefinition)
+    FunctionEffects[&F.second];
+  for (auto &I : InfixOpDefinition)
+    InfixOpEffects[&I.second];
+  CollectingBody = true;
+  for (auto &F : FunctionDefinition)
+    addEffects(F.second.getStatement(), FunctionEffects[&F.second]);
+  for (auto &I : InfixOpDefinition)
+    addEffects(I.second.getStatement(), InfixOpEffects[&I.second]);
+  CollectingBody = false;
+  for (bool Changed = true; Changed;) {
+    Changed = false;
+    for (auto &F : FunctionEffects)
+      for (const Effects *Callee : F.second.Callees)
+        Changed |= F.second.merge(*Callee);
+    for (auto &I : InfixOpEffects)
+      for (const Effects *Callee : I.second.Callees)
+        Changed |= I.second.merge(*Callee);
+  }
+
+  // Bodies run after the top level code has declared the globals they may
+  // safely read.
+  InBody = true;
+  for (auto &F : FunctionDefinition)
+    FunctionEffects[&F.second].Safe = F.second.hasCheckedReturns() &&
+                                      isSafeBody(F.second.getStatement());
+
+  InBody = false;
+  optimizeBlock(&TopLevelBlock);
+  InBody = true;
+  for (auto &F : FunctionDefinition)
+    optimizeStatement(F.second.getStatement());
+  for (auto &I : InfixOpDefinition)
+    optimizeStatement(I.second.getStatement());
+}
+
+/*===------------------------------- Collect ------------------------------===*/
+
+void LoopOptimizer::collect() {
+  LooseNames.clear();
+  TempCount = 0;
+  Globals.compute();
+  walkProgram(TopLevelBlock, FunctionDefinition, InfixOpDefinition);
+}
+
+void LoopOptimizer::visitDeclaration(const DeclarationAST *Decl,
+                                     bool InBlock) {
+  if (!InBlock)
+    LooseNames.insert(Decl->getName());
+}
+
+/*===------------------------------- Effects ------------------------------===*/
+
+void LoopOptimizer::addEffects(const StatementAST *Stmt, Effects &Eff) {
+  if (!Stmt)
+    return;
+
+  switch (Stmt->getKind()) {
+  case StatementAST::BreakStatement:
+  case StatementAST::ContinueStatement:
+    break;
+  case StatementAST::BlockStatement:
+    for (const StatementAST *S : Stmt->as_cptr<BlockAST>()->getStatementList())
+      addEffects(S, Eff);
+    break;
+  case StatementAST::DeclarationStatement:
+    addEffects(Stmt->as_cptr<DeclarationAST>(), Eff);
+    break;
+  case StatementAST::DeclarationListStatement:
+    for (auto &Decl :
+         Stmt->as_cptr<DeclarationListAST>()->getDeclarationList())
+      addEffects(Decl, Eff);
+    break;
+  case StatementAST::ExprStatement:
+    addEffects(Stmt->as_cptr<ExprStatementAST>()->getExpression(), Eff);
+    break;
+  case StatementAST::ReturnStatement:
+    if (auto *Value = Stmt->as_cptr<ReturnStatementAST>()->getReturnValue())
+      addEffects(Value, Eff);
+    break;
+  case StatementAST::IfStatement: {
+    auto *IfStmt = Stmt->as_cptr<IfStatementAST>();
+    addEffects(IfStmt->getCondition(), Eff);
+    addEffects(IfStmt->getStatementThen(), Eff);
+    addEffects(IfStmt->getStatementElse(), Eff);
+    break;
+  }
+  case StatementAST::WhileStatement: {
+    auto *WhileStmt = Stmt->as_cptr<WhileStatementAST>();
+    if (WhileStmt->getCondition())
+      addEffects(WhileStmt->getCondition(), Eff);
+    addEffects(WhileStmt->getStatement(), Eff);
+    break;
+  }
+  case StatementAST::ForStatement: {
+    auto *ForStmt = Stmt->as_cptr<ForStatementAST>();
+    if (ForStmt->getInit())
+      addEffects(ForStmt->getInit(), Eff);
+    if (ForStmt->getCondition())
+      addEffects(ForStmt->getCondition(), Eff);
+    if (ForStmt->getPost())
+      addEffects(ForStmt->getPost(), Eff);
+    addEffects(ForStmt->getStatement(), Eff);
+    break;
+  }
+  }
+}
+
+void LoopOptimizer::addEffects(const DeclarationAST *Decl, Effects &Eff) {
+  for (const ExpressionAST *E : Decl->getElementCountList())
+    addEffects(E, Eff);
+  if (Decl->getInitializer())
+    addEffects(Decl->getInitializer(), Eff);
+  // A body declares into its own frames, but a loop may shadow or redeclare
+  // a variable read by the code hoisted out of it.
+  if (!CollectingBody)
+    Eff.Writes.insert(Decl->getName());
+}
+
+void LoopOptimizer::addEffects(const ExpressionAST *Expr, Effects &Eff) {
+  switch (Expr->getKind()) {
+  case ExpressionAST::IntExpression:
+  case ExpressionAST::DoubleExpression:
+  case ExpressionAST::BoolExpression:
+  case ExpressionAST::StringExpression:
+    break;
+  case ExpressionAST::IdentifierExpression:
+    addAccess(Expr->as_cptr<IdentifierAST>(), Eff, false);
+    break;
+  case ExpressionAST::FunctionCallExpression: {
+    // A dynamically bound callee assigns the caller's variables by name,
+    // which is all a summary records anyway.
+    auto *FuncCall = Expr->as_cptr<FunctionCallAST>();
+    for (const ExpressionAST *Arg : FuncCall->getArguments())
+      addEffects(Arg, Eff);
+    if (FuncCall->getFunction())
+      Eff.Callees.push_back(&FunctionEffects[FuncCall->getFunction()]);
+    else if (!cvm::getNativeTraits(FuncCall->getNativeFunction()).isPure())
+      Eff.Pure = false;
+    break;
+  }
+  case ExpressionAST::InfixOpExpression: {
+    auto *InfixOp = Expr->as_cptr<InfixOpExprAST>();
+    addEffects(InfixOp->getLHS(), Eff);
+    addEffects(InfixOp->getRHS(), Eff);
+    if (InfixOp->getDefinition())
+      Eff.Callees.push_back(&InfixOpEffects[InfixOp->getDefinition()]);
+    else
+      Eff.Pure = false;
+    break;
+  }
+  case ExpressionAST::BinaryOperatorExpression: {
+    auto *BinOp = Expr->as_cptr<BinaryOperatorAST>();
+    if (BinOp->getOpKind() == BinaryOperatorAST::Assign) {
+      if (BinOp->getLHS()->isIdentifierExpr())
+        addAccess(BinOp->getLHS()->as_cptr<IdentifierAST>(), Eff, true);
+      else
+        Eff.StoresElements = true;
+    }
+    addEffects(BinOp->getLHS(), Eff);
+    addEffects(BinOp->getRHS(), Eff);
+    break;
+  }
+  case ExpressionAST::UnaryOperatorExpression:
+    addEffects(Expr->as_cptr<UnaryOperatorAST>()->getOperand(), Eff);
+    break;
+  }
+}
+
+void LoopOptimizer::addAccess(const IdentifierAST *IdExpr, Effects &Eff,
+                              bool Write) {
+  // The frames of a body are its own, unless some declaration that isn't
+  // directly in a block may leave the name looked up at run time.
+  if (CollectingBody && IdExpr->isResolved() &&
+      IdExpr->getScope() != &TopLevelBlock.getLayout() &&
+      !LooseNames.count(IdExpr->getName()))
+    return;
+  (Write ? Eff.Writes : Eff.Reads).insert(IdExpr->getName());
+}
+
+/*===------------------------------ Optimize ------------------------------===*/
+
+void LoopOptimizer::optimizeStatement(StatementAST *Stmt) {
+  if (!Stmt)
+    return;
+
+  switch (Stmt->getKind()) {
+  default:
+    break;
+  case StatementAST::BlockStatement:
+    optimizeBlock(Stmt->as_ptr<BlockAST>());
+    break;
+  case StatementAST::IfStatement:
+    optimizeStatement(Stmt->as_ptr<IfStatementAST>()->getStatementThen());
+    optimizeStatement(Stmt->as_ptr<IfStatementAST>()->getStatementElse());
+    break;
+  case StatementAST::WhileStatement:
+    optimizeStatement(Stmt->as_ptr<WhileStatementAST>()->getStatement());
+    break;
+  case StatementAST::ForStatement:
+    optimizeStatement(Stmt->as_ptr<ForStatementAST>()->getStatement());
+    break;
+  }
+}
+
+void LoopOptimizer::optimizeBlock(BlockAST *Block) {
+  // Outer loops go first, so what they hoist out of inner loops already sits
+  // in the inner blocks when those are optimized.
+  std::vector<StatementAST *> List;
+  bool Changed = false;
+  for (StatementAST *Stmt : Block->getStatementList()) {
+    if (Stmt && (Stmt->getKind() == StatementAST::WhileStatement ||
+                 Stmt->getKind() == StatementAST::ForStatement)) {
+      LoopBlock = Block;
+      Changed |= optimizeLoop(Stmt, List);
+    } else {
+      List.push_back(Stmt);
+    }
+    optimizeStatement(Stmt);
+  }
+  if (Changed)
+    Block->setStatementList(Arena.copyArray(List.data(), List.size()));
+}
+
+/// \brief Optimize the loop Stmt of LoopBlock, and append it to List with the
+/// statements computing its temporaries. Return true if there are any.
+bool LoopOptimizer::optimizeLoop(StatementAST *Stmt,
+                                 std::vector<StatementAST *> &List) {
+  ForStatementAST *ForStmt = nullptr;
+  ExpressionAST *Cond;
+  StatementAST *Body;
+  if (Stmt->getKind() == StatementAST::ForStatement) {
+    ForStmt = Stmt->as_ptr<ForStatementAST>();
+    Cond = ForStmt->getCondition();
+    Body = ForStmt->getStatement();
+  } else {
+    Cond = Stmt->as_ptr<WhileStatementAST>()->getCondition();
+    Body = Stmt->as_ptr<WhileStatementAST>()->getStatement();
+  }
+
+  Effects Eff;
+  if (Cond)
+    addEffects(Cond, Eff);
+  addEffects(Body, Eff);
+  for (const Effects *Callee : Eff.Callees)
+    Eff.merge(*Callee);
+  Loop = &Eff;
+  Nesting = 0;
+  Temporaries.clear();
+
+  // The induction variable may only be assigned by the post expression.
+  int Step = 0;
+  bool Reduce = ForStmt && findInduction(ForStmt, Eff, Step);
+  if (ForStmt && ForStmt->getPost()) {
+    addEffects(ForStmt->getPost(), Eff);
+    for (const Effects *Callee : Eff.Callees)
+      Eff.merge(*Callee);
+  }
+  if (Reduce)
+    reduce(ForStmt, Step, Eff);
+
+  if (Cond) {
+    ConditionClean = true;
+    Cond = hoistExpression(Cond, true);
+    if (ForStmt)
+      ForStmt->setCondition(Cond);
+    else
+      Stmt->as_ptr<WhileStatementAST>()->setCondition(Cond);
+  }
+  if (ForStmt && ForStmt->getPost())
+    ForStmt->setPost(hoistExpression(ForStmt->getPost(), false));
+  walkStatement(Body, &LoopOptimizer::hoistInBody);
+  Loop = nullptr;
+
+  if (Temporaries.empty()) {
+    List.push_back(Stmt);
+    return false;
+  }
+  // The temporaries may read what the initializer assigns.
+  if (ForStmt && ForStmt->getInit()) {
+    List.push_back(Arena.create<ExprStatementAST>(ForStmt->getInit()));
+    ForStmt->setInit(nullptr);
+  }
+  List.insert(List.end(), Temporaries.begin(), Temporaries.end());
+  List.push_back(Stmt);
+  return true;
+}
+
+/// \brief Replace each expression of Stmt by what Visit returns for it,
+/// keeping Nesting up to date
+void LoopOptimizer::walkStatement(StatementAST *Stmt,
+                                  ExpressionVisitor Visit) {
+  if (!Stmt)
+    return;
+
+  switch (Stmt->getKind()) {
+  case StatementAST::BreakStatement:
+  case StatementAST::ContinueStatement:
+    break;
+  case StatementAST::BlockStatement:
+    ++Nesting;
+    for (auto &S : Stmt->as_ptr<BlockAST>()->getStatementList())
+      walkStatement(S, Visit);
+    --Nesting;
+    break;
+  case StatementAST::DeclarationStatement:
+    walkDeclaration(Stmt->as_ptr<DeclarationAST>(), Visit);
+    break;
+  case StatementAST::DeclarationListStatement:
+    for (auto &Decl : Stmt->as_ptr<DeclarationListAST>()->getDeclarationList())
+      walkDeclaration(Decl, Visit);
+    break;
+  case StatementAST::ExprStatement: {
+    auto *ExprStmt = Stmt->as_ptr<ExprStatementAST>();
+    ExprStmt->setExpression((this->*Visit)(ExprStmt->getExpression()));
+    break;
+  }
+  case StatementAST::ReturnStatement: {
+    auto *Return = Stmt->as_ptr<ReturnStatementAST>();
+    if (Return->getReturnValue())
+      Return->setReturnValue((this->*Visit)(Return->getReturnValue()));
+    break;
+  }
+  case StatementAST::IfStatement: {
+    auto *IfStmt = Stmt->as_ptr<IfStatementAST>();
+    IfStmt->setCondition((this->*Visit)(IfStmt->getCondition()));
+    walkStatement(IfStmt->getStatementThen(), Visit);
+    walkStatement(IfStmt->getStatementElse(), Visit);
+    break;
+  }
+  case StatementAST::WhileStatement: {
+    auto *WhileStmt = Stmt->as_ptr<WhileStatementAST>();
+    if (WhileStmt->getCondition())
+      WhileStmt->setCondition((this->*Visit)(WhileStmt->getCondition()));
+    walkStatement(WhileStmt->getStatement(), Visit);
+    break;
+  }
+  case StatementAST::ForStatement: {
+    auto *ForStmt = Stmt->as_ptr<ForStatementAST>();
+    if (ForStmt->getInit())
+      ForStmt->setInit((this->*Visit)(ForStmt->getInit()));
+    if (ForStmt->getCondition())
+      ForStmt->setCondition((this->*Visit)(ForStmt->getCondition()));
+    if (ForStmt->getPost())
+      ForStmt->setPost((this->*Visit)(ForStmt->getPost()));
+    walkStatement(ForStmt->getStatement(), Visit);
+    break;
+  }
+  }
+}
+
+void LoopOptimizer::walkDeclaration(DeclarationAST *Decl,
+                                    ExpressionVisitor Visit) {
+  for (auto &E : Decl->getElementCountList())
+    E = (this->*Visit)(E);
+  if (Decl->getInitializer())
+    Decl->setInitializer((this->*Visit)(Decl->getInitializer()));
+}
+
+/// \brief Return Expr with its largest invariant subexpressions replaced by
+/// reads of temporaries. InCondition is true for the parts of the condition
+/// its first test always evaluates, in the order it evaluates them.
+ExpressionAST *LoopOptimizer::hoistExpression(ExpressionAST *Expr,
+                                              bool InCondition) {
+  if (!Expr->isConstant() && !Expr->isIdentifierExpr() &&
+      Expr->hasStaticType() && isInvariant(Expr) &&
+      (isSafe(Expr) || (InCondition && ConditionClean)))
+    return makeTemporary(Expr);
+
+  switch (Expr->getKind()) {
+  default:
+    break;
+  case ExpressionAST::FunctionCallExpression:
+    for (auto &Arg : Expr->as_ptr<FunctionCallAST>()->getArguments())
+      Arg = hoistExpression(Arg, InCondition);
+    break;
+  case ExpressionAST::InfixOpExpression: {
+    auto *InfixOp = Expr->as_ptr<InfixOpExprAST>();
+    InfixOp->setLHS(hoistExpression(InfixOp->getLHS(), InCondition));
+    InfixOp->setRHS(hoistExpression(InfixOp->getRHS(), InCondition));
+    break;
+  }
+  case ExpressionAST::BinaryOperatorExpression: {
+    auto *BinOp = Expr->as_ptr<BinaryOperatorAST>();
+    switch (BinOp->getOpKind()) {
+    case BinaryOperatorAST::Assign:
+    case BinaryOperatorAST::Index:
+      BinOp->setLHS(hoistLvalue(BinOp->getLHS(), InCondition));
+      BinOp->setRHS(hoistExpression(BinOp->getRHS(), InCondition));
+      break;
+    case BinaryOperatorAST::LogicalAnd:
+    case BinaryOperatorAST::LogicalOr:
+      // The right operand may not be evaluated.
+      BinOp->setLHS(hoistExpression(BinOp->getLHS(), InCondition));
+      BinOp->setRHS(hoistExpression(BinOp->getRHS(), false));
+      break;
+    default:
+      BinOp->setLHS(hoistExpression(BinOp->getLHS(), InCondition));
+      BinOp->setRHS(hoistExpression(BinOp->getRHS(), InCondition));
+      break;
+    }
+    break;
+  }
+  case ExpressionAST::UnaryOperatorExpression: {
+    auto *UnaryOp = Expr->as_ptr<UnaryOperatorAST>();
+    UnaryOp->setOperand(hoistExpression(UnaryOp->getOperand(), InCondition));
+    break;
+  }
+  }
+
+  if (InCondition && !isSafe(Expr))
+    ConditionClean = false;
+  return Expr;
+}
+
+/// \brief Hoist from the subexpressions of an expression evaluated as a
+/// lvalue, keeping the variable it refers to
+ExpressionAST *LoopOptimizer::hoistLvalue(ExpressionAST *Expr,
+                                          bool InCondition) {
+  if (Expr->isIdentifierExpr()) {
+    if (InCondition && !isDeclared(Expr->as_cptr<IdentifierAST>()))
+      ConditionClean = false;
+    return Expr;
+  }
+  if (IsBinaryOperator(Expr, BinaryOperatorAST::Index)) {
+    auto *BinOp = Expr->as_ptr<BinaryOperatorAST>();
+    BinOp->setLHS(hoistLvalue(BinOp->getLHS(), InCondition));
+    BinOp->setRHS(hoistExpression(BinOp->getRHS(), InCondition));
+    if (InCondition)
+      ConditionClean = false;
+    return Expr;
+  }
+  return hoistExpression(Expr, InCondition);
+}
+
+/// \brief Move Expr out of the loop into a new temporary, and return a read
+/// of it
+ExpressionAST *LoopOptimizer::makeTemporary(ExpressionAST *Expr) {
+  shiftDepth(Expr, Nesting);
+  Symbol Name = makeTemporaryName();
+  int Slot = LoopBlock->getLayout().appendSlot(Name);
+  Temporaries.push_back(makeDeclaration(Name, Slot, Expr));
+  return makeRead(Name, Slot, Expr->getStaticType());
+}
+
+/*===-------------------------- Strength reduction ------------------------===*/
+
+/// \brief Return true if the post expression of ForStmt steps an int variable
+/// by a constant, which it sets Induction and Step to, and Eff leaves it
+/// alone.
+bool LoopOptimizer::findInduction(ForStatementAST *ForStmt, const Effects &Eff,
+                                  int &Step) {
+  // A continue would skip the update of the reduced products.
+  const ExpressionAST *Post = ForStmt->getPost();
+  const StatementAST *Body = ForStmt->getStatement();
+  if (!Post || !Body || Body->getKind() != StatementAST::BlockStatement ||
+      hasContinue(Body) || !IsBinaryOperator(Post, BinaryOperatorAST::Assign))
+    return false;
+
+  auto *Assign = Post->as_cptr<BinaryOperatorAST>();
+  if (!Assign->getLHS()->isIdentifierExpr())
+    return false;
+  auto *Var = Assign->getLHS()->as_cptr<IdentifierAST>();
+  if (!Var->hasStaticType(cvm::IntType) || !isDeclared(Var) ||
+      Eff.Writes.count(Var->getName()))
+    return false;
+
+  const ExpressionAST *Value = Assign->getRHS();
+  bool IsAdd = IsBinaryOperator(Value, BinaryOperatorAST::Add);
+  if (!Value->hasStaticType(cvm::IntType) ||
+      !(IsAdd || IsBinaryOperator(Value, BinaryOperatorAST::Minus)))
+    return false;
+  const ExpressionAST *L = Value->as_cptr<BinaryOperatorAST>()->getLHS();
+  const ExpressionAST *R = Value->as_cptr<BinaryOperatorAST>()->getRHS();
+  if (IsAdd && L->getKind() == ExpressionAST::IntExpression)
+    std::swap(L, R);
+  if (!L->isIdentifierExpr() || R->getKind() != ExpressionAST::IntExpression)
+    return false;
+  auto *Read = L->as_cptr<IdentifierAST>();
+  if (Read->getName() != Var->getName() ||
+      Read->getScope() != Var->getScope() ||
+      Read->getSlot() != Var->getSlot() || Read->getDepth() != Var->getDepth())
+    return false;
+
+  Induction = Var;
+  Step = R->as_cptr<IntAST>()->getValue();
+  if (!IsAdd)
+    Step = static_cast<int>(0u - static_cast<unsigned>(Step));
+  return true;
+}
+
+bool LoopOptimizer::isInductionRead(const ExpressionAST *Expr) const {
+  if (!Expr->isIdentifierExpr())
+    return false;
+  auto *IdExpr = Expr->as_cptr<IdentifierAST>();
+  return IdExpr->getName() == Induction->getName() &&
+         IdExpr->getScope() == Induction->getScope() &&
+         IdExpr->getSlot() == Induction->getSlot() &&
+         IdExpr->getDepth() == Induction->getDepth() + Nesting;
+}
+
+/// \brief Key the factor Expr of a product of the induction variable, and
+/// return true if it is a constant or an invariant int variable
+bool LoopOptimizer::getFactorKey(const ExpressionAST *Expr,
+                                 FactorKey &Key) const {
+  if (Expr->getKind() == ExpressionAST::IntExpression) {
+    Key = FactorKey(nullptr, Expr->as_cptr<IntAST>()->getValue());
+    return true;
+  }
+  if (!Expr->isIdentifierExpr())
+    return false;
+  auto *IdExpr = Expr->as_cptr<IdentifierAST>();
+  if (!IdExpr->isResolved() || !IdExpr->hasStaticType(cvm::IntType) ||
+      !isDeclared(IdExpr) || Loop->Writes.count(IdExpr->getName()))
+    return false;
+  Key = FactorKey(IdExpr->getScope(), IdExpr->getSlot());
+  return true;
+}
+
+/// \brief Return a new read of the factor of R from Nesting blocks in the
+/// loop
+ExpressionAST *LoopOptimizer::makeFactor(const FactorKey &Key,
+                                         const Reduction &R) {
+  if (!Key.first) {
+    auto *Constant = Arena.create<IntAST>(Key.second);
+    Constant->setStaticType(cvm::IntType);
+    return Constant;
+  }
+  auto *IdExpr = Arena.create<IdentifierAST>(R.FactorName);
+  IdExpr->setBinding(R.FactorDepth + Nesting, Key.second, Key.first);
+  IdExpr->setStaticType(cvm::IntType);
+  return IdExpr;
+}
+
+/// \brief Count the products of the induction variable in Expr, or replace
+/// those being reduced if Replacing
+ExpressionAST *LoopOptimizer::reduceExpression(ExpressionAST *Expr) {
+  if (IsBinaryOperator(Expr, BinaryOperatorAST::Multiply) &&
+      Expr->hasStaticType(cvm::IntType)) {
+    auto *BinOp = Expr->as_ptr<BinaryOperatorAST>();
+    const ExpressionAST *Factor = nullptr;
+    if (isInductionRead(BinOp->getLHS()))
+      Factor = BinOp->getRHS();
+    else if (isInductionRead(BinOp->getRHS()))
+      Factor = BinOp->getLHS();
+    FactorKey Key;
+    if (Factor && getFactorKey(Factor, Key)) {
+      Reduction &R = Reductions[Key];
+      if (Replacing)
+        return R.Slot < 0 ? Expr : makeRead(R.Name, R.Slot, cvm::IntType);
+      ++R.Uses;
+      if (Factor->isIdentifierExpr()) {
+        R.FactorName = Factor->as_cptr<IdentifierAST>()->getName();
+        R.FactorDepth = Factor->as_cptr<IdentifierAST>()->getDepth() - Nesting;
+      }
+      return Expr;
+    }
+  }
+
+  switch (Expr->getKind()) {
+  default:
+    break;
+  case ExpressionAST::FunctionCallExpression:
+    for (auto &Arg : Expr->as_ptr<FunctionCallAST>()->getArguments())
+      Arg = reduceExpression(Arg);
+    break;
+  case ExpressionAST::InfixOpExpression: {
+    auto *InfixOp = Expr->as_ptr<InfixOpExprAST>();
+    InfixOp->setLHS(reduceExpression(InfixOp->getLHS()));
+    InfixOp->setRHS(reduceExpression(InfixOp->getRHS()));
+    break;
+  }
+  case ExpressionAST::BinaryOperatorExpression: {
+    auto *BinOp = Expr->as_ptr<BinaryOperatorAST>();
+    BinOp->setLHS(reduceExpression(BinOp->getLHS()));
+    BinOp->setRHS(reduceExpression(BinOp->getRHS()));
+    break;
+  }
+  case ExpressionAST::UnaryOperatorExpression: {
+    auto *UnaryOp = Expr->as_ptr<UnaryOperatorAST>();
+    UnaryOp->setOperand(reduceExpression(UnaryOp->getOperand()));
+    break;
+  }
+  }
+  return Expr;
+}
+
+/// \brief Replace the products of the induction variable ForStmt computes
+/// more than once by temporaries it advances along with the variable
+void LoopOptimizer::reduce(ForStatementAST *ForStmt, int Step, Effects &Eff) {
+  // A product computed once costs no more than the addition keeping it.
+  auto *Body = ForStmt->getStatement()->as_ptr<BlockAST>();
+  Reductions.clear();
+  Replacing = false;
+  if (ForStmt->getCondition())
+    reduceExpression(ForStmt->getCondition());
+  walkStatement(Body, &LoopOptimizer::reduceExpression);
+
+  std::vector<StatementAST *> Updates;
+  for (auto &Entry : Reductions) {
+    Reduction &R = Entry.second;
+    if (R.Uses < 2)
+      continue;
+
+    // int d = i * k; before the loop, and d = d + s; at the end of its body.
+    Nesting = 0;
+    R.Name = makeTemporaryName();
+    R.Slot = LoopBlock->getLayout().appendSlot(R.Name);
+    auto *Var = Arena.create<IdentifierAST>(Induction->getName());
+    Var->setBinding(Induction->getDepth(), Induction->getSlot(),
+                    Induction->getScope());
+    Var->setStaticType(cvm::IntType);
+    Temporaries.push_back(makeDeclaration(
+        R.Name, R.Slot,
+        makeIntOperator(BinaryOperatorAST::Multiply, Var,
+                        makeFactor(Entry.first, R))));
+    Eff.Writes.insert(R.Name);
+
+    ExpressionAST *Increment;
+    Nesting = 1;
+    if (!Entry.first.first) {
+      Increment = Arena.create<IntAST>(
+          WrappingMultiply(Step, Entry.first.second));
+      Increment->setStaticType(cvm::IntType);
+    } else if (Step == 1) {
+      Increment = makeFactor(Entry.first, R);
+    } else {
+      Nesting = 0;
+      auto *StepConstant = Arena.create<IntAST>(Step);
+      StepConstant->setStaticType(cvm::IntType);
+      Symbol Name = makeTemporaryName();
+      int Slot = LoopBlock->getLayout().appendSlot(Name);
+      Temporaries.push_back(makeDeclaration(
+          Name, Slot,
+          makeIntOperator(BinaryOperatorAST::Multiply, StepConstant,
+                          makeFactor(Entry.first, R))));
+      Nesting = 1;
+      Increment = makeRead(Name, Slot, cvm::IntType);
+    }
+    auto *Update = makeIntOperator(
+        BinaryOperatorAST::Assign, makeRead(R.Name, R.Slot, cvm::IntType),
+        makeIntOperator(BinaryOperatorAST::Add,
+                        makeRead(R.Name, R.Slot, cvm::IntType), Increment));
+    Update->setAssignCoercion(Coercion::Identity);
+    Updates.push_back(Arena.create<ExprStatementAST>(Update));
+  }
+  Nesting = 0;
+  if (Updates.empty())
+    return;
+
+  Replacing = true;
+  if (ForStmt->getCondition())
+    ForStmt->setCondition(reduceExpression(ForStmt->getCondition()));
+  walkStatement(Body, &LoopOptimizer::reduceExpression);
+  Replacing = false;
+
+  std::vector<StatementAST *> List(Body->getStatementList().begin(),
+                                   Body->getStatementList().end());
+  List.insert(List.end(), Updates.begin(), Updates.end());
+  Body->setStatementList(Arena.copyArray(List.data(), List.size()));
+}
+
+/*===------------------------------ Analysis ------------------------------===*/
+
+/// \brief Return true if Expr computes the same value on every iteration of
+/// Loop, with no side effect
+bool LoopOptimizer::isInvariant(const ExpressionAST *Expr) const {
+  switch (Expr->getKind()) {
+  case ExpressionAST::IntExpression:
+  case ExpressionAST::DoubleExpression:
+  case ExpressionAST::BoolExpression:
+  case ExpressionAST::StringExpression:
+    return true;
+  case ExpressionAST::IdentifierExpression:
+    return Expr->hasStaticType() &&
+           !Loop->Writes.count(Expr->as_cptr<IdentifierAST>()->getName());
+  case ExpressionAST::FunctionCallExpression: {
+    auto *FuncCall = Expr->as_cptr<FunctionCallAST>();
+    if (FuncCall->isDynamicBound())
+      return false;
+    for (const ExpressionAST *Arg : FuncCall->getArguments())
+      if (!isInvariant(Arg))
+        return false;
+    if (FuncCall->getNativeFunction()) {
+      cvm::NativeTraits::ArgumentUse Use =
+          cvm::getNativeTraits(FuncCall->getNativeFunction()).Use;
+      return Use != cvm::NativeTraits::Impure &&
+             !(Use == cvm::NativeTraits::ToText && Loop->StoresElements);
+    }
+    if (!FuncCall->getFunction() || Loop->StoresElements)
+      return false;
+    const Effects &Callee = FunctionEffects.at(FuncCall->getFunction());
+    if (!Callee.isPureCall())
+      return false;
+    for (Symbol Name : Callee.Reads)
+      if (Loop->Writes.count(Name))
+        return false;
+    return true;
+  }
+  case ExpressionAST::InfixOpExpression:
+    return false;
+  case ExpressionAST::BinaryOperatorExpression: {
+    auto *BinOp = Expr->as_cptr<BinaryOperatorAST>();
+    switch (BinOp->getOpKind()) {
+    case BinaryOperatorAST::Assign:
+    case BinaryOperatorAST::Index:
+      return false;
+    case BinaryOperatorAST::Add:
+      // Converting an array to a string reads its elements.
+      if (Loop->StoresElements &&
+          (BinOp->getLHS()->hasStaticType(cvm::StringType) ||
+           BinOp->getRHS()->hasStaticType(cvm::StringType)))
+        return false;
+      break;
+    default:
+      break;
+    }
+    return isInvariant(BinOp->getLHS()) && isInvariant(BinOp->getRHS());
+  }
+  case ExpressionAST::UnaryOperatorExpression:
+    return isInvariant(Expr->as_cptr<UnaryOperatorAST>()->getOperand());
+  }
+  return false;
+}
+
+/// \brief Return true if evaluating Expr can't fail
+bool LoopOptimizer::isSafe(const ExpressionAST *Expr) const {
+  switch (Expr->getKind()) {
+  case ExpressionAST::IntExpression:
+  case ExpressionAST::DoubleExpression:
+  case ExpressionAST::BoolExpression:
+  case ExpressionAST::StringExpression:
+    return true;
+  case ExpressionAST::IdentifierExpression:
+    return isDeclared(Expr->as_cptr<IdentifierAST>());
+  case ExpressionAST::FunctionCallExpression: {
+    auto *FuncCall = Expr->as_cptr<FunctionCallAST>();
+    for (const ExpressionAST *Arg : FuncCall->getArguments())
+      if (!isSafe(Arg))
+        return false;
+    if (FuncCall->getFunction()) {
+      const Effects &Callee = FunctionEffects.at(FuncCall->getFunction());
+      return !FuncCall->isDynamicBound() && FuncCall->hasCheckedArguments() &&
+             Callee.Safe && Callee.isPureCall();
+    }
+    if (!FuncCall->getNativeFunction())
+      return false;
+    cvm::NativeTraits::ArgumentUse Use =
+        cvm::getNativeTraits(FuncCall->getNativeFunction()).Use;
+    if (Use == cvm::NativeTraits::Impure)
+      return false;
+    if (Use != cvm::NativeTraits::ToNumber)
+      return true;
+    for (const ExpressionAST *Arg : FuncCall->getArguments())
+      if (!Arg->hasStaticType() || Arg->hasStaticType(cvm::StringType))
+        return false;
+    return true;
+  }
+  case ExpressionAST::InfixOpExpression:
+    return false;
+  case ExpressionAST::BinaryOperatorExpression: {
+    auto *BinOp = Expr->as_cptr<BinaryOperatorAST>();
+    const ExpressionAST *LHS = BinOp->getLHS(), *RHS = BinOp->getRHS();
+    if (BinOp->getOpKind() == BinaryOperatorAST::Assign ||
+        BinOp->getOpKind() == BinaryOperatorAST::Index || !isSafe(LHS) ||
+        !isSafe(RHS))
+      return false;
+    bool BothInt =
+        LHS->hasStaticType(cvm::IntType) && RHS->hasStaticType(cvm::IntType);
+    switch (BinOp->getOpKind()) {
+    default:
+      return false;
+    case BinaryOperatorAST::Add:
+      return LHS->hasStaticType(cvm::StringType) ||
+             RHS->hasStaticType(cvm::StringType) ||
+             (LHS->hasNumericType() && RHS->hasNumericType());
+    case BinaryOperatorAST::Minus:
+    case BinaryOperatorAST::Multiply:
+      return LHS->hasNumericType() && RHS->hasNumericType();
+    case BinaryOperatorAST::Division:
+    case BinaryOperatorAST::Modulo:
+      return LHS->hasNumericType() && RHS->hasNumericType() &&
+             (!BothInt || IsSafeDivisor(RHS));
+    case BinaryOperatorAST::LogicalAnd:
+    case BinaryOperatorAST::LogicalOr:
+      return true;
+    case BinaryOperatorAST::Less:
+    case BinaryOperatorAST::LessEqual:
+    case BinaryOperatorAST::Equal:
+    case BinaryOperatorAST::NotEqual:
+    case BinaryOperatorAST::Greater:
+    case BinaryOperatorAST::GreaterEqual:
+      return (LHS->hasStaticType() &&
+              RHS->hasStaticType(LHS->getStaticType())) ||
+             (LHS->hasNumericType() && RHS->hasNumericType());
+    case BinaryOperatorAST::BitwiseAnd:
+    case BinaryOperatorAST::BitwiseOr:
+    case BinaryOperatorAST::BitwiseXor:
+      return BothInt;
+    case BinaryOperatorAST::LeftShift:
+    case BinaryOperatorAST::RightShift:
+      return BothInt && RHS->getKind() == ExpressionAST::IntExpression &&
+             RHS->as_cptr<IntAST>()->getValue() >= 0 &&
+             RHS->as_cptr<IntAST>()->getValue() < 32;
+    }
+  }
+  case ExpressionAST::UnaryOperatorExpression: {
+    auto *UnaryOp = Expr->as_cptr<UnaryOperatorAST>();
+    const ExpressionAST *Operand = UnaryOp->getOperand();
+    if (!isSafe(Operand))
+      return false;
+    switch (UnaryOp->getOpKind()) {
+    case UnaryOperatorAST::Plus:
+    case UnaryOperatorAST::Minus:
+      return Operand->hasNumericType();
+    case UnaryOperatorAST::LogicalNot:
+      return true;
+    case UnaryOperatorAST::BitwiseNot:
+      return Operand->hasStaticType(cvm::IntType);
+    }
+  }
+  }
+  return false;
+}
+
+/// \brief Return true if running the body Stmt of a function can't fail. It
+/// may not loop, so it ends, and only calls functions already found safe, so
+/// it doesn't recurse.
+bool LoopOptimizer::isSafeBody(const StatementAST *Stmt) const {
+  if (!Stmt)
+    return true;
+
+  switch (Stmt->getKind()) {
+  default:
+    return false;
+  case StatementAST::BlockStatement:
+    for (const StatementAST *S : Stmt->as_cptr<BlockAST>()->getStatementList())
+      if (!isSafeBody(S))
+        return false;
+    return true;
+  case StatementAST::DeclarationStatement:
+    return isSafeDeclaration(Stmt->as_cptr<DeclarationAST>());
+  case StatementAST::DeclarationListStatement:
+    for (const DeclarationAST *Decl :
+         Stmt->as_cptr<DeclarationListAST>()->getDeclarationList())
+      if (!isSafeDeclaration(Decl))
+        return false;
+    return true;
+  case StatementAST::ExprStatement: {
+    const ExpressionAST *Expr =
+        Stmt->as_cptr<ExprStatementAST>()->getExpression();
+    if (IsBinaryOperator(Expr, BinaryOperatorAST::Assign)) {
+      auto *Assign = Expr->as_cptr<BinaryOperatorAST>();
+      return Assign->getLHS()->isIdentifierExpr() &&
+             isDeclared(Assign->getLHS()->as_cptr<IdentifierAST>()) &&
+             Assign->getAssignCoercion() != Coercion::Unchecked &&
+             isSafe(Assign->getRHS());
+    }
+    return isSafe(Expr);
+  }
+  case StatementAST::ReturnStatement: {
+    auto *Value = Stmt->as_cptr<ReturnStatementAST>()->getReturnValue();
+    return Value && isSafe(Value);
+  }
+  case StatementAST::IfStatement: {
+    auto *IfStmt = Stmt->as_cptr<IfStatementAST>();
+    return isSafe(IfStmt->getCondition()) &&
+           isSafeBody(IfStmt->getStatementThen()) &&
+           isSafeBody(IfStmt->getStatementElse());
+  }
+  }
+}
+
+bool LoopOptimizer::isSafeDeclaration(const DeclarationAST *Decl) const {
+  return !Decl->isArray() &&
+         (!Decl->getInitializer() ||
+          (Decl->getInitializerCoercion() != Coercion::Unchecked &&
+           isSafe(Decl->getInitializer())));
+}
+
+/// \brief Return true if IdExpr is sure to be declared wherever the loop
+/// being optimized is
+bool LoopOptimizer::isDeclared(const IdentifierAST *IdExpr) const {
+  return IdExpr->hasStaticType() && Globals.isDeclared(IdExpr, InBody);
+}
+
+/*===------------------------------- Helpers ------------------------------===*/
+
+/// \brief Return a read of the temporary Name of LoopBlock from Nesting
+/// blocks in the loop
+IdentifierAST *LoopOptimizer::makeRead(Symbol Name, int Slot,
+                                       cvm::BasicType Type) {
+  auto *IdExpr = Arena.create<IdentifierAST>(Name);
+  IdExpr->setBinding(Nesting, Slot, &LoopBlock->getLayout());
+  IdExpr->setStaticType(Type);
+  return IdExpr;
+}
+
+BinaryOperatorAST *
+LoopOptimizer::makeIntOperator(BinaryOperatorAST::OperatorKind OpKind,
+                               ExpressionAST *LHS, ExpressionAST *RHS) {
+  auto *BinOp = Arena.create<BinaryOperatorAST>(OpKind, LHS, RHS);
+  BinOp->setStaticType(cvm::IntType);
+  if (OpKind != BinaryOperatorAST::Assign)
+    BinOp->quicken(BinaryOperatorAST::getIntQuickKind(OpKind));
+  return BinOp;
+}
+
+Symbol LoopOptimizer::makeTemporaryName() {
+  return Symbol::intern(std::to_string(TempCount++) + "_loop");
+}
+
+DeclarationListAST *LoopOptimizer::makeDeclaration(Symbol Name, int Slot,
+                                                   ExpressionAST *Init) {
+  auto *Decl = Arena.create<DeclarationAST>(
+      Name, Init->getStaticType(), Init, ASTArray<ExpressionAST *>());
+  Decl->setSlot(Slot);
+  Decl->setInitializerCoercion(Coercion::Identity);
+  auto *List = Arena.create<DeclarationListAST>(Init->getStaticType());
+  List->setDeclarationList(Arena.copyArray(&Decl, 1));
+  return List;
+}
+
+void LoopOptimizer::shiftDepth(ExpressionAST *Expr, int By) {
+  switch (Expr->getKind()) {
+  default:
+    break;
+  case ExpressionAST::IdentifierExpression: {
+    auto *IdExpr = Expr->as_ptr<IdentifierAST>();
+    if (IdExpr->isResolved())
+      IdExpr->setBinding(IdExpr->getDepth() - By, IdExpr->getSlot(),
+                         IdExpr->getScope());
+    break;
+  }
+  case ExpressionAST::FunctionCallExpression:
+    for (ExpressionAST *Arg : Expr->as_ptr<FunctionCallAST>()->getArguments())
+      shiftDepth(Arg, By);
+    break;
+  case ExpressionAST::InfixOpExpression:
+    shiftDepth(Expr->as_ptr<InfixOpExprAST>()->getLHS(), By);
+    shiftDepth(Expr->as_ptr<InfixOpExprAST>()->getRHS(), By);
+    break;
+  case ExpressionAST::BinaryOperatorExpression:
+    shiftDepth(Expr->as_ptr<BinaryOperatorAST>()->getLHS(), By);
+    shiftDepth(Expr->as_ptr<BinaryOperatorAST>()->getRHS(), By);
+    break;
+  case ExpressionAST::UnaryOperatorExpression:
+    shiftDepth(Expr->as_ptr<UnaryOperatorAST>()->getOperand(), By);
+    break;
+  }
+}
+
+bool LoopOptimizer::hasContinue(const StatementAST *Stmt) {
+  if (!Stmt)
+    return false;
+  switch (Stmt->getKind()) {
+  default:
+    return false;
+  case StatementAST::ContinueStatement:
+    return true;
+  case StatementAST::BlockStatement:
+    for (const StatementAST *S : Stmt->as_cptr<BlockAST>()->getStatementList())
+      if (hasContinue(S))
+        return true;
+    return false;
+  case StatementAST::IfStatement:
+    return hasContinue(Stmt->as_cptr<IfStatementAST>()->getStatementThen()) ||
+           hasContinue(Stmt->as_cptr<IfStatementAST>()->getStatementElse());
+  }
+}
@@ -1,6 +1,6 @@
 #include "NativeFunctions.h"
 
-#include "CMMParser.h"
+#include "CycleCollector.h"
 
 #include <ctime>
 #include <cstdlib>
@@ -13,100 +13,196 @@
 
 namespace cvm {
 
-BasicValue
-Native::TypeOf(std::list<BasicValue, std::allocator<BasicValue>> &Args) {
+static std::map<std::string, NativeFunction> createNativeFunctionMap() {
+  std::map<std::string, NativeFunction> NativeFunctionMap;
+
+  NativeFunctionMap["typeof"] = Native::TypeOf;
+  NativeFunctionMap["len"] = Native::Length;
+  NativeFunctionMap["strlen"] = Native::StrLength;
+  NativeFunctionMap["print"] = Native::Print;
+  NativeFunctionMap["println"] = Native::PrintLn;
+  NativeFunctionMap["puts"] = Native::PrintLn;
+  NativeFunctionMap["system"] = Native::System;
+  NativeFunctionMap["random"] = Native::Random;
+  NativeFunctionMap["rand"] = Native::Random;
+  NativeFunctionMap["srand"] = Native::Srand;
+  NativeFunctionMap["time"] = Native::Time;
+  NativeFunctionMap["exit"] = Native::Exit;
+  NativeFunctionMap["gc"] = Native::CollectGarbage;
+  NativeFunctionMap["toint"] = Native::ToInt;
+  NativeFunctionMap["todouble"] = Native::ToDouble;
+  NativeFunctionMap["tostring"] = Native::ToString;
+  NativeFunctionMap["str"] = Native::ToString;
+  NativeFunctionMap["tobool"] = Native::ToBool;
+  NativeFunctionMap["read"] = Native::Read;
+  NativeFunctionMap["readln"] = Native::ReadLn;
+  NativeFunctionMap["readint"] = Native::ReadInt;
+  NativeFunctionMap["sqrt"] = Native::Sqrt;
+  NativeFunctionMap["pow"] = Native::Pow;
+  NativeFunctionMap["exp"] = Native::Exp;
+  NativeFunctionMap["log"] = Native::Log;
+  NativeFunctionMap["log10"] = Native::Log10;
+
+#if defined(__APPLE__) || defined(__linux__)
+  NativeFunctionMap["UnixFork"] = Unix::Fork;
+
+  NativeFunctionMap["NcEndWin"] = Ncurses::EndWindow;
+  NativeFunctionMap["NcInitScr"] = Ncurses::InitScreen;
+  NativeFunctionMap["NcNoEcho"] = Ncurses::NoEcho;
+  NativeFunctionMap["NcCursSet"] = Ncurses::CursSet;
+  NativeFunctionMap["NcKeypad"] = Ncurses::Keypad;
+  NativeFunctionMap["NcTimeout"] = Ncurses::Timeout;
+  NativeFunctionMap["NcGetCh"] = Ncurses::GetChar;
+  NativeFunctionMap["NcMvAddCh"] = Ncurses::MoveAddChar;
+  NativeFunctionMap["NcMvAddStr"] = Ncurses::MoveAddString;
+  NativeFunctionMap["NcGetMaxY"] = Ncurses::GetMaxY;
+  NativeFunctionMap["NcGetMaxX"] = Ncurses::GetMaxX;
+  NativeFunctionMap["NcStartColor"] = Ncurses::StartColor;
+  NativeFunctionMap["NcInitPair"] = Ncurses::InitPair;
+  NativeFunctionMap["NcAttrOn"] = Ncurses::AttrOn;
+  NativeFunctionMap["NcAttrOff"] = Ncurses::AttrOff;
+  NativeFunctionMap["NcColorPair"] = Ncurses::ColorPair;
+
+#endif // defined(__APPLE__) || defined(__linux__)
+  return NativeFunctionMap;
+}
+
+const std::map<std::string, NativeFunction> &getNativeFunctionMap() {
+  static const std::map<std::string, NativeFunction> NativeFunctionMap =
+      createNativeFunctionMap();
+  return NativeFunctionMap;
+}
+
+static std::map<NativeFunction, NativeTraits> createNativeTraitsMap() {
+  typedef NativeTraits T;
+  std::map<NativeFunction, NativeTraits> NativeTraitsMap;
+
+  NativeTraitsMap[Native::TypeOf] = {T::Inspect, true, StringType};
+  NativeTraitsMap[Native::Length] = {T::Inspect, true, IntType};
+  NativeTraitsMap[Native::StrLength] = {T::Inspect, true, IntType};
+  NativeTraitsMap[Native::ToBool] = {T::Inspect, true, BoolType};
+  NativeTraitsMap[Native::ToInt] = {T::ToNumber, true, IntType};
+  NativeTraitsMap[Native::ToDouble] = {T::ToNumber, true, DoubleType};
+  NativeTraitsMap[Native::Sqrt] = {T::ToNumber, true, DoubleType};
+  NativeTraitsMap[Native::Pow] = {T::ToNumber, true, DoubleType};
+  NativeTraitsMap[Native::Exp] = {T::ToNumber, true, DoubleType};
+  NativeTraitsMap[Native::Log] = {T::ToNumber, true, DoubleType};
+  NativeTraitsMap[Native::Log10] = {T::ToNumber, true, DoubleType};
+  NativeTraitsMap[Native::ToString] = {T::ToText, true, StringType};
+  NativeTraitsMap[Native::Read] = {T::Impure, true, StringType};
+  NativeTraitsMap[Native::ReadLn] = {T::Impure, true, StringType};
+  NativeTraitsMap[Native::ReadInt] = {T::Impure, true, IntType};
+  NativeTraitsMap[Native::Random] = {T::Impure, true, IntType};
+  NativeTraitsMap[Native::Time] = {T::Impure, true, IntType};
+
+  return NativeTraitsMap;
+}
+
+const NativeTraits &getNativeTraits(NativeFunction Function) {
+  static const std::map<NativeFunction, NativeTraits> NativeTraitsMap =
+      createNativeTraitsMap();
+  static const NativeTraits Untyped = {NativeTraits::Impure, false, VoidType};
+  auto It = NativeTraitsMap.find(Function);
+  return It == NativeTraitsMap.end() ? Untyped : It->second;
+}
+
+BasicValue Native::TypeOf(ArgumentList Args) {
   if (Args.empty())
     return std::string("Nil");
-  return TypeToStr(Args.front().Type);
+  return TypeToStr(Args.front().getType());
 }
 
-BasicValue
-Native::Length(std::list<BasicValue, std::allocator<BasicValue>> &Args) {
+BasicValue Native::Length(ArgumentList Args) {
   if (Args.empty())
     return 0;
   const BasicValue &Arg = Args.front();
   if (Arg.isArray())
-    return static_cast<int>(Arg.ArrayPtr->size());
+    return Arg.getArraySize();
   if (Arg.isString())
-    return static_cast<int>(Arg.StrVal.size());
+    return static_cast<int>(Arg.getString().size());
   return 0;
 }
 
-BasicValue Native::StrLength(std::list<BasicValue> &Args) {
+BasicValue Native::StrLength(ArgumentList Args) {
   if (Args.empty())
     return 0;
-  return static_cast<int>(Args.front().StrVal.size());
+  return static_cast<int>(Args.front().getString().size());
 }
 
-BasicValue Native::ReadInt(std::list<BasicValue> &/*Args*/) {
+BasicValue Native::ReadInt(ArgumentList /*Args*/) {
   int Res;
   std::cin >> Res;
   return Res;
 }
 
-BasicValue Native::ReadLn(std::list<BasicValue> &/*Args*/) {
+BasicValue Native::ReadLn(ArgumentList /*Args*/) {
   std::string Res;
   std::getline(std::cin, Res);
   return Res;
 }
 
-BasicValue Native::Read(std::list<BasicValue> &/*Args*/) {
+BasicValue Native::Read(ArgumentList /*Args*/) {
   std::string Res;
   std::cin >> Res;
   return Res;
 }
 
-BasicValue Native::ToInt(std::list<BasicValue> &Args) {
+BasicValue Native::ToInt(ArgumentList Args) {
   if (Args.size() != 1)
     return 0;
   return Args.front().toInt();
 }
 
-BasicValue Native::ToBool(std::list<BasicValue> &Args) {
+BasicValue Native::ToBool(ArgumentList Args) {
   if (Args.size() != 1)
     return false;
   return Args.front().toBool();
 }
 
-BasicValue Native::ToString(std::list<BasicValue> &Args) {
+BasicValue Native::ToString(ArgumentList Args) {
   if (Args.size() != 1)
     return std::string();
   return Args.front().toString();
 }
 
-BasicValue Native::ToDouble(std::list<BasicValue> &Args) {
+BasicValue Native::ToDouble(ArgumentList Args) {
   if (Args.size() != 1)
     return 0.0;
   return Args.front().toDouble();
 }
 
-BasicValue Native::Exit(std::list<BasicValue> &Args) {
+BasicValue Native::Exit(ArgumentList Args) {
   if (Args.empty())
     std::exit(EXIT_SUCCESS);
   std::exit(Args.front().toInt());
 }
 
-BasicValue Native::Print(std::list<BasicValue> &Args) {
+/// Collect unreachable array cycles now; return the bytes freed.
+BasicValue Native::CollectGarbage(ArgumentList /*Args*/) {
+  return static_cast<int>(collectCycles());
+}
+
+BasicValue Native::Print(ArgumentList Args) {
   for (auto &Arg : Args) {
     std::cout << Arg.toString() << " ";
   }
   return BasicValue();
 }
 
-BasicValue Native::PrintLn(std::list<BasicValue> &Args) {
+BasicValue Native::PrintLn(ArgumentList Args) {
   Native::Print(Args);
   std::cout << "\n";
   return BasicValue();
 }
 
-BasicValue Native::System(std::list<BasicValue> &Args) {
+BasicValue Native::System(ArgumentList Args) {
   for (auto &Arg : Args) {
     std::system(Arg.toString().c_str());
   }
   return BasicValue();
 }
 
-BasicValue Native::Random(std::list<BasicValue> &Args) {
+BasicValue Native::Random(ArgumentList Args) {
   if (Args.empty())
     return std::rand();
 
@@ -117,41 +213,41 @@ BasicValue Native::Random(std::list<BasicValue> &Args) {
   return std::rand() % (High - Low) + Low;
 }
 
-BasicValue Native::Srand(std::list<BasicValue> &Args) {
-  int Seed = (Args.empty() || !Args.front().isInt()) ? 0 : Args.front().IntVal;
+BasicValue Native::Srand(ArgumentList Args) {
+  int Seed = (Args.empty() || !Args.front().isInt()) ? 0 : Args.front().getInt();
   std::srand(static_cast<unsigned int>(Seed));
   return BasicValue();
 }
 
-BasicValue Native::Time(std::list<BasicValue> &/*Args*/) {
+BasicValue Native::Time(ArgumentList /*Args*/) {
   return static_cast<int>(std::time(nullptr));
 }
 
-BasicValue Native::Sqrt(std::list<BasicValue> &Args) {
+BasicValue Native::Sqrt(ArgumentList Args) {
   if (Args.empty())
     return 0.0;
   return std::sqrt(Args.front().toDouble());
 }
 
-BasicValue Native::Pow(std::list<BasicValue> &Args) {
+BasicValue Native::Pow(ArgumentList Args) {
   if (Args.size() != 2)
     return 0.0;
   return std::pow(Args.front().toDouble(), Args.back().toDouble());
 }
 
-BasicValue Native::Exp(std::list<BasicValue> &Args) {
+BasicValue Native::Exp(ArgumentList Args) {
   if (Args.empty())
     return 0.0;
   return std::exp(Args.front().toDouble());
 }
 
-BasicValue Native::Log(std::list<BasicValue> &Args) {
+BasicValue Native::Log(ArgumentList Args) {
   if (Args.empty())
     return 0.0;
   return std::log(Args.front().toDouble());
 }
 
-BasicValue Native::Log10(std::list<BasicValue> &Args) {
+BasicValue Native::Log10(ArgumentList Args) {
   if (Args.empty())
     return 0.0;
   return std::log10(Args.front().toDouble());
@@ -159,45 +255,45 @@ BasicValue Native::Log10(std::list<BasicValue> &Args) {
 
 #if defined(__APPLE__) || defined(__linux__)
 
-BasicValue Unix::Fork(std::list<BasicValue> &/*Args*/) {
+BasicValue Unix::Fork(ArgumentList /*Args*/) {
   return ::fork();
 }
 
-BasicValue Ncurses::GetMaxY(std::list<BasicValue> &/*Args*/) {
+BasicValue Ncurses::GetMaxY(ArgumentList /*Args*/) {
   return getmaxy(stdscr);
 }
 
-BasicValue Ncurses::GetMaxX(std::list<BasicValue> &/*Args*/) {
+BasicValue Ncurses::GetMaxX(ArgumentList /*Args*/) {
   return getmaxx(stdscr);
 }
 
-BasicValue Ncurses::InitScreen(std::list<BasicValue> &/*Args*/) {
+BasicValue Ncurses::InitScreen(ArgumentList /*Args*/) {
   ::initscr();
   return BasicValue();
 }
 
-BasicValue Ncurses::NoEcho(std::list<BasicValue> &/*Args*/) {
+BasicValue Ncurses::NoEcho(ArgumentList /*Args*/) {
   return ::noecho();
 }
 
-BasicValue Ncurses::CursSet(std::list<BasicValue> &Args) {
+BasicValue Ncurses::CursSet(ArgumentList Args) {
   return ::curs_set(Args.empty() ? false : Args.front().toBool());
 }
 
-BasicValue Ncurses::Keypad(std::list<BasicValue> &Args) {
+BasicValue Ncurses::Keypad(ArgumentList Args) {
   return ::keypad(::stdscr, Args.empty() ? false : Args.front().toBool());
 }
 
-BasicValue Ncurses::Timeout(std::list<BasicValue> &Args) {
+BasicValue Ncurses::Timeout(ArgumentList Args) {
   ::timeout(Args.empty() ? -1 : Args.front().toInt());
   return BasicValue();
 }
 
-BasicValue Ncurses::GetChar(std::list<BasicValue> &/*Args*/) {
+BasicValue Ncurses::GetChar(ArgumentList /*Args*/) {
   return ::wgetch(stdscr);
 }
 
-BasicValue Ncurses::MoveAddChar(std::list<BasicValue> &Args) {
+BasicValue Ncurses::MoveAddChar(ArgumentList Args) {
   if (Args.size() != 3)
     return BasicValue();
 
@@ -207,11 +303,11 @@ BasicValue Ncurses::MoveAddChar(std::list<BasicValue> &Args) {
   ++Iterator;
   int X = Iterator->toInt();
 
-  char C = static_cast<char>(Args.back().IntVal);
+  char C = static_cast<char>(Args.back().getInt());
   return mvaddch(Y, X, C);
 }
 
-BasicValue Ncurses::MoveAddString(std::list<BasicValue> &Args) {
+BasicValue Ncurses::MoveAddString(ArgumentList Args) {
   if (Args.size() != 3)
     return BasicValue();
 
@@ -221,15 +317,15 @@ BasicValue Ncurses::MoveAddString(std::list<BasicValue> &Args) {
   ++Iterator;
   int X = Iterator->toInt();
 
-  const char *S = Args.back().StrVal.c_str();
+  const char *S = Args.back().getString().c_str();
   return mvaddstr(Y, X, S);
 }
 
-BasicValue Ncurses::EndWindow(std::list<BasicValue> &/*Args*/) {
+BasicValue Ncurses::EndWindow(ArgumentList /*Args*/) {
   return ::endwin();
 }
 
-BasicValue Ncurses::InitPair(std::list<BasicValue> &Args) {
+BasicValue Ncurses::InitPair(ArgumentList Args) {
   if (Args.size() != 3)
     return ERR;
 
@@ -243,23 +339,23 @@ BasicValue Ncurses::InitPair(std::list<BasicValue> &Args) {
   return ::init_pair(PairNo, FgColor, BgColor);
 }
 
-BasicValue Ncurses::StartColor(std::list<BasicValue> &/*Args*/) {
+BasicValue Ncurses::StartColor(ArgumentList /*Args*/) {
   return ::start_color();
 }
 
-BasicValue Ncurses::AttrOn(std::list<BasicValue> &Args) {
+BasicValue Ncurses::AttrOn(ArgumentList Args) {
   if (Args.empty())
     return ERR;
   return attron(Args.front().toInt());
 }
 
-BasicValue Ncurses::AttrOff(std::list<BasicValue> &Args) {
+BasicValue Ncurses::AttrOff(ArgumentList Args) {
   if (Args.empty())
     return ERR;
   return attroff(Args.front().toInt());
 }
 
-BasicValue Ncurses::ColorPair(std::list<BasicValue> &Args) {
+BasicValue Ncurses::ColorPair(ArgumentList Args) {
   if (Args.empty())
     return 0;
   return static_cast<int>(COLOR_PAIR(Args.front().toInt()));
@@ -0,0 +1,167 @@
+#include "Profiler.h"
+#include "NativeFunctions.h"
+#include <algorithm>
+#include <cstdio>
+
+using namespace cmm;
+
+Profiler::Profiler() : Last(Clock::now()) {
+  addEntry(TopLevel, "<top level>");
+  Entries[0].Calls = 1;
+  Entries[0].Active = 1;
+  Nodes.push_back(StackNode{0, 0, Clock::duration::zero(), {}});
+  Stack.push_back(Frame{0, Last});
+}
+
+unsigned Profiler::addEntry(EntryKind Kind, const std::string &Name) {
+  Entries.push_back(Entry{Kind, Name, 0, Clock::duration::zero(),
+                          Clock::duration::zero(), 0});
+  return static_cast<unsigned>(Entries.size() - 1);
+}
+
+void Profiler::enterFunction(const FunctionDefinitionAST &Function) {
+  auto It = DefinitionEntries.find(&Function);
+  if (It == DefinitionEntries.end()) {
+    It = DefinitionEntries.emplace(
+        &Function, addEntry(UserFunction, Function.getName().str())).first;
+  }
+  enter(It->second);
+}
+
+void Profiler::enterInfixOp(const InfixOpDefinitionAST &InfixOp) {
+  auto It = DefinitionEntries.find(&InfixOp);
+  if (It == DefinitionEntries.end()) {
+    It = DefinitionEntries.emplace(
+        &InfixOp, addEntry(InfixOperator, InfixOp.getSymbol().str())).first;
+  }
+  enter(It->second);
+}
+
+void Profiler::enterNative(cvm::NativeFunction Native) {
+  auto It = NativeEntries.find(Native);
+  if (It == NativeEntries.end()) {
+    // Natives are only known by address; find the name they are bound to.
+    std::string Name = "<native>";
+    for (auto &N : cvm::getNativeFunctionMap()) {
+      if (N.second == Native) {
+        Name = N.first;
+        break;
+      }
+    }
+    It = NativeEntries.emplace(Native, addEntry(NativeFunction, Name)).first;
+  }
+  enter(It->second);
+}
+
+/// \brief Charge the time since the last event to the callee on top
+void Profiler::charge(Clock::time_point Now) {
+  StackNode &Node = Nodes[Stack.back().Node];
+  Node.Self += Now - Last;
+  Entries[Node.Entry].Exclusive += Now - Last;
+  Last = Now;
+}
+
+void Profiler::enter(unsigned EntryIndex) {
+  Clock::time_point Now = Clock::now();
+  charge(Now);
+
+  unsigned Parent = Stack.back().Node;
+  auto It = Nodes[Parent].Children.find(EntryIndex);
+  if (It == Nodes[Parent].Children.end()) {
+    Nodes.push_back(StackNode{Parent, EntryIndex, Clock::duration::zero(), {}});
+    It = Nodes[Parent].Children.emplace(
+        EntryIndex, static_cast<unsigned>(Nodes.size() - 1)).first;
+  }
+
+  Entry &E = Entries[EntryIndex];
+  ++E.Calls;
+  ++E.Active;
+  Stack.push_back(Frame{It->second, Now});
+}
+
+void Profiler::leave() {
+  if (Stack.empty())
+    return;
+
+  Clock::time_point Now = Clock::now();
+  charge(Now);
+  Frame F = Stack.back();
+  Stack.pop_back();
+  Entry &E = Entries[Nodes[F.Node].Entry];
+  if (--E.Active == 0)
+    E.Inclusive += Now - F.Start;
+}
+
+void Profiler::finish() {
+  while (!Stack.empty())
+    leave();
+}
+
+std::string Profiler::getFrameName(const Entry &E) const {
+  switch (E.Kind) {
+  case TopLevel:
+  case UserFunction:
+    return E.Name;
+  case NativeFunction:
+    return E.Name + " [native]";
+  case InfixOperator:
+    return "infix " + E.Name;
+  }
+  return E.Name;
+}
+
+static double ToMilliseconds(std::chrono::steady_clock::duration D) {
+  return std::chrono::duration<double, std::milli>(D).count();
+}
+
+void Profiler::printSummary(std::ostream &OS) const {
+  std::vector<const Entry *> Sorted;
+  Clock::duration Total = Clock::duration::zero();
+  for (const Entry &E : Entries) {
+    Sorted.push_back(&E);
+    Total += E.Exclusive;
+  }
+  std::stable_sort(Sorted.begin(), Sorted.end(),
+                   [](const Entry *L, const Entry *R) {
+                     return L->Exclusive > R->Exclusive;
+                   });
+
+  char Line[128];
+  OS << "CMM profile (wall time)\n";
+  std::snprintf(Line, sizeof(Line), "%7s %12s %12s %12s  %s\n", "% self",
+                "self ms", "total ms", "calls", "name");
+  OS << Line;
+  for (const Entry *E : Sorted) {
+    double Percent = Total.count() ? 100.0 * E->Exclusive.count() /
+        Total.count() : 0.0;
+    std::snprintf(Line, sizeof(Line), "%7.2f %12.3f %12.3f %12llu  ",
+                  Percent, ToMilliseconds(E->Exclusive),
+                  ToMilliseconds(E->Inclusive),
+                  static_cast<unsigned long long>(E->Calls));
+    OS << Line << getFrameName(*E) << "\n";
+  }
+}
+
+/// \brief Print one line per distinct call stack: the frames from the top
+/// level down separated by semicolons, then the exclusive time in microseconds
+void Profiler::printFoldedStacks(std::ostream &OS) const {
+  for (size_t I = 0; I < Nodes.size(); ++I) {
+    long long Micros = std::chrono::duration_cast<std::chrono::microseconds>(
+        Nodes[I].Self).count();
+    if (Micros <= 0)
+      continue;
+
+    std::vector<unsigned> Path;
+    for (unsigned N = static_cast<unsigned>(I); N != 0; N = Nodes[N].Parent)
+      Path.push_back(N);
+    Path.push_back(0);
+
+    std::string Line;
+    for (auto It = Path.rbegin(); It != Path.rend(); ++It) {
+      if (It != Path.rbegin())
+        Line += ';';
+      Line += getFrameName(Entries[Nodes[*It].Entry]);
+    }
+    OS << Line << " " << Micros << "\n";
+  }
+}
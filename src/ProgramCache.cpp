@@ -0,0 +1,708 @@
+#include "ProgramCache.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+
+#if defined(__APPLE__) || defined(__linux__)
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif // defined(__APPLE__) || defined(__linux__)
+
+using namespace cmm;
+
+/*===----------------------------- File layout ----------------------------===*/
+//
+// Header:  "CMMC", u32 FormatVersion, u64 SourceHash, u64 SourceSize,
+//          u64 PayloadSize, u64 PayloadHash
+// Payload: u32 N, N * (Str Name, Type, u32 M, M * (Str, Type, u64 Loc), Stmt)
+//          u32 N, N * (Str Symbol, Str LHSName, Str RHSName, Stmt)
+//          u32 N, N * Stmt                                (top level block)
+//
+// Every node starts with its kind as one byte, NoNode for a null pointer, and
+// is followed by its operands. Integers are little endian on the machines
+// that have mmap, which are the only ones that keep a cache.
+
+namespace {
+const char Magic[4] = {'C', 'M', 'M', 'C'};
+const size_t HeaderSize = 4 + 4 + 8 + 8 + 8 + 8;
+const uint8_t NoNode = 0xFF;
+
+/// \brief MurmurHash64A of Size bytes at Data
+uint64_t Hash(const char *Data, size_t Size, uint64_t Seed) {
+  const uint64_t M = 0xc6a4a7935bd1e995ULL;
+  const int R = 47;
+  uint64_t H = Seed ^ (Size * M);
+
+  const char *End = Data + (Size & ~static_cast<size_t>(7));
+  for (; Data != End; Data += 8) {
+    uint64_t K;
+    std::memcpy(&K, Data, 8);
+    K *= M;
+    K ^= K >> R;
+    K *= M;
+    H ^= K;
+    H *= M;
+  }
+
+  switch (Size & 7) {
+  case 7:
+    H ^= uint64_t(static_cast<uint8_t>(Data[6])) << 48;
+    // fallthrough
+  case 6:
+    H ^= uint64_t(static_cast<uint8_t>(Data[5])) << 40;
+    // fallthrough
+  case 5:
+    H ^= uint64_t(static_cast<uint8_t>(Data[4])) << 32;
+    // fallthrough
+  case 4:
+    H ^= uint64_t(static_cast<uint8_t>(Data[3])) << 24;
+    // fallthrough
+  case 3:
+    H ^= uint64_t(static_cast<uint8_t>(Data[2])) << 16;
+    // fallthrough
+  case 2:
+    H ^= uint64_t(static_cast<uint8_t>(Data[1])) << 8;
+    // fallthrough
+  case 1:
+    H ^= uint64_t(static_cast<uint8_t>(Data[0]));
+    H *= M;
+  }
+
+  H ^= H >> R;
+  H *= M;
+  H ^= H >> R;
+  return H;
+}
+
+/// \brief Return the directory cache files go to, or "" if there is none
+std::string GetCacheDirectory() {
+#if defined(__APPLE__) || defined(__linux__)
+  if (const char *Dir = std::getenv("CMM_CACHE_DIR"))
+    return Dir;
+  if (const char *Dir = std::getenv("XDG_CACHE_HOME"))
+    return std::string(Dir) + "/cmm";
+  if (const char *Home = std::getenv("HOME"))
+    return std::string(Home) + "/.cache/cmm";
+#endif // defined(__APPLE__) || defined(__linux__)
+  return "";
+}
+
+/// \brief Create Dir and its missing parents, return false on failure
+bool MakeDirectories(const std::string &Dir) {
+#if defined(__APPLE__) || defined(__linux__)
+  for (size_t Slash = Dir.find('/', 1); ; Slash = Dir.find('/', Slash + 1)) {
+    std::string Prefix = Dir.substr(0, Slash);
+    if (mkdir(Prefix.c_str(), 0755) != 0 && errno != EEXIST)
+      return false;
+    if (Slash == std::string::npos)
+      return true;
+  }
+#else
+  (void)Dir;
+  return false;
+#endif // defined(__APPLE__) || defined(__linux__)
+}
+
+/// \brief Read-only mapping of a cache file.
+class MappedFile {
+  void *Base;
+  size_t Size;
+
+public:
+  MappedFile(const std::string &Path) : Base(nullptr), Size(0) {
+#if defined(__APPLE__) || defined(__linux__)
+    int FD = open(Path.c_str(), O_RDONLY);
+    if (FD < 0)
+      return;
+    struct stat Status;
+    if (fstat(FD, &Status) == 0 && S_ISREG(Status.st_mode) &&
+        Status.st_size > 0) {
+      void *P = mmap(nullptr, static_cast<size_t>(Status.st_size), PROT_READ,
+                     MAP_PRIVATE, FD, 0);
+      if (P != MAP_FAILED) {
+        Base = P;
+        Size = static_cast<size_t>(Status.st_size);
+      }
+    }
+    close(FD);
+#else
+    (void)Path;
+#endif // defined(__APPLE__) || defined(__linux__)
+  }
+  MappedFile(const MappedFile &) = delete;
+  MappedFile &operator=(const MappedFile &) = delete;
+  ~MappedFile() {
+#if defined(__APPLE__) || defined(__linux__)
+    if (Base)
+      munmap(Base, Size);
+#endif // defined(__APPLE__) || defined(__linux__)
+  }
+
+  const char *getStart() const { return static_cast<const char *>(Base); }
+  size_t getSize() const { return Size; }
+};
+
+/*===---------------------------- Serialization ---------------------------===*/
+
+class ProgramWriter {
+  std::string &Out;
+
+public:
+  ProgramWriter(std::string &Out) : Out(Out) {}
+
+  void write8(uint8_t V) { Out.push_back(static_cast<char>(V)); }
+  void write32(uint32_t V) { Out.append(reinterpret_cast<char *>(&V), 4); }
+  void write64(uint64_t V) { Out.append(reinterpret_cast<char *>(&V), 8); }
+  void writeString(const std::string &S) {
+    write32(static_cast<uint32_t>(S.size()));
+    Out.append(S);
+  }
+  void writeSymbol(Symbol S) { writeString(S.str()); }
+
+  void writeFunction(const FunctionDefinitionAST &Function);
+  void writeInfixOp(const InfixOpDefinitionAST &InfixOp);
+  void writeStatementList(const ASTArray<StatementAST *> &List);
+  void writeStatement(const StatementAST *Stmt);
+  void writeExpression(const ExpressionAST *Expr);
+};
+
+void ProgramWriter::writeFunction(const FunctionDefinitionAST &Function) {
+  writeSymbol(Function.getName());
+  write8(Function.getType());
+  write32(static_cast<uint32_t>(Function.getParameterCount()));
+  for (const Parameter &Param : Function.getParameterList()) {
+    writeSymbol(Param.getName());
+    write8(Param.getType());
+    write64(Param.getLoc());
+  }
+  writeStatement(Function.getStatement());
+}
+
+void ProgramWriter::writeInfixOp(const InfixOpDefinitionAST &InfixOp) {
+  writeSymbol(InfixOp.getSymbol());
+  writeSymbol(InfixOp.getLHSName());
+  writeSymbol(InfixOp.getRHSName());
+  writeStatement(InfixOp.getStatement());
+}
+
+void ProgramWriter::writeStatementList(const ASTArray<StatementAST *> &List) {
+  write32(static_cast<uint32_t>(List.size()));
+  for (const StatementAST *S : List)
+    writeStatement(S);
+}
+
+void ProgramWriter::writeStatement(const StatementAST *Stmt) {
+  if (!Stmt) {
+    write8(NoNode);
+    return;
+  }
+
+  write8(Stmt->getKind());
+  switch (Stmt->getKind()) {
+  case StatementAST::ExprStatement:
+    writeExpression(Stmt->as_cptr<ExprStatementAST>()->getExpression());
+    break;
+  case StatementAST::BlockStatement:
+    writeStatementList(Stmt->as_cptr<BlockAST>()->getStatementList());
+    break;
+  case StatementAST::IfStatement: {
+    auto *IfStmt = Stmt->as_cptr<IfStatementAST>();
+    writeExpression(IfStmt->getCondition());
+    writeStatement(IfStmt->getStatementThen());
+    writeStatement(IfStmt->getStatementElse());
+    break;
+  }
+  case StatementAST::WhileStatement: {
+    auto *WhileStmt = Stmt->as_cptr<WhileStatementAST>();
+    writeExpression(WhileStmt->getCondition());
+    writeStatement(WhileStmt->getStatement());
+    break;
+  }
+  case StatementAST::ForStatement: {
+    auto *ForStmt = Stmt->as_cptr<ForStatementAST>();
+    writeExpression(ForStmt->getInit());
+    writeExpression(ForStmt->getCondition());
+    writeExpression(ForStmt->getPost());
+    writeStatement(ForStmt->getStatement());
+    break;
+  }
+  case StatementAST::ReturnStatement: {
+    auto *Return = Stmt->as_cptr<ReturnStatementAST>();
+    write64(Return->getLoc());
+    writeExpression(Return->getReturnValue());
+    break;
+  }
+  case StatementAST::ContinueStatement:
+  case StatementAST::BreakStatement:
+    break;
+  case StatementAST::DeclarationStatement: {
+    auto *Decl = Stmt->as_cptr<DeclarationAST>();
+    writeSymbol(Decl->getName());
+    write8(Decl->getType());
+    write64(Decl->getLoc());
+    writeExpression(Decl->getInitializer());
+    write32(static_cast<uint32_t>(Decl->getElementCountList().size()));
+    for (const ExpressionAST *E : Decl->getElementCountList())
+      writeExpression(E);
+    break;
+  }
+  case StatementAST::DeclarationListStatement: {
+    auto &List = Stmt->as_cptr<DeclarationListAST>()->getDeclarationList();
+    write32(static_cast<uint32_t>(List.size()));
+    for (const DeclarationAST *D : List)
+      writeStatement(D);
+    break;
+  }
+  }
+}
+
+void ProgramWriter::writeExpression(const ExpressionAST *Expr) {
+  if (!Expr) {
+    write8(NoNode);
+    return;
+  }
+
+  write8(Expr->getKind());
+  switch (Expr->getKind()) {
+  case ExpressionAST::IntExpression:
+    write32(static_cast<uint32_t>(Expr->as_cptr<IntAST>()->getValue()));
+    break;
+  case ExpressionAST::DoubleExpression: {
+    double V = Expr->as_cptr<DoubleAST>()->getValue();
+    uint64_t Bits;
+    std::memcpy(&Bits, &V, 8);
+    write64(Bits);
+    break;
+  }
+  case ExpressionAST::BoolExpression:
+    write8(Expr->as_cptr<BoolAST>()->getValue());
+    break;
+  case ExpressionAST::StringExpression:
+    writeString(Expr->as_cptr<StringAST>()->getValue());
+    break;
+  case ExpressionAST::IdentifierExpression:
+    writeSymbol(Expr->as_cptr<IdentifierAST>()->getName());
+    break;
+  case ExpressionAST::FunctionCallExpression: {
+    auto *FuncCall = Expr->as_cptr<FunctionCallAST>();
+    writeSymbol(FuncCall->getCallee());
+    write8(FuncCall->isDynamicBound());
+    write64(FuncCall->getLoc());
+    write32(static_cast<uint32_t>(FuncCall->getArguments().size()));
+    for (const ExpressionAST *Arg : FuncCall->getArguments())
+      writeExpression(Arg);
+    break;
+  }
+  case ExpressionAST::InfixOpExpression: {
+    auto *InfixOp = Expr->as_cptr<InfixOpExprAST>();
+    writeSymbol(InfixOp->getSymbol());
+    writeExpression(InfixOp->getLHS());
+    writeExpression(InfixOp->getRHS());
+    break;
+  }
+  case ExpressionAST::BinaryOperatorExpression: {
+    auto *BinOp = Expr->as_cptr<BinaryOperatorAST>();
+    write8(BinOp->getOpKind());
+    write64(BinOp->getLoc());
+    writeExpression(BinOp->getLHS());
+    writeExpression(BinOp->getRHS());
+    break;
+  }
+  case ExpressionAST::UnaryOperatorExpression: {
+    auto *UnaryOp = Expr->as_cptr<UnaryOperatorAST>();
+    write8(UnaryOp->getOpKind());
+    write64(UnaryOp->getLoc());
+    writeExpression(UnaryOp->getOperand());
+    break;
+  }
+  }
+}
+
+/*===--------------------------- Deserialization --------------------------===*/
+
+/// \brief Rebuild a program from the payload of a cache file.
+/// A truncated or corrupt payload sets Failed; reads then return zeros and
+/// nodes null until the caller gives up.
+class ProgramReader {
+  const char *Cur;
+  const char *End;
+  ASTArena &Arena;
+  BlockAST *CurrentBlock;
+  /// Children of the nodes being read, as in the parser.
+  std::vector<StatementAST *> PendingStatements;
+  std::vector<ExpressionAST *> PendingExpressions;
+  std::vector<DeclarationAST *> PendingDeclarations;
+  bool Failed;
+
+  template <typename T>
+  ASTArray<T *> takePending(std::vector<T *> &Pending, size_t Mark) {
+    ASTArray<T *> Res = Arena.copyArray(Pending.data() + Mark,
+                                        Pending.size() - Mark);
+    Pending.resize(Mark);
+    return Res;
+  }
+
+  bool fail() {
+    Failed = true;
+    Cur = End;
+    return false;
+  }
+
+public:
+  ProgramReader(const char *Start, const char *End, ASTArena &Arena,
+                BlockAST &TopLevelBlock)
+      : Cur(Start), End(End), Arena(Arena), CurrentBlock(&TopLevelBlock),
+        Failed(false) {}
+
+  bool hasFailed() const { return Failed; }
+  bool atEnd() const { return Cur == End; }
+
+  void read(void *Dest, size_t Size) {
+    if (static_cast<size_t>(End - Cur) < Size) {
+      fail();
+      std::memset(Dest, 0, Size);
+      return;
+    }
+    std::memcpy(Dest, Cur, Size);
+    Cur += Size;
+  }
+  uint8_t read8() { uint8_t V; read(&V, 1); return V; }
+  uint32_t read32() { uint32_t V; read(&V, 4); return V; }
+  uint64_t read64() { uint64_t V; read(&V, 8); return V; }
+  std::string readString();
+  Symbol readSymbol() { return Symbol::intern(readString()); }
+  cvm::BasicType readType();
+  /// Read the length of a list, each element of which takes a byte at least.
+  uint32_t readCount();
+
+  bool readFunction(FunctionDefinitionAST &Function);
+  bool readInfixOp(InfixOpDefinitionAST &InfixOp);
+  ASTArray<StatementAST *> readStatementList();
+  StatementAST *readStatement();
+  ExpressionAST *readExpression();
+};
+
+std::string ProgramReader::readString() {
+  uint32_t Size = read32();
+  if (static_cast<size_t>(End - Cur) < Size) {
+    fail();
+    return "";
+  }
+  std::string S(Cur, Size);
+  Cur += Size;
+  return S;
+}
+
+cvm::BasicType ProgramReader::readType() {
+  uint8_t Type = read8();
+  if (Type > cvm::VoidType) {
+    fail();
+    return cvm::VoidType;
+  }
+  return static_cast<cvm::BasicType>(Type);
+}
+
+uint32_t ProgramReader::readCount() {
+  uint32_t Count = read32();
+  if (Count > static_cast<size_t>(End - Cur)) {
+    fail();
+    return 0;
+  }
+  return Count;
+}
+
+bool ProgramReader::readFunction(FunctionDefinitionAST &Function) {
+  Symbol Name = readSymbol();
+  cvm::BasicType Type = readType();
+  std::vector<Parameter> ParameterList;
+  for (uint32_t Count = readCount(); Count; --Count) {
+    Symbol ParamName = readSymbol();
+    cvm::BasicType ParamType = readType();
+    ParameterList.emplace_back(ParamName, ParamType, read64());
+  }
+  StatementAST *Statement = readStatement();
+  Function = FunctionDefinitionAST(Name, Type, std::move(ParameterList),
+                                   Statement);
+  return !Failed;
+}
+
+bool ProgramReader::readInfixOp(InfixOpDefinitionAST &InfixOp) {
+  Symbol Sym = readSymbol();
+  Symbol LHS = readSymbol();
+  Symbol RHS = readSymbol();
+  InfixOp = InfixOpDefinitionAST(Sym, LHS, RHS, readStatement());
+  return !Failed;
+}
+
+ASTArray<StatementAST *> ProgramReader::readStatementList() {
+  size_t Mark = PendingStatements.size();
+  for (uint32_t Count = readCount(); Count; --Count) {
+    if (StatementAST *S = readStatement())
+      PendingStatements.push_back(S);
+  }
+  return takePending(PendingStatements, Mark);
+}
+
+StatementAST *ProgramReader::readStatement() {
+  uint8_t Kind = read8();
+  if (Failed || Kind == NoNode)
+    return nullptr;
+
+  switch (Kind) {
+  default:
+    fail();
+    return nullptr;
+  case StatementAST::ExprStatement:
+    return Arena.create<ExprStatementAST>(readExpression());
+  case StatementAST::BlockStatement: {
+    BlockAST *Block = Arena.create<BlockAST>(CurrentBlock);
+    CurrentBlock = Block;
+    Block->setStatementList(readStatementList());
+    CurrentBlock = Block->getOuterBlock();
+    return Block;
+  }
+  case StatementAST::IfStatement: {
+    ExpressionAST *Condition = readExpression();
+    StatementAST *Then = readStatement();
+    StatementAST *Else = readStatement();
+    return Arena.create<IfStatementAST>(Condition, Then, Else);
+  }
+  case StatementAST::WhileStatement: {
+    ExpressionAST *Condition = readExpression();
+    return Arena.create<WhileStatementAST>(Condition, readStatement());
+  }
+  case StatementAST::ForStatement: {
+    ExpressionAST *Init = readExpression();
+    ExpressionAST *Condition = readExpression();
+    ExpressionAST *Post = readExpression();
+    return Arena.create<ForStatementAST>(Init, Condition, Post,
+                                         readStatement());
+  }
+  case StatementAST::ReturnStatement: {
+    CMMLexer::LocTy Loc = read64();
+    return Arena.create<ReturnStatementAST>(readExpression(), Loc);
+  }
+  case StatementAST::ContinueStatement:
+    return Arena.create<ContinueStatementAST>();
+  case StatementAST::BreakStatement:
+    return Arena.create<BreakStatementAST>();
+  case StatementAST::DeclarationStatement: {
+    Symbol Name = readSymbol();
+    cvm::BasicType Type = readType();
+    CMMLexer::LocTy Loc = read64();
+    ExpressionAST *Initializer = readExpression();
+    size_t Mark = PendingExpressions.size();
+    for (uint32_t Count = readCount(); Count; --Count)
+      PendingExpressions.push_back(readExpression());
+    return Arena.create<DeclarationAST>(
+        Name, Type, Initializer, takePending(PendingExpressions, Mark), Loc);
+  }
+  case StatementAST::DeclarationListStatement: {
+    // Only declarations of one type are ever listed together.
+    size_t Mark = PendingDeclarations.size();
+    for (uint32_t Count = readCount(); Count; --Count) {
+      StatementAST *S = readStatement();
+      if (!S || S->getKind() != StatementAST::DeclarationStatement) {
+        fail();
+        break;
+      }
+      PendingDeclarations.push_back(S->as_ptr<DeclarationAST>());
+    }
+    if (Failed || PendingDeclarations.size() == Mark) {
+      PendingDeclarations.resize(Mark);
+      fail();
+      return nullptr;
+    }
+    auto *List = Arena.create<DeclarationListAST>(
+        PendingDeclarations[Mark]->getType());
+    List->setDeclarationList(takePending(PendingDeclarations, Mark));
+    return List;
+  }
+  }
+}
+
+ExpressionAST *ProgramReader::readExpression() {
+  uint8_t Kind = read8();
+  if (Failed || Kind == NoNode)
+    return nullptr;
+
+  switch (Kind) {
+  default:
+    fail();
+    return nullptr;
+  case ExpressionAST::IntExpression:
+    return Arena.create<IntAST>(static_cast<int>(read32()));
+  case ExpressionAST::DoubleExpression: {
+    uint64_t Bits = read64();
+    double V;
+    std::memcpy(&V, &Bits, 8);
+    return Arena.create<DoubleAST>(V);
+  }
+  case ExpressionAST::BoolExpression:
+    return Arena.create<BoolAST>(read8() != 0);
+  case ExpressionAST::StringExpression:
+    return Arena.create<StringAST>(readString());
+  case ExpressionAST::IdentifierExpression:
+    return Arena.create<IdentifierAST>(readSymbol());
+  case ExpressionAST::FunctionCallExpression: {
+    Symbol Callee = readSymbol();
+    bool DynamicBound = read8() != 0;
+    CMMLexer::LocTy Loc = read64();
+    size_t Mark = PendingExpressions.size();
+    for (uint32_t Count = readCount(); Count; --Count)
+      PendingExpressions.push_back(readExpression());
+    return Arena.create<FunctionCallAST>(
+        Callee, takePending(PendingExpressions, Mark), DynamicBound, Loc);
+  }
+  case ExpressionAST::InfixOpExpression: {
+    Symbol Sym = readSymbol();
+    ExpressionAST *LHS = readExpression();
+    ExpressionAST *RHS = readExpression();
+    return Arena.create<InfixOpExprAST>(Sym, LHS, RHS);
+  }
+  case ExpressionAST::BinaryOperatorExpression: {
+    uint8_t OpKind = read8();
+    if (OpKind > BinaryOperatorAST::Index) {
+      fail();
+      return nullptr;
+    }
+    CMMLexer::LocTy Loc = read64();
+    ExpressionAST *LHS = readExpression();
+    ExpressionAST *RHS = readExpression();
+    return Arena.create<BinaryOperatorAST>(
+        static_cast<BinaryOperatorAST::OperatorKind>(OpKind), LHS, RHS, Loc);
+  }
+  case ExpressionAST::UnaryOperatorExpression: {
+    uint8_t OpKind = read8();
+    if (OpKind > UnaryOperatorAST::BitwiseNot) {
+      fail();
+      return nullptr;
+    }
+    CMMLexer::LocTy Loc = read64();
+    return Arena.create<UnaryOperatorAST>(
+        static_cast<UnaryOperatorAST::OperatorKind>(OpKind), readExpression(),
+        Loc);
+  }
+  }
+}
+}
+
+/*===----------------------------- ProgramCache ---------------------------===*/
+
+ProgramCache::ProgramCache(SourceMgr &SrcMgr)
+    : SrcMgr(SrcMgr),
+      SourceHash(Hash(SrcMgr.getBufferStart(), SrcMgr.getBufferSize(),
+                      FormatVersion)) {
+  std::string Dir = GetCacheDirectory();
+  if (Dir.empty())
+    return;
+
+  char Name[32];
+  std::snprintf(Name, sizeof(Name), "/%016llx.cmmc",
+                static_cast<unsigned long long>(SourceHash));
+  Path = Dir + Name;
+}
+
+bool ProgramCache::tryLoad(CMMParser &Parser) {
+  if (Path.empty())
+    return false;
+  MappedFile File(Path);
+  if (File.getSize() < HeaderSize)
+    return false;
+
+  ProgramReader Header(File.getStart(), File.getStart() + HeaderSize,
+                       Parser.Arena, Parser.TopLevelBlock);
+  char FileMagic[4];
+  Header.read(FileMagic, 4);
+  uint32_t Version = Header.read32();
+  uint64_t FileSourceHash = Header.read64();
+  uint64_t SourceSize = Header.read64();
+  uint64_t PayloadSize = Header.read64();
+  uint64_t PayloadHash = Header.read64();
+  if (std::memcmp(FileMagic, Magic, 4) || Version != FormatVersion ||
+      FileSourceHash != SourceHash ||
+      SourceSize != SrcMgr.getBufferSize() ||
+      PayloadSize != File.getSize() - HeaderSize ||
+      PayloadHash != Hash(File.getStart() + HeaderSize, PayloadSize, 0))
+    return false;
+
+  // Read into locals first, so that a corrupt file leaves Parser as it was
+  // but for some garbage in its arena.
+  ProgramReader Reader(File.getStart() + HeaderSize,
+                       File.getStart() + File.getSize(), Parser.Arena,
+                       Parser.TopLevelBlock);
+  std::map<Symbol, FunctionDefinitionAST> Functions;
+  for (uint32_t Count = Reader.readCount(); Count; --Count) {
+    FunctionDefinitionAST Function;
+    if (!Reader.readFunction(Function))
+      return false;
+    Functions.emplace(Function.getName(), std::move(Function));
+  }
+
+  std::map<Symbol, InfixOpDefinitionAST> InfixOps;
+  for (uint32_t Count = Reader.readCount(); Count; --Count) {
+    InfixOpDefinitionAST InfixOp(Symbol(), Symbol(), Symbol(), nullptr);
+    if (!Reader.readInfixOp(InfixOp))
+      return false;
+    InfixOps.emplace(InfixOp.getSymbol(), std::move(InfixOp));
+  }
+
+  ASTArray<StatementAST *> TopLevel = Reader.readStatementList();
+  if (Reader.hasFailed() || !Reader.atEnd())
+    return false;
+
+  Parser.FunctionDefinition.swap(Functions);
+  Parser.InfixOpDefinition.swap(InfixOps);
+  Parser.TopLevelBlock.setStatementList(TopLevel);
+  return !Parser.resolve();
+}
+
+void ProgramCache::store(const CMMParser &Parser) {
+  // Diagnostics are only reported while parsing, so a program that had some
+  // is parsed again every time to report them again.
+  if (Path.empty() || SrcMgr.getDiagnosticCount())
+    return;
+
+  std::string Payload;
+  ProgramWriter Writer(Payload);
+  Writer.write32(static_cast<uint32_t>(Parser.FunctionDefinition.size()));
+  for (const auto &F : Parser.FunctionDefinition)
+    Writer.writeFunction(F.second);
+  Writer.write32(static_cast<uint32_t>(Parser.InfixOpDefinition.size()));
+  for (const auto &I : Parser.InfixOpDefinition)
+    Writer.writeInfixOp(I.second);
+  Writer.writeStatementList(Parser.TopLevelBlock.getStatementList());
+
+  std::string File(Magic, 4);
+  ProgramWriter Header(File);
+  Header.write32(FormatVersion);
+  Header.write64(SourceHash);
+  Header.write64(SrcMgr.getBufferSize());
+  Header.write64(Payload.size());
+  Header.write64(Hash(Payload.data(), Payload.size(), 0));
+  File += Payload;
+
+#if defined(__APPLE__) || defined(__linux__)
+  if (!MakeDirectories(Path.substr(0, Path.rfind('/'))))
+    return;
+
+  // Write a private file and rename it over the cache file, so that runs in
+  // parallel never see half of one.
+  std::string TempPath = Path + "." + std::to_string(getpid()) + ".tmp";
+  {
+    std::ofstream OS(TempPath, std::ios::binary);
+    OS.write(File.data(), File.size());
+    if (!OS) {
+      OS.close();
+      std::remove(TempPath.c_str());
+      return;
+    }
+  }
+  if (std::rename(TempPath.c_str(), Path.c_str()) != 0)
+    std::remove(TempPath.c_str());
+#endif // defined(__APPLE__) || defined(__linux__)
+}
@@ -0,0 +1,124 @@
+#include "ProgramWalker.h"
+
+using namespace cmm;
+
+void ProgramWalker::walkProgram(
+    const BlockAST &TopLevelBlock,
+    const std::map<Symbol, FunctionDefinitionAST> &F,
+    const std::map<Symbol, InfixOpDefinitionAST> &I) {
+  Scopes.assign(1, &TopLevelBlock.getLayout());
+  for (const StatementAST *S : TopLevelBlock.getStatementList())
+    walkStatement(S, true);
+
+  for (auto &Func : F) {
+    Scopes.assign(1, &TopLevelBlock.getLayout());
+    Scopes.push_back(&Func.second.getLayout());
+    enterFunction(Func.second);
+    walkStatement(Func.second.getStatement(), false);
+    leaveFunction(Func.second);
+  }
+  for (auto &Infix : I) {
+    Scopes.assign(1, &TopLevelBlock.getLayout());
+    Scopes.push_back(&Infix.second.getLayout());
+    enterInfixOp(Infix.second);
+    walkStatement(Infix.second.getStatement(), false);
+    leaveInfixOp(Infix.second);
+  }
+}
+
+void ProgramWalker::walkStatement(const StatementAST *Stmt, bool InBlock) {
+  if (!Stmt)
+    return;
+
+  visitStatement(Stmt, InBlock);
+  switch (Stmt->getKind()) {
+  case StatementAST::BreakStatement:
+  case StatementAST::ContinueStatement:
+    break;
+  case StatementAST::BlockStatement: {
+    auto *Block = Stmt->as_cptr<BlockAST>();
+    Scopes.push_back(&Block->getLayout());
+    for (const StatementAST *S : Block->getStatementList())
+      walkStatement(S, true);
+    Scopes.pop_back();
+    break;
+  }
+  case StatementAST::DeclarationStatement:
+    walkDeclaration(Stmt->as_cptr<DeclarationAST>(), InBlock);
+    break;
+  case StatementAST::DeclarationListStatement:
+    for (const DeclarationAST *Decl :
+         Stmt->as_cptr<DeclarationListAST>()->getDeclarationList())
+      walkDeclaration(Decl, InBlock);
+    break;
+  case StatementAST::ExprStatement:
+    walkExpression(Stmt->as_cptr<ExprStatementAST>()->getExpression());
+    break;
+  case StatementAST::ReturnStatement:
+    if (auto *Value = Stmt->as_cptr<ReturnStatementAST>()->getReturnValue())
+      walkExpression(Value);
+    break;
+  case StatementAST::IfStatement: {
+    auto *IfStmt = Stmt->as_cptr<IfStatementAST>();
+    walkExpression(IfStmt->getCondition());
+    walkStatement(IfStmt->getStatementThen(), false);
+    walkStatement(IfStmt->getStatementElse(), false);
+    break;
+  }
+  case StatementAST::WhileStatement: {
+    auto *WhileStmt = Stmt->as_cptr<WhileStatementAST>();
+    if (WhileStmt->getCondition())
+      walkExpression(WhileStmt->getCondition());
+    walkStatement(WhileStmt->getStatement(), false);
+    break;
+  }
+  case StatementAST::ForStatement: {
+    auto *ForStmt = Stmt->as_cptr<ForStatementAST>();
+    if (ForStmt->getInit())
+      walkExpression(ForStmt->getInit());
+    if (ForStmt->getCondition())
+      walkExpression(ForStmt->getCondition());
+    if (ForStmt->getPost())
+      walkExpression(ForStmt->getPost());
+    walkStatement(ForStmt->getStatement(), false);
+    break;
+  }
+  }
+}
+
+void ProgramWalker::walkDeclaration(const DeclarationAST *Decl,
+                                    bool InBlock) {
+  for (const ExpressionAST *E : Decl->getElementCountList())
+    walkExpression(E);
+  if (Decl->getInitializer())
+    walkExpression(Decl->getInitializer());
+  visitDeclaration(Decl, InBlock);
+}
+
+void ProgramWalker::walkExpression(const ExpressionAST *Expr) {
+  visitExpression(Expr);
+  switch (Expr->getKind()) {
+  case ExpressionAST::IntExpression:
+  case ExpressionAST::DoubleExpression:
+  case ExpressionAST::BoolExpression:
+  case ExpressionAST::StringExpression:
+  case ExpressionAST::IdentifierExpression:
+    break;
+  case ExpressionAST::FunctionCallExpression:
+    for (const ExpressionAST *Arg :
+         Expr->as_cptr<FunctionCallAST>()->getArguments())
+      walkExpression(Arg);
+    break;
+  case ExpressionAST::InfixOpExpression:
+    walkExpression(Expr->as_cptr<InfixOpExprAST>()->getLHS());
+    walkExpression(Expr->as_cptr<InfixOpExprAST>()->getRHS());
+    break;
+  case ExpressionAST::BinaryOperatorExpression:
+    walkExpression(Expr->as_cptr<BinaryOperatorAST>()->getLHS());
+    walkExpression(Expr->as_cptr<BinaryOperatorAST>()->getRHS());
+    break;
+  case ExpressionAST::UnaryOperatorExpression:
+    walkExpression(Expr->as_cptr<UnaryOperatorAST>()->getOperand());
+    break;
+  }
+}
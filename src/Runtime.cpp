@@ -0,0 +1,320 @@
+#include "Runtime.h"
+#include <cmath>
+#include <iostream>
+
+namespace cvm {
+
+void RuntimeError(const std::string &Msg) {
+#if defined(__APPLE__) || defined(__linux__)
+  const char *StartColor = "\033[1;31m";
+  const char *EndColor = "\033[0m";
+  std::cerr << StartColor;
+#endif // defined(__APPLE__) || defined(__linux__)
+
+  std::cerr << "CMM Runtime Error: ";
+
+#if defined(__APPLE__) || defined(__linux__)
+  std::cerr << EndColor;
+#endif // defined(__APPLE__) || defined(__linux__)
+  std::cerr << Msg << std::endl;
+  std::exit(EXIT_FAILURE);
+}
+
+/// \brief Perform unary arithmetic operation (+) on value
+BasicValue unaryPlus(const BasicValue &Operand) {
+  if (!Operand.isNumeric()) {
+    RuntimeError("operands of unary arithmetic operations should be numeric");
+  }
+  return Operand;
+}
+
+/// \brief Perform unary arithmetic operation (-) on value
+BasicValue unaryMinus(const BasicValue &Operand) {
+  if (!Operand.isNumeric()) {
+    RuntimeError("operands of unary arithmetic operations should be numeric");
+  }
+  if (Operand.isInt())
+    return -Operand.getInt();
+  return -Operand.getDouble();
+}
+
+/// \brief Perform unary logical operation (!) on value
+BasicValue logicalNot(const BasicValue &Operand) {
+  return !Operand.toBool();
+}
+
+/// \brief Perform unary bitwise operation (~) on value
+BasicValue bitwiseNot(const BasicValue &Operand) {
+  if (!Operand.isInt()) {
+    RuntimeError("operand of unary bitwise operation should be int");
+  }
+  return ~Operand.getInt();
+}
+
+static void checkArithOperands(const BasicValue &LHS, const BasicValue &RHS) {
+  if (!LHS.isNumeric() || !RHS.isNumeric()) {
+    RuntimeError("operands of binary arithmetic operations should be numeric");
+  }
+}
+
+/// \brief Perform binary addition, or string concatenation if either operand
+/// is a string
+BasicValue add(const BasicValue &LHS, const BasicValue &RHS) {
+  if (LHS.isString() && RHS.isString() && !LHS.isArray() && !RHS.isArray())
+    return LHS.getString() + RHS.getString();
+  if (LHS.isString() || RHS.isString())
+    return LHS.toString() + RHS.toString();
+
+  checkArithOperands(LHS, RHS);
+  if (LHS.isInt() && RHS.isInt())
+    return LHS.getInt() + RHS.getInt();
+  return LHS.toDouble() + RHS.toDouble();
+}
+
+BasicValue subtract(const BasicValue &LHS, const BasicValue &RHS) {
+  checkArithOperands(LHS, RHS);
+  if (LHS.isInt() && RHS.isInt())
+    return LHS.getInt() - RHS.getInt();
+  return LHS.toDouble() - RHS.toDouble();
+}
+
+BasicValue multiply(const BasicValue &LHS, const BasicValue &RHS) {
+  checkArithOperands(LHS, RHS);
+  if (LHS.isInt() && RHS.isInt())
+    return LHS.getInt() * RHS.getInt();
+  return LHS.toDouble() * RHS.toDouble();
+}
+
+BasicValue divide(const BasicValue &LHS, const BasicValue &RHS) {
+  checkArithOperands(LHS, RHS);
+  if (LHS.isInt() && RHS.isInt()) {
+    if (RHS.getInt() == 0)
+      RuntimeError("int division by zero");
+    return LHS.getInt() / RHS.getInt();
+  }
+  return LHS.toDouble() / RHS.toDouble();
+}
+
+BasicValue modulo(const BasicValue &LHS, const BasicValue &RHS) {
+  checkArithOperands(LHS, RHS);
+  if (LHS.isInt() && RHS.isInt()) {
+    if (RHS.getInt() == 0)
+      RuntimeError("int modulo by zero");
+    return LHS.getInt() % RHS.getInt();
+  }
+  return std::fmod(LHS.toDouble(), RHS.toDouble());
+}
+
+/// \brief Check the operands of a relational operator
+/// Return true if they are an int and a double, which compare as doubles.
+static bool checkRelationOperands(const BasicValue &LHS,
+                                  const BasicValue &RHS) {
+  if (LHS.getType() == RHS.getType())
+    return false;
+  if (LHS.isNumeric() && RHS.isNumeric())
+    return true;
+  RuntimeError("relational operator should apply to identical type");
+}
+
+BasicValue less(const BasicValue &LHS, const BasicValue &RHS) {
+  if (checkRelationOperands(LHS, RHS))
+    return BasicValue(LHS.toDouble()) < BasicValue(RHS.toDouble());
+  return LHS < RHS;
+}
+
+BasicValue lessEqual(const BasicValue &LHS, const BasicValue &RHS) {
+  if (checkRelationOperands(LHS, RHS))
+    return BasicValue(LHS.toDouble()) <= BasicValue(RHS.toDouble());
+  return LHS <= RHS;
+}
+
+BasicValue equal(const BasicValue &LHS, const BasicValue &RHS) {
+  if (checkRelationOperands(LHS, RHS))
+    return BasicValue(LHS.toDouble()) == BasicValue(RHS.toDouble());
+  return LHS == RHS;
+}
+
+BasicValue notEqual(const BasicValue &LHS, const BasicValue &RHS) {
+  if (checkRelationOperands(LHS, RHS))
+    return BasicValue(LHS.toDouble()) != BasicValue(RHS.toDouble());
+  return LHS != RHS;
+}
+
+BasicValue greater(const BasicValue &LHS, const BasicValue &RHS) {
+  if (checkRelationOperands(LHS, RHS))
+    return BasicValue(LHS.toDouble()) > BasicValue(RHS.toDouble());
+  return LHS > RHS;
+}
+
+BasicValue greaterEqual(const BasicValue &LHS, const BasicValue &RHS) {
+  if (checkRelationOperands(LHS, RHS))
+    return BasicValue(LHS.toDouble()) >= BasicValue(RHS.toDouble());
+  return LHS >= RHS;
+}
+
+static void checkBitwiseOperands(const BasicValue &LHS,
+                                 const BasicValue &RHS) {
+  if (!LHS.isInt() || !RHS.isInt()) {
+    RuntimeError("operands of bitwise operations should be int");
+  }
+}
+
+BasicValue bitwiseAnd(const BasicValue &LHS, const BasicValue &RHS) {
+  checkBitwiseOperands(LHS, RHS);
+  return LHS.getInt() & RHS.getInt();
+}
+
+BasicValue bitwiseOr(const BasicValue &LHS, const BasicValue &RHS) {
+  checkBitwiseOperands(LHS, RHS);
+  return LHS.getInt() | RHS.getInt();
+}
+
+BasicValue bitwiseXor(const BasicValue &LHS, const BasicValue &RHS) {
+  checkBitwiseOperands(LHS, RHS);
+  return LHS.getInt() ^ RHS.getInt();
+}
+
+BasicValue leftShift(const BasicValue &LHS, const BasicValue &RHS) {
+  checkBitwiseOperands(LHS, RHS);
+  return LHS.getInt() << RHS.getInt();
+}
+
+BasicValue rightShift(const BasicValue &LHS, const BasicValue &RHS) {
+  checkBitwiseOperands(LHS, RHS);
+  return LHS.getInt() >> RHS.getInt();
+}
+
+/// \brief Store Value into Variable, promoting int to double if needed
+BasicValue &assignValue(BasicValue &Variable, BasicValue Value) {
+  if (Variable.isArray()) {
+    RuntimeError("cannot assign value to array directly");
+  }
+
+  if (Variable.getType() != Value.getType()) {
+    if (Variable.isDouble() && Value.isInt()) {
+      return Variable = static_cast<double>(Value.getInt());
+    } else {
+      RuntimeError("assignment to " + TypeToStr(Variable.getType()) +
+          " variable with " + TypeToStr(Value.getType()) + " expression");
+    }
+  }
+  return Variable = std::move(Value);
+}
+
+/// \brief Check one dimension of the declaration of array Name and return it
+int checkDimension(const std::string &Name, const BasicValue &Dimension) {
+  if (!Dimension.isInt()) {
+    RuntimeError("expressions in array declaration `" + Name +
+        "' should be integral type");
+  }
+
+  if (Dimension.getInt() <= 0) {
+    RuntimeError("dimension of array `" + Name + "' declared to be " +
+        std::to_string(Dimension.getInt()) + "; positive number expected");
+  }
+  return Dimension.getInt();
+}
+
+/// \brief Check the initializer of variable Name against its declared Type,
+/// promoting int to double if needed
+void coerceInitializer(const std::string &Name, BasicType Type,
+                       BasicValue &Val) {
+  if (Val.getType() == Type)
+    return;
+
+  if (Type == DoubleType && Val.isInt()) {
+    Val = static_cast<double>(Val.getInt());
+  } else {
+    RuntimeError("variable `" + Name + "' is declared to be " +
+        TypeToStr(Type) + ", but is initialized to be " +
+        TypeToStr(Val.getType()));
+  }
+}
+
+void checkIndexBase(const BasicValue &Base) {
+  if (!Base.isArray())
+    RuntimeError("too many index or index expression didn't start with array");
+}
+
+/// \brief Check that Index is a valid index of array Base and return it
+int checkIndex(const BasicValue &Base, const BasicValue &Index) {
+  checkIndexBase(Base);
+  if (!Index.isInt())
+    RuntimeError("non-int index in index expression");
+
+  int ArraySize = Base.getArraySize();
+  if (Index.getInt() < 0 || Index.getInt() >= ArraySize) {
+    RuntimeError("index out of range: should within [0," +
+        std::to_string(ArraySize) + "); actually got index " +
+        std::to_string(Index.getInt()));
+  }
+  return Index.getInt();
+}
+
+/// \brief Store Value into element Index of array Base the way assignValue
+/// does, and return the value stored
+BasicValue storeElement(const BasicValue &Base, int Index,
+                        const BasicValue &Value) {
+  BasicValue Element = Base.getElement(Index);
+  assignValue(Element, Value);
+  Base.setElement(Index, Element);
+  return Element;
+}
+
+void checkInfixOpValue(const BasicValue &Value) {
+  if (Value.isVoid()) {
+    RuntimeError("infix operator didn't return any value");
+  }
+}
+
+void checkArgumentCount(const std::string &Function, size_t ParamCount,
+                        size_t Count) {
+  if (Count != ParamCount) {
+    RuntimeError("Function `" + Function + "' expects " +
+        std::to_string(ParamCount) + " parameter(s), " +
+        std::to_string(Count) + " argument(s) provided");
+  }
+}
+
+/// \brief Check an argument against the Type of parameter Param, promoting
+/// int to double if needed
+void coerceArgument(const std::string &Function, const std::string &Param,
+                    BasicType Type, BasicValue &Arg) {
+  if (Type == Arg.getType())
+    return;
+
+  if (Arg.isInt() && Type == DoubleType) {
+    Arg = static_cast<double>(Arg.getInt());
+  } else {
+    RuntimeError("in function `" + Function + "', parameter `" + Param +
+      "' has type " + TypeToStr(Type) + ", but argument is " +
+      TypeToStr(Arg.getType()));
+  }
+}
+
+/// \brief Check the value of an explicit return statement
+void checkReturnValue(const std::string &Function, BasicType Type,
+                      const BasicValue &Value) {
+  if (Value.getType() != Type) {
+    RuntimeError("function `" + Function + "' ought to return " +
+        TypeToStr(Type) + ", but got " + TypeToStr(Value.getType()));
+  }
+}
+
+/// \brief Check the value of a top level return statement and return it
+int checkTopLevelReturn(const BasicValue &Value) {
+  if (!Value.isInt()) {
+    RuntimeError("top level return statement should return integers, but " +
+        TypeToStr(Value.getType()) + Value.toString() + " is returned");
+  }
+  return Value.getInt();
+}
+
+BasicValue makeArgumentArray(int Argc, char *Argv[]) {
+  std::vector<BasicValue> Args;
+  Args.reserve(static_cast<size_t>(Argc));
+  for (int I = 0; I < Argc; ++I)
+    Args.emplace_back(std::string(Argv[I]));
+  return BasicValue(StringType, std::move(Args));
+}
+}
@@ -2,6 +2,20 @@
 #include <iostream>
 #include <algorithm>
 #include <cassert>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+
+#if defined(__APPLE__) || defined(__linux__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif // defined(__APPLE__) || defined(__linux__)
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif // __SSE2__
 
 using namespace cmm;
 
@@ -28,72 +42,111 @@ void SourceMgr::dumpError(LocTy L, ErrorKind K,
 }
 
 SourceMgr::SourceMgr(const std::string &SourcePath, bool DumpInstantly)
-  : SourceStream(SourcePath), CurrentLoc(0), DumpInstantly(DumpInstantly) {
+  : BufferStart(nullptr), BufferEnd(nullptr), MappedBase(nullptr),
+    MappedSize(0), DiagnosticCount(0), DumpInstantly(DumpInstantly) {
 
-  if (SourceStream.fail()) {
+  if (!mapFile(SourcePath) && !readFile(SourcePath)) {
     std::cerr << "Fatal Error: Cannot open file '" << SourcePath
               << "', exited." << std::endl;
     std::exit(EXIT_FAILURE);
   }
 
-  SourceStream.seekg(0, SourceStream.end);
-  SourceContent.reserve(SourceStream.tellg());
-  SourceStream.seekg(0, SourceStream.beg);
-  LineNoOffsets.reserve(ReservedLineNo);
-  LineNoOffsets.emplace_back(std::streampos(0));
+  buildLineTable();
+}
 
-  int CurChar;
-  size_t Index;
-  for (size_t Offset = 0; (CurChar = SourceStream.get()) !=
-       std::char_traits<char>::eof(); ++Offset) {
-    SourceContent.push_back(static_cast<char>(CurChar));
+SourceMgr::~SourceMgr() {
+#if defined(__APPLE__) || defined(__linux__)
+  if (MappedBase)
+    munmap(MappedBase, MappedSize);
+#endif // defined(__APPLE__) || defined(__linux__)
+}
 
-    if (CurChar == '\n')
-      LineNoOffsets.push_back(Offset);
+/// \brief Map the file read-only, return false if it can't be mapped
+bool SourceMgr::mapFile(const std::string &SourcePath) {
+#if defined(__APPLE__) || defined(__linux__)
+  int FD = open(SourcePath.c_str(), O_RDONLY);
+  if (FD < 0)
+    return false;
+
+  struct stat Status;
+  if (fstat(FD, &Status) != 0 || !S_ISREG(Status.st_mode) ||
+      Status.st_size == 0) {
+    // Empty files can't be mapped, and pipes have to be read.
+    close(FD);
+    return false;
   }
 
-  SourceStream.close();
+  size_t Size = static_cast<size_t>(Status.st_size);
+  void *Base = mmap(nullptr, Size, PROT_READ, MAP_PRIVATE, FD, 0);
+  close(FD);
+  if (Base == MAP_FAILED)
+    return false;
+
+  MappedBase = Base;
+  MappedSize = Size;
+  BufferStart = static_cast<const char *>(Base);
+  BufferEnd = BufferStart + Size;
+  return true;
+#else
+  (void)SourcePath;
+  return false;
+#endif // defined(__APPLE__) || defined(__linux__)
 }
 
-int SourceMgr::get() {
-  if (CurrentLoc == SourceContent.size())
-    return std::char_traits<char>::eof();
-  return SourceContent[CurrentLoc++];
+/// \brief Read the whole file with one read, return false on failure
+bool SourceMgr::readFile(const std::string &SourcePath) {
+  std::ifstream SourceStream(SourcePath, std::ios::binary);
+  if (SourceStream.fail())
+    return false;
+
+  ReadBuffer.assign(std::istreambuf_iterator<char>(SourceStream),
+                    std::istreambuf_iterator<char>());
+  BufferStart = ReadBuffer.data();
+  BufferEnd = BufferStart + ReadBuffer.size();
+  return true;
 }
 
-int SourceMgr::peek() {
-  if (CurrentLoc == SourceContent.size())
-    return std::char_traits<char>::eof();
-  return SourceContent[CurrentLoc];
-}
+/// \brief Record the offset of every '\n', scanning 16 bytes at a time
+void SourceMgr::buildLineTable() {
+  LineNoOffsets.reserve(getBufferSize() / 32 + 1);
+  LineNoOffsets.push_back(0);
+
+  const char *Cur = BufferStart;
+#ifdef __SSE2__
+  const __m128i NewLines = _mm_set1_epi8('\n');
+  for (; BufferEnd - Cur >= 16; Cur += 16) {
+    __m128i Chunk = _mm_loadu_si128(reinterpret_cast<const __m128i *>(Cur));
+    unsigned Mask = static_cast<unsigned>(
+        _mm_movemask_epi8(_mm_cmpeq_epi8(Chunk, NewLines)));
+    for (; Mask; Mask &= Mask - 1) {
+      LineNoOffsets.push_back(Cur - BufferStart + __builtin_ctz(Mask));
+    }
+  }
+#endif // __SSE2__
 
-void SourceMgr::unget() {
-  if (CurrentLoc > 0)
-    --CurrentLoc;
+  while ((Cur = static_cast<const char *>(
+              std::memchr(Cur, '\n', BufferEnd - Cur)))) {
+    LineNoOffsets.push_back(Cur - BufferStart);
+    ++Cur;
+  }
 }
 
 void SourceMgr::Error(LocTy L, const std::string &Msg) {
+  ++DiagnosticCount;
   if (DumpInstantly)
     dumpError(L, ErrorKind::Error, Msg);
   else
     ErrorList.emplace_back(L, ErrorKind::Error, Msg);
 }
 
-void SourceMgr::Error(const std::string &Msg) {
-  Error(CurrentLoc, Msg);
-}
-
 void SourceMgr::Warning(LocTy L, const std::string &Msg) {
+  ++DiagnosticCount;
   if (DumpInstantly)
     dumpError(L, ErrorKind::Warning, Msg);
   else
     ErrorList.emplace_back(L, ErrorKind::Warning, Msg);
 }
 
-void SourceMgr::Warning(const std::string &Msg) {
-  Warning(CurrentLoc, Msg);
-}
-
 std::pair<size_t, size_t> SourceMgr::getLineColByLoc(LocTy L) const {
   //std::cout << L << std::endl;
   auto It = std::upper_bound(LineNoOffsets.cbegin(), LineNoOffsets.cend(), L);
@@ -105,9 +158,6 @@ std::pair<size_t, size_t> SourceMgr::getLineColByLoc(LocTy L) const {
   return std::make_pair(LineIndex, ColIndex);
 }
 
-void SourceMgr::dumpFile() {
-  int CurChar;
-  while ((CurChar = get()) != std::char_traits<char>::eof()) {
-    std::cout << static_cast<char>(CurChar);
-  }
+void SourceMgr::dumpFile() const {
+  std::cout.write(BufferStart, getBufferSize());
 }
@@ -0,0 +1,84 @@
+#include "Symbol.h"
+#include <cstring>
+#include <deque>
+#include <vector>
+
+using namespace cmm;
+
+namespace {
+/// \brief Names of all symbols, found by an open addressing hash table of
+/// their indexes.
+class SymbolTable {
+  /// A deque never moves its elements, so str() can hand out references.
+  std::deque<std::string> Names;
+  std::vector<uint32_t> Hashes;
+  /// Index + 1 of the symbol in each bucket, 0 for an empty bucket. The
+  /// size is a power of two and at most half of the buckets are used.
+  std::vector<uint32_t> Buckets;
+
+  static uint32_t hash(const char *Name, size_t Len) {
+    uint32_t H = 2166136261u;
+    for (size_t I = 0; I < Len; ++I)
+      H = (H ^ static_cast<unsigned char>(Name[I])) * 16777619u;
+    return H;
+  }
+
+  void grow() {
+    std::vector<uint32_t> NewBuckets(Buckets.size() * 2, 0);
+    size_t Mask = NewBuckets.size() - 1;
+    for (uint32_t Entry : Buckets) {
+      if (!Entry)
+        continue;
+      size_t B = Hashes[Entry - 1] & Mask;
+      while (NewBuckets[B])
+        B = (B + 1) & Mask;
+      NewBuckets[B] = Entry;
+    }
+    Buckets.swap(NewBuckets);
+  }
+
+public:
+  SymbolTable() : Buckets(1024, 0) {
+    // Symbol 0 is the empty name.
+    Names.emplace_back();
+    Hashes.push_back(hash("", 0));
+    Buckets[Hashes[0] & (Buckets.size() - 1)] = 1;
+  }
+
+  uint32_t intern(const char *Name, size_t Len) {
+    uint32_t H = hash(Name, Len);
+    size_t Mask = Buckets.size() - 1;
+    size_t B = H & Mask;
+    for (; Buckets[B]; B = (B + 1) & Mask) {
+      uint32_t Index = Buckets[B] - 1;
+      const std::string &S = Names[Index];
+      if (Hashes[Index] == H && S.size() == Len &&
+          !std::memcmp(S.data(), Name, Len))
+        return Index;
+    }
+
+    uint32_t Index = static_cast<uint32_t>(Names.size());
+    Names.emplace_back(Name, Len);
+    Hashes.push_back(H);
+    Buckets[B] = Index + 1;
+    if (Names.size() * 2 > Buckets.size())
+      grow();
+    return Index;
+  }
+
+  const std::string &getName(uint32_t Index) const { return Names[Index]; }
+};
+
+SymbolTable &getSymbolTable() {
+  static SymbolTable Table;
+  return Table;
+}
+}
+
+Symbol Symbol::intern(const char *Name, size_t Len) {
+  return Symbol(getSymbolTable().intern(Name, Len));
+}
+
+const std::string &Symbol::str() const {
+  return getSymbolTable().getName(ID);
+}
@@ -0,0 +1,60 @@
+#include "TokenBuffer.h"
+
+using namespace cmm;
+
+/// \brief Lex one more token into the buffer
+void TokenBuffer::lexNext() {
+  Token::TokenKind Kind = Lexer.Lex().getKind();
+  uint32_t Value = 0;
+
+  switch (Kind) {
+  default:
+    break;
+  case Token::Identifier:
+  case Token::InfixOp:
+    Value = Lexer.getSymbolVal().getID();
+    break;
+  case Token::String:
+    Value = static_cast<uint32_t>(Strings.size());
+    Strings.push_back(Lexer.getStrVal());
+    break;
+  case Token::Integer:
+    Value = static_cast<uint32_t>(Lexer.getIntVal());
+    break;
+  case Token::Double:
+    Value = static_cast<uint32_t>(Doubles.size());
+    Doubles.push_back(Lexer.getDoubleVal());
+    break;
+  case Token::Boolean:
+    Value = Lexer.getBoolVal();
+    break;
+  }
+
+  Tokens.push_back(LexedToken{Kind, Value, Lexer.getLoc()});
+}
+
+Token TokenBuffer::Lex() {
+  if (Tokens.empty()) {
+    lexNext();
+    return getTok();
+  }
+
+  if (getCurrent().isNot(Token::Eof)) {
+    if (++Current == Tokens.size())
+      lexNext();
+  }
+  return getTok();
+}
+
+const LexedToken &TokenBuffer::lookAhead(size_t N) {
+  if (Tokens.empty())
+    lexNext();
+
+  // Nothing follows the Eof token but itself.
+  while (Current + N >= Tokens.size()) {
+    if (Tokens.back().is(Token::Eof))
+      return Tokens.back();
+    lexNext();
+  }
+  return Tokens[Current + N];
+}
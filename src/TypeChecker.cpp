@@ -0,0 +1,505 @@
+#include "TypeChecker.h"
+#include "NativeFunctions.h"
+#include <algorithm>
+
+using namespace cmm;
+
+/// \brief Return what storing the value of Expr into a variable of Type
+/// takes, or Unchecked if that isn't known statically
+/// Only an int converts to another type, double.
+static Coercion GetCoercion(const ExpressionAST *Expr, cvm::BasicType Type) {
+  if (!Expr->hasStaticType())
+    return Coercion::Unchecked;
+  if (Expr->getStaticType() == Type)
+    return Coercion::Identity;
+  if (Expr->getStaticType() == cvm::IntType && Type == cvm::DoubleType)
+    return Coercion::IntToDouble;
+  return Coercion::Unchecked;
+}
+
+/// \brief Return true if the runtime rejects storing every value of Expr
+/// into a variable of Type
+static bool IsMismatch(const ExpressionAST *Expr, cvm::BasicType Type) {
+  return Expr->hasStaticType() &&
+         GetCoercion(Expr, Type) == Coercion::Unchecked;
+}
+
+bool TypeChecker::check() {
+  Variables.clear();
+  LooseNames.clear();
+  DynamicCallees.clear();
+  ExplicitReturns.clear();
+  Errors.clear();
+  collect();
+
+  for (auto &Stmt : TopLevelBlock.getStatementList())
+    checkStatement(Stmt);
+
+  for (auto &F : FunctionDefinition) {
+    Function = &F.second;
+    ReturnsProven = true;
+    checkStatement(F.second.getStatement());
+    F.second.setCheckedReturns(ReturnsProven);
+  }
+  Function = nullptr;
+
+  for (auto &I : InfixOpDefinition) {
+    InfixOp = &I.second;
+    checkStatement(I.second.getStatement());
+  }
+  InfixOp = nullptr;
+
+  // Functions are checked in the order of their names, not where they are.
+  std::stable_sort(Errors.begin(), Errors.end(),
+                   [](const std::pair<CMMLexer::LocTy, std::string> &L,
+                      const std::pair<CMMLexer::LocTy, std::string> &R) {
+                     return L.first < R.first;
+                   });
+  for (auto &E : Errors)
+    SrcMgr.Error(E.first, E.second);
+  return !Errors.empty();
+}
+
+/*===------------------------------- Collect ------------------------------===*/
+
+void TypeChecker::collect() {
+  walkProgram(TopLevelBlock, FunctionDefinition, InfixOpDefinition);
+}
+
+// Operands of infix operators have no declared type, so they are left out of
+// Variables.
+void TypeChecker::enterFunction(const FunctionDefinitionAST &F) {
+  int Slot = 0;
+  for (const Parameter &Param : F.getParameterList())
+    addVariable(&F.getLayout(), Slot++, Param.getType(), false);
+}
+
+void TypeChecker::leaveFunction(const FunctionDefinitionAST &F) {
+  if (returnsExplicitly(F.getStatement()))
+    ExplicitReturns.insert(&F);
+}
+
+/// \brief Record the declared type of the variable Decl declares
+/// A declaration that isn't directly in a block leaves its name to be looked
+/// up at run time.
+void TypeChecker::visitDeclaration(const DeclarationAST *Decl, bool InBlock) {
+  addVariable(Scopes.back(), Decl->getSlot(), Decl->getType(), !InBlock);
+  if (!InBlock)
+    LooseNames.insert(Decl->getName());
+}
+
+void TypeChecker::visitExpression(const ExpressionAST *Expr) {
+  if (Expr->getKind() != ExpressionAST::FunctionCallExpression)
+    return;
+  auto *FuncCall = Expr->as_cptr<FunctionCallAST>();
+  if (FuncCall->isDynamicBound() && FuncCall->getFunction())
+    DynamicCallees.insert(FuncCall->getFunction());
+}
+
+void TypeChecker::addVariable(const FrameLayout *Layout, int Slot,
+                              cvm::BasicType Type, bool Ambiguous) {
+  auto Res = Variables.insert(
+      std::make_pair(VariableKey(Layout, Slot), VariableInfo{Type, Ambiguous}));
+  // A name declared twice in a block shares the slot.
+  VariableInfo &Var = Res.first->second;
+  if (!Res.second && (Ambiguous || Var.Type != Type))
+    Var.Ambiguous = true;
+}
+
+/// \brief Return true if every run of Stmt that completes leaves through a
+/// return statement
+bool TypeChecker::returnsExplicitly(const StatementAST *Stmt) {
+  if (!Stmt)
+    return false;
+
+  switch (Stmt->getKind()) {
+  default:
+    return false;
+  case StatementAST::ReturnStatement:
+    return true;
+  case StatementAST::BlockStatement:
+    for (auto &S : Stmt->as_cptr<BlockAST>()->getStatementList()) {
+      if (returnsExplicitly(S))
+        return true;
+      if (mayBreak(S))
+        return false;
+    }
+    return false;
+  case StatementAST::IfStatement: {
+    auto *IfStmt = Stmt->as_cptr<IfStatementAST>();
+    return returnsExplicitly(IfStmt->getStatementThen()) &&
+           returnsExplicitly(IfStmt->getStatementElse());
+  }
+  }
+}
+
+/// \brief Return true if Stmt may run a break or continue statement that
+/// isn't in a loop inside it
+bool TypeChecker::mayBreak(const StatementAST *Stmt) {
+  if (!Stmt)
+    return false;
+
+  switch (Stmt->getKind()) {
+  default:
+    return false;
+  case StatementAST::BreakStatement:
+  case StatementAST::ContinueStatement:
+    return true;
+  case StatementAST::BlockStatement:
+    for (auto &S : Stmt->as_cptr<BlockAST>()->getStatementList())
+      if (mayBreak(S))
+        return true;
+    return false;
+  case StatementAST::IfStatement: {
+    auto *IfStmt = Stmt->as_cptr<IfStatementAST>();
+    return mayBreak(IfStmt->getStatementThen()) ||
+           mayBreak(IfStmt->getStatementElse());
+  }
+  }
+}
+
+/*===-------------------------------- Check -------------------------------===*/
+
+void TypeChecker::reportError(CMMLexer::LocTy Loc, const std::string &Msg) {
+  Errors.emplace_back(Loc, Msg);
+}
+
+void TypeChecker::checkStatement(StatementAST *Stmt) {
+  if (!Stmt)
+    return;
+
+  switch (Stmt->getKind()) {
+  case StatementAST::BreakStatement:
+  case StatementAST::ContinueStatement:
+    break;
+  case StatementAST::BlockStatement:
+    for (auto &S : Stmt->as_ptr<BlockAST>()->getStatementList())
+      checkStatement(S);
+    break;
+  case StatementAST::DeclarationStatement:
+    checkDeclaration(Stmt->as_ptr<DeclarationAST>());
+    break;
+  case StatementAST::DeclarationListStatement:
+    for (auto &Decl : Stmt->as_ptr<DeclarationListAST>()->getDeclarationList())
+      checkDeclaration(Decl);
+    break;
+  case StatementAST::ExprStatement:
+    checkExpression(Stmt->as_ptr<ExprStatementAST>()->getExpression());
+    break;
+  case StatementAST::ReturnStatement:
+    checkReturn(Stmt->as_ptr<ReturnStatementAST>());
+    break;
+  case StatementAST::IfStatement: {
+    auto *IfStmt = Stmt->as_ptr<IfStatementAST>();
+    checkExpression(IfStmt->getCondition());
+    checkStatement(IfStmt->getStatementThen());
+    checkStatement(IfStmt->getStatementElse());
+    break;
+  }
+  case StatementAST::WhileStatement: {
+    auto *WhileStmt = Stmt->as_ptr<WhileStatementAST>();
+    if (WhileStmt->getCondition())
+      checkExpression(WhileStmt->getCondition());
+    checkStatement(WhileStmt->getStatement());
+    break;
+  }
+  case StatementAST::ForStatement: {
+    auto *ForStmt = Stmt->as_ptr<ForStatementAST>();
+    if (ForStmt->getInit())
+      checkExpression(ForStmt->getInit());
+    if (ForStmt->getCondition())
+      checkExpression(ForStmt->getCondition());
+    if (ForStmt->getPost())
+      checkExpression(ForStmt->getPost());
+    checkStatement(ForStmt->getStatement());
+    break;
+  }
+  }
+}
+
+void TypeChecker::checkDeclaration(DeclarationAST *Decl) {
+  const std::string &Name = Decl->getName().str();
+  for (auto &E : Decl->getElementCountList()) {
+    checkExpression(E);
+    if (E->hasStaticType() && E->getStaticType() != cvm::IntType)
+      reportError(Decl->getLoc(), "expressions in array declaration `" + Name +
+                  "' should be integral type");
+  }
+
+  ExpressionAST *Init = Decl->getInitializer();
+  if (!Init)
+    return;
+  checkExpression(Init);
+  if (IsMismatch(Init, Decl->getType()))
+    reportError(Decl->getLoc(), "variable `" + Name + "' is declared to be " +
+                cvm::TypeToStr(Decl->getType()) +
+                ", but is initialized to be " +
+                cvm::TypeToStr(Init->getStaticType()));
+  Decl->setInitializerCoercion(GetCoercion(Init, Decl->getType()));
+}
+
+void TypeChecker::checkReturn(ReturnStatementAST *Stmt) {
+  ExpressionAST *Value = Stmt->getReturnValue();
+  if (Value)
+    checkExpression(Value);
+
+  // The value of an infix operator is only checked not to be void.
+  if (InfixOp)
+    return;
+
+  if (Value && !Value->hasStaticType()) {
+    ReturnsProven = false;
+    return;
+  }
+  cvm::BasicType Type = Value ? Value->getStaticType() : cvm::VoidType;
+  if (!Function) {
+    if (Type != cvm::IntType)
+      reportError(Stmt->getLoc(),
+                  "return statement should return int, but returns " +
+                  cvm::TypeToStr(Type));
+    return;
+  }
+  if (Type != Function->getType()) {
+    reportError(Stmt->getLoc(), "return statement should return " +
+                cvm::TypeToStr(Function->getType()) + ", but returns " +
+                cvm::TypeToStr(Type));
+    ReturnsProven = false;
+  }
+}
+
+void TypeChecker::checkExpression(ExpressionAST *Expr) {
+  switch (Expr->getKind()) {
+  case ExpressionAST::IntExpression:
+    Expr->setStaticType(cvm::IntType);
+    break;
+  case ExpressionAST::DoubleExpression:
+    Expr->setStaticType(cvm::DoubleType);
+    break;
+  case ExpressionAST::BoolExpression:
+    Expr->setStaticType(cvm::BoolType);
+    break;
+  case ExpressionAST::StringExpression:
+    Expr->setStaticType(cvm::StringType);
+    break;
+  case ExpressionAST::IdentifierExpression:
+    checkIdentifier(Expr->as_ptr<IdentifierAST>());
+    break;
+  case ExpressionAST::FunctionCallExpression:
+    checkFunctionCall(Expr->as_ptr<FunctionCallAST>());
+    break;
+  case ExpressionAST::InfixOpExpression:
+    checkExpression(Expr->as_ptr<InfixOpExprAST>()->getLHS());
+    checkExpression(Expr->as_ptr<InfixOpExprAST>()->getRHS());
+    break;
+  case ExpressionAST::BinaryOperatorExpression:
+    checkBinaryOperator(Expr->as_ptr<BinaryOperatorAST>());
+    break;
+  case ExpressionAST::UnaryOperatorExpression:
+    checkUnaryOperator(Expr->as_ptr<UnaryOperatorAST>());
+    break;
+  }
+}
+
+/// \brief Give IdExpr the declared type of the variable it is bound to
+/// Every store into a variable converts the value to that type or fails, so
+/// it is the type of every value a bound read finds.
+void TypeChecker::checkIdentifier(IdentifierAST *IdExpr) {
+  if (!IdExpr->isResolved() || LooseNames.count(IdExpr->getName()))
+    return;
+  // Past its own frames, a dynamically bound callee finds names in the frames
+  // of its caller.
+  if (Function && DynamicCallees.count(Function) &&
+      IdExpr->getScope() == &TopLevelBlock.getLayout())
+    return;
+
+  auto It =
+      Variables.find(VariableKey(IdExpr->getScope(), IdExpr->getSlot()));
+  if (It != Variables.end() && !It->second.Ambiguous)
+    IdExpr->setStaticType(It->second.Type);
+}
+
+void TypeChecker::checkFunctionCall(FunctionCallAST *FuncCall) {
+  auto &Args = FuncCall->getArguments();
+  for (auto &Arg : Args)
+    checkExpression(Arg);
+
+  const FunctionDefinitionAST *Callee = FuncCall->getFunction();
+  if (!Callee) {
+    if (FuncCall->getNativeFunction())
+      checkNativeCall(FuncCall);
+    return;
+  }
+  if (ExplicitReturns.count(Callee))
+    FuncCall->setStaticType(Callee->getType());
+
+  // The runtime reports a wrong argument count first.
+  if (Args.size() != Callee->getParameterCount())
+    return;
+
+  bool Checked = true;
+  auto ParamIt = Callee->getParameterList().cbegin();
+  for (ExpressionAST *Arg : Args) {
+    const Parameter &Param = *ParamIt++;
+    if (GetCoercion(Arg, Param.getType()) != Coercion::Identity)
+      Checked = false;
+    if (IsMismatch(Arg, Param.getType())) {
+      reportError(FuncCall->getLoc(), "parameter `" + Param.getName().str() +
+          "' of function `" + Callee->getName().str() + "' has type " +
+          cvm::TypeToStr(Param.getType()) + ", but argument is " +
+          cvm::TypeToStr(Arg->getStaticType()));
+    }
+  }
+  FuncCall->setCheckedArguments(Checked);
+}
+
+/// \brief Give a call to a native the type of its result, if the native
+/// always returns values of one type
+void TypeChecker::checkNativeCall(FunctionCallAST *FuncCall) {
+  const cvm::NativeTraits &Traits =
+      cvm::getNativeTraits(FuncCall->getNativeFunction());
+  if (Traits.Typed)
+    FuncCall->setStaticType(Traits.ReturnType);
+}
+
+void TypeChecker::checkBinaryOperator(BinaryOperatorAST *Expr) {
+  if (Expr->getOpKind() == BinaryOperatorAST::Assign)
+    return checkAssignment(Expr);
+
+  ExpressionAST *LHS = Expr->getLHS(), *RHS = Expr->getRHS();
+  checkExpression(LHS);
+  checkExpression(RHS);
+  bool BothKnown = LHS->hasStaticType() && RHS->hasStaticType();
+  bool BothNumeric = LHS->hasNumericType() && RHS->hasNumericType();
+  bool BothInt =
+      LHS->hasStaticType(cvm::IntType) && RHS->hasStaticType(cvm::IntType);
+  BinaryOperatorAST::OperatorKind OpKind = Expr->getOpKind();
+
+  switch (OpKind) {
+  default:
+    break;
+  case BinaryOperatorAST::Index:
+    if (RHS->hasStaticType() && RHS->getStaticType() != cvm::IntType)
+      reportError(Expr->getLoc(), "non-int index in index expression");
+    // An element has the type of its array.
+    if (LHS->hasStaticType())
+      Expr->setStaticType(LHS->getStaticType());
+    break;
+
+  case BinaryOperatorAST::LogicalAnd:
+  case BinaryOperatorAST::LogicalOr:
+    Expr->setStaticType(cvm::BoolType);
+    break;
+
+  case BinaryOperatorAST::Add:
+  case BinaryOperatorAST::Minus:
+  case BinaryOperatorAST::Multiply:
+  case BinaryOperatorAST::Division:
+  case BinaryOperatorAST::Modulo: {
+    // Adding a string to anything concatenates.
+    if (OpKind == BinaryOperatorAST::Add) {
+      if (LHS->hasStaticType(cvm::StringType) ||
+          RHS->hasStaticType(cvm::StringType)) {
+        Expr->setStaticType(cvm::StringType);
+        break;
+      }
+      if (!BothKnown)
+        break;
+    }
+    if ((LHS->hasStaticType() && !LHS->hasNumericType()) ||
+        (RHS->hasStaticType() && !RHS->hasNumericType())) {
+      reportError(Expr->getLoc(),
+                  "operands of binary arithmetic operations should be "
+                  "numeric");
+      break;
+    }
+    if (BothInt) {
+      Expr->setStaticType(cvm::IntType);
+      Expr->quicken(BinaryOperatorAST::getIntQuickKind(OpKind));
+    } else if (LHS->hasStaticType(cvm::DoubleType) ||
+               RHS->hasStaticType(cvm::DoubleType)) {
+      // The other operand is numeric or the operation fails.
+      Expr->setStaticType(cvm::DoubleType);
+      if (BothNumeric &&
+          BinaryOperatorAST::getDoubleQuickKind(OpKind) !=
+              BinaryOperatorAST::Generic)
+        Expr->quicken(BinaryOperatorAST::getDoubleQuickKind(OpKind));
+    }
+    break;
+  }
+
+  case BinaryOperatorAST::Less:
+  case BinaryOperatorAST::LessEqual:
+  case BinaryOperatorAST::Equal:
+  case BinaryOperatorAST::NotEqual:
+  case BinaryOperatorAST::Greater:
+  case BinaryOperatorAST::GreaterEqual:
+    Expr->setStaticType(cvm::BoolType);
+    if (BothKnown && LHS->getStaticType() != RHS->getStaticType() &&
+        !BothNumeric)
+      reportError(Expr->getLoc(),
+                  "relational operator should apply to identical type");
+    else if (BothInt)
+      Expr->quicken(BinaryOperatorAST::getIntQuickKind(OpKind));
+    else if (BothNumeric)
+      Expr->quicken(BinaryOperatorAST::getDoubleQuickKind(OpKind));
+    break;
+
+  case BinaryOperatorAST::BitwiseAnd:
+  case BinaryOperatorAST::BitwiseOr:
+  case BinaryOperatorAST::BitwiseXor:
+  case BinaryOperatorAST::LeftShift:
+  case BinaryOperatorAST::RightShift:
+    Expr->setStaticType(cvm::IntType);
+    if ((LHS->hasStaticType() && LHS->getStaticType() != cvm::IntType) ||
+        (RHS->hasStaticType() && RHS->getStaticType() != cvm::IntType))
+      reportError(Expr->getLoc(),
+                  "operands of bitwise operations should be int");
+    else if (BothInt)
+      Expr->quicken(BinaryOperatorAST::getIntQuickKind(OpKind));
+    break;
+  }
+}
+
+/// \brief Check an assignment, which yields the variable or element after the
+/// store
+void TypeChecker::checkAssignment(BinaryOperatorAST *Expr) {
+  ExpressionAST *LHS = Expr->getLHS(), *RHS = Expr->getRHS();
+  checkExpression(LHS);
+  checkExpression(RHS);
+  if (!LHS->hasStaticType())
+    return;
+
+  cvm::BasicType Type = LHS->getStaticType();
+  Expr->setStaticType(Type);
+  if (IsMismatch(RHS, Type))
+    reportError(Expr->getLoc(), "assignment to " + cvm::TypeToStr(Type) +
+                " variable with " + cvm::TypeToStr(RHS->getStaticType()) +
+                " expression");
+  Expr->setAssignCoercion(GetCoercion(RHS, Type));
+}
+
+void TypeChecker::checkUnaryOperator(UnaryOperatorAST *Expr) {
+  ExpressionAST *Operand = Expr->getOperand();
+  checkExpression(Operand);
+
+  switch (Expr->getOpKind()) {
+  case UnaryOperatorAST::Plus:
+  case UnaryOperatorAST::Minus:
+    if (Operand->hasNumericType())
+      Expr->setStaticType(Operand->getStaticType());
+    else if (Operand->hasStaticType())
+      reportError(Expr->getLoc(),
+                  "operands of unary arithmetic operations should be "
+                  "numeric");
+    break;
+  case UnaryOperatorAST::LogicalNot:
+    Expr->setStaticType(cvm::BoolType);
+    break;
+  case UnaryOperatorAST::BitwiseNot:
+    Expr->setStaticType(cvm::IntType);
+    if (Operand->hasStaticType() && Operand->getStaticType() != cvm::IntType)
+      reportError(Expr->getLoc(),
+                  "operand of unary bitwise operation should be int");
+    break;
+  }
+}
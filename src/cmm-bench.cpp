@@ -0,0 +1,220 @@
+/*
+ * cmm-bench.cpp
+ * Run CMM benchmarks repeatedly in one process and report median time,
+ * allocations and peak RSS per benchmark.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <new>
+#include <streambuf>
+#include <string>
+#include <vector>
+#include "BytecodeCompiler.h"
+#include "BytecodeVM.h"
+#include "CMMInterpreter.h"
+#include "CMMParser.h"
+#include "JIT.h"
+
+#if defined(__APPLE__) || defined(__linux__)
+#include <sys/resource.h>
+#endif
+
+/// Every allocation the interpreter makes goes through the replaceable global
+/// operator new, which counts them.
+static unsigned long long AllocationCount;
+static unsigned long long AllocatedBytes;
+
+void *operator new(std::size_t Size) {
+  ++AllocationCount;
+  AllocatedBytes += Size;
+  if (void *P = std::malloc(Size ? Size : 1))
+    return P;
+  throw std::bad_alloc();
+}
+
+void operator delete(void *P) noexcept { std::free(P); }
+
+namespace {
+/// Swallows what benchmarks print.
+class NullBuffer : public std::streambuf {
+protected:
+  int overflow(int C) override { return C; }
+  std::streamsize xsputn(const char *, std::streamsize N) override {
+    return N;
+  }
+};
+
+enum EngineKind { WalkerEngine, VMEngine, JITEngine };
+
+struct BenchResult {
+  std::vector<double> Milliseconds;
+  unsigned long long Allocations;
+  unsigned long long Bytes;
+  long PeakRSS;
+};
+}
+
+static void Usage(const char *Name) {
+  std::cerr
+      << "USAGE: " << Name << " [options] <benchmark file>...\n\n"
+         "OPTIONS:\n\n"
+         "  -h  --help       print this usage and exit\n"
+         "  -n <runs>        run each benchmark <runs> times (5)\n"
+         "      --vm         run on the bytecode VM instead of the AST walker\n"
+         "      --jit        run on the VM with the baseline JIT\n";
+}
+
+/// \brief Forget the peak RSS so far, where the kernel allows it
+static void ResetPeakRSS() {
+#if defined(__linux__)
+  std::ofstream ClearRefs("/proc/self/clear_refs");
+  ClearRefs << "5";
+#endif
+}
+
+/// \brief Return the peak resident set size in KiB, or -1 if unknown
+static long GetPeakRSS() {
+#if defined(__linux__)
+  std::ifstream Status("/proc/self/status");
+  std::string Line;
+  while (std::getline(Status, Line)) {
+    if (!Line.compare(0, 6, "VmHWM:"))
+      return std::atol(Line.c_str() + 6);
+  }
+#endif
+#if defined(__APPLE__) || defined(__linux__)
+  struct rusage Usage;
+  if (!getrusage(RUSAGE_SELF, &Usage)) {
+#if defined(__APPLE__)
+    return Usage.ru_maxrss / 1024;
+#else
+    return Usage.ru_maxrss;
+#endif
+  }
+#endif
+  return -1;
+}
+
+/// \brief Parse Path once and run it Runs times on Engine
+/// Return true if the file can't be run.
+static bool RunBenchmark(const char *Path, EngineKind Engine, int Runs,
+                         BenchResult &Result) {
+  using namespace cmm;
+  SourceMgr SrcMgr(Path);
+  CMMParser Parser(SrcMgr);
+  if (Parser.parse())
+    return true;
+  Parser.optimize();
+
+  std::unique_ptr<BytecodeProgram> Program;
+  std::unique_ptr<BaselineJIT> JIT;
+  if (Engine != WalkerEngine) {
+    Program.reset(new BytecodeProgram(
+        BytecodeCompiler(Parser.getTopLevelBlock(),
+                         Parser.getFunctionDefinition(),
+                         Parser.getInfixOpDefinition()).compile()));
+    if (Engine == JITEngine)
+      JIT.reset(new BaselineJIT(*Program));
+  }
+
+  NullBuffer Null;
+  char *Argv[] = {nullptr};
+  Result.Allocations = Result.Bytes = 0;
+  ResetPeakRSS();
+
+  for (int I = 0; I < Runs; ++I) {
+    std::streambuf *Stdout = std::cout.rdbuf(&Null);
+    unsigned long long Allocations = AllocationCount;
+    unsigned long long Bytes = AllocatedBytes;
+    auto Start = std::chrono::steady_clock::now();
+
+    if (Engine == WalkerEngine) {
+      CMMInterpreter(Parser.getTopLevelBlock(),
+                     Parser.getFunctionDefinition(),
+                     Parser.getInfixOpDefinition()).interpret(0, Argv);
+    } else {
+      BytecodeVM(*Program, JIT.get()).run(0, Argv);
+    }
+
+    auto End = std::chrono::steady_clock::now();
+    Result.Allocations += AllocationCount - Allocations;
+    Result.Bytes += AllocatedBytes - Bytes;
+    std::cout.flush();
+    std::cout.rdbuf(Stdout);
+    Result.Milliseconds.push_back(
+        std::chrono::duration<double, std::milli>(End - Start).count());
+  }
+
+  Result.Allocations /= static_cast<unsigned>(Runs);
+  Result.Bytes /= static_cast<unsigned>(Runs);
+  Result.PeakRSS = GetPeakRSS();
+  return false;
+}
+
+int main(int argc, char *argv[]) {
+  EngineKind Engine = WalkerEngine;
+  int Runs = 5;
+  std::vector<const char *> Files;
+
+  for (int Index = 1; Index < argc; ++Index) {
+    if (!std::strcmp(argv[Index], "-h") ||
+        !std::strcmp(argv[Index], "--help")) {
+      Usage(argv[0]);
+      return EXIT_SUCCESS;
+    }
+    if (!std::strcmp(argv[Index], "--vm")) {
+      Engine = VMEngine;
+    } else if (!std::strcmp(argv[Index], "--jit")) {
+      Engine = JITEngine;
+    } else if (!std::strcmp(argv[Index], "-n") && Index + 1 < argc) {
+      Runs = std::atoi(argv[++Index]);
+      if (Runs <= 0) {
+        std::cerr << argv[0] << ": number of runs should be positive\n";
+        return EXIT_FAILURE;
+      }
+    } else if (argv[Index][0] == '-') {
+      std::cerr << argv[0] << ": invalid option `" << argv[Index] << "'\n\n";
+      Usage(argv[0]);
+      return EXIT_FAILURE;
+    } else {
+      Files.push_back(argv[Index]);
+    }
+  }
+
+  if (Files.empty()) {
+    std::cerr << argv[0] << ": no benchmark file\n\n";
+    Usage(argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  std::printf("%-24s %12s %12s %14s %14s %12s\n", "benchmark", "median ms",
+              "min ms", "allocs/run", "bytes/run", "peak KiB");
+  int Failures = 0;
+  for (const char *Path : Files) {
+    BenchResult Result;
+    if (RunBenchmark(Path, Engine, Runs, Result)) {
+      ++Failures;
+      continue;
+    }
+
+    std::vector<double> &Times = Result.Milliseconds;
+    std::sort(Times.begin(), Times.end());
+    double Median = Times.size() % 2
+        ? Times[Times.size() / 2]
+        : (Times[Times.size() / 2 - 1] + Times[Times.size() / 2]) / 2;
+
+    const char *Name = std::strrchr(Path, '/');
+    std::printf("%-24s %12.3f %12.3f %14llu %14llu %12ld\n",
+                Name ? Name + 1 : Path, Median, Times.front(),
+                Result.Allocations, Result.Bytes, Result.PeakRSS);
+    std::fflush(stdout);
+  }
+  return Failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -12,6 +12,13 @@
 #include "CMMLexer.h"
 #include "CMMParser.h"
 #include "CMMInterpreter.h"
+#include "BytecodeCompiler.h"
+#include "BytecodeVM.h"
+#include "CycleCollector.h"
+#include "CppEmitter.h"
+#include "Profiler.h"
+#include "ProgramCache.h"
+#include <fstream>
 
 static void Error(const char *Name, const char *Msg);
 
@@ -19,8 +26,15 @@ static void Usage(const char *Name);
 static int DumpFile(cmm::SourceMgr &SrcMgr);
 static int AsLexInput(cmm::SourceMgr &SrcMgr);
 static int Interpret(cmm::SourceMgr &SrcMgr, int Argc, char **Argv,
-                     bool Verbose = false);
+                     bool Verbose = false, bool UseVM = false,
+                     bool UseJIT = false, const char *ProfileOutput = nullptr,
+                     bool UseCache = true);
 static int DumpAST(cmm::SourceMgr &SrcMgr);
+static int DumpBytecode(cmm::SourceMgr &SrcMgr);
+static int EmitCpp(cmm::SourceMgr &SrcMgr);
+
+/// Largest body inlined, in AST nodes; 0 disables inlining.
+static unsigned InlineLimit = cmm::Inliner::DefaultLimit;
 
 static bool EqualOneOf(const char *S, const char *S1) {
   return !std::strcmp(S, S1);
@@ -30,11 +44,22 @@ static bool EqualOneOf(const char *S, const char *S1, Tn... Sn) {
   return EqualOneOf(S, S1) || EqualOneOf(S, Sn...);
 }
 
+/// The program may exit from anywhere, so the statistics are printed by an
+/// atexit handler.
+static void DumpCollectorStatistics() {
+  cvm::dumpCollectorStatistics(std::cerr);
+}
+
 int main(int argc, char *argv[])
 {
   enum ActionKind {
-    DefaultAct, LexAct, ParseAct, DebugAct, DumpFileAct
+    DefaultAct, LexAct, ParseAct, DebugAct, DumpFileAct, DisasmAct, EmitCppAct
   } Action = DefaultAct;
+  bool UseVM = false;
+  bool UseJIT = false;
+  bool GCStats = false;
+  bool UseCache = true;
+  const char *ProfileOutput = nullptr;
   const char *ProgName = argv[0];
   const char *Input = nullptr;
   int Index;
@@ -45,6 +70,48 @@ int main(int argc, char *argv[])
 
   for (Index = 1; Index < argc; ++Index) {
     if (argv[Index][0] == '-') {
+      // Engine selection and statistics aren't actions and combine with the
+      // others.
+      if (EqualOneOf(argv[Index], "-vm", "--vm")) {
+        UseVM = true;
+        continue;
+      }
+
+      // The JIT compiles bytecode, so it runs on the VM.
+      if (EqualOneOf(argv[Index], "-jit", "--jit")) {
+        UseVM = UseJIT = true;
+        continue;
+      }
+
+      if (EqualOneOf(argv[Index], "-gc-stats", "--gc-stats")) {
+        GCStats = true;
+        continue;
+      }
+
+      if (EqualOneOf(argv[Index], "-no-cache", "--no-cache")) {
+        UseCache = false;
+        continue;
+      }
+
+      if (EqualOneOf(argv[Index], "-profile", "--profile")) {
+        ProfileOutput = "cmm-profile.folded";
+        continue;
+      }
+
+      if (!std::strncmp(argv[Index], "--profile=", 10)) {
+        ProfileOutput = argv[Index] + 10;
+        continue;
+      }
+
+      if (!std::strncmp(argv[Index], "--inline=", 9)) {
+        char *End;
+        InlineLimit =
+            static_cast<unsigned>(std::strtoul(argv[Index] + 9, &End, 10));
+        if (End == argv[Index] + 9 || *End)
+          Error(ProgName, "--inline takes a number of AST nodes");
+        continue;
+      }
+
       if (Action != DefaultAct)
         Error(ProgName, "too many options");
 
@@ -68,6 +135,16 @@ int main(int argc, char *argv[])
         continue;
       }
 
+      if (EqualOneOf(argv[Index], "-disasm", "--disasm")) {
+        Action = DisasmAct;
+        continue;
+      }
+
+      if (EqualOneOf(argv[Index], "-emit-cpp", "--emit-cpp")) {
+        Action = EmitCppAct;
+        continue;
+      }
+
       if (EqualOneOf(argv[Index], "-h", "-H", "-help", "--help")) {
         Usage(ProgName);
         std::exit(EXIT_SUCCESS);
@@ -84,6 +161,14 @@ int main(int argc, char *argv[])
 
   if (!Input)
     Error(ProgName, "no input file");
+  if (ProfileOutput && UseVM)
+    Error(ProgName, "--profile only works with the tree walker");
+  // Profiles report time by function as written.
+  if (ProfileOutput)
+    InlineLimit = 0;
+
+  if (GCStats)
+    std::atexit(DumpCollectorStatistics);
 
   cmm::SourceMgr SrcMgr(Input);
 
@@ -94,7 +179,8 @@ int main(int argc, char *argv[])
     Res = DumpFile(SrcMgr);
     break;
   case DefaultAct:
-    Res = Interpret(SrcMgr, argc - Index, argv + Index);
+    Res = Interpret(SrcMgr, argc - Index, argv + Index, false, UseVM, UseJIT,
+                    ProfileOutput, UseCache);
     break;
   case LexAct:
     Res = AsLexInput(SrcMgr);
@@ -103,7 +189,14 @@ int main(int argc, char *argv[])
     Res = DumpAST(SrcMgr);
     break;
   case DebugAct:
-    Res = Interpret(SrcMgr, argc - Index, argv + Index, true);
+    Res = Interpret(SrcMgr, argc - Index, argv + Index, true, UseVM, UseJIT,
+                    ProfileOutput, UseCache);
+    break;
+  case DisasmAct:
+    Res = DumpBytecode(SrcMgr);
+    break;
+  case EmitCppAct:
+    Res = EmitCpp(SrcMgr);
     break;
   }
 
@@ -125,7 +218,22 @@ void Usage(const char *Name) {
          "  -f  --file       dump a file and exit (for debugging)\n"
          "  -l  --lex        lex tokens from a CMM source code file\n"
          "  -p  --parse      parse a CMM source code file and dump AST\n"
-         "  -d  --debug      interpret a file with extra information dumped\n\n"
+         "  -d  --debug      interpret a file with extra information dumped\n"
+         "      --disasm     compile a CMM source code file and dump bytecode\n"
+         "      --emit-cpp   translate a CMM source code file to C++ linking\n"
+         "                   against the cmmrt runtime library\n"
+         "      --vm         run on the bytecode VM instead of the AST walker\n"
+         "      --jit        run on the VM and compile hot functions to\n"
+         "                   machine code (x86-64 only)\n"
+         "      --no-cache   always parse the input file, instead of loading the\n"
+         "                   program cached by a previous run\n"
+         "      --gc-stats   report what the cycle collector freed at exit\n"
+         "      --inline=<n> inline calls to functions and infix operators of\n"
+         "                   at most <n> AST nodes (24, 0 to disable)\n"
+         "      --profile[=<file>]\n"
+         "                   time every function on the tree walker, print a\n"
+         "                   summary at exit and write folded stacks for flame\n"
+         "                   graphs to <file> (cmm-profile.folded)\n\n"
          "Report bugs to <hsu [at] whu [dot] edu [dot] cn>.\n";
 }
 
@@ -154,7 +262,7 @@ int AsLexInput(cmm::SourceMgr &SrcMgr) {
       Err = true; // error already printed.
       break;
     case Token::Identifier:
-      cout << "Identifier: " << Lexer.getStrVal();  break;
+      cout << "Identifier: " << Lexer.getSymbolVal().str();  break;
     case Token::String:
       cout << "String: " << Lexer.getStrVal(); break;
     case Token::Integer:
@@ -164,7 +272,7 @@ int AsLexInput(cmm::SourceMgr &SrcMgr) {
     case Token::Boolean:
       cout << "Boolean: " << (Lexer.getBoolVal() ? "True" : "False"); break;
     case Token::InfixOp:
-      cout << "InfixOp: " << Lexer.getStrVal(); break;
+      cout << "InfixOp: " << Lexer.getSymbolVal().str(); break;
     case Token::LParen:
       cout << "LParen: (";
       break;
@@ -215,20 +323,79 @@ int AsLexInput(cmm::SourceMgr &SrcMgr) {
   return Err;
 }
 
-int Interpret(cmm::SourceMgr &SrcMgr, int Argc, char **Argv, bool Verbose) {
+/// The profiler of the running program and where its folded stacks go. The
+/// program may exit from anywhere, so they are written by an atexit handler.
+static cmm::Profiler *ActiveProfiler;
+static const char *ActiveProfileOutput;
+
+static void WriteProfile() {
+  ActiveProfiler->finish();
+  ActiveProfiler->printSummary(std::cerr);
+
+  std::ofstream OS(ActiveProfileOutput);
+  ActiveProfiler->printFoldedStacks(OS);
+  if (!OS) {
+    std::cerr << "cmm: cannot write profile to `" << ActiveProfileOutput
+              << "'\n";
+    return;
+  }
+  std::cerr << "Folded stacks written to `" << ActiveProfileOutput << "'\n";
+}
+
+int Interpret(cmm::SourceMgr &SrcMgr, int Argc, char **Argv, bool Verbose,
+              bool UseVM, bool UseJIT, const char *ProfileOutput,
+              bool UseCache) {
   using namespace cmm;
   CMMParser Parser(SrcMgr);
 
-  int Err = Parser.parse();
+  // A cached program was folded when it was stored, so -d parses the source
+  // to report the folds.
+  int Err = 0;
+  if (!UseCache || Verbose) {
+    Err = Parser.parse();
+  } else {
+    ProgramCache Cache(SrcMgr);
+    if (!Cache.tryLoad(Parser)) {
+      Err = Parser.parse();
+      if (!Err)
+        Cache.store(Parser);
+    }
+  }
+
   if (!Err) {
+    Parser.optimize(InlineLimit);
     if (Verbose) {
       Parser.dumpAST();
+      std::cout << "\n";
+      Parser.dumpFoldings();
       std::cout << "\n\n****** Interpreter started ******\n\n";
     }
 
+    if (UseVM) {
+      BytecodeProgram Program =
+          BytecodeCompiler(Parser.getTopLevelBlock(),
+                           Parser.getFunctionDefinition(),
+                           Parser.getInfixOpDefinition()).compile();
+      if (Verbose) {
+        Program.dump();
+        std::cout << "\n****** VM started ******\n\n";
+      }
+      if (UseJIT) {
+        BaselineJIT JIT(Program);
+        return BytecodeVM(Program, &JIT).run(Argc, Argv);
+      }
+      return BytecodeVM(Program).run(Argc, Argv);
+    }
+
+    if (ProfileOutput) {
+      ActiveProfiler = new Profiler();
+      ActiveProfileOutput = ProfileOutput;
+      std::atexit(WriteProfile);
+    }
+
     CMMInterpreter Interpreter(Parser.getTopLevelBlock(),
                                Parser.getFunctionDefinition(),
-                               Parser.getInfixOpDefinition());
+                               Parser.getInfixOpDefinition(), ActiveProfiler);
     Err = Interpreter.interpret(Argc, Argv);
   }
   return Err;
@@ -241,7 +408,36 @@ int DumpAST(cmm::SourceMgr &SrcMgr) {
 
   int Err = Parser.parse();
   if (!Err) {
+    Parser.optimize(InlineLimit);
     Parser.dumpAST();
   }
   return Err;
 }
+
+int DumpBytecode(cmm::SourceMgr &SrcMgr) {
+  using namespace cmm;
+  CMMParser Parser(SrcMgr);
+
+  int Err = Parser.parse();
+  if (!Err) {
+    Parser.optimize(InlineLimit);
+    BytecodeCompiler(Parser.getTopLevelBlock(),
+                     Parser.getFunctionDefinition(),
+                     Parser.getInfixOpDefinition()).compile().dump();
+  }
+  return Err;
+}
+
+int EmitCpp(cmm::SourceMgr &SrcMgr) {
+  using namespace cmm;
+  CMMParser Parser(SrcMgr);
+
+  int Err = Parser.parse();
+  if (!Err) {
+    Parser.optimize(InlineLimit);
+    Err = CppEmitter(SrcMgr, Parser.getTopLevelBlock(),
+                     Parser.getFunctionDefinition(),
+                     Parser.getInfixOpDefinition()).emit(std::cout);
+  }
+  return Err;
+}